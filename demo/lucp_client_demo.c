@@ -97,10 +97,11 @@ int main(int argc, char* argv[]) {
     }
 
     // 3. Wait for 0x03 (log ready) up to 5s
+    //    A cached archive lets 0x03 arrive together with 0x02, already buffered in netctx
     FD_ZERO(&rfds); FD_SET(sockfd, &rfds);
     tv.tv_sec = 5; tv.tv_usec = 0;
-    rv = select(sockfd+1, &rfds, NULL, NULL, &tv);
-    if (rv > 0 && FD_ISSET(sockfd, &rfds)) {
+    rv = netctx.rbuf_len > 0 ? 1 : select(sockfd+1, &rfds, NULL, NULL, &tv);
+    if (rv > 0 && (netctx.rbuf_len > 0 || FD_ISSET(sockfd, &rfds))) {
         if (lucp_net_recv(&netctx, &reply) == 0 && reply.msgType == 0x03) {
             printf("[Client] Got 0x03 (status=0x%x, payload=\"%.*s\")\n",
                 reply.status, reply.textInfo_len, reply.textInfo);
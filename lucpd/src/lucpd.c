@@ -1,9 +1,16 @@
+#define _GNU_SOURCE // ppoll, accept4
+#include "lucpd_cache.h"
 #include "lucpd_cfg.h"
+#include "lucpd_log.h"
+#include "lucpd_mark.h"
+#include "lucpd_session.h"
 #include "lucpd_utils.h"
 #include <arpa/inet.h>
 #include <errno.h>
 #include <lucp.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdatomic.h>
@@ -11,51 +18,29 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
 
 #define RATE_LIMIT_SECONDS 3
-// 会话状态
-typedef enum
-{
-    LUCP_SESSION_INIT,
-    LUCP_SESSION_WAITING_UPLOAD_REQUEST,
-    LUCP_SESSION_WAITING_FTP_LOGIN_RESULT,
-    LUCP_SESSION_WAITING_FTP_DOWNLOAD_RESULT,
-    LUCP_SESSION_WAITING_CLOUD_UPLOAD_RESULT,
-    LUCP_SESSION_COMPLETED,
-    LUCP_SESSION_ERROR
-} LucpSessionState;
-
-// 会话结构
-typedef struct
-{
-    int fd;
-    LucpSessionState state;
-    uint32_t seq_num;
-    uint64_t last_active_ms;
-    LucpdConfig_t* config;
-    atomic_bool* server_running;
-} LucpSession_t;
-
-static LucpdConfig_t g_lucpdcfg;
 
 // 全局运行标志
 atomic_bool server_running = true;
+// 收到SIGHUP，等待主线程重新加载配置
+static volatile sig_atomic_t reload_requested = 0;
 // 监听Socket
 int listen_fd              = -1;
 
-// 客户端计数，线程安全
+// 会话线程计数，线程安全（挂起的会话不计入）
 atomic_int client_count = 0;
 
-// 信号处理函数
+// 信号处理函数，只设置标志，由主线程在等待连接的间隙处理
 void handle_sig(int sig)
 {
-    (void) sig;
-    server_running = false;
-    if (listen_fd >= 0)
-        close(listen_fd);
-    printf("[Server] Shutting down...\n");
+    if (sig == SIGHUP)
+        reload_requested = 1;
+    else
+        server_running = false;
 }
 
 
@@ -68,17 +53,28 @@ static void* session_thread(void* arg)
     lucp_frame_t frame, reply;
     char payload[256];
     int running = 1;
+    char log_dir[sizeof(((LucpdConfig_t*) 0)->file.log_dir)];
     // uint64_t session_start = get_now_ms();
 
     log_debug("[Session %d] Started.", sess->fd);
+    sess->conn_id        = netctx.conn_id;
     sess->state          = LUCP_SESSION_INIT;
     sess->last_active_ms = get_now_ms();
 
-    while (running && *sess->server_running)
+    while (running && server_running)
     {
+        // 每轮状态处理开始时复制本轮用到的配置，重新加载后的配置从下一轮开始生效。
+        // 之后的接收和打包可能阻塞很久，不能停留在读区间内，否则旧快照迟迟不能回收
+        const LucpdConfig_t* cfg = lucpd_cfg_enter();
+        int session_timeout_ms   = cfg->protocol.session_timeout_ms;
+        int resume_grace_ms      = cfg->protocol.resume_grace_ms;
+        bool validate_version    = cfg->protocol.validate_version;
+        memcpy(log_dir, cfg->file.log_dir, sizeof(log_dir));
+        lucpd_cfg_exit();
+
         // 超时管理
         uint64_t now = get_now_ms();
-        if ((int) (now - sess->last_active_ms) > sess->config->protocol.session_timeout_ms)
+        if ((int) (now - sess->last_active_ms) > session_timeout_ms)
         {
             log_debug("[Session %d] Session timeout.", sess->fd);
             sess->state = LUCP_SESSION_ERROR;
@@ -92,7 +88,7 @@ static void* session_thread(void* arg)
             if (ret == 0 && frame.msgType == LUCP_MTYP_UPLOAD_REQUEST)
             {
                 // 检查版本
-                if (sess->config->protocol.validate_version)
+                if (validate_version)
                 {
                     if (frame.version_major != LUCP_VER_MAJOR)
                     {
@@ -107,6 +103,59 @@ static void* session_thread(void* arg)
                         break;
                     }
                 }
+                if (lucpd_archive_parse_request(frame.textInfo, frame.textInfo_len, &sess->request) != 0)
+                {
+                    lucp_frame_make(&reply,
+                                    frame.seq_num,
+                                    LUCP_MTYP_ACK_START,
+                                    LUCP_STAT_INVALID_REQUEST,
+                                    "Bad request",
+                                    11);
+                    lucp_net_send(&netctx, &reply);
+                    sess->state = LUCP_SESSION_ERROR;
+                    break;
+                }
+                if (sess->request.resume_token[0] != '\0')
+                {
+                    // 设备携带令牌重连，接续之前的会话
+                    LucpSession_t* old = lucpd_session_claim(sess->request.resume_token);
+                    if (!old)
+                    {
+                        lucp_frame_make(&reply,
+                                        frame.seq_num,
+                                        LUCP_MTYP_ACK_START,
+                                        LUCP_STAT_INVALID_REQUEST,
+                                        "Resume expired",
+                                        14);
+                        lucp_net_send(&netctx, &reply);
+                        sess->state = LUCP_SESSION_ERROR;
+                        break;
+                    }
+                    old->fd      = sess->fd;
+                    old->conn_id = sess->conn_id;
+                    old->seq_num = frame.seq_num;
+                    sess->fd     = -1;
+                    // 告知设备从哪一步继续：login 等待登录结果，download 等待下载结果
+                    const char* step = old->state == LUCP_SESSION_WAITING_FTP_LOGIN_RESULT
+                                           ? "login"
+                                           : "download";
+                    int n = snprintf(payload, sizeof(payload), "state=%s", step);
+                    lucp_frame_make(&reply,
+                                    old->seq_num,
+                                    LUCP_MTYP_ACK_START,
+                                    LUCP_STAT_SUCCESS,
+                                    payload,
+                                    (uint16_t) n);
+                    lucp_net_send(&netctx, &reply);
+                    log_debug("[Session %d] Resumed session %u (%s), waiting for FTP result.",
+                              old->fd,
+                              old->index,
+                              payload);
+                    lucpd_session_free(sess);
+                    lucpd_session_park(old, netctx.rbuf, netctx.rbuf_len);
+                    atomic_fetch_sub(&client_count, 1);
+                    return NULL;
+                }
                 sess->seq_num        = frame.seq_num;
                 sess->state          = LUCP_SESSION_WAITING_UPLOAD_REQUEST;
                 sess->last_active_ms = get_now_ms();
@@ -126,26 +175,22 @@ static void* session_thread(void* arg)
             break;
         }
         case LUCP_SESSION_WAITING_UPLOAD_REQUEST: {
-            // Simulate log prep (archive + FTP upload), send LUCP_MTYP_NOTIFY_DONE
-            int prep_status = LUCP_STAT_SUCCESS;
+            // 准备日志包（保留期内的相同请求直接复用已有产物），完成后发送 LUCP_MTYP_NOTIFY_DONE
             memset(payload, 0, sizeof(payload));
-            int r = rand() % 10;
-            if (r < 8)
+            int prep_status = lucpd_cache_get(
+                log_dir, &sess->request, payload, sizeof(payload), &sess->ticket);
+            // 设备支持续传时附带令牌：file=<日志包>;resume=<令牌>
+            char token[LUCPD_RESUME_TOKEN_LEN + 1];
+            if (prep_status == LUCP_STAT_SUCCESS && sess->request.resumable &&
+                resume_grace_ms > 0 &&
+                lucpd_session_make_token(sess, token, sizeof(token)) == 0 &&
+                strlen(payload) < LUCPD_ARCHIVE_NAME_MAX)
             {
-                prep_status = 1;
-                snprintf(payload, sizeof(payload), "demo_logfile_20250925.log");
+                // 产物名不超过 LUCPD_ARCHIVE_NAME_MAX，加上令牌一定放得下
+                char name[LUCPD_ARCHIVE_NAME_MAX];
+                memcpy(name, payload, strlen(payload) + 1);
+                snprintf(payload, sizeof(payload), "file=%s;resume=%s", name, token);
             }
-            else if (r == 8)
-            {
-                prep_status = LUCP_STAT_ARCHIVE_FAILED;
-                snprintf(payload, sizeof(payload), "Archive failed: disk full");
-            }
-            else
-            {
-                prep_status = LUCP_STAT_FTP_UPLOAD_FAILED;
-                snprintf(payload, sizeof(payload), "FTP upload failed: connection timeout");
-            }
-            usleep(700 * 1000); // 700ms
             lucp_frame_make(&reply,
                             sess->seq_num,
                             LUCP_MTYP_NOTIFY_DONE,
@@ -160,63 +205,14 @@ static void* session_thread(void* arg)
             if (prep_status != LUCP_STAT_SUCCESS)
             {
                 sess->state = LUCP_SESSION_ERROR;
+                break;
             }
-            else
-            {
-                sess->state = LUCP_SESSION_WAITING_FTP_LOGIN_RESULT;
-            }
-            sess->last_active_ms = get_now_ms();
-            break;
-        }
-        case LUCP_SESSION_WAITING_FTP_LOGIN_RESULT: {
-            int ret = lucp_net_recv(&netctx, &frame);
-            if (ret == 0 && frame.msgType == LUCP_MTYP_FTP_LOGIN_RESULT)
-            {
-                log_debug("[Session %d] Got LUCP_MTYP_FTP_LOGIN_RESULT(0x%02X) (FTP login result, "
-                          "status=0x%02X).",
-                          sess->fd,
-                          LUCP_MTYP_FTP_LOGIN_RESULT,
-                          frame.status);
-                if (frame.status != LUCP_STAT_SUCCESS)
-                {
-                    sess->state = LUCP_SESSION_ERROR;
-                }
-                else
-                {
-                    sess->state = LUCP_SESSION_WAITING_FTP_DOWNLOAD_RESULT;
-                }
-                sess->last_active_ms = get_now_ms();
-            }
-            else if (ret < 0)
-            {
-                sess->state = LUCP_SESSION_ERROR;
-            }
-            break;
-        }
-        case LUCP_SESSION_WAITING_FTP_DOWNLOAD_RESULT: {
-            int ret = lucp_net_recv(&netctx, &frame);
-            if (ret == 0 && frame.msgType == LUCP_MTYP_FTP_DOWNLOAD_RESULT)
-            {
-                log_debug("[Session %d] Got LUCP_MTYP_FTP_DOWNLOAD_RESULT(0x%02X) (Download result, "
-                          "status=0x%02X).",
-                          sess->fd,
-                          LUCP_MTYP_FTP_DOWNLOAD_RESULT,
-                          frame.status);
-                if (frame.status != LUCP_STAT_SUCCESS)
-                {
-                    sess->state = LUCP_SESSION_ERROR;
-                }
-                else
-                {
-                    sess->state = LUCP_SESSION_COMPLETED;
-                }
-                sess->last_active_ms = get_now_ms();
-            }
-            else if (ret < 0)
-            {
-                sess->state = LUCP_SESSION_ERROR;
-            }
-            break;
+            // 等待FTP结果可能持续很久，会话交给挂起线程，本线程退出
+            sess->state = LUCP_SESSION_WAITING_FTP_LOGIN_RESULT;
+            log_debug("[Session %d] Parked, waiting for FTP result.", sess->fd);
+            lucpd_session_park(sess, netctx.rbuf, netctx.rbuf_len);
+            atomic_fetch_sub(&client_count, 1);
+            return NULL;
         }
         case LUCP_SESSION_COMPLETED:
             log_debug("[Session %d] Session completed!.", sess->fd);
@@ -232,105 +228,297 @@ static void* session_thread(void* arg)
     }
 
     log_debug("[Session %d] Thread exit", sess->fd);
-    close(sess->fd);
-    free(sess);
+    lucpd_session_free(sess);
     // 客户端断开时递减 client_count
     atomic_fetch_sub(&client_count, 1);
     return NULL;
 }
 
-int main(int argc, char** argv)
+// 按配置创建监听Socket，失败返回-1
+static int open_listener(const LucpdConfig_t* cfg)
 {
-    // 设置SIGINT和SIGTERM的处理函数
-    signal(SIGINT, handle_sig);
-    signal(SIGTERM, handle_sig);
-
-    // 注册lucp库的日志回调
-    lucp_set_log_callback(handle_lucp_log);
-
-    // 加载配置
-    lucpd_cfg_load_with_entryArgs(&g_lucpdcfg, argc, argv);
-
-    // 初始化随机数种子
-    srand(time(NULL));
-
-    // 创建监听Socket
-    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_fd < 0)
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
     {
-        perror("socket");
-        exit(1);
+        log_error("socket: %s", strerror(errno));
+        return -1;
     }
     int opt = 1;
 
     // 允许地址重用
-    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
 
     // 绑定地址和端口
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
     addr.sin_family      = AF_INET;
-    addr.sin_addr.s_addr = inet_addr(g_lucpdcfg.network.ip);
-    addr.sin_port        = htons(g_lucpdcfg.network.port);
+    addr.sin_addr.s_addr = inet_addr(cfg->network.ip);
+    addr.sin_port        = htons(cfg->network.port);
 
     // 绑定和监听
-    if (bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
     {
-        perror("bind");
-        close(listen_fd);
+        log_error("bind %s:%d: %s", cfg->network.ip, cfg->network.port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    // 开始监听，会话挂起后连接数远大于会话线程数，积压队列按系统上限设置
+    if (listen(fd, SOMAXCONN) < 0)
+    {
+        log_error("listen: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 重新加载配置文件并发布新快照，已建立的会话不受影响
+static void reload_config(int argc, char** argv)
+{
+    LucpdConfig_t* cfg = calloc(1, sizeof(LucpdConfig_t));
+    if (!cfg)
+    {
+        log_error("[Server] Reload failed: out of memory");
+        return;
+    }
+    if (lucpd_cfg_load_with_entryArgs(cfg, argc, argv) != 0)
+    {
+        log_error("[Server] Reload failed, keeping current configuration");
+        free(cfg);
+        return;
+    }
+
+    const LucpdConfig_t* cur = lucpd_cfg_enter();
+
+    // 以下配置决定了已分配的资源，只在启动时生效
+    if (cfg->network.session_mem_budget_mb != cur->network.session_mem_budget_mb ||
+        strcmp(cfg->file.tmp_dir, cur->file.tmp_dir) != 0 ||
+        strcmp(cfg->logging.log_file, cur->logging.log_file) != 0 ||
+        strcmp(cfg->logging.capture_file, cur->logging.capture_file) != 0 ||
+        cfg->file.compress_threads != cur->file.compress_threads)
+    {
+        log_warn("[Server] session_mem_budget_mb, tmp_dir, log_file, capture_file and "
+                 "compress_threads take effect after restart");
+    }
+    cfg->network.session_mem_budget_mb = cur->network.session_mem_budget_mb;
+    cfg->file.compress_threads         = cur->file.compress_threads;
+    memcpy(cfg->file.tmp_dir, cur->file.tmp_dir, sizeof(cfg->file.tmp_dir));
+    memcpy(cfg->logging.log_file, cur->logging.log_file, sizeof(cfg->logging.log_file));
+    memcpy(cfg->logging.capture_file, cur->logging.capture_file, sizeof(cfg->logging.capture_file));
+
+    // 只有监听地址变化时才重新绑定，新地址绑定失败则继续使用原监听
+    if (strcmp(cfg->network.ip, cur->network.ip) != 0 || cfg->network.port != cur->network.port)
+    {
+        int fd = open_listener(cfg);
+        if (fd < 0)
+        {
+            log_error("[Server] Keeping listener on %s:%d", cur->network.ip, cur->network.port);
+            memcpy(cfg->network.ip, cur->network.ip, sizeof(cfg->network.ip));
+            cfg->network.port = cur->network.port;
+        }
+        else
+        {
+            close(listen_fd);
+            listen_fd = fd;
+            log_info("[Server] Listening on %s:%d", cfg->network.ip, cfg->network.port);
+        }
+    }
+    lucpd_cfg_exit();
+
+    log_info("[Server] Configuration reloaded (max_clients=%d, session_timeout_ms=%d, log_level=%s)",
+             cfg->network.max_clients,
+             cfg->protocol.session_timeout_ms,
+             cfg->logging.log_level);
+    if (lucpd_log_set_level(cfg->logging.log_level) != 0)
+        log_warn("Invalid logging->log_level %s, level unchanged", cfg->logging.log_level);
+    lucp_set_log_level(lucpd_log_level());
+    lucpd_cache_set_limits(cfg->file.file_retention_min,
+                           (uint64_t) cfg->file.cache_quota_mb * 1024 * 1024);
+    lucpd_archive_set_level(cfg->file.compress_level);
+    lucpd_cfg_publish(cfg);
+}
+
+int main(int argc, char** argv)
+{
+    // 信号只设置标志，不使用SA_RESTART，以便打断主线程的等待
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_sig;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+
+    // 所有线程屏蔽这些信号，只有主线程在ppoll等待连接期间解除屏蔽，保证信号一定打断主循环
+    sigset_t sigs, wait_mask;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &sigs, &wait_mask);
+    sigdelset(&wait_mask, SIGINT);
+    sigdelset(&wait_mask, SIGTERM);
+    sigdelset(&wait_mask, SIGHUP);
+
+    // 注册lucp库的日志回调
+    lucp_set_log_callback(handle_lucp_log);
+
+    // 加载配置并发布为第一个快照
+    LucpdConfig_t* boot_cfg = calloc(1, sizeof(LucpdConfig_t));
+    if (!boot_cfg)
         exit(1);
+    lucpd_cfg_load_with_entryArgs(boot_cfg, argc, argv);
+    lucpd_cfg_publish(boot_cfg);
+    const LucpdConfig_t* cfg = lucpd_cfg_enter();
+
+    // 启动异步日志后端，之后的日志由后台线程批量写出
+    lucpd_log_init(cfg->logging.log_level, cfg->logging.log_file);
+    lucp_set_log_level(lucpd_log_level());
+
+    // 抓包，记录所有会话收发的帧，可用 lucp_replay 回放
+    if (cfg->logging.capture_file[0] != '\0')
+    {
+        if (lucp_capture_open(cfg->logging.capture_file, LUCP_CAPTURE_ROLE_SERVER) == 0)
+            log_info("[Server] Capturing LUCP traffic to %s", cfg->logging.capture_file);
+        else
+            log_error("[Server] Failed to open capture file %s", cfg->logging.capture_file);
     }
 
-    // 开始监听
-    if (listen(listen_fd, g_lucpdcfg.network.max_clients) < 0)
+    // 日志包压缩线程池，所有打包请求共享
+    if (lucpd_archive_init(cfg->file.compress_threads, cfg->file.compress_level) != 0)
+        log_warn("Archive: no compression threads, compressing in session threads");
+
+    // 日志包缓存，产物存放在 file.tmp_dir，按保留时间和磁盘配额淘汰
+    if (lucpd_cache_init(cfg->file.tmp_dir,
+                         cfg->file.file_retention_min,
+                         (uint64_t) cfg->file.cache_quota_mb * 1024 * 1024) != 0)
     {
-        perror("listen");
-        close(listen_fd);
+        log_error("Archive cache unavailable, upload requests will fail");
+    }
+
+    // 设备日志上传高水位，持久化在 file.tmp_dir 下
+    if (lucpd_mark_init(cfg->file.tmp_dir) != 0)
+        log_warn("Upload marks will not survive restart");
+
+    // 会话slab与挂起线程，发出 NOTIFY_DONE 后的会话不再占用线程
+    if (lucpd_session_init(cfg) != 0)
+    {
+        lucpd_cache_shutdown();
+        lucpd_archive_shutdown();
+        lucpd_log_shutdown();
+        exit(1);
+    }
+
+    // 会话线程只处理请求和打包，使用较小的栈并以分离状态创建
+    pthread_attr_t thread_attr;
+    pthread_attr_init(&thread_attr);
+    pthread_attr_setstacksize(&thread_attr, LUCPD_SESSION_STACK_SIZE);
+    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+
+    // 创建监听Socket
+    listen_fd = open_listener(cfg);
+    if (listen_fd < 0)
+    {
+        lucpd_log_shutdown();
         exit(1);
     }
-    printf("[Server] Listening on %s:%d (max_clients=%d)\n",
-           g_lucpdcfg.network.ip,
-           g_lucpdcfg.network.port,
-           g_lucpdcfg.network.max_clients);
+    log_info("[Server] Listening on %s:%d (max_clients=%d)",
+           cfg->network.ip,
+           cfg->network.port,
+           cfg->network.max_clients);
+    lucpd_cfg_exit();
 
     // 主循环，接受连接
     while (server_running)
     {
+        if (reload_requested)
+        {
+            reload_requested = 0;
+            log_info("[Server] SIGHUP received, reloading configuration");
+            reload_config(argc, argv);
+            continue;
+        }
+
+        // 等待新连接，期间允许信号递送
+        struct pollfd pfd = {.fd = listen_fd, .events = POLLIN};
+        if (ppoll(&pfd, 1, NULL, &wait_mask) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            log_error("ppoll: %s", strerror(errno));
+            break;
+        }
+
         struct sockaddr_in cli_addr;
         socklen_t cli_len = sizeof(cli_addr);
 
         // 接受新连接
-        int client_fd = accept(listen_fd, (struct sockaddr*) &cli_addr, &cli_len);
+        int client_fd = accept4(listen_fd, (struct sockaddr*) &cli_addr, &cli_len, SOCK_CLOEXEC);
         if (client_fd < 0)
         {
-            if (errno == EINTR)
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED)
                 continue;
-            perror("accept");
+            if (server_running)
+                log_error("accept: %s", strerror(errno));
             break;
         }
 
+        cfg = lucpd_cfg_enter();
+
         // 检查最大连接数
-        if (atomic_load(&client_count) >= g_lucpdcfg.network.max_clients)
+        if (atomic_load(&client_count) >= cfg->network.max_clients)
+        {
+            lucpd_cfg_exit();
+            log_warn("[Server] Max clients reached, rejecting connection");
+            close(client_fd);
+            continue;
+        }
+
+        // 从slab分配会话，超出内存预算时拒绝
+        LucpSession_t* sess = lucpd_session_alloc(client_fd);
+        if (!sess)
         {
-            printf("[Server] Max clients reached, rejecting connection\n");
+            lucpd_cfg_exit();
+            log_warn("[Server] Session memory budget exhausted, rejecting connection");
             close(client_fd);
             continue;
         }
 
+        // 会话线程阻塞接收请求，客户端一直不发送时按会话超时退出
+        struct timeval tv;
+        tv.tv_sec  = cfg->protocol.session_timeout_ms / 1000;
+        tv.tv_usec = (cfg->protocol.session_timeout_ms % 1000) * 1000;
+        setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        lucpd_cfg_exit();
+
+        // ACK_START 与 NOTIFY_DONE 连续发出，关闭Nagle，否则后一帧要等前一帧被确认，
+        // 高延迟链路上多等一个往返
+        int nodelay = 1;
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
         // 创建会话线程
-        LucpSession_t* sess  = calloc(1, sizeof(LucpSession_t));
-        sess->fd             = client_fd;
-        sess->config         = &g_lucpdcfg;
-        sess->server_running = &server_running;
         pthread_t tid;
-        pthread_create(&tid, NULL, session_thread, sess);
-        pthread_detach(tid);
         atomic_fetch_add(&client_count, 1);
+        if (pthread_create(&tid, &thread_attr, session_thread, sess) != 0)
+        {
+            log_error("[Server] Failed to create session thread");
+            atomic_fetch_sub(&client_count, 1);
+            lucpd_session_free(sess);
+            continue;
+        }
     }
     close(listen_fd);
-    printf("[Server] Exiting main loop\n");
+    log_info("[Server] Shutting down...");
     sleep(1); // Let threads finish
+    pthread_attr_destroy(&thread_attr);
+    lucpd_session_shutdown();
+    lucp_capture_close();
+    lucpd_cache_shutdown();
+    lucpd_archive_shutdown();
+    lucpd_mark_shutdown();
+    lucpd_log_shutdown();
+    if (atomic_load(&client_count) == 0)
+        lucpd_cfg_cleanup();
     return 0;
 }
-
-
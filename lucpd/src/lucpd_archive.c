@@ -0,0 +1,933 @@
+#define _GNU_SOURCE // statx
+#include "lucpd_archive.h"
+#include "lucpd_utils.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define ARCHIVE_IO_BUF       (128 * 1024)
+#define ARCHIVE_TAR_BLOCK    512
+#define ARCHIVE_BLOCK_SIZE   (128 * 1024) // 并行压缩的块大小
+#define ARCHIVE_DICT_SIZE    (32 * 1024)  // deflate 窗口大小，作为下一块的预置字典
+#define ARCHIVE_MAX_INFLIGHT 64           // 单个打包请求同时在途的块数上限
+
+uint64_t lucpd_hash64(uint64_t seed, const void* data, size_t len)
+{
+    const uint8_t* p = (const uint8_t*) data;
+    uint64_t h       = seed;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// ================================ 请求解析 ===========================
+
+static int valid_device_id(const char* id)
+{
+    if (id[0] == '\0' || id[0] == '.')
+        return 0;
+    for (const char* p = id; *p; p++)
+    {
+        if (!isalnum((unsigned char) *p) && *p != '-' && *p != '_' && *p != '.')
+            return 0;
+    }
+    return 1;
+}
+
+static int parse_time_field(const char* value, int64_t* out)
+{
+    char* end;
+    errno       = 0;
+    long long v = strtoll(value, &end, 10);
+    if (errno != 0 || *end != '\0' || v < 0)
+        return -1;
+    *out = v;
+    return 0;
+}
+
+int lucpd_archive_parse_request(const uint8_t* text, uint16_t len, LucpdArchiveRequest_t* req)
+{
+    char buf[LUCP_MAX_TEXTINFO_LEN + 1];
+    memset(req, 0, sizeof(*req));
+    strcpy(req->device, LUCPD_DEFAULT_DEVICE_ID);
+
+    if (len > LUCP_MAX_TEXTINFO_LEN)
+        return -1;
+    memcpy(buf, text, len);
+    buf[len] = '\0';
+
+    char* saveptr = NULL;
+    for (char* tok = strtok_r(buf, ";", &saveptr); tok; tok = strtok_r(NULL, ";", &saveptr))
+    {
+        char* eq = strchr(tok, '=');
+        if (!eq)
+            continue; // 旧客户端的描述性文本
+        *eq = '\0';
+        const char* key   = tok;
+        const char* value = eq + 1;
+        if (strcmp(key, "device") == 0)
+        {
+            if (strlen(value) >= sizeof(req->device) || !valid_device_id(value))
+                return -1;
+            strcpy(req->device, value);
+        }
+        else if (strcmp(key, "start") == 0)
+        {
+            if (parse_time_field(value, &req->start_time) != 0)
+                return -1;
+        }
+        else if (strcmp(key, "end") == 0)
+        {
+            if (parse_time_field(value, &req->end_time) != 0)
+                return -1;
+        }
+        else if (strcmp(key, "full") == 0)
+        {
+            if (strcmp(value, "0") != 0 && strcmp(value, "1") != 0)
+                return -1;
+            req->full = value[0] == '1';
+        }
+        else if (strcmp(key, "resume") == 0)
+        {
+            if (strcmp(value, "1") == 0)
+            {
+                req->resumable = true;
+                continue;
+            }
+            if (strlen(value) != LUCPD_RESUME_TOKEN_LEN)
+                return -1;
+            for (const char* p = value; *p; p++)
+            {
+                if (!isxdigit((unsigned char) *p))
+                    return -1;
+            }
+            strcpy(req->resume_token, value);
+            req->resumable = true;
+        }
+    }
+    if (req->end_time != 0 && req->end_time < req->start_time)
+        return -1;
+    return 0;
+}
+
+// ================================ 日志扫描 ===========================
+
+static int compare_log_file(const void* a, const void* b)
+{
+    return strcmp(((const LucpdLogFile_t*) a)->name, ((const LucpdLogFile_t*) b)->name);
+}
+
+int lucpd_archive_scan(const char* log_dir, const LucpdArchiveRequest_t* req, LucpdLogSet_t* set)
+{
+    memset(set, 0, sizeof(*set));
+    if (snprintf(set->dir, sizeof(set->dir), "%s/%s", log_dir, req->device) >= (int) sizeof(set->dir))
+        return -1;
+
+    DIR* dir = opendir(set->dir);
+    if (!dir)
+        return -1;
+
+    int cap = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+        // tar ustar 的文件名字段最长99字节
+        if (strlen(entry->d_name) >= 100)
+        {
+            log_warn("Skip log file with too long name: %s/%s", set->dir, entry->d_name);
+            continue;
+        }
+
+        // 创建时间作为inode代数：inode号被删除后复用时，代数不同
+        struct statx st;
+        if (statx(dirfd(dir),
+                  entry->d_name,
+                  AT_SYMLINK_NOFOLLOW,
+                  STATX_BASIC_STATS | STATX_BTIME,
+                  &st) != 0 ||
+            !S_ISREG(st.stx_mode))
+            continue;
+        // 最后修改时间早于起点的文件不可能包含范围内的日志
+        if (req->start_time > 0 && st.stx_mtime.tv_sec < req->start_time)
+            continue;
+        // 创建时间晚于终点的文件只含终点之后的日志；文件系统不提供创建时间时保留
+        if (req->end_time > 0 && (st.stx_mask & STATX_BTIME) &&
+            st.stx_btime.tv_sec > req->end_time)
+            continue;
+
+        if (set->count == LUCPD_ARCHIVE_MAX_FILES)
+        {
+            log_warn("Too many log files in %s, only first %d archived", set->dir, set->count);
+            break;
+        }
+        if (set->count == cap)
+        {
+            cap                 = cap ? cap * 2 : 32;
+            LucpdLogFile_t* tmp = realloc(set->files, cap * sizeof(LucpdLogFile_t));
+            if (!tmp)
+            {
+                closedir(dir);
+                lucpd_archive_free_set(set);
+                return -1;
+            }
+            set->files = tmp;
+        }
+        LucpdLogFile_t* f = &set->files[set->count++];
+        strcpy(f->name, entry->d_name);
+        f->ino      = st.stx_ino;
+        f->gen      = 0;
+        f->size     = st.stx_size;
+        f->offset   = 0;
+        f->mtime_ns = (int64_t) st.stx_mtime.tv_sec * 1000000000LL + st.stx_mtime.tv_nsec;
+        if (st.stx_mask & STATX_BTIME)
+            f->gen = (uint64_t) st.stx_btime.tv_sec * 1000000000ULL + st.stx_btime.tv_nsec;
+        set->total_bytes += f->size;
+    }
+    closedir(dir);
+
+    if (set->count > 1)
+        qsort(set->files, set->count, sizeof(LucpdLogFile_t), compare_log_file);
+
+    uint64_t h = LUCPD_HASH64_INIT;
+    for (int i = 0; i < set->count; i++)
+    {
+        const LucpdLogFile_t* f = &set->files[i];
+        h                       = lucpd_hash64(h, f->name, strlen(f->name) + 1);
+        h                       = lucpd_hash64(h, &f->ino, sizeof(f->ino));
+        h                       = lucpd_hash64(h, &f->gen, sizeof(f->gen));
+        h                       = lucpd_hash64(h, &f->size, sizeof(f->size));
+        h                       = lucpd_hash64(h, &f->mtime_ns, sizeof(f->mtime_ns));
+    }
+    set->generation = h;
+    return 0;
+}
+
+void lucpd_archive_free_set(LucpdLogSet_t* set)
+{
+    free(set->files);
+    set->files = NULL;
+    set->count = 0;
+}
+
+// ================================ 并行 gzip 输出 ===========================
+//
+// 与 pigz 相同的做法：输入按固定大小切块，每块以前一块末尾32KB为预置字典独立做raw deflate，
+// 非最后一块以 Z_SYNC_FLUSH 结束（字节对齐、不带结束标志），各块输出按顺序拼接即为一个完整的
+// deflate 流；整体CRC由各块CRC用 crc32_combine 合并，输出是标准的单成员gzip文件。
+// 压缩线程池由所有打包请求共享，每个打包请求同时在途的块数有上限，内存占用与文件大小无关。
+
+typedef enum
+{
+    BLOCK_QUEUED,
+    BLOCK_DONE,
+    BLOCK_FAILED
+} ArchiveBlockState;
+
+typedef struct ArchiveBlock
+{
+    struct ArchiveBlock* next; // 工作队列 / 空闲链表
+    int level;
+    int last;                  // 是否为最后一块
+    int state;                 // ArchiveBlockState，由 g_pool.lock 保护
+    uint32_t crc;
+    size_t in_len;
+    size_t dict_len;
+    size_t out_len;
+    size_t out_cap;
+    uint8_t* out;
+    uint8_t dict[ARCHIVE_DICT_SIZE];
+    uint8_t in[ARCHIVE_BLOCK_SIZE];
+} ArchiveBlock_t;
+
+typedef struct
+{
+    int fd;
+    int level;
+    int depth;                 // 同时在途的块数上限
+    int head;                  // ring中最早提交的块
+    int count;                 // ring中在途的块数
+    uint32_t crc;
+    uint64_t consumed;         // 已写出部分对应的输入字节数
+    uint64_t written;          // 已写出的字节数
+    ArchiveBlock_t* cur;       // 正在填充的块
+    ArchiveBlock_t* free_list;
+    ArchiveBlock_t* ring[ARCHIVE_MAX_INFLIGHT];
+    size_t dict_len;
+    uint8_t dict[ARCHIVE_DICT_SIZE]; // 已提交输入的最后32KB
+} ArchiveOut_t;
+
+// 压缩线程池
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t work; // 队列中有待压缩的块
+    pthread_cond_t done; // 有块压缩完成
+    ArchiveBlock_t* head;
+    ArchiveBlock_t* tail;
+    pthread_t* threads;
+    int nthreads;
+    int level;
+    bool running;
+    LucpdArchiveStats_t stats;
+} g_pool = {
+    .lock  = PTHREAD_MUTEX_INITIALIZER,
+    .work  = PTHREAD_COND_INITIALIZER,
+    .done  = PTHREAD_COND_INITIALIZER,
+    .level = LUCPD_ARCHIVE_DEFAULT_LEVEL,
+};
+
+static uint64_t clock_ns(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t mono_now_ns(void) { return clock_ns(CLOCK_MONOTONIC); }
+
+// 线程CPU时间，压缩线程多于CPU时不把被抢占的时间计入压缩耗时
+static uint64_t thread_cpu_ns(void) { return clock_ns(CLOCK_THREAD_CPUTIME_ID); }
+
+static int write_full(int fd, const void* buf, size_t len)
+{
+    const uint8_t* p = (const uint8_t*) buf;
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+// 压缩单个块，可在压缩线程或调用者线程中执行
+static int block_compress(ArchiveBlock_t* b)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // 负的windowBits生成不带头尾的raw deflate
+    if (deflateInit2(&zs, b->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return -1;
+    if (b->dict_len > 0)
+        deflateSetDictionary(&zs, b->dict, (uInt) b->dict_len);
+
+    // 按上界分配，Z_SYNC_FLUSH 额外的空存储块标记留出余量
+    size_t bound = deflateBound(&zs, (uLong) b->in_len) + 64;
+    if (b->out_cap < bound)
+    {
+        uint8_t* p = realloc(b->out, bound);
+        if (!p)
+        {
+            deflateEnd(&zs);
+            return -1;
+        }
+        b->out     = p;
+        b->out_cap = bound;
+    }
+
+    int flush    = b->last ? Z_FINISH : Z_SYNC_FLUSH;
+    zs.next_in   = b->in;
+    zs.avail_in  = (uInt) b->in_len;
+    zs.next_out  = b->out;
+    zs.avail_out = (uInt) b->out_cap;
+    int rc       = deflate(&zs, flush);
+    b->out_len   = b->out_cap - zs.avail_out;
+    int complete = flush == Z_FINISH ? rc == Z_STREAM_END : (rc == Z_OK && zs.avail_out > 0);
+    deflateEnd(&zs);
+    if (!complete)
+        return -1;
+
+    b->crc = (uint32_t) crc32(0L, b->in, (uInt) b->in_len);
+    return 0;
+}
+
+static void* pool_worker(void* arg)
+{
+    (void) arg;
+    pthread_mutex_lock(&g_pool.lock);
+    while (1)
+    {
+        while (g_pool.running && !g_pool.head)
+            pthread_cond_wait(&g_pool.work, &g_pool.lock);
+        // 停止后先处理完队列中剩余的块
+        ArchiveBlock_t* b = g_pool.head;
+        if (!b)
+            break;
+        g_pool.head = b->next;
+        if (!g_pool.head)
+            g_pool.tail = NULL;
+        pthread_mutex_unlock(&g_pool.lock);
+
+        uint64_t t0 = thread_cpu_ns();
+        int rc      = block_compress(b);
+        uint64_t t1 = thread_cpu_ns();
+
+        pthread_mutex_lock(&g_pool.lock);
+        b->state = rc == 0 ? BLOCK_DONE : BLOCK_FAILED;
+        g_pool.stats.cpu_ns += t1 - t0;
+        pthread_cond_broadcast(&g_pool.done);
+    }
+    pthread_mutex_unlock(&g_pool.lock);
+    return NULL;
+}
+
+// 提交块到线程池；线程池未启动或已停止时由调用者直接压缩
+static void pool_submit(ArchiveBlock_t* b)
+{
+    pthread_mutex_lock(&g_pool.lock);
+    b->state = BLOCK_QUEUED;
+    if (g_pool.running)
+    {
+        b->next = NULL;
+        if (g_pool.tail)
+            g_pool.tail->next = b;
+        else
+            g_pool.head = b;
+        g_pool.tail = b;
+        pthread_cond_signal(&g_pool.work);
+        pthread_mutex_unlock(&g_pool.lock);
+        return;
+    }
+    pthread_mutex_unlock(&g_pool.lock);
+
+    uint64_t t0 = thread_cpu_ns();
+    int rc      = block_compress(b);
+    uint64_t t1 = thread_cpu_ns();
+    pthread_mutex_lock(&g_pool.lock);
+    b->state = rc == 0 ? BLOCK_DONE : BLOCK_FAILED;
+    g_pool.stats.cpu_ns += t1 - t0;
+    pthread_mutex_unlock(&g_pool.lock);
+}
+
+// 等待块压缩完成，返回最终状态
+static int block_wait(ArchiveBlock_t* b)
+{
+    pthread_mutex_lock(&g_pool.lock);
+    while (b->state == BLOCK_QUEUED)
+        pthread_cond_wait(&g_pool.done, &g_pool.lock);
+    int state = b->state;
+    pthread_mutex_unlock(&g_pool.lock);
+    return state;
+}
+
+static ArchiveBlock_t* block_get(ArchiveOut_t* out)
+{
+    ArchiveBlock_t* b = out->free_list;
+    if (b)
+        out->free_list = b->next;
+    else if (!(b = calloc(1, sizeof(ArchiveBlock_t))))
+        return NULL;
+    b->in_len = 0;
+    return b;
+}
+
+static void block_put(ArchiveOut_t* out, ArchiveBlock_t* b)
+{
+    b->next        = out->free_list;
+    out->free_list = b;
+}
+
+// 按提交顺序写出最早的块
+static int out_retire(ArchiveOut_t* out)
+{
+    ArchiveBlock_t* b = out->ring[out->head];
+    out->head         = (out->head + 1) % ARCHIVE_MAX_INFLIGHT;
+    out->count--;
+    if (block_wait(b) != BLOCK_DONE)
+    {
+        block_put(out, b);
+        errno = ENOMEM;
+        return -1;
+    }
+    int rc = write_full(out->fd, b->out, b->out_len);
+    if (rc == 0)
+    {
+        out->crc = (uint32_t) crc32_combine(out->crc, b->crc, (z_off_t) b->in_len);
+        out->consumed += b->in_len;
+        out->written += b->out_len;
+    }
+    block_put(out, b);
+    return rc;
+}
+
+static int out_submit(ArchiveOut_t* out, int last)
+{
+    ArchiveBlock_t* b = out->cur;
+    out->cur          = NULL;
+    b->last           = last;
+    b->level          = out->level;
+    b->dict_len       = out->dict_len;
+    memcpy(b->dict, out->dict, out->dict_len);
+
+    // 滑动字典：保留到目前为止输入的最后32KB
+    if (b->in_len >= ARCHIVE_DICT_SIZE)
+    {
+        memcpy(out->dict, b->in + b->in_len - ARCHIVE_DICT_SIZE, ARCHIVE_DICT_SIZE);
+        out->dict_len = ARCHIVE_DICT_SIZE;
+    }
+    else
+    {
+        size_t keep = ARCHIVE_DICT_SIZE - b->in_len;
+        if (keep < out->dict_len)
+        {
+            memmove(out->dict, out->dict + out->dict_len - keep, keep);
+            out->dict_len = keep;
+        }
+        memcpy(out->dict + out->dict_len, b->in, b->in_len);
+        out->dict_len += b->in_len;
+    }
+
+    out->ring[(out->head + out->count) % ARCHIVE_MAX_INFLIGHT] = b;
+    out->count++;
+    pool_submit(b);
+
+    while (out->count >= out->depth || (last && out->count > 0))
+    {
+        if (out_retire(out) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int out_open(ArchiveOut_t* out, int fd)
+{
+    memset(out, 0, offsetof(ArchiveOut_t, dict));
+    out->fd = fd;
+
+    pthread_mutex_lock(&g_pool.lock);
+    out->level = g_pool.level;
+    out->depth = g_pool.running ? g_pool.nthreads * 2 : 1;
+    pthread_mutex_unlock(&g_pool.lock);
+    if (out->depth > ARCHIVE_MAX_INFLIGHT)
+        out->depth = ARCHIVE_MAX_INFLIGHT;
+
+    // gzip头：无文件名、mtime为0，OS=Unix
+    static const uint8_t hdr[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+    if (write_full(fd, hdr, sizeof(hdr)) != 0)
+        return -1;
+    out->written = sizeof(hdr);
+    return 0;
+}
+
+static int out_write(ArchiveOut_t* out, const void* buf, size_t len)
+{
+    const uint8_t* p = (const uint8_t*) buf;
+    while (len > 0)
+    {
+        if (!out->cur && !(out->cur = block_get(out)))
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        ArchiveBlock_t* b = out->cur;
+        size_t n          = ARCHIVE_BLOCK_SIZE - b->in_len;
+        if (n > len)
+            n = len;
+        memcpy(b->in + b->in_len, p, n);
+        b->in_len += n;
+        p += n;
+        len -= n;
+        if (b->in_len == ARCHIVE_BLOCK_SIZE && out_submit(out, 0) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int out_finish(ArchiveOut_t* out)
+{
+    // 最后一块可能为空，仍需提交以写出deflate结束块
+    if (!out->cur && !(out->cur = block_get(out)))
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (out_submit(out, 1) != 0)
+        return -1;
+
+    // gzip尾：CRC32 与 输入长度(mod 2^32)，小端
+    uint8_t trailer[8];
+    uint32_t isize = (uint32_t) out->consumed;
+    for (int i = 0; i < 4; i++)
+    {
+        trailer[i]     = (uint8_t) (out->crc >> (8 * i));
+        trailer[4 + i] = (uint8_t) (isize >> (8 * i));
+    }
+    if (write_full(out->fd, trailer, sizeof(trailer)) != 0)
+        return -1;
+    out->written += sizeof(trailer);
+    return 0;
+}
+
+// 等待在途的块并释放全部缓冲区（失败路径中在途的块仍可能被压缩线程访问）
+static void out_close(ArchiveOut_t* out)
+{
+    while (out->count > 0)
+    {
+        ArchiveBlock_t* b = out->ring[out->head];
+        out->head         = (out->head + 1) % ARCHIVE_MAX_INFLIGHT;
+        out->count--;
+        block_wait(b);
+        block_put(out, b);
+    }
+    if (out->cur)
+        block_put(out, out->cur);
+    out->cur = NULL;
+    while (out->free_list)
+    {
+        ArchiveBlock_t* b = out->free_list;
+        out->free_list    = b->next;
+        free(b->out);
+        free(b);
+    }
+}
+
+int lucpd_archive_init(int threads, int level)
+{
+    if (threads == 0)
+    {
+        long n  = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = n > 0 ? (int) n : 1;
+    }
+    if (threads > LUCPD_ARCHIVE_MAX_THREADS)
+        threads = LUCPD_ARCHIVE_MAX_THREADS;
+
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.level = level;
+    pthread_mutex_unlock(&g_pool.lock);
+
+    if (threads <= 1)
+    {
+        log_info("Archive: compressing in session threads (level %d)", level);
+        return 0;
+    }
+
+    g_pool.threads = calloc((size_t) threads, sizeof(pthread_t));
+    if (!g_pool.threads)
+        return -1;
+    g_pool.running = true;
+    for (int i = 0; i < threads; i++)
+    {
+        if (pthread_create(&g_pool.threads[i], NULL, pool_worker, NULL) != 0)
+        {
+            log_warn("Archive: only %d of %d compression threads started", i, threads);
+            break;
+        }
+        g_pool.nthreads++;
+    }
+    if (g_pool.nthreads == 0)
+    {
+        g_pool.running = false;
+        free(g_pool.threads);
+        g_pool.threads = NULL;
+        return -1;
+    }
+    log_info("Archive: %d compression threads, level %d, %d KB blocks",
+             g_pool.nthreads,
+             level,
+             ARCHIVE_BLOCK_SIZE / 1024);
+    return 0;
+}
+
+void lucpd_archive_set_level(int level)
+{
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.level = level;
+    pthread_mutex_unlock(&g_pool.lock);
+}
+
+void lucpd_archive_shutdown(void)
+{
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.running = false;
+    pthread_cond_broadcast(&g_pool.work);
+    pthread_mutex_unlock(&g_pool.lock);
+    for (int i = 0; i < g_pool.nthreads; i++)
+        pthread_join(g_pool.threads[i], NULL);
+    free(g_pool.threads);
+    g_pool.threads  = NULL;
+    g_pool.nthreads = 0;
+
+    LucpdArchiveStats_t st;
+    lucpd_archive_stats(&st);
+    if (st.archives > 0)
+    {
+        log_info("Archive: %llu archives, %.1f MB -> %.1f MB, %.1f MB/s wall, %.1f MB/s per thread",
+                 (unsigned long long) st.archives,
+                 st.bytes_in / 1048576.0,
+                 st.bytes_out / 1048576.0,
+                 st.wall_ns ? st.bytes_in * 1000.0 / st.wall_ns : 0.0,
+                 st.cpu_ns ? st.bytes_in * 1000.0 / st.cpu_ns : 0.0);
+    }
+}
+
+void lucpd_archive_stats(LucpdArchiveStats_t* stats)
+{
+    pthread_mutex_lock(&g_pool.lock);
+    *stats = g_pool.stats;
+    pthread_mutex_unlock(&g_pool.lock);
+}
+
+// ================================ tar 打包 ===========================
+
+static void tar_octal(char* dst, size_t width, uint64_t value)
+{
+    // 超出八进制表示范围时使用GNU base-256编码
+    if (width == 12 && value > 077777777777ULL)
+    {
+        memset(dst, 0, width);
+        dst[0] = (char) 0x80;
+        for (size_t i = width - 1; i > 0 && value; i--, value >>= 8)
+            dst[i] = (char) (value & 0xFF);
+        return;
+    }
+    snprintf(dst, width, "%0*llo", (int) width - 1, (unsigned long long) value);
+}
+
+static int tar_write_header(ArchiveOut_t* out,
+                            const char* prefix,
+                            const char* name,
+                            uint64_t size,
+                            int64_t mtime)
+{
+    uint8_t hdr[ARCHIVE_TAR_BLOCK];
+    memset(hdr, 0, sizeof(hdr));
+    char* h = (char*) hdr;
+
+    strncpy(h, name, 99);                 // name
+    tar_octal(h + 100, 8, 0644);          // mode
+    tar_octal(h + 108, 8, 0);             // uid
+    tar_octal(h + 116, 8, 0);             // gid
+    tar_octal(h + 124, 12, size);         // size
+    tar_octal(h + 136, 12, (uint64_t) mtime); // mtime
+    memset(h + 148, ' ', 8);              // chksum 计算时按空格处理
+    h[156] = '0';                         // typeflag: 普通文件
+    memcpy(h + 257, "ustar", 6);          // magic
+    memcpy(h + 263, "00", 2);             // version
+    strncpy(h + 265, "lucp", 31);         // uname
+    strncpy(h + 297, "lucp", 31);         // gname
+    strncpy(h + 345, prefix, 154);        // prefix
+
+    unsigned int sum = 0;
+    for (size_t i = 0; i < sizeof(hdr); i++)
+        sum += hdr[i];
+    snprintf(h + 148, 8, "%06o", sum);
+    h[155] = ' ';
+
+    return out_write(out, hdr, sizeof(hdr));
+}
+
+// 数据按512字节补齐
+static int tar_write_pad(ArchiveOut_t* out, uint64_t size, uint8_t* buf)
+{
+    size_t pad = (ARCHIVE_TAR_BLOCK - (size % ARCHIVE_TAR_BLOCK)) % ARCHIVE_TAR_BLOCK;
+    if (pad == 0)
+        return 0;
+    memset(buf, 0, pad);
+    return out_write(out, buf, pad);
+}
+
+// 打包文件中 [offset, size) 的内容；文件在打包期间被截断时以0补齐，保证与头部声明一致
+static int tar_write_file(ArchiveOut_t* out, const char* dir, const LucpdLogFile_t* f, uint8_t* buf)
+{
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/%s", dir, f->name) >= (int) sizeof(path))
+        return -1;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    posix_fadvise(fd, (off_t) f->offset, 0, POSIX_FADV_SEQUENTIAL);
+    if (f->offset > 0 && lseek(fd, (off_t) f->offset, SEEK_SET) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    uint64_t remain = f->size - f->offset;
+    while (remain > 0)
+    {
+        size_t want = remain < ARCHIVE_IO_BUF ? (size_t) remain : ARCHIVE_IO_BUF;
+        ssize_t n   = read(fd, buf, want);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            memset(buf, 0, want);
+            n = (ssize_t) want;
+        }
+        if (out_write(out, buf, (size_t) n) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+        remain -= (uint64_t) n;
+    }
+    close(fd);
+
+    return tar_write_pad(out, f->size - f->offset, buf);
+}
+
+// 生成增量清单：基准版本、本包对应的高水位版本，以及每个有新内容的文件
+static char* delta_manifest(const LucpdLogSet_t* set, size_t* len)
+{
+    size_t cap = 64 + (size_t) set->count * (NAME_MAX + 48);
+    char* text = malloc(cap);
+    if (!text)
+        return NULL;
+    size_t n = (size_t) snprintf(text,
+                                 cap,
+                                 "base=%016llx\nmark=%016llx\n",
+                                 (unsigned long long) set->base_mark,
+                                 (unsigned long long) set->generation);
+    for (int i = 0; i < set->count; i++)
+    {
+        const LucpdLogFile_t* f = &set->files[i];
+        if (f->offset == f->size && f->offset > 0)
+            continue;
+        n += (size_t) snprintf(text + n,
+                               cap - n,
+                               "%s %llu %llu\n",
+                               f->name,
+                               (unsigned long long) f->offset,
+                               (unsigned long long) (f->size - f->offset));
+    }
+    *len = n;
+    return text;
+}
+
+int lucpd_archive_build(const LucpdLogSet_t* set,
+                        const char* device,
+                        const char* out_path,
+                        uint64_t* out_size,
+                        char* err,
+                        size_t errlen)
+{
+    char part_path[PATH_MAX];
+    if (snprintf(part_path, sizeof(part_path), "%s.part", out_path) >= (int) sizeof(part_path))
+    {
+        snprintf(err, errlen, "Archive failed: path too long");
+        return -1;
+    }
+
+    int fd = open(part_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        snprintf(err, errlen, "Archive failed: %s", strerror(errno));
+        return -1;
+    }
+
+    ArchiveOut_t* out = malloc(sizeof(ArchiveOut_t));
+    uint8_t* buf      = malloc(ARCHIVE_IO_BUF);
+    uint64_t t0       = mono_now_ns();
+    int opened        = 0;
+    int rc            = -1;
+    if (!out || !buf)
+    {
+        snprintf(err, errlen, "Archive failed: out of memory");
+        goto cleanup;
+    }
+    opened = 1;
+    if (out_open(out, fd) != 0)
+    {
+        snprintf(err, errlen, "Archive failed: %s", strerror(errno));
+        goto cleanup;
+    }
+
+    if (set->base_mark != 0)
+    {
+        size_t len     = 0;
+        char* manifest = delta_manifest(set, &len);
+        if (!manifest ||
+            tar_write_header(out, device, LUCPD_DELTA_MANIFEST, len, time(NULL)) != 0 ||
+            out_write(out, manifest, len) != 0 || tar_write_pad(out, len, buf) != 0)
+        {
+            snprintf(err,
+                     errlen,
+                     "Archive failed: %s",
+                     manifest ? strerror(errno) : "out of memory");
+            free(manifest);
+            goto cleanup;
+        }
+        free(manifest);
+    }
+
+    for (int i = 0; i < set->count; i++)
+    {
+        const LucpdLogFile_t* f = &set->files[i];
+        // 增量打包时跳过没有新内容的文件
+        if (f->offset == f->size && f->offset > 0)
+            continue;
+        if (tar_write_header(out,
+                             device,
+                             f->name,
+                             f->size - f->offset,
+                             f->mtime_ns / 1000000000LL) != 0 ||
+            tar_write_file(out, set->dir, f, buf) != 0)
+        {
+            snprintf(err, errlen, "Archive failed: %s: %s", f->name, strerror(errno));
+            goto cleanup;
+        }
+    }
+
+    // tar 结束标记：两个全0块
+    memset(buf, 0, 2 * ARCHIVE_TAR_BLOCK);
+    if (out_write(out, buf, 2 * ARCHIVE_TAR_BLOCK) != 0 || out_finish(out) != 0)
+    {
+        snprintf(err, errlen, "Archive failed: %s", errno == ENOSPC ? "disk full" : strerror(errno));
+        goto cleanup;
+    }
+    if (fsync(fd) != 0 || rename(part_path, out_path) != 0)
+    {
+        snprintf(err, errlen, "Archive failed: %s", strerror(errno));
+        goto cleanup;
+    }
+    *out_size = out->written;
+    rc        = 0;
+
+    uint64_t elapsed = mono_now_ns() - t0;
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.stats.archives++;
+    g_pool.stats.bytes_in += out->consumed;
+    g_pool.stats.bytes_out += out->written;
+    g_pool.stats.wall_ns += elapsed;
+    pthread_mutex_unlock(&g_pool.lock);
+    log_info("Archive %s: %llu -> %llu bytes (%.1f%%) in %llu ms, %.1f MB/s, level %d",
+             device,
+             (unsigned long long) out->consumed,
+             (unsigned long long) out->written,
+             out->consumed ? out->written * 100.0 / out->consumed : 0.0,
+             (unsigned long long) (elapsed / 1000000),
+             elapsed ? out->consumed * 1000.0 / elapsed : 0.0,
+             out->level);
+
+cleanup:
+    if (opened)
+        out_close(out);
+    close(fd);
+    if (rc != 0)
+        unlink(part_path);
+    free(buf);
+    free(out);
+    return rc;
+}
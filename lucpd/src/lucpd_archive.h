@@ -0,0 +1,111 @@
+#ifndef LUCPD_ARCHIVE_H
+#define LUCPD_ARCHIVE_H
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LUCPD_DEVICE_ID_MAX    64
+#define LUCPD_ARCHIVE_NAME_MAX 128
+// 单个设备一次最多打包的日志文件数
+#define LUCPD_ARCHIVE_MAX_FILES 4096
+#define LUCPD_DEFAULT_DEVICE_ID "default"
+// 断线续传令牌长度（十六进制字符）
+#define LUCPD_RESUME_TOKEN_LEN 32
+// 增量日志包中的清单文件名
+#define LUCPD_DELTA_MANIFEST ".lucp_delta"
+// gzip 压缩级别缺省值
+#define LUCPD_ARCHIVE_DEFAULT_LEVEL 6
+// 压缩线程数上限
+#define LUCPD_ARCHIVE_MAX_THREADS 64
+
+// 从 LUCP_MTYP_UPLOAD_REQUEST 的 textInfo 中解析出的打包请求
+// textInfo 格式: "device=<id>;start=<unix秒>;end=<unix秒>;full=<0|1>;resume=<1|令牌>"，
+// 各字段均可省略。resume=1 申请断线续传令牌，resume=<令牌> 接续之前断开的会话
+typedef struct
+{
+    char device[LUCPD_DEVICE_ID_MAX]; // 设备标识，对应 log_dir 下的子目录
+    int64_t start_time;               // 日志时间范围起点，0表示不限
+    int64_t end_time;                 // 日志时间范围终点，0表示不限
+    bool full;                        // 忽略高水位，强制全量打包
+    bool resumable;                   // 客户端支持断线续传
+    char resume_token[LUCPD_RESUME_TOKEN_LEN + 1]; // 重连时出示的续传令牌，为空表示新会话
+} LucpdArchiveRequest_t;
+
+// 参与打包的单个日志文件（扫描时刻的快照）
+typedef struct
+{
+    char name[NAME_MAX + 1];
+    uint64_t ino;
+    uint64_t gen;    // inode代数（创建时间），用于识别inode号被复用
+    uint64_t size;
+    uint64_t offset; // 增量打包的起点，之前的内容已上传过
+    int64_t mtime_ns;
+} LucpdLogFile_t;
+
+// 一次打包请求选中的全部日志文件
+typedef struct
+{
+    char dir[PATH_MAX];
+    LucpdLogFile_t* files;
+    int count;
+    uint64_t total_bytes;
+    uint64_t generation; // 所有文件(名称,inode,代数,大小,修改时间)的指纹，任一文件变化都会改变
+    uint64_t base_mark;  // 增量打包所基于的高水位版本，0表示全量
+} LucpdLogSet_t;
+
+// 压缩统计（自启动以来累计）
+typedef struct
+{
+    uint64_t archives;  // 成功构建的日志包数
+    uint64_t bytes_in;  // 压缩前(tar)字节数
+    uint64_t bytes_out; // 压缩后字节数
+    uint64_t wall_ns;   // 构建耗时总和（含读文件和写盘）
+    uint64_t cpu_ns;    // 各块压缩占用的CPU时间总和
+} LucpdArchiveStats_t;
+
+/// @brief 启动压缩线程池
+/// @param threads 压缩线程数，0表示按CPU数，1表示在会话线程中直接压缩
+/// @param level gzip 压缩级别(1~9)
+/// @return 成功返回0，线程无法创建时返回-1（此时退化为在会话线程中压缩）
+int lucpd_archive_init(int threads, int level);
+
+/// @brief 调整压缩级别，对之后开始构建的日志包生效
+void lucpd_archive_set_level(int level);
+
+/// @brief 停止压缩线程池并输出累计统计，之后的构建在调用者线程中压缩
+void lucpd_archive_shutdown(void);
+
+/// @brief 获取压缩统计
+void lucpd_archive_stats(LucpdArchiveStats_t* stats);
+
+/// @brief 解析打包请求，不含'='的文本（旧客户端）按缺省值处理
+/// @return 成功返回0，字段取值非法返回-1
+int lucpd_archive_parse_request(const uint8_t* text, uint16_t len, LucpdArchiveRequest_t* req);
+
+/// @brief 扫描 log_dir/<device> 下满足时间范围的日志文件，按文件名排序
+/// @return 成功返回0，目录不存在或无法读取返回-1
+int lucpd_archive_scan(const char* log_dir, const LucpdArchiveRequest_t* req, LucpdLogSet_t* set);
+
+/// @brief 释放扫描结果
+void lucpd_archive_free_set(LucpdLogSet_t* set);
+
+/// @brief 把日志集合打包为 tar.gz 写入 out_path（先写临时文件，成功后原子重命名）
+/// 压缩由线程池分块并行完成，输出为标准的单成员gzip文件。
+/// 增量打包(base_mark非0)时每个文件只打包 [offset, size)，没有新内容的文件不打包，
+/// 首个条目为清单 LUCPD_DELTA_MANIFEST，逐行列出 "<文件名> <offset> <长度>"
+/// @return 成功返回0并通过out_size返回产物大小，失败返回-1并在err中写入原因
+int lucpd_archive_build(const LucpdLogSet_t* set,
+                        const char* device,
+                        const char* out_path,
+                        uint64_t* out_size,
+                        char* err,
+                        size_t errlen);
+
+/// @brief 64位FNV-1a哈希，可通过seed串联多段数据
+uint64_t lucpd_hash64(uint64_t seed, const void* data, size_t len);
+
+#define LUCPD_HASH64_INIT 0xcbf29ce484222325ULL
+
+#endif // LUCPD_ARCHIVE_H
@@ -0,0 +1,625 @@
+#include "lucpd_cache.h"
+#include "lucpd_mark.h"
+#include "lucpd_utils.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef enum
+{
+    LUCPD_CACHE_BUILDING,
+    LUCPD_CACHE_READY,
+    LUCPD_CACHE_FAILED
+} LucpdCacheState;
+
+// 缓存条目，索引只保存元数据，产物本身在tmp_dir中
+typedef struct LucpdCacheEntry
+{
+    uint64_t key;
+    LucpdCacheState state;
+    char name[LUCPD_ARCHIVE_NAME_MAX]; // 产物文件名
+    char error[128];                   // 构建失败原因
+    uint64_t size;
+    uint64_t expire_at; // 过期时刻(单调时钟毫秒)
+    int heap_idx;     // 在过期堆中的下标，-1表示不在堆中
+    int waiters;      // 等待本次构建结果的请求数
+    int pins;         // 正在被设备下载的会话数，非0时不得删除
+    bool doomed;      // 钉住期间到期或需要腾出配额，已移出过期堆，释放后重新入堆
+    bool detached;    // 已从哈希表摘除，由最后一个等待者或最后一个下载者释放
+    struct LucpdCacheEntry* next;
+} LucpdCacheEntry_t;
+
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t built; // 任一构建结束
+    pthread_cond_t sweep; // 唤醒清理线程
+    pthread_t sweeper;
+    bool running;
+    char dir[PATH_MAX];
+    int dir_fd;
+    uint64_t retention_ms;
+    uint64_t quota;
+    uint64_t used;
+    LucpdCacheEntry_t* buckets[LUCPD_CACHE_BUCKETS];
+    // 按过期时间排序的最小堆，清理线程只需查看堆顶，无需扫描目录
+    LucpdCacheEntry_t** heap;
+    int heap_len;
+    int heap_cap;
+    uint64_t hits, misses, collapsed, evicted, deferred;
+} g_cache = {.lock = PTHREAD_MUTEX_INITIALIZER, .dir_fd = -1};
+
+static uint64_t mono_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// ================================ 过期堆 ===========================
+
+static void heap_swap(int a, int b)
+{
+    LucpdCacheEntry_t* tmp    = g_cache.heap[a];
+    g_cache.heap[a]           = g_cache.heap[b];
+    g_cache.heap[b]           = tmp;
+    g_cache.heap[a]->heap_idx = a;
+    g_cache.heap[b]->heap_idx = b;
+}
+
+static void heap_sift_up(int i)
+{
+    while (i > 0)
+    {
+        int parent = (i - 1) / 2;
+        if (g_cache.heap[parent]->expire_at <= g_cache.heap[i]->expire_at)
+            break;
+        heap_swap(i, parent);
+        i = parent;
+    }
+}
+
+static void heap_sift_down(int i)
+{
+    while (1)
+    {
+        int l = 2 * i + 1, r = l + 1, min = i;
+        if (l < g_cache.heap_len && g_cache.heap[l]->expire_at < g_cache.heap[min]->expire_at)
+            min = l;
+        if (r < g_cache.heap_len && g_cache.heap[r]->expire_at < g_cache.heap[min]->expire_at)
+            min = r;
+        if (min == i)
+            break;
+        heap_swap(i, min);
+        i = min;
+    }
+}
+
+static int heap_push(LucpdCacheEntry_t* e)
+{
+    if (g_cache.heap_len == g_cache.heap_cap)
+    {
+        int cap                  = g_cache.heap_cap ? g_cache.heap_cap * 2 : 64;
+        LucpdCacheEntry_t** heap = realloc(g_cache.heap, cap * sizeof(*heap));
+        if (!heap)
+            return -1;
+        g_cache.heap     = heap;
+        g_cache.heap_cap = cap;
+    }
+    e->heap_idx                      = g_cache.heap_len;
+    g_cache.heap[g_cache.heap_len++] = e;
+    heap_sift_up(e->heap_idx);
+    return 0;
+}
+
+static void heap_remove(LucpdCacheEntry_t* e)
+{
+    int i = e->heap_idx;
+    if (i < 0)
+        return;
+    int last = --g_cache.heap_len;
+    if (i != last)
+    {
+        heap_swap(i, last);
+        heap_sift_down(i);
+        heap_sift_up(i);
+    }
+    e->heap_idx = -1;
+}
+
+// ================================ 哈希索引 ===========================
+
+static LucpdCacheEntry_t** bucket_of(uint64_t key)
+{
+    return &g_cache.buckets[key & (LUCPD_CACHE_BUCKETS - 1)];
+}
+
+static LucpdCacheEntry_t* table_find(uint64_t key)
+{
+    for (LucpdCacheEntry_t* e = *bucket_of(key); e; e = e->next)
+    {
+        if (e->key == key)
+            return e;
+    }
+    return NULL;
+}
+
+static void table_remove(LucpdCacheEntry_t* e)
+{
+    for (LucpdCacheEntry_t** pp = bucket_of(e->key); *pp; pp = &(*pp)->next)
+    {
+        if (*pp == e)
+        {
+            *pp = e->next;
+            break;
+        }
+    }
+    e->next     = NULL;
+    e->detached = true;
+}
+
+// 从索引中淘汰一个已就绪的条目并删除产物，调用方持有锁
+static void evict_entry(LucpdCacheEntry_t* e, const char* reason)
+{
+    heap_remove(e);
+    table_remove(e);
+    g_cache.used -= e->size;
+    g_cache.evicted++;
+    if (unlinkat(g_cache.dir_fd, e->name, 0) != 0 && errno != ENOENT)
+        log_warn("Cache: failed to remove %s: %s", e->name, strerror(errno));
+    log_debug("Cache: evicted %s (%s, %llu bytes)", e->name, reason, (unsigned long long) e->size);
+    // 仍有请求在读取构建结果或仍被下载时，由最后一个等待者或 lucpd_cache_release 释放。
+    // 同一个键随后可能重建出新条目，持有旧条目的下载只会释放旧条目
+    if (e->waiters == 0 && e->pins == 0)
+        free(e);
+}
+
+// ================================ 清理线程 ===========================
+
+static void* cache_sweeper_thread(void* arg)
+{
+    (void) arg;
+    pthread_mutex_lock(&g_cache.lock);
+    while (g_cache.running)
+    {
+        uint64_t now = mono_now_ms();
+        while (g_cache.heap_len > 0)
+        {
+            LucpdCacheEntry_t* top = g_cache.heap[0];
+            if (top->expire_at > now && g_cache.used <= g_cache.quota)
+                break;
+            if (top->pins > 0)
+            {
+                // 正在被下载，移出过期堆，最后一个下载结束后再处理
+                heap_remove(top);
+                top->doomed = true;
+                g_cache.deferred++;
+                log_debug("Cache: %s in use by %d downloads, deferring removal",
+                          top->name,
+                          top->pins);
+            }
+            else
+            {
+                evict_entry(top, top->expire_at <= now ? "expired" : "over quota");
+            }
+        }
+
+        uint64_t wake = now + LUCPD_CACHE_SWEEP_MAX_SLEEP_S * 1000;
+        if (g_cache.heap_len > 0 && g_cache.heap[0]->expire_at < wake)
+            wake = g_cache.heap[0]->expire_at;
+        struct timespec ts = {.tv_sec = wake / 1000, .tv_nsec = (wake % 1000) * 1000000};
+        pthread_cond_timedwait(&g_cache.sweep, &g_cache.lock, &ts);
+    }
+    pthread_mutex_unlock(&g_cache.lock);
+    return NULL;
+}
+
+// ================================ 启动接管 ===========================
+
+// 产物文件名: <设备>_<16位十六进制键>.tar.gz，解析出键
+static int parse_artifact_name(const char* name, uint64_t* key)
+{
+    static const char suffix[] = ".tar.gz";
+    size_t len                 = strlen(name);
+    size_t tail                = 1 + 16 + sizeof(suffix) - 1;
+    if (len <= tail || len >= LUCPD_ARCHIVE_NAME_MAX || strcmp(name + len - 7, suffix) != 0 ||
+        name[len - tail] != '_')
+        return -1;
+    char hex[17];
+    memcpy(hex, name + len - tail + 1, 16);
+    hex[16] = '\0';
+    char* end;
+    *key = strtoull(hex, &end, 16);
+    return *end == '\0' ? 0 : -1;
+}
+
+// 接管上次运行留下的产物并删除构建中断留下的 .part 文件，在清理线程启动前调用
+static void cache_adopt(void)
+{
+    int fd   = dup(g_cache.dir_fd);
+    DIR* dir = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!dir)
+    {
+        if (fd >= 0)
+            close(fd);
+        log_warn("Cache: failed to scan %s: %s", g_cache.dir, strerror(errno));
+        return;
+    }
+
+    uint64_t now_ms        = mono_now_ms();
+    time_t now             = time(NULL);
+    int adopted            = 0;
+    int removed            = 0;
+    uint64_t adopted_bytes = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        const char* name = entry->d_name;
+        size_t len       = strlen(name);
+        if (name[0] == '.')
+            continue;
+        if (len > 5 && strcmp(name + len - 5, ".part") == 0)
+        {
+            if (unlinkat(g_cache.dir_fd, name, 0) == 0)
+                removed++;
+            continue;
+        }
+
+        uint64_t key;
+        struct stat st;
+        if (parse_artifact_name(name, &key) != 0 ||
+            fstatat(g_cache.dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode) ||
+            table_find(key))
+            continue;
+
+        LucpdCacheEntry_t* e = calloc(1, sizeof(LucpdCacheEntry_t));
+        if (!e)
+            break;
+        e->key      = key;
+        e->state    = LUCPD_CACHE_READY;
+        e->size     = st.st_size;
+        e->heap_idx = -1;
+        strcpy(e->name, name);
+        // 按文件年龄扣除已经过的保留时间
+        uint64_t age_ms = now > st.st_mtime ? (uint64_t) (now - st.st_mtime) * 1000 : 0;
+        e->expire_at    = now_ms;
+        if (age_ms < g_cache.retention_ms)
+            e->expire_at += g_cache.retention_ms - age_ms;
+        if (heap_push(e) != 0)
+        {
+            free(e);
+            break;
+        }
+        e->next         = *bucket_of(key);
+        *bucket_of(key) = e;
+        g_cache.used += e->size;
+        adopted++;
+        adopted_bytes += e->size;
+    }
+    closedir(dir);
+    if (adopted > 0 || removed > 0)
+    {
+        log_info("Cache: adopted %d archives (%llu bytes), removed %d partial files",
+                 adopted,
+                 (unsigned long long) adopted_bytes,
+                 removed);
+    }
+}
+
+// ================================ 对外接口 ===========================
+
+int lucpd_cache_init(const char* tmp_dir, int retention_min, uint64_t quota_bytes)
+{
+    if (mkdir(tmp_dir, 0755) != 0 && errno != EEXIST)
+    {
+        log_error("Cache: failed to create %s: %s", tmp_dir, strerror(errno));
+        return -1;
+    }
+    g_cache.dir_fd = open(tmp_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (g_cache.dir_fd < 0)
+    {
+        log_error("Cache: failed to open %s: %s", tmp_dir, strerror(errno));
+        return -1;
+    }
+    strncpy(g_cache.dir, tmp_dir, sizeof(g_cache.dir) - 1);
+    g_cache.retention_ms = (uint64_t) retention_min * 60 * 1000;
+    g_cache.quota       = quota_bytes;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_cache.sweep, &attr);
+    pthread_cond_init(&g_cache.built, NULL);
+    pthread_condattr_destroy(&attr);
+
+    cache_adopt();
+
+    g_cache.running = true;
+    if (pthread_create(&g_cache.sweeper, NULL, cache_sweeper_thread, NULL) != 0)
+    {
+        g_cache.running = false;
+        close(g_cache.dir_fd);
+        g_cache.dir_fd = -1;
+        return -1;
+    }
+    log_debug("Cache: %s (retention=%d min, quota=%llu bytes)",
+              tmp_dir,
+              retention_min,
+              (unsigned long long) quota_bytes);
+    return 0;
+}
+
+void lucpd_cache_set_limits(int retention_min, uint64_t quota_bytes)
+{
+    pthread_mutex_lock(&g_cache.lock);
+    g_cache.retention_ms = (uint64_t) retention_min * 60 * 1000;
+    g_cache.quota        = quota_bytes;
+    pthread_cond_signal(&g_cache.sweep);
+    pthread_mutex_unlock(&g_cache.lock);
+}
+
+void lucpd_cache_shutdown(void)
+{
+    pthread_mutex_lock(&g_cache.lock);
+    if (!g_cache.running)
+    {
+        pthread_mutex_unlock(&g_cache.lock);
+        return;
+    }
+    g_cache.running = false;
+    pthread_cond_signal(&g_cache.sweep);
+    pthread_mutex_unlock(&g_cache.lock);
+    pthread_join(g_cache.sweeper, NULL);
+
+    pthread_mutex_lock(&g_cache.lock);
+    log_debug("Cache: hits=%llu misses=%llu collapsed=%llu evicted=%llu deferred=%llu",
+              (unsigned long long) g_cache.hits,
+              (unsigned long long) g_cache.misses,
+              (unsigned long long) g_cache.collapsed,
+              (unsigned long long) g_cache.evicted,
+              (unsigned long long) g_cache.deferred);
+    // 仅释放就绪条目（含推迟删除的条目）；构建中的条目仍由其构建线程持有，
+    // 仍被钉住的条目摘除后由最后一个下载者释放
+    for (int i = 0; i < LUCPD_CACHE_BUCKETS; i++)
+    {
+        LucpdCacheEntry_t** pp = &g_cache.buckets[i];
+        while (*pp)
+        {
+            LucpdCacheEntry_t* e = *pp;
+            if (e->state == LUCPD_CACHE_READY)
+            {
+                *pp         = e->next;
+                e->next     = NULL;
+                e->detached = true;
+                if (e->pins == 0)
+                    free(e);
+            }
+            else
+            {
+                pp = &e->next;
+            }
+        }
+    }
+    g_cache.heap_len = 0;
+    free(g_cache.heap);
+    g_cache.heap     = NULL;
+    g_cache.heap_cap = 0;
+    close(g_cache.dir_fd);
+    g_cache.dir_fd = -1;
+    pthread_mutex_unlock(&g_cache.lock);
+}
+
+void lucpd_cache_release(LucpdCacheTicket_t* ticket)
+{
+    LucpdCacheEntry_t* e = ticket->entry;
+    ticket->entry        = NULL;
+    if (!e)
+        return;
+    pthread_mutex_lock(&g_cache.lock);
+    if (e->pins > 0)
+        e->pins--;
+    if (e->pins == 0 && e->detached)
+    {
+        // 钉住期间已被淘汰（如产物在磁盘上丢失），只剩本次下载引用它
+        if (e->waiters == 0)
+            free(e);
+    }
+    else if (e->pins == 0 && e->doomed)
+    {
+        // 推迟删除的产物不再被下载，放回过期堆由清理线程按期限和配额处理
+        e->doomed = false;
+        if (heap_push(e) == 0)
+            pthread_cond_signal(&g_cache.sweep);
+        else
+            evict_entry(e, "released");
+    }
+    pthread_mutex_unlock(&g_cache.lock);
+}
+
+static uint64_t request_key(const LucpdArchiveRequest_t* req, const LucpdLogSet_t* set)
+{
+    uint64_t h = lucpd_hash64(LUCPD_HASH64_INIT, req->device, strlen(req->device) + 1);
+    h          = lucpd_hash64(h, &req->start_time, sizeof(req->start_time));
+    h          = lucpd_hash64(h, &req->end_time, sizeof(req->end_time));
+    h          = lucpd_hash64(h, &set->base_mark, sizeof(set->base_mark));
+    return lucpd_hash64(h, &set->generation, sizeof(set->generation));
+}
+
+// 钉住产物，调用方持有锁
+static void entry_pin(LucpdCacheEntry_t* e, LucpdCacheTicket_t* ticket)
+{
+    e->pins++;
+    ticket->entry = e;
+    // 推迟删除的产物再次被请求，重新开始保留期
+    if (e->doomed)
+    {
+        e->doomed    = false;
+        e->expire_at = mono_now_ms() + g_cache.retention_ms;
+        if (heap_push(e) != 0)
+            log_warn("Cache: %s not indexed for expiry (out of memory)", e->name);
+    }
+}
+
+// 等待其他请求完成同一产物的构建，调用方持有锁
+static int wait_for_build(LucpdCacheEntry_t* e,
+                          char* result,
+                          size_t result_len,
+                          LucpdCacheTicket_t* ticket)
+{
+    g_cache.collapsed++;
+    e->waiters++;
+    while (e->state == LUCPD_CACHE_BUILDING)
+        pthread_cond_wait(&g_cache.built, &g_cache.lock);
+    e->waiters--;
+
+    int status = LUCP_STAT_SUCCESS;
+    if (e->state == LUCPD_CACHE_READY)
+    {
+        snprintf(result, result_len, "%s", e->name);
+        if (!e->detached)
+            entry_pin(e, ticket);
+    }
+    else
+    {
+        snprintf(result, result_len, "%s", e->error);
+        status = LUCP_STAT_ARCHIVE_FAILED;
+    }
+    if (e->detached && e->waiters == 0 && e->pins == 0)
+        free(e);
+    return status;
+}
+
+int lucpd_cache_get(const char* log_dir,
+                    const LucpdArchiveRequest_t* req,
+                    char* result,
+                    size_t result_len,
+                    LucpdCacheTicket_t* ticket)
+{
+    memset(ticket, 0, sizeof(*ticket));
+    if (g_cache.dir_fd < 0)
+    {
+        snprintf(result, result_len, "Archive failed: tmp_dir unavailable");
+        return LUCP_STAT_ARCHIVE_FAILED;
+    }
+
+    LucpdLogSet_t set;
+    if (lucpd_archive_scan(log_dir, req, &set) != 0)
+    {
+        snprintf(result, result_len, "Archive failed: no logs for device %s", req->device);
+        return LUCP_STAT_ARCHIVE_FAILED;
+    }
+    if (set.count == 0)
+    {
+        lucpd_archive_free_set(&set);
+        snprintf(result, result_len, "Archive failed: no logs in requested range");
+        return LUCP_STAT_ARCHIVE_FAILED;
+    }
+
+    // 不限时间范围的请求按设备高水位增量打包，并在设备确认成功后前移高水位
+    bool track = req->start_time == 0 && req->end_time == 0;
+    if (track && !req->full)
+        lucpd_mark_apply(req->device, &set);
+
+    uint64_t key = request_key(req, &set);
+
+    pthread_mutex_lock(&g_cache.lock);
+    LucpdCacheEntry_t* e = table_find(key);
+    if (e && e->state == LUCPD_CACHE_READY)
+    {
+        struct stat st;
+        if (fstatat(g_cache.dir_fd, e->name, &st, 0) == 0)
+        {
+            g_cache.hits++;
+            entry_pin(e, ticket);
+            snprintf(result, result_len, "%s", e->name);
+            pthread_mutex_unlock(&g_cache.lock);
+            if (track)
+                ticket->mark = lucpd_mark_stage(req->device, &set);
+            lucpd_archive_free_set(&set);
+            log_debug("Cache: hit %s", result);
+            return LUCP_STAT_SUCCESS;
+        }
+        // 产物被外部删除，重新构建
+        evict_entry(e, "missing on disk");
+        e = NULL;
+    }
+    if (e)
+    {
+        int status = wait_for_build(e, result, result_len, ticket);
+        pthread_mutex_unlock(&g_cache.lock);
+        if (track && status == LUCP_STAT_SUCCESS)
+            ticket->mark = lucpd_mark_stage(req->device, &set);
+        lucpd_archive_free_set(&set);
+        return status;
+    }
+
+    // 未命中：登记为构建中，释放锁后构建
+    e = calloc(1, sizeof(LucpdCacheEntry_t));
+    if (!e)
+    {
+        pthread_mutex_unlock(&g_cache.lock);
+        lucpd_archive_free_set(&set);
+        snprintf(result, result_len, "Archive failed: out of memory");
+        return LUCP_STAT_ARCHIVE_FAILED;
+    }
+    e->key      = key;
+    e->state    = LUCPD_CACHE_BUILDING;
+    e->heap_idx = -1;
+    snprintf(e->name, sizeof(e->name), "%s_%016llx.tar.gz", req->device, (unsigned long long) key);
+    e->next         = *bucket_of(key);
+    *bucket_of(key) = e;
+    g_cache.misses++;
+    pthread_mutex_unlock(&g_cache.lock);
+
+    char path[PATH_MAX + LUCPD_ARCHIVE_NAME_MAX];
+    snprintf(path, sizeof(path), "%s/%s", g_cache.dir, e->name);
+    uint64_t size = 0;
+    uint64_t t0   = get_now_ms();
+    int rc        = lucpd_archive_build(&set, req->device, path, &size, e->error, sizeof(e->error));
+    if (track && rc == 0)
+        ticket->mark = lucpd_mark_stage(req->device, &set);
+    lucpd_archive_free_set(&set);
+
+    pthread_mutex_lock(&g_cache.lock);
+    int status = LUCP_STAT_SUCCESS;
+    if (rc == 0)
+    {
+        e->state      = LUCPD_CACHE_READY;
+        e->size       = size;
+        e->expire_at  = mono_now_ms() + g_cache.retention_ms;
+        e->pins       = 1;
+        ticket->entry = e;
+        g_cache.used += size;
+        if (heap_push(e) != 0)
+            log_warn("Cache: %s not indexed for expiry (out of memory)", e->name);
+        if (g_cache.used > g_cache.quota)
+            pthread_cond_signal(&g_cache.sweep);
+        snprintf(result, result_len, "%s", e->name);
+        log_debug("Cache: built %s (%llu bytes, %llu ms)",
+                  e->name,
+                  (unsigned long long) size,
+                  (unsigned long long) (get_now_ms() - t0));
+    }
+    else
+    {
+        // 失败结果只分发给当前等待者，之后的请求会重新构建
+        e->state = LUCPD_CACHE_FAILED;
+        table_remove(e);
+        snprintf(result, result_len, "%s", e->error);
+        status = LUCP_STAT_ARCHIVE_FAILED;
+        log_warn("Cache: build %s failed: %s", e->name, e->error);
+    }
+    pthread_cond_broadcast(&g_cache.built);
+    if (e->state == LUCPD_CACHE_FAILED && e->waiters == 0)
+        free(e);
+    pthread_mutex_unlock(&g_cache.lock);
+    return status;
+}
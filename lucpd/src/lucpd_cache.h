@@ -0,0 +1,61 @@
+#ifndef LUCPD_CACHE_H
+#define LUCPD_CACHE_H
+
+#include "lucpd_archive.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// 缓存索引的哈希桶数量（必须是2的幂）
+#define LUCPD_CACHE_BUCKETS 4096
+// 清理线程在没有即将过期条目时的最长休眠时间(秒)
+#define LUCPD_CACHE_SWEEP_MAX_SLEEP_S 60
+
+struct LucpdCacheEntry;
+
+// 一次成功获取的日志包
+typedef struct
+{
+    struct LucpdCacheEntry* entry; // 钉住的产物，下载结束后交给 lucpd_cache_release
+    uint64_t mark; // 待确认的高水位版本，设备确认下载成功后交给 lucpd_mark_commit；0表示无需确认
+} LucpdCacheTicket_t;
+
+/// @brief 初始化产物缓存并启动清理线程
+///
+/// 启动时接管 tmp_dir 中上次运行留下的产物（按文件修改时间计算剩余保留期），
+/// 并删除构建中断留下的 .part 文件。
+/// @param tmp_dir 产物存放目录（不存在时自动创建）
+/// @param retention_min 产物保留时间(分钟)
+/// @param quota_bytes 产物占用磁盘的上限(字节)，超出时按过期时间从早到晚淘汰
+/// @return 成功返回0，失败返回-1
+int lucpd_cache_init(const char* tmp_dir, int retention_min, uint64_t quota_bytes);
+
+/// @brief 运行时调整保留时间和磁盘配额（配置热加载时调用）
+///
+/// 新的保留时间只对之后构建的产物生效；配额缩小时清理线程立即按过期时间从早到晚淘汰。
+void lucpd_cache_set_limits(int retention_min, uint64_t quota_bytes);
+
+/// @brief 停止清理线程并释放索引（磁盘上的产物保留）
+void lucpd_cache_shutdown(void);
+
+/// @brief 获取请求对应的日志包，必要时构建
+///
+/// 以(设备, 时间范围, 源文件指纹)为键：保留期内的重复请求直接返回已有产物；
+/// 多个相同请求并发到达时只构建一次，其余请求等待同一结果。
+/// @param log_dir 日志源目录
+/// @param req 打包请求
+/// 不限时间范围的请求只打包设备高水位之后的新增内容（除非请求 full=1）。
+/// 成功返回的产物被钉住，调用 lucpd_cache_release 之前清理线程不会删除它
+/// （期间过期或超出配额的产物在释放后才删除）。
+/// @param result 成功时输出产物文件名（相对tmp_dir），失败时输出原因
+/// @param ticket 成功时输出产物键和待确认的高水位
+/// @return LUCP_STAT_SUCCESS 或 LUCP_STAT_ARCHIVE_FAILED
+int lucpd_cache_get(const char* log_dir,
+                    const LucpdArchiveRequest_t* req,
+                    char* result,
+                    size_t result_len,
+                    LucpdCacheTicket_t* ticket);
+
+/// @brief 释放 lucpd_cache_get 钉住的产物（设备下载结束或会话关闭时调用），并清空 ticket->entry
+void lucpd_cache_release(LucpdCacheTicket_t* ticket);
+
+#endif // LUCPD_CACHE_H
@@ -1,6 +1,8 @@
 #include "lucpd_cfg.h"
 #include "lucfg.h"
 #include "lucpd_utils.h"
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -9,24 +11,31 @@ static void set_default_config(LucpdConfig_t* config)
 {
     // 网络默认配置
     strncpy(config->network.ip, LUCPD_DEFAULT_IP, sizeof(config->network.ip) - 1);
-    config->network.port            = LUCPD_DEFAULT_PORT;
-    config->network.max_clients     = LUCPD_DEFAULT_MAX_CLIENTS;
-    config->network.recv_timeout_ms = LUCPD_DEFAULT_NW_RECV_TIMEOUT_MS;
-    config->network.send_timeout_ms = LUCPD_DEFAULT_NW_SEND_TIMEOUT_MS;
+    config->network.port                  = LUCPD_DEFAULT_PORT;
+    config->network.max_clients           = LUCPD_DEFAULT_MAX_CLIENTS;
+    config->network.session_mem_budget_mb = LUCPD_DEFAULT_SESSION_MEM_MB;
+    config->network.recv_timeout_ms       = LUCPD_DEFAULT_NW_RECV_TIMEOUT_MS;
+    config->network.send_timeout_ms       = LUCPD_DEFAULT_NW_SEND_TIMEOUT_MS;
 
     // 协议默认配置
     config->protocol.rate_limit_ms      = LUCPD_DEFAULT_RATE_LIMIT_MS;
     config->protocol.session_timeout_ms = LUCPD_DEFAULT_SESSION_TIMEOUT_MS;
+    config->protocol.resume_grace_ms    = LUCPD_DEFAULT_RESUME_GRACE_MS;
     config->protocol.validate_version   = LUCPD_DEFAULT_VALIDATE_VERSION;
     config->protocol.validate_crc16     = LUCPD_DEFAULT_VALIDATE_CRC16;
 
     // 日志默认配置
     strncpy(config->logging.log_level, "DEBUG", sizeof(config->logging.log_level) - 1);
-    config->logging.log_file[0] = '\0'; // 默认输出到stdout
+    config->logging.log_file[0]     = '\0'; // 默认输出到stdout
+    config->logging.capture_file[0] = '\0'; // 默认不抓包
 
     // 文件默认配置
-    strncpy(config->file.tmp_dir, "/tmp/lucp", sizeof(config->file.tmp_dir) - 1);
-    config->file.file_retention_min = 30;
+    strncpy(config->file.tmp_dir, LUCPD_DEFAULT_TMP_DIR, sizeof(config->file.tmp_dir) - 1);
+    strncpy(config->file.log_dir, LUCPD_DEFAULT_LOG_DIR, sizeof(config->file.log_dir) - 1);
+    config->file.file_retention_min = LUCPD_DEFAULT_RETENTION_MIN;
+    config->file.cache_quota_mb     = LUCPD_DEFAULT_CACHE_QUOTA_MB;
+    config->file.compress_level     = LUCPD_DEFAULT_COMPRESS_LEVEL;
+    config->file.compress_threads   = LUCPD_DEFAULT_COMPRESS_THREADS;
 }
 
 // 加载配置文件
@@ -66,7 +75,7 @@ int lucpd_cfg_load_with_file(LucpdConfig_t* cfg, const char* config_file)
     int32_t max_clients;
     if (lucfg_get_int32(lucfg, "network", "max_clients", &max_clients) == LUCFG_OK)
     {
-        if (max_clients > 0 && max_clients <= 100)
+        if (max_clients > 0 && max_clients <= 1024)
         { // 限制合理范围
             cfg->network.max_clients = max_clients;
         }
@@ -76,6 +85,19 @@ int lucpd_cfg_load_with_file(LucpdConfig_t* cfg, const char* config_file)
         }
     }
 
+    int32_t session_mem;
+    if (lucfg_get_int32(lucfg, "network", "session_mem_budget_mb", &session_mem) == LUCFG_OK)
+    {
+        if (session_mem >= 1 && session_mem <= 65536)
+        {
+            cfg->network.session_mem_budget_mb = session_mem;
+        }
+        else
+        {
+            log_warn("Invalid network->session_mem_budget_mb: %d", session_mem);
+        }
+    }
+
     int32_t recv_timeout;
     if (lucfg_get_int32(lucfg, "network", "recv_timeout_ms", &recv_timeout) == LUCFG_OK)
     {
@@ -128,6 +150,19 @@ int lucpd_cfg_load_with_file(LucpdConfig_t* cfg, const char* config_file)
         }
     }
 
+    int32_t resume_grace;
+    if (lucfg_get_int32(lucfg, "protocol", "resume_grace_ms", &resume_grace) == LUCFG_OK)
+    {
+        if (resume_grace >= 0 && resume_grace <= 3600000)
+        { // 0~1小时
+            cfg->protocol.resume_grace_ms = resume_grace;
+        }
+        else
+        {
+            log_warn("Invalid protocol->resume_grace_ms: %d", resume_grace);
+        }
+    }
+
     int need_validate_version;
     if (lucfg_get_bool(lucfg, "protocol", "validate_version", &need_validate_version) == LUCFG_OK)
     {
@@ -169,6 +204,12 @@ int lucpd_cfg_load_with_file(LucpdConfig_t* cfg, const char* config_file)
         strncpy(cfg->logging.log_file, log_file, sizeof(cfg->logging.log_file) - 1);
     }
 
+    const char* capture_file;
+    if (lucfg_get_string(lucfg, "logging", "capture_file", &capture_file) == LUCFG_OK)
+    {
+        strncpy(cfg->logging.capture_file, capture_file, sizeof(cfg->logging.capture_file) - 1);
+    }
+
     // 读取[file]部分配置
     const char* tmp_dir;
     if (lucfg_get_string(lucfg, "file", "tmp_dir", &tmp_dir) == LUCFG_OK)
@@ -176,6 +217,12 @@ int lucpd_cfg_load_with_file(LucpdConfig_t* cfg, const char* config_file)
         strncpy(cfg->file.tmp_dir, tmp_dir, sizeof(cfg->file.tmp_dir) - 1);
     }
 
+    const char* log_dir;
+    if (lucfg_get_string(lucfg, "file", "log_dir", &log_dir) == LUCFG_OK)
+    {
+        strncpy(cfg->file.log_dir, log_dir, sizeof(cfg->file.log_dir) - 1);
+    }
+
     int32_t retention;
     if (lucfg_get_int32(lucfg, "file", "file_retention_min", &retention) == LUCFG_OK)
     {
@@ -189,18 +236,58 @@ int lucpd_cfg_load_with_file(LucpdConfig_t* cfg, const char* config_file)
         }
     }
 
+    int32_t cache_quota;
+    if (lucfg_get_int32(lucfg, "file", "cache_quota_mb", &cache_quota) == LUCFG_OK)
+    {
+        if (cache_quota >= 16 && cache_quota <= 1048576)
+        { // 16MB~1TB
+            cfg->file.cache_quota_mb = cache_quota;
+        }
+        else
+        {
+            log_warn("Invalid file->cache_quota_mb: %d", cache_quota);
+        }
+    }
+
+    int32_t compress_level;
+    if (lucfg_get_int32(lucfg, "file", "compress_level", &compress_level) == LUCFG_OK)
+    {
+        if (compress_level >= 1 && compress_level <= 9)
+        {
+            cfg->file.compress_level = compress_level;
+        }
+        else
+        {
+            log_warn("Invalid file->compress_level: %d", compress_level);
+        }
+    }
+
+    int32_t compress_threads;
+    if (lucfg_get_int32(lucfg, "file", "compress_threads", &compress_threads) == LUCFG_OK)
+    {
+        if (compress_threads >= 0 && compress_threads <= 64)
+        {
+            cfg->file.compress_threads = compress_threads;
+        }
+        else
+        {
+            log_warn("Invalid file->compress_threads: %d", compress_threads);
+        }
+    }
+
     lucfg_close(lucfg);
     log_debug("Loaded config from %s", config_file);
     return 0;
 }
 
-static void set_file_and_port(LucpdConfig_t* cfg, const char* file, int port, bool hassetc_)
+static int set_file_and_port(LucpdConfig_t* cfg, const char* file, int port, bool hassetc_)
 {
-    lucpd_cfg_load_with_file(cfg, file);
+    int ret = lucpd_cfg_load_with_file(cfg, file);
     if (hassetc_)
     {
         cfg->network.port = port;
     }
+    return ret;
 }
 
 int lucpd_cfg_load_with_entryArgs(LucpdConfig_t* cfg, int argc, char* argv[])
@@ -263,6 +350,154 @@ int lucpd_cfg_load_with_entryArgs(LucpdConfig_t* cfg, int argc, char* argv[])
         }
     }
 
-    set_file_and_port(cfg, cfgpath, port, hassetc);
-    return 0;
+    return set_file_and_port(cfg, cfgpath, port, hassetc);
+}
+
+// ================================ 配置快照 ===========================
+
+// 读者记录，线程首次读取配置时分配，线程退出后留给新线程复用
+typedef struct CfgReader
+{
+    _Atomic uint64_t epoch; // 进入读区间时的全局纪元，0表示不在读区间
+    atomic_bool in_use;
+    int depth;              // 嵌套层数，仅所属线程访问
+    struct CfgReader* next;
+} CfgReader_t;
+
+// 已被替换、等待回收的快照
+typedef struct CfgRetired
+{
+    LucpdConfig_t* cfg;
+    uint64_t epoch; // 替换时的纪元，纪元不大于它的读者可能仍在引用
+    struct CfgRetired* next;
+} CfgRetired_t;
+
+static _Atomic(LucpdConfig_t*) g_cfg_current;
+static _Atomic uint64_t g_cfg_epoch = 1;
+static _Atomic(CfgReader_t*) g_cfg_readers;
+static pthread_mutex_t g_cfg_publish_lock = PTHREAD_MUTEX_INITIALIZER;
+static CfgRetired_t* g_cfg_retired;
+static pthread_key_t g_cfg_key;
+static pthread_once_t g_cfg_once = PTHREAD_ONCE_INIT;
+static __thread CfgReader_t* t_cfg_reader;
+
+static void cfg_reader_release(void* arg)
+{
+    CfgReader_t* r = (CfgReader_t*) arg;
+    r->depth       = 0;
+    atomic_store(&r->epoch, 0);
+    atomic_store(&r->in_use, false);
+}
+
+static void cfg_key_init(void) { pthread_key_create(&g_cfg_key, cfg_reader_release); }
+
+static CfgReader_t* cfg_reader_self(void)
+{
+    if (t_cfg_reader)
+        return t_cfg_reader;
+    pthread_once(&g_cfg_once, cfg_key_init);
+
+    CfgReader_t* r;
+    for (r = atomic_load(&g_cfg_readers); r; r = r->next)
+    {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&r->in_use, &expected, true))
+            break;
+    }
+    if (!r)
+    {
+        r = calloc(1, sizeof(CfgReader_t));
+        if (!r)
+            return NULL;
+        atomic_store(&r->in_use, true);
+        CfgReader_t* head = atomic_load(&g_cfg_readers);
+        do
+        {
+            r->next = head;
+        } while (!atomic_compare_exchange_weak(&g_cfg_readers, &head, r));
+    }
+    pthread_setspecific(g_cfg_key, r);
+    t_cfg_reader = r;
+    return r;
+}
+
+const LucpdConfig_t* lucpd_cfg_enter(void)
+{
+    CfgReader_t* r = cfg_reader_self();
+    // 先登记纪元再读取指针：发布者在登记之后替换的快照不会被本读者看到之前释放
+    if (r && r->depth++ == 0)
+        atomic_store(&r->epoch, atomic_load(&g_cfg_epoch));
+    return atomic_load(&g_cfg_current);
+}
+
+void lucpd_cfg_exit(void)
+{
+    CfgReader_t* r = t_cfg_reader;
+    if (r && --r->depth == 0)
+        atomic_store_explicit(&r->epoch, 0, memory_order_release);
+}
+
+// 释放所有读者都已离开其纪元的旧快照
+static void cfg_reclaim(void)
+{
+    uint64_t min = UINT64_MAX;
+    for (CfgReader_t* r = atomic_load(&g_cfg_readers); r; r = r->next)
+    {
+        uint64_t e = atomic_load(&r->epoch);
+        if (e != 0 && e < min)
+            min = e;
+    }
+    CfgRetired_t** pp = &g_cfg_retired;
+    while (*pp)
+    {
+        CfgRetired_t* t = *pp;
+        if (t->epoch < min)
+        {
+            *pp = t->next;
+            free(t->cfg);
+            free(t);
+        }
+        else
+        {
+            pp = &t->next;
+        }
+    }
+}
+
+void lucpd_cfg_publish(LucpdConfig_t* cfg)
+{
+    pthread_mutex_lock(&g_cfg_publish_lock);
+    LucpdConfig_t* old = atomic_exchange(&g_cfg_current, cfg);
+    uint64_t epoch     = atomic_fetch_add(&g_cfg_epoch, 1);
+    if (old)
+    {
+        CfgRetired_t* t = malloc(sizeof(CfgRetired_t));
+        if (t)
+        {
+            t->cfg        = old;
+            t->epoch      = epoch;
+            t->next       = g_cfg_retired;
+            g_cfg_retired = t;
+        }
+        else
+        {
+            log_warn("Out of memory, leaking replaced config snapshot");
+        }
+    }
+    cfg_reclaim();
+    pthread_mutex_unlock(&g_cfg_publish_lock);
+}
+
+void lucpd_cfg_cleanup(void)
+{
+    pthread_mutex_lock(&g_cfg_publish_lock);
+    while (g_cfg_retired)
+    {
+        CfgRetired_t* t = g_cfg_retired;
+        g_cfg_retired   = t->next;
+        free(t->cfg);
+        free(t);
+    }
+    free(atomic_exchange(&g_cfg_current, NULL));
+    pthread_mutex_unlock(&g_cfg_publish_lock);
 }
\ No newline at end of file
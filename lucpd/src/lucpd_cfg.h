@@ -9,12 +9,20 @@
 #define LUCPD_DEFAULT_IP                 "127.0.0.1"
 #define LUCPD_DEFAULT_VERSION            0x10 // 1.0 版本 (高4位主版本，低4位次版本)
 #define LUCPD_DEFAULT_MAX_CLIENTS        10
+#define LUCPD_DEFAULT_SESSION_MEM_MB     64
 #define LUCPD_DEFAULT_NW_RECV_TIMEOUT_MS 1000
 #define LUCPD_DEFAULT_NW_SEND_TIMEOUT_MS 1000
 #define LUCPD_DEFAULT_RATE_LIMIT_MS      3000
 #define LUCPD_DEFAULT_SESSION_TIMEOUT_MS 2000
+#define LUCPD_DEFAULT_RESUME_GRACE_MS    60000
 #define LUCPD_DEFAULT_VALIDATE_VERSION   1
 #define LUCPD_DEFAULT_VALIDATE_CRC16     1
+#define LUCPD_DEFAULT_TMP_DIR            "/tmp/lucp"
+#define LUCPD_DEFAULT_LOG_DIR            "/var/log/lucp"
+#define LUCPD_DEFAULT_RETENTION_MIN      30
+#define LUCPD_DEFAULT_CACHE_QUOTA_MB     1024
+#define LUCPD_DEFAULT_COMPRESS_LEVEL     6
+#define LUCPD_DEFAULT_COMPRESS_THREADS   0
 
 #define LUCPD_DEFAULT_CFG_FILE "/etc/lucpd.conf"
 
@@ -24,18 +32,20 @@ typedef struct
     // 网络相关配置
     struct
     {
-        char ip[64];         // 绑定的IP地址，默认"0.0.0.0"
-        uint16_t port;       // 监听端口，默认32100
-        int max_clients;     // 最大客户端连接数，默认10
-        int recv_timeout_ms; // 接收超时(毫秒)，默认1000
-        int send_timeout_ms; // 发送超时(毫秒)，默认1000
+        char ip[64];               // 绑定的IP地址，默认"0.0.0.0"
+        uint16_t port;             // 监听端口，默认32100
+        int max_clients;           // 同时处理请求的会话线程数（挂起等待FTP结果的会话不计入），默认10
+        int session_mem_budget_mb; // 全部会话(含活跃会话线程栈)的内存预算(MB)，默认64
+        int recv_timeout_ms;       // 接收超时(毫秒)，默认1000
+        int send_timeout_ms;       // 发送超时(毫秒)，默认1000
     } network;
 
     // 协议相关配置
     struct
     {
-        int rate_limit_ms;      // 频率限制(秒)，默认3
+        int rate_limit_ms;      // 频率限制(毫秒)，默认3000；只做解析，尚未生效
         int session_timeout_ms; // 会话超时(秒)，默认2
+        int resume_grace_ms;    // 断线后保留会话等待重连的时间(毫秒)，0表示不支持续传，默认60000
         bool validate_version;  // 是否校验版本号
         bool validate_crc16;    // 是否校验crc16
     } protocol;
@@ -43,22 +53,46 @@ typedef struct
     // 日志相关配置
     struct
     {
-        char log_level[16]; // 日志级别(DEBUG/INFO/WARN/ERROR)，默认"DEBUG"
-        char log_file[256]; // 日志文件路径，默认stdout
+        char log_level[16];     // 日志级别(DEBUG/INFO/WARN/ERROR)，默认"DEBUG"
+        char log_file[256];     // 日志文件路径，默认stdout
+        char capture_file[256]; // LUCP抓包文件路径，为空时不抓包
     } logging;
 
     // 文件相关配置
     struct
     {
-        char tmp_dir[256];      // 临时文件目录，默认"/var/lucp/tmp"
+        char tmp_dir[256];      // 临时文件目录，默认"/tmp/lucp"
+        char log_dir[256];      // 日志源目录，每个设备一个子目录，默认"/var/log/lucp"
         int file_retention_min; // 文件保留时间(分钟)，默认30
+        int cache_quota_mb;     // tmp_dir中日志包占用磁盘上限(MB)，默认1024
+        int compress_level;     // 日志包gzip压缩级别(1~9)，默认6
+        int compress_threads;   // 压缩线程数，0按CPU数，1在会话线程中压缩，默认0
     } file;
 } LucpdConfig_t;
 
 // 从配置文件加载配置文件
 int lucpd_cfg_load_with_file(LucpdConfig_t* cfg, const char* config_file);
 
-// 直接从函数入口参数加载配置
+// 直接从函数入口参数加载配置，参数错误或配置文件无法打开时返回-1（cfg仍为可用的缺省配置）
 int lucpd_cfg_load_with_entryArgs(LucpdConfig_t* cfg, int argc, char* argv[]);
 
+// ================================ 配置快照 ===========================
+//
+// 运行中的配置以不可变快照发布：读者不加锁，重新加载时整体替换指针，
+// 旧快照在所有可能引用它的读者离开读区间后释放（基于纪元的延迟回收）。
+
+/// @brief 发布新的配置快照
+/// @param cfg 由malloc分配的配置，发布后所有权归快照管理，不得再修改
+void lucpd_cfg_publish(LucpdConfig_t* cfg);
+
+/// @brief 进入读区间并返回当前快照，离开读区间前快照保持有效
+/// 可嵌套调用，每次调用须与 lucpd_cfg_exit 配对；读区间内不应长时间阻塞
+const LucpdConfig_t* lucpd_cfg_enter(void);
+
+/// @brief 离开读区间
+void lucpd_cfg_exit(void);
+
+/// @brief 释放全部快照，仅在没有读者的退出阶段调用
+void lucpd_cfg_cleanup(void);
+
 #endif // CONFIG_H
\ No newline at end of file
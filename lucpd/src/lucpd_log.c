@@ -0,0 +1,450 @@
+#include "lucpd_log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+// 单次writev最多携带的日志行数
+#define LUCPD_LOG_BATCH 256
+// 环形缓冲区满时，生产线程让出CPU的最大次数，超过后丢弃该条日志
+#define LUCPD_LOG_FULL_SPINS 8
+
+#define LUCPD_LOG_CACHELINE 64
+
+// 每个线程独占的单生产者/单消费者环形缓冲区
+typedef struct LucpdLogRing
+{
+    _Alignas(LUCPD_LOG_CACHELINE) _Atomic uint32_t tail; // 生产线程写入位置
+    _Alignas(LUCPD_LOG_CACHELINE) _Atomic uint32_t head; // 写线程消费位置
+    atomic_bool orphaned;                                  // 所属线程已退出
+    struct LucpdLogRing* next;
+    uint16_t len[LUCPD_LOG_RING_SLOTS];
+    uint8_t to_err[LUCPD_LOG_RING_SLOTS]; // 未配置日志文件时，ERROR/WARN 写到stderr
+    char line[LUCPD_LOG_RING_SLOTS][LUCPD_LOG_LINE_MAX];
+} LucpdLogRing_t;
+
+static const char* const g_level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+static atomic_int g_min_level = LUCP_LOG_DEBUG;
+static atomic_bool g_async    = false;
+static atomic_ulong g_dropped = 0;
+static _Atomic(LucpdLogRing_t*) g_rings = NULL;
+
+static int g_out_fd  = STDOUT_FILENO;
+static int g_err_fd  = STDERR_FILENO;
+static int g_file_fd = -1;
+static int g_wake_fd = -1;
+static pthread_t g_writer;
+
+static pthread_key_t g_ring_key;
+static pthread_once_t g_ring_key_once = PTHREAD_ONCE_INIT;
+static __thread LucpdLogRing_t* tl_ring;
+// 线程退出时环形缓冲区已交给写线程回收，此后该线程的日志改为同步写
+static __thread bool tl_ring_gone;
+
+// 线程本地的时间戳缓存，每秒最多格式化一次
+static __thread time_t tl_ts_sec = (time_t) -1;
+static __thread char tl_ts_str[20];
+
+static const char* cached_timestamp(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    if (ts.tv_sec != tl_ts_sec)
+    {
+        struct tm tm_info;
+        localtime_r(&ts.tv_sec, &tm_info);
+        strftime(tl_ts_str, sizeof(tl_ts_str), "%Y-%m-%d %H:%M:%S", &tm_info);
+        tl_ts_sec = ts.tv_sec;
+    }
+    return tl_ts_str;
+}
+
+static int parse_level(const char* level)
+{
+    if (level)
+    {
+        for (int i = LUCP_LOG_DEBUG; i <= LUCP_LOG_ERROR; i++)
+        {
+            if (strcasecmp(level, g_level_names[i]) == 0)
+                return i;
+        }
+    }
+    return -1;
+}
+
+// 按统一格式生成一行日志，保证以'\n'结尾，返回长度
+static size_t format_line(char* buf,
+                          LucpLogLevel level,
+                          const char* prefix,
+                          const char* format,
+                          va_list args)
+{
+    const size_t cap = LUCPD_LOG_LINE_MAX - 1; // 预留'\n'
+    int n            = snprintf(buf,
+                     cap,
+                     "[%s] %s: %s%s",
+                     cached_timestamp(),
+                     g_level_names[level],
+                     prefix ? prefix : "",
+                     prefix ? " " : "");
+    size_t len       = (n < 0) ? 0 : ((size_t) n >= cap ? cap - 1 : (size_t) n);
+    n                = vsnprintf(buf + len, cap - len, format, args);
+    if (n > 0)
+        len += ((size_t) n >= cap - len) ? cap - len - 1 : (size_t) n;
+    buf[len++] = '\n';
+    return len;
+}
+
+static void wake_writer(void)
+{
+    uint64_t one = 1;
+    if (g_wake_fd >= 0)
+    {
+        ssize_t r = write(g_wake_fd, &one, sizeof(one));
+        (void) r;
+    }
+}
+
+static void ring_destructor(void* arg)
+{
+    LucpdLogRing_t* ring = (LucpdLogRing_t*) arg;
+    // 写线程排空后释放孤立的缓冲区，之后运行的 TLS 析构函数若再打日志不能再写入它
+    tl_ring      = NULL;
+    tl_ring_gone = true;
+    atomic_store_explicit(&ring->orphaned, true, memory_order_release);
+}
+
+static void ring_key_create(void) { pthread_key_create(&g_ring_key, ring_destructor); }
+
+// 获取（必要时创建并登记）当前线程的环形缓冲区
+static LucpdLogRing_t* thread_ring(void)
+{
+    if (tl_ring || tl_ring_gone)
+        return tl_ring;
+
+    size_t sz = (sizeof(LucpdLogRing_t) + LUCPD_LOG_CACHELINE - 1) & ~(size_t) (LUCPD_LOG_CACHELINE - 1);
+    LucpdLogRing_t* ring = aligned_alloc(LUCPD_LOG_CACHELINE, sz);
+    if (!ring)
+        return NULL;
+    memset(ring, 0, sizeof(*ring));
+
+    pthread_once(&g_ring_key_once, ring_key_create);
+    pthread_setspecific(g_ring_key, ring);
+
+    LucpdLogRing_t* old = atomic_load_explicit(&g_rings, memory_order_relaxed);
+    do
+    {
+        ring->next = old;
+    } while (!atomic_compare_exchange_weak_explicit(
+        &g_rings, &old, ring, memory_order_release, memory_order_relaxed));
+
+    tl_ring = ring;
+    return ring;
+}
+
+// 同步输出，仅在后端未启动或已停止时使用
+static void write_sync(LucpLogLevel level, const char* prefix, const char* format, va_list args)
+{
+    char buf[LUCPD_LOG_LINE_MAX];
+    size_t len = format_line(buf, level, prefix, format, args);
+    int fd     = (level >= LUCP_LOG_WARN) ? g_err_fd : g_out_fd;
+    ssize_t r  = write(fd, buf, len);
+    (void) r;
+}
+
+bool lucpd_log_enabled(LucpLogLevel level)
+{
+    return (int) level >= atomic_load_explicit(&g_min_level, memory_order_relaxed);
+}
+
+int lucpd_log_set_level(const char* level)
+{
+    int lvl = parse_level(level);
+    if (lvl < 0)
+        return -1;
+    atomic_store(&g_min_level, lvl);
+    return 0;
+}
+
+LucpLogLevel lucpd_log_level(void)
+{
+    return (LucpLogLevel) atomic_load_explicit(&g_min_level, memory_order_relaxed);
+}
+
+void lucpd_log_vwrite(LucpLogLevel level, const char* prefix, const char* format, va_list args)
+{
+    if ((int) level < LUCP_LOG_DEBUG || (int) level > LUCP_LOG_ERROR || !lucpd_log_enabled(level))
+        return;
+
+    LucpdLogRing_t* ring = atomic_load_explicit(&g_async, memory_order_acquire) ? thread_ring() : NULL;
+    if (!ring)
+    {
+        write_sync(level, prefix, format, args);
+        return;
+    }
+
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    for (int spins = 0; tail - head >= LUCPD_LOG_RING_SLOTS; spins++)
+    {
+        if (spins >= LUCPD_LOG_FULL_SPINS)
+        {
+            atomic_fetch_add_explicit(&g_dropped, 1, memory_order_relaxed);
+            return;
+        }
+        if (spins == 0)
+            wake_writer();
+        sched_yield();
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    }
+
+    uint32_t slot      = tail & (LUCPD_LOG_RING_SLOTS - 1);
+    ring->len[slot]    = (uint16_t) format_line(ring->line[slot], level, prefix, format, args);
+    ring->to_err[slot] = level >= LUCP_LOG_WARN;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+    // 缓冲区过半时立即唤醒写线程，否则由写线程定时批量收集
+    if (tail + 1 - head == LUCPD_LOG_RING_SLOTS / 2)
+        wake_writer();
+}
+
+static void log_self(LucpLogLevel level, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    lucpd_log_vwrite(level, NULL, format, args);
+    va_end(args);
+}
+
+unsigned long lucpd_log_dropped(void) { return atomic_load(&g_dropped); }
+
+// ================================ 写线程 ===========================
+
+typedef struct
+{
+    struct iovec iov[LUCPD_LOG_BATCH];
+    int iovcnt;
+    int fd;
+    LucpdLogRing_t* ring[LUCPD_LOG_BATCH];
+    uint32_t head[LUCPD_LOG_BATCH];
+    int nring;
+} LucpdLogBatch_t;
+
+static void writev_full(int fd, struct iovec* iov, int iovcnt)
+{
+    while (iovcnt > 0)
+    {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return; // 输出端异常，放弃本批
+        }
+        while (iovcnt > 0 && (size_t) n >= iov->iov_len)
+        {
+            n -= (ssize_t) iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char*) iov->iov_base + n;
+            iov->iov_len -= (size_t) n;
+        }
+    }
+}
+
+// 写出当前批次，然后归还各环形缓冲区的槽位
+static void batch_flush(LucpdLogBatch_t* b)
+{
+    if (b->iovcnt > 0)
+        writev_full(b->fd, b->iov, b->iovcnt);
+    for (int i = 0; i < b->nring; i++)
+        atomic_store_explicit(&b->ring[i]->head, b->head[i], memory_order_release);
+    b->iovcnt = 0;
+    b->nring  = 0;
+}
+
+static void batch_add(LucpdLogBatch_t* b, LucpdLogRing_t* ring, uint32_t pos, int fd)
+{
+    if (b->iovcnt == LUCPD_LOG_BATCH || (b->iovcnt > 0 && b->fd != fd))
+        batch_flush(b);
+
+    uint32_t slot              = pos & (LUCPD_LOG_RING_SLOTS - 1);
+    b->fd                      = fd;
+    b->iov[b->iovcnt].iov_base = ring->line[slot];
+    b->iov[b->iovcnt].iov_len  = ring->len[slot];
+    b->iovcnt++;
+
+    if (b->nring > 0 && b->ring[b->nring - 1] == ring)
+    {
+        b->head[b->nring - 1] = pos + 1;
+    }
+    else
+    {
+        b->ring[b->nring] = ring;
+        b->head[b->nring] = pos + 1;
+        b->nring++;
+    }
+}
+
+// 从链表中摘除已退出线程的空缓冲区，只有写线程会修改next指针
+static void unlink_ring(LucpdLogRing_t* prev, LucpdLogRing_t* ring)
+{
+    if (prev)
+    {
+        prev->next = ring->next;
+        return;
+    }
+    LucpdLogRing_t* expected = ring;
+    if (atomic_compare_exchange_strong(&g_rings, &expected, ring->next))
+        return;
+    // 有新线程插入到了表头，从新表头开始查找前驱
+    for (LucpdLogRing_t* p = expected; p; p = p->next)
+    {
+        if (p->next == ring)
+        {
+            p->next = ring->next;
+            return;
+        }
+    }
+}
+
+static size_t drain_rings(LucpdLogBatch_t* b)
+{
+    size_t lines         = 0;
+    LucpdLogRing_t* prev = NULL;
+    LucpdLogRing_t* ring = atomic_load_explicit(&g_rings, memory_order_acquire);
+    while (ring)
+    {
+        LucpdLogRing_t* next = ring->next;
+        bool orphaned        = atomic_load_explicit(&ring->orphaned, memory_order_acquire);
+        uint32_t head        = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        uint32_t tail        = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        for (uint32_t pos = head; pos != tail; pos++)
+        {
+            uint32_t slot = pos & (LUCPD_LOG_RING_SLOTS - 1);
+            batch_add(b, ring, pos, ring->to_err[slot] ? g_err_fd : g_out_fd);
+            lines++;
+        }
+        if (orphaned && head == tail)
+        {
+            unlink_ring(prev, ring);
+            free(ring);
+        }
+        else
+        {
+            prev = ring;
+        }
+        ring = next;
+    }
+    batch_flush(b);
+    return lines;
+}
+
+static void report_dropped(unsigned long* reported)
+{
+    unsigned long dropped = atomic_load(&g_dropped);
+    if (dropped == *reported)
+        return;
+    char buf[128];
+    int n = snprintf(buf,
+                     sizeof(buf),
+                     "[%s] WARN: %lu log lines dropped (thread buffer full)\n",
+                     cached_timestamp(),
+                     dropped - *reported);
+    ssize_t r = write(g_err_fd, buf, (size_t) n);
+    (void) r;
+    *reported = dropped;
+}
+
+static void* log_writer_thread(void* arg)
+{
+    (void) arg;
+    static LucpdLogBatch_t batch;
+    unsigned long reported = 0;
+
+    while (1)
+    {
+        bool running = atomic_load(&g_async);
+        size_t lines = drain_rings(&batch);
+        report_dropped(&reported);
+        if (!running)
+            break;
+        if (lines == 0)
+        {
+            struct pollfd pfd = {.fd = g_wake_fd, .events = POLLIN};
+            if (poll(&pfd, 1, LUCPD_LOG_FLUSH_INTERVAL_MS) > 0)
+            {
+                uint64_t cnt;
+                ssize_t r = read(g_wake_fd, &cnt, sizeof(cnt));
+                (void) r;
+            }
+        }
+    }
+    // 停止后再收集一次，防止遗漏停止前最后写入的日志
+    drain_rings(&batch);
+    return NULL;
+}
+
+int lucpd_log_init(const char* level, const char* file)
+{
+    int lvl = parse_level(level);
+    atomic_store(&g_min_level, lvl < 0 ? LUCP_LOG_DEBUG : lvl);
+
+    if (atomic_load(&g_async))
+        return 0;
+
+    if (file && file[0] != '\0')
+    {
+        g_file_fd = open(file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (g_file_fd < 0)
+        {
+            fprintf(stderr, "Failed to open log file %s: %s, using stdout\n", file, strerror(errno));
+        }
+        else
+        {
+            g_out_fd = g_file_fd;
+            g_err_fd = g_file_fd;
+        }
+    }
+
+    g_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_wake_fd < 0)
+        return -1;
+
+    atomic_store(&g_async, true);
+    if (pthread_create(&g_writer, NULL, log_writer_thread, NULL) != 0)
+    {
+        atomic_store(&g_async, false);
+        close(g_wake_fd);
+        g_wake_fd = -1;
+        return -1;
+    }
+    if (lvl < 0 && level)
+        log_self(LUCP_LOG_WARN, "Invalid logging->log_level %s, using DEBUG", level);
+    return 0;
+}
+
+void lucpd_log_shutdown(void)
+{
+    if (!atomic_exchange(&g_async, false))
+        return;
+    wake_writer();
+    pthread_join(g_writer, NULL);
+    close(g_wake_fd);
+    g_wake_fd = -1;
+}
@@ -0,0 +1,40 @@
+#ifndef LUCPD_LOG_H
+#define LUCPD_LOG_H
+
+#include <lucp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+
+// 每条日志的最大长度（含时间戳与级别前缀），超出部分截断
+#define LUCPD_LOG_LINE_MAX 512
+// 每个线程环形缓冲区的槽位数（必须是2的幂）
+#define LUCPD_LOG_RING_SLOTS 64
+// 写线程空闲时的最长等待时间(毫秒)
+#define LUCPD_LOG_FLUSH_INTERVAL_MS 20
+
+/// @brief 启动异步日志后端
+/// @param level 日志级别字符串(DEBUG/INFO/WARN/ERROR)，无法识别时使用DEBUG
+/// @param file 日志文件路径，为空字符串或NULL时输出到stdout/stderr
+/// @return 成功返回0，失败返回-1（此时继续使用同步输出）
+int lucpd_log_init(const char* level, const char* file);
+
+/// @brief 停止写线程，并在返回前把所有线程缓冲区中的日志写出
+void lucpd_log_shutdown(void);
+
+/// @brief 判断某个级别的日志是否需要输出（在格式化之前调用）
+bool lucpd_log_enabled(LucpLogLevel level);
+
+/// @brief 运行时调整日志级别（配置热加载时调用）
+/// @return 成功返回0，级别无法识别时保持原级别并返回-1
+int lucpd_log_set_level(const char* level);
+
+/// @brief 返回当前生效的最低日志级别
+LucpLogLevel lucpd_log_level(void);
+
+/// @brief 写入一条日志；prefix可为NULL，用于附加"(file:line)"等来源信息
+void lucpd_log_vwrite(LucpLogLevel level, const char* prefix, const char* format, va_list args);
+
+/// @brief 返回因线程缓冲区已满而被丢弃的日志条数
+unsigned long lucpd_log_dropped(void);
+
+#endif // LUCPD_LOG_H
@@ -0,0 +1,389 @@
+#include "lucpd_mark.h"
+#include "lucpd_utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// 单个文件的高水位
+typedef struct
+{
+    uint64_t ino;
+    uint64_t gen;
+    uint64_t offset;
+    uint64_t fp; // 偏移之前最多 LUCPD_MARK_FP_BYTES 字节内容的哈希，0表示未知
+} MarkFile_t;
+
+// 已交给设备、等待确认的高水位
+typedef struct
+{
+    uint64_t base;    // 打包所基于的高水位版本，0表示全量
+    uint64_t version; // 确认后的高水位版本
+    MarkFile_t* files;
+    int count;
+} MarkPending_t;
+
+typedef struct MarkDevice
+{
+    struct MarkDevice* next;
+    char device[LUCPD_DEVICE_ID_MAX];
+    uint64_t version;   // 已确认高水位的版本，0表示没有
+    MarkFile_t* files;  // 按(ino, gen)排序
+    int count;
+    MarkPending_t pending[LUCPD_MARK_MAX_PENDING];
+    int pending_next;   // 待确认槽位已满时下一个被替换的槽位
+} MarkDevice_t;
+
+static struct
+{
+    pthread_mutex_t lock;
+    int dir_fd;
+    MarkDevice_t* buckets[LUCPD_MARK_BUCKETS];
+    uint64_t applied, committed, superseded;
+} g_mark = {.lock = PTHREAD_MUTEX_INITIALIZER, .dir_fd = -1};
+
+static int compare_mark_file(const void* a, const void* b)
+{
+    const MarkFile_t* x = a;
+    const MarkFile_t* y = b;
+    if (x->ino != y->ino)
+        return x->ino < y->ino ? -1 : 1;
+    if (x->gen != y->gen)
+        return x->gen < y->gen ? -1 : 1;
+    return 0;
+}
+
+// ================================ 持久化 ===========================
+
+// 文件格式：首行 "version <16进制>"，之后每行 "<inode> <代数> <偏移> <指纹16进制>"。
+// 旧格式的行没有指纹，按未知处理
+static void mark_load(MarkDevice_t* dev)
+{
+    if (g_mark.dir_fd < 0)
+        return;
+    int fd = openat(g_mark.dir_fd, dev->device, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    FILE* fp = fdopen(fd, "r");
+    if (!fp)
+    {
+        close(fd);
+        return;
+    }
+
+    unsigned long long version;
+    int cap = 0;
+    if (fscanf(fp, "version %llx", &version) == 1)
+    {
+        unsigned long long ino, gen, offset, fpr;
+        char line[128];
+        while (fgets(line, sizeof(line), fp))
+        {
+            int n = sscanf(line, "%llu %llu %llu %llx", &ino, &gen, &offset, &fpr);
+            if (n < 3)
+                continue;
+            if (n == 3)
+                fpr = 0;
+            if (dev->count == cap)
+            {
+                cap           = cap ? cap * 2 : 32;
+                MarkFile_t* p = realloc(dev->files, cap * sizeof(MarkFile_t));
+                if (!p)
+                    break;
+                dev->files = p;
+            }
+            dev->files[dev->count++] =
+                (MarkFile_t){.ino = ino, .gen = gen, .offset = offset, .fp = fpr};
+        }
+        dev->version = version;
+        qsort(dev->files, dev->count, sizeof(MarkFile_t), compare_mark_file);
+        log_debug("Mark: loaded %s (version %016llx, %d files)", dev->device, version, dev->count);
+    }
+    fclose(fp);
+}
+
+// 先写临时文件再重命名，进程崩溃时保留上一次的高水位
+static void mark_save(const MarkDevice_t* dev)
+{
+    if (g_mark.dir_fd < 0)
+        return;
+    char tmp[LUCPD_DEVICE_ID_MAX + 8];
+    // 设备标识不以'.'开头，临时文件名不会与其他设备冲突
+    snprintf(tmp, sizeof(tmp), ".%s.tmp", dev->device);
+    int fd = openat(g_mark.dir_fd, tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        log_warn("Mark: failed to save %s: %s", dev->device, strerror(errno));
+        return;
+    }
+    FILE* fp = fdopen(fd, "w");
+    if (!fp)
+    {
+        close(fd);
+        unlinkat(g_mark.dir_fd, tmp, 0);
+        return;
+    }
+    fprintf(fp, "version %016llx\n", (unsigned long long) dev->version);
+    for (int i = 0; i < dev->count; i++)
+    {
+        fprintf(fp,
+                "%llu %llu %llu %016llx\n",
+                (unsigned long long) dev->files[i].ino,
+                (unsigned long long) dev->files[i].gen,
+                (unsigned long long) dev->files[i].offset,
+                (unsigned long long) dev->files[i].fp);
+    }
+    int rc = fflush(fp) == 0 && fsync(fd) == 0 ? 0 : -1;
+    if (fclose(fp) != 0)
+        rc = -1;
+    if (rc != 0 || renameat(g_mark.dir_fd, tmp, g_mark.dir_fd, dev->device) != 0)
+    {
+        log_warn("Mark: failed to save %s: %s", dev->device, strerror(errno));
+        unlinkat(g_mark.dir_fd, tmp, 0);
+    }
+}
+
+// ================================ 内容指纹 ===========================
+
+// 文件 [offset - LUCPD_MARK_FP_BYTES, offset) 内容的哈希，读取失败返回0。
+// copytruncate 轮转后 inode 和代数不变，文件清空后重新写到超过旧偏移时只比较偏移发现不了，
+// 要核对偏移之前的内容是否还是上传过的那些字节
+static uint64_t mark_fingerprint(int dir_fd, const char* name, uint64_t offset)
+{
+    if (dir_fd < 0 || offset == 0)
+        return 0;
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0)
+        return 0;
+    char buf[LUCPD_MARK_FP_BYTES];
+    size_t len = offset < sizeof(buf) ? (size_t) offset : sizeof(buf);
+    ssize_t n  = pread(fd, buf, len, (off_t) (offset - len));
+    close(fd);
+    if (n != (ssize_t) len)
+        return 0;
+    uint64_t h = lucpd_hash64(LUCPD_HASH64_INIT, buf, len);
+    return h ? h : 1;
+}
+
+// ================================ 设备索引 ===========================
+
+static MarkDevice_t** bucket_of(const char* device)
+{
+    uint64_t h = lucpd_hash64(LUCPD_HASH64_INIT, device, strlen(device));
+    return &g_mark.buckets[h & (LUCPD_MARK_BUCKETS - 1)];
+}
+
+// 查找设备，不存在时创建并从磁盘加载，调用方持有锁
+static MarkDevice_t* device_get(const char* device)
+{
+    MarkDevice_t** bucket = bucket_of(device);
+    for (MarkDevice_t* dev = *bucket; dev; dev = dev->next)
+    {
+        if (strcmp(dev->device, device) == 0)
+            return dev;
+    }
+    MarkDevice_t* dev = calloc(1, sizeof(MarkDevice_t));
+    if (!dev)
+        return NULL;
+    snprintf(dev->device, sizeof(dev->device), "%s", device);
+    mark_load(dev);
+    dev->next = *bucket;
+    *bucket   = dev;
+    return dev;
+}
+
+static void pending_clear(MarkPending_t* p)
+{
+    free(p->files);
+    memset(p, 0, sizeof(*p));
+}
+
+// ================================ 对外接口 ===========================
+
+int lucpd_mark_init(const char* tmp_dir)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", tmp_dir, LUCPD_MARK_DIR);
+    if (mkdir(path, 0755) != 0 && errno != EEXIST)
+    {
+        log_error("Mark: failed to create %s: %s", path, strerror(errno));
+        return -1;
+    }
+    g_mark.dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (g_mark.dir_fd < 0)
+    {
+        log_error("Mark: failed to open %s: %s", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+void lucpd_mark_shutdown(void)
+{
+    pthread_mutex_lock(&g_mark.lock);
+    log_debug("Mark: applied=%llu committed=%llu superseded=%llu",
+              (unsigned long long) g_mark.applied,
+              (unsigned long long) g_mark.committed,
+              (unsigned long long) g_mark.superseded);
+    for (int i = 0; i < LUCPD_MARK_BUCKETS; i++)
+    {
+        while (g_mark.buckets[i])
+        {
+            MarkDevice_t* dev = g_mark.buckets[i];
+            g_mark.buckets[i] = dev->next;
+            for (int j = 0; j < LUCPD_MARK_MAX_PENDING; j++)
+                pending_clear(&dev->pending[j]);
+            free(dev->files);
+            free(dev);
+        }
+    }
+    if (g_mark.dir_fd >= 0)
+        close(g_mark.dir_fd);
+    g_mark.dir_fd = -1;
+    pthread_mutex_unlock(&g_mark.lock);
+}
+
+uint64_t lucpd_mark_apply(const char* device, LucpdLogSet_t* set)
+{
+    uint64_t* fps = malloc((set->count > 0 ? set->count : 1) * sizeof(uint64_t));
+    if (!fps)
+        return 0;
+    pthread_mutex_lock(&g_mark.lock);
+    MarkDevice_t* dev = device_get(device);
+    if (!dev || dev->version == 0)
+    {
+        pthread_mutex_unlock(&g_mark.lock);
+        free(fps);
+        return 0;
+    }
+    for (int i = 0; i < set->count; i++)
+    {
+        LucpdLogFile_t* f = &set->files[i];
+        MarkFile_t key    = {.ino = f->ino, .gen = f->gen};
+        MarkFile_t* m =
+            bsearch(&key, dev->files, dev->count, sizeof(MarkFile_t), compare_mark_file);
+        // 文件变短说明被截断后重新写入，从头打包
+        f->offset = (m && m->offset <= f->size) ? m->offset : 0;
+        fps[i]    = m ? m->fp : 0;
+    }
+    set->base_mark = dev->version;
+    g_mark.applied++;
+    pthread_mutex_unlock(&g_mark.lock);
+
+    // 读文件核对指纹放在锁外。截断后又写到超过旧偏移的文件内容已不同，从头打包
+    int dir_fd       = open(set->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    set->total_bytes = 0;
+    for (int i = 0; i < set->count; i++)
+    {
+        LucpdLogFile_t* f = &set->files[i];
+        if (f->offset > 0 &&
+            (fps[i] == 0 || mark_fingerprint(dir_fd, f->name, f->offset) != fps[i]))
+        {
+            log_debug("Mark: %s/%s changed before offset %llu, sending from start",
+                      device,
+                      f->name,
+                      (unsigned long long) f->offset);
+            f->offset = 0;
+        }
+        set->total_bytes += f->size - f->offset;
+    }
+    if (dir_fd >= 0)
+        close(dir_fd);
+    free(fps);
+    return set->base_mark;
+}
+
+uint64_t lucpd_mark_stage(const char* device, const LucpdLogSet_t* set)
+{
+    // 指纹在锁外计算，只有真正登记时才用到
+    MarkFile_t* files = malloc((set->count > 0 ? set->count : 1) * sizeof(MarkFile_t));
+    if (!files)
+        return 0;
+    int dir_fd = open(set->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    for (int i = 0; i < set->count; i++)
+    {
+        const LucpdLogFile_t* f = &set->files[i];
+        files[i]                = (MarkFile_t){.ino = f->ino, .gen = f->gen, .offset = f->size};
+        files[i].fp             = mark_fingerprint(dir_fd, f->name, f->size);
+    }
+    if (dir_fd >= 0)
+        close(dir_fd);
+    qsort(files, set->count, sizeof(MarkFile_t), compare_mark_file);
+
+    pthread_mutex_lock(&g_mark.lock);
+    MarkDevice_t* dev = device_get(device);
+    if (!dev || dev->version == set->generation)
+    {
+        pthread_mutex_unlock(&g_mark.lock);
+        free(files);
+        return set->generation;
+    }
+    for (int i = 0; i < LUCPD_MARK_MAX_PENDING; i++)
+    {
+        MarkPending_t* p = &dev->pending[i];
+        if (p->files && p->version == set->generation && p->base == set->base_mark)
+        {
+            pthread_mutex_unlock(&g_mark.lock);
+            free(files);
+            return set->generation;
+        }
+    }
+
+    MarkPending_t* p  = &dev->pending[dev->pending_next];
+    dev->pending_next = (dev->pending_next + 1) % LUCPD_MARK_MAX_PENDING;
+    pending_clear(p);
+    p->base    = set->base_mark;
+    p->version = set->generation;
+    p->files   = files;
+    p->count   = set->count;
+    pthread_mutex_unlock(&g_mark.lock);
+    return set->generation;
+}
+
+void lucpd_mark_commit(const char* device, uint64_t mark)
+{
+    pthread_mutex_lock(&g_mark.lock);
+    MarkDevice_t* dev = device_get(device);
+    MarkPending_t* p  = NULL;
+    for (int i = 0; dev && i < LUCPD_MARK_MAX_PENDING; i++)
+    {
+        if (dev->pending[i].files && dev->pending[i].version == mark)
+        {
+            p = &dev->pending[i];
+            break;
+        }
+    }
+    if (!p)
+    {
+        pthread_mutex_unlock(&g_mark.lock);
+        return;
+    }
+
+    // 基于旧高水位的增量包不能覆盖期间已前移的高水位，全量包总是可以
+    if (p->base != 0 && p->base != dev->version)
+    {
+        g_mark.superseded++;
+        log_debug("Mark: %s %016llx superseded by %016llx",
+                  device,
+                  (unsigned long long) mark,
+                  (unsigned long long) dev->version);
+        pending_clear(p);
+        pthread_mutex_unlock(&g_mark.lock);
+        return;
+    }
+
+    free(dev->files);
+    dev->files   = p->files;
+    dev->count   = p->count;
+    dev->version = p->version;
+    p->files     = NULL;
+    pending_clear(p);
+    g_mark.committed++;
+    mark_save(dev);
+    pthread_mutex_unlock(&g_mark.lock);
+    log_debug("Mark: %s advanced to %016llx", device, (unsigned long long) mark);
+}
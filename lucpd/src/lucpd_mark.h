@@ -0,0 +1,46 @@
+#ifndef LUCPD_MARK_H
+#define LUCPD_MARK_H
+
+#include "lucpd_archive.h"
+#include <stdint.h>
+
+// 设备索引的哈希桶数量（必须是2的幂）
+#define LUCPD_MARK_BUCKETS 1024
+// 每个设备最多同时保留的待确认高水位数
+#define LUCPD_MARK_MAX_PENDING 4
+// 每个文件的高水位附带偏移之前这么多字节内容的指纹
+#define LUCPD_MARK_FP_BYTES 4096
+// 高水位文件所在目录（相对tmp_dir）
+#define LUCPD_MARK_DIR "marks"
+
+// 设备日志上传高水位
+//
+// 对每个设备记录最近一次确认上传成功的日志包覆盖到的位置：每个文件的
+// (inode, 代数, 偏移)。之后的打包请求只打包高水位之后新增的文件和字节。
+// 以 inode+代数 而不是文件名匹配，日志轮转(重命名)后仍能接续；文件被截断时从头打包。
+// copytruncate 轮转会保留 inode 并清空文件，之后文件可能又长过旧偏移，因此高水位还记录
+// 偏移之前一段内容的指纹，对不上时同样从头打包。
+//
+// 高水位只在设备确认 LUCP_MTYP_FTP_DOWNLOAD_RESULT 成功后前移：打包时先登记为
+// 待确认，确认时若设备的高水位在此期间已被其他上传前移，则放弃本次前移，
+// 下一次打包会重复包含部分内容，但不会遗漏。
+
+/// @brief 初始化高水位存储，高水位持久化在 tmp_dir/marks 下，重启后继续生效
+/// @return 成功返回0，目录无法创建时返回-1（此时高水位只保存在内存中）
+int lucpd_mark_init(const char* tmp_dir);
+
+/// @brief 释放全部高水位
+void lucpd_mark_shutdown(void);
+
+/// @brief 按设备已确认的高水位设置日志集合中每个文件的打包起点
+/// @return 高水位版本（写入 set->base_mark），没有高水位时返回0，集合保持全量
+uint64_t lucpd_mark_apply(const char* device, LucpdLogSet_t* set);
+
+/// @brief 登记打包结果为待确认高水位
+/// @return 待确认高水位的版本（即 set->generation），用于之后确认
+uint64_t lucpd_mark_stage(const char* device, const LucpdLogSet_t* set);
+
+/// @brief 设备确认上传成功，前移高水位并持久化
+void lucpd_mark_commit(const char* device, uint64_t mark);
+
+#endif // LUCPD_MARK_H
@@ -0,0 +1,672 @@
+#include "lucpd_session.h"
+#include "lucpd_mark.h"
+#include "lucpd_utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <lucp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/random.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define SESSION_FRAME_MAX  (14 + LUCP_MAX_TEXTINFO_LEN)
+// 挂起线程的接收缓冲区：残留半帧加一次读取，至少能拼出一个完整帧
+#define SESSION_PARK_RBUF  (2 * SESSION_FRAME_MAX)
+#define SESSION_MAX_EVENTS 256
+#define SESSION_WAKE_TAG   UINT64_MAX
+
+static struct
+{
+    pthread_mutex_t lock; // 保护slab分配、空闲链表、交接队列和脱离队列
+    LucpSession_t** chunks;
+    uint32_t chunk_cap;
+    uint32_t chunk_count;
+    uint32_t free_head;
+    uint32_t handoff_head, handoff_tail; // 会话线程交给挂起线程、尚未接收的会话
+    uint32_t dq_head, dq_tail;           // 连接已断开、等待重连的会话，按断开时间排列
+    uint64_t mem_budget;
+    atomic_uint_fast64_t mem_used;
+    atomic_uint active;
+    atomic_uint parked;
+    atomic_uint detached;
+    atomic_bool running;
+    pthread_t thread;
+    int epfd;
+    int wake_fd;
+    // 以下仅由挂起线程访问
+    uint32_t tq_head, tq_tail; // 挂起会话按最近活跃时间排列，队首最先超时
+    lucp_frame_t frame;
+} g_sess = {.lock = PTHREAD_MUTEX_INITIALIZER, .epfd = -1, .wake_fd = -1};
+
+static inline LucpSession_t* slot(uint32_t idx)
+{
+    return &g_sess.chunks[idx / LUCPD_SESSION_CHUNK][idx % LUCPD_SESSION_CHUNK];
+}
+
+// 在预算内计入内存，超出预算返回false
+static bool mem_charge(uint64_t bytes)
+{
+    uint_fast64_t cur = atomic_load(&g_sess.mem_used);
+    do
+    {
+        if (cur + bytes > g_sess.mem_budget)
+            return false;
+    } while (!atomic_compare_exchange_weak(&g_sess.mem_used, &cur, cur + bytes));
+    return true;
+}
+
+// 调整会话计入的内存（挂起后的缓冲区不受预算限制，以免已接受的会话因预算被丢弃）
+static void mem_set(LucpSession_t* sess, uint32_t bytes)
+{
+    if (bytes >= sess->mem)
+        atomic_fetch_add(&g_sess.mem_used, bytes - sess->mem);
+    else
+        atomic_fetch_sub(&g_sess.mem_used, sess->mem - bytes);
+    sess->mem = bytes;
+}
+
+static void session_release(LucpSession_t* sess)
+{
+    if (sess->fd >= 0)
+        close(sess->fd);
+    // 下载结束（成功、失败或连接断开），日志包不再被钉住
+    if (sess->ticket.entry)
+        lucpd_cache_release(&sess->ticket);
+    free(sess->rbuf);
+    atomic_fetch_sub(&g_sess.mem_used, sess->mem);
+
+    pthread_mutex_lock(&g_sess.lock);
+    sess->fd       = -1;
+    sess->rbuf     = NULL;
+    sess->rbuf_len = 0;
+    sess->mem      = 0;
+    sess->gen++;
+    sess->next       = g_sess.free_head;
+    g_sess.free_head = sess->index;
+    pthread_mutex_unlock(&g_sess.lock);
+}
+
+LucpSession_t* lucpd_session_alloc(int fd)
+{
+    const uint32_t charge = sizeof(LucpSession_t) + LUCPD_SESSION_STACK_SIZE;
+    if (!mem_charge(charge))
+        return NULL;
+
+    pthread_mutex_lock(&g_sess.lock);
+    if (g_sess.free_head == LUCPD_SESSION_NONE)
+    {
+        LucpSession_t* chunk = NULL;
+        if (g_sess.chunk_count < g_sess.chunk_cap)
+            chunk = calloc(LUCPD_SESSION_CHUNK, sizeof(LucpSession_t));
+        if (!chunk)
+        {
+            pthread_mutex_unlock(&g_sess.lock);
+            atomic_fetch_sub(&g_sess.mem_used, charge);
+            return NULL;
+        }
+        uint32_t base                      = g_sess.chunk_count * LUCPD_SESSION_CHUNK;
+        g_sess.chunks[g_sess.chunk_count++] = chunk;
+        for (int i = LUCPD_SESSION_CHUNK - 1; i >= 0; i--)
+        {
+            chunk[i].index   = base + (uint32_t) i;
+            chunk[i].fd      = -1;
+            chunk[i].next    = g_sess.free_head;
+            g_sess.free_head = base + (uint32_t) i;
+        }
+    }
+    LucpSession_t* sess = slot(g_sess.free_head);
+    g_sess.free_head    = sess->next;
+    pthread_mutex_unlock(&g_sess.lock);
+
+    uint32_t index = sess->index;
+    uint32_t gen   = sess->gen;
+    memset(sess, 0, sizeof(*sess));
+    sess->index          = index;
+    sess->gen            = gen;
+    sess->fd             = fd;
+    sess->state          = LUCP_SESSION_INIT;
+    sess->prev           = LUCPD_SESSION_NONE;
+    sess->next           = LUCPD_SESSION_NONE;
+    sess->mem            = charge;
+    sess->last_active_ms = get_now_ms();
+    atomic_fetch_add(&g_sess.active, 1);
+    return sess;
+}
+
+void lucpd_session_free(LucpSession_t* sess)
+{
+    atomic_fetch_sub(&g_sess.active, 1);
+    session_release(sess);
+}
+
+// ================================ 超时队列 ===========================
+
+// 会话超时时间对所有会话相同，按最近活跃时间追加到队尾即保持有序，增删均为O(1)
+static void tq_append(LucpSession_t* sess)
+{
+    sess->prev = g_sess.tq_tail;
+    sess->next = LUCPD_SESSION_NONE;
+    if (g_sess.tq_tail != LUCPD_SESSION_NONE)
+        slot(g_sess.tq_tail)->next = sess->index;
+    else
+        g_sess.tq_head = sess->index;
+    g_sess.tq_tail = sess->index;
+}
+
+static void tq_remove(LucpSession_t* sess)
+{
+    if (sess->prev != LUCPD_SESSION_NONE)
+        slot(sess->prev)->next = sess->next;
+    else
+        g_sess.tq_head = sess->next;
+    if (sess->next != LUCPD_SESSION_NONE)
+        slot(sess->next)->prev = sess->prev;
+    else
+        g_sess.tq_tail = sess->prev;
+    sess->prev = sess->next = LUCPD_SESSION_NONE;
+}
+
+// 脱离队列与超时队列结构相同，等待时间对所有会话相同，调用方持有锁
+static void dq_append(LucpSession_t* sess)
+{
+    sess->prev = g_sess.dq_tail;
+    sess->next = LUCPD_SESSION_NONE;
+    if (g_sess.dq_tail != LUCPD_SESSION_NONE)
+        slot(g_sess.dq_tail)->next = sess->index;
+    else
+        g_sess.dq_head = sess->index;
+    g_sess.dq_tail = sess->index;
+}
+
+static void dq_remove(LucpSession_t* sess)
+{
+    if (sess->prev != LUCPD_SESSION_NONE)
+        slot(sess->prev)->next = sess->next;
+    else
+        g_sess.dq_head = sess->next;
+    if (sess->next != LUCPD_SESSION_NONE)
+        slot(sess->next)->prev = sess->prev;
+    else
+        g_sess.dq_tail = sess->prev;
+    sess->prev = sess->next = LUCPD_SESSION_NONE;
+    sess->detached          = 0;
+}
+
+// ================================ 挂起线程 ===========================
+
+static void park_close(LucpSession_t* sess)
+{
+    tq_remove(sess);
+    atomic_fetch_sub(&g_sess.parked, 1);
+    session_release(sess);
+}
+
+// 连接断开，可续传的会话转入脱离队列等待重连，其余直接关闭
+static void park_detach(LucpSession_t* sess)
+{
+    int grace = lucpd_cfg_enter()->protocol.resume_grace_ms;
+    lucpd_cfg_exit();
+    if (sess->resume_secret == 0 || grace <= 0)
+    {
+        park_close(sess);
+        return;
+    }
+    tq_remove(sess);
+    close(sess->fd);
+    free(sess->rbuf);
+    sess->rbuf           = NULL;
+    sess->rbuf_len       = 0;
+    sess->last_active_ms = get_now_ms();
+    mem_set(sess, sizeof(LucpSession_t));
+    atomic_fetch_sub(&g_sess.parked, 1);
+    atomic_fetch_add(&g_sess.detached, 1);
+    log_debug("[Session %d] Detached, waiting %d ms for reconnect.", sess->fd, grace);
+
+    pthread_mutex_lock(&g_sess.lock);
+    sess->fd       = -1;
+    sess->detached = 1;
+    dq_append(sess);
+    pthread_mutex_unlock(&g_sess.lock);
+}
+
+static void park_touch(LucpSession_t* sess)
+{
+    sess->last_active_ms = get_now_ms();
+    tq_remove(sess);
+    tq_append(sess);
+}
+
+// 保存未成帧的残留数据，缓冲区按实际长度分配
+static bool park_keep(LucpSession_t* sess, const uint8_t* data, size_t len)
+{
+    if (len == 0)
+    {
+        free(sess->rbuf);
+        sess->rbuf = NULL;
+    }
+    else
+    {
+        uint8_t* p = realloc(sess->rbuf, len);
+        if (!p)
+            return false;
+        memcpy(p, data, len);
+        sess->rbuf = p;
+    }
+    sess->rbuf_len = (uint16_t) len;
+    mem_set(sess, (uint32_t) (sizeof(LucpSession_t) + len));
+    return true;
+}
+
+// 设备报告下载结果（FTP_DOWNLOAD_RESULT 或合并的 FTP_TRANSFER_RESULT），会话结束
+static void park_finish(LucpSession_t* sess, const lucp_frame_t* frame)
+{
+    if (frame->status != LUCP_STAT_SUCCESS)
+    {
+        log_debug("[Session %d] Session error!.", sess->fd);
+    }
+    else
+    {
+        // 设备已取走日志包，前移高水位，下次只打包新增内容
+        if (sess->ticket.mark != 0)
+            lucpd_mark_commit(sess->request.device, sess->ticket.mark);
+        log_debug("[Session %d] Session completed!.", sess->fd);
+    }
+    park_close(sess);
+}
+
+// 处理挂起会话收到的一帧，返回false表示会话已结束并释放
+//
+// 设备不必等待服务端即可连续发送结果帧：挂起前提前到达的帧随残留数据一起交给
+// 挂起线程，同一次读取到的多帧按到达顺序逐帧推进状态。顺序仍然强制，
+// 登录结果之前到达的下载结果视为协议错误。
+static bool park_on_frame(LucpSession_t* sess, const lucp_frame_t* frame)
+{
+    if (frame->msgType == LUCP_MTYP_FTP_TRANSFER_RESULT &&
+        (sess->state == LUCP_SESSION_WAITING_FTP_LOGIN_RESULT ||
+         sess->state == LUCP_SESSION_WAITING_FTP_DOWNLOAD_RESULT))
+    {
+        log_debug("[Session %d] Got LUCP_MTYP_FTP_TRANSFER_RESULT(0x%02X) (Transfer result, "
+                  "status=0x%02X).",
+                  sess->fd,
+                  LUCP_MTYP_FTP_TRANSFER_RESULT,
+                  frame->status);
+        park_finish(sess, frame);
+        return false;
+    }
+
+    switch (sess->state)
+    {
+    case LUCP_SESSION_WAITING_FTP_LOGIN_RESULT:
+        if (frame->msgType == LUCP_MTYP_FTP_DOWNLOAD_RESULT)
+        {
+            log_debug("[Session %d] Download result before login result, session error!.",
+                      sess->fd);
+            park_close(sess);
+            return false;
+        }
+        if (frame->msgType != LUCP_MTYP_FTP_LOGIN_RESULT)
+            return true;
+        log_debug("[Session %d] Got LUCP_MTYP_FTP_LOGIN_RESULT(0x%02X) (FTP login result, "
+                  "status=0x%02X).",
+                  sess->fd,
+                  LUCP_MTYP_FTP_LOGIN_RESULT,
+                  frame->status);
+        if (frame->status != LUCP_STAT_SUCCESS)
+        {
+            log_debug("[Session %d] Session error!.", sess->fd);
+            park_close(sess);
+            return false;
+        }
+        sess->state = LUCP_SESSION_WAITING_FTP_DOWNLOAD_RESULT;
+        park_touch(sess);
+        return true;
+    case LUCP_SESSION_WAITING_FTP_DOWNLOAD_RESULT:
+        if (frame->msgType != LUCP_MTYP_FTP_DOWNLOAD_RESULT)
+            return true;
+        log_debug("[Session %d] Got LUCP_MTYP_FTP_DOWNLOAD_RESULT(0x%02X) (Download result, "
+                  "status=0x%02X).",
+                  sess->fd,
+                  LUCP_MTYP_FTP_DOWNLOAD_RESULT,
+                  frame->status);
+        park_finish(sess, frame);
+        return false;
+    default:
+        park_close(sess);
+        return false;
+    }
+}
+
+// 处理挂起会话的输入（残留数据及可读时新到的数据），返回false表示会话已结束并释放
+static bool park_feed(LucpSession_t* sess, bool readable)
+{
+    uint8_t buf[SESSION_PARK_RBUF];
+    size_t len = sess->rbuf_len;
+    if (len > 0)
+        memcpy(buf, sess->rbuf, len);
+
+    if (readable)
+    {
+        ssize_t n;
+        do
+        {
+            n = recv(sess->fd, buf + len, sizeof(buf) - len, 0);
+        } while (n < 0 && errno == EINTR);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            log_debug("[Session %d] Connection closed while waiting for FTP result.", sess->fd);
+            park_detach(sess);
+            return false;
+        }
+        if (n > 0)
+            len += (size_t) n;
+    }
+
+    size_t off = 0;
+    int used;
+    while ((used = lucp_frame_unpack(&g_sess.frame, buf + off, len - off)) > 0)
+    {
+        lucp_capture_frame(sess->conn_id, LUCP_CAPTURE_RX, buf + off, (size_t) used);
+        off += (size_t) used;
+        if (!park_on_frame(sess, &g_sess.frame))
+            return false;
+    }
+    if (used < 0 || !park_keep(sess, buf + off, len - off))
+    {
+        log_debug("[Session %d] Session error!.", sess->fd);
+        park_close(sess);
+        return false;
+    }
+    return true;
+}
+
+// 接收会话线程交来的会话
+static void park_adopt(void)
+{
+    uint64_t v;
+    while (read(g_sess.wake_fd, &v, sizeof(v)) < 0 && errno == EINTR)
+        ;
+
+    pthread_mutex_lock(&g_sess.lock);
+    uint32_t idx        = g_sess.handoff_head;
+    g_sess.handoff_head = g_sess.handoff_tail = LUCPD_SESSION_NONE;
+    pthread_mutex_unlock(&g_sess.lock);
+
+    while (idx != LUCPD_SESSION_NONE)
+    {
+        LucpSession_t* sess = slot(idx);
+        idx                 = sess->next;
+        tq_append(sess);
+
+        int flags = fcntl(sess->fd, F_GETFL, 0);
+        struct epoll_event ev;
+        ev.events   = EPOLLIN | EPOLLRDHUP;
+        ev.data.u64 = ((uint64_t) sess->gen << 32) | sess->index;
+        if (flags < 0 || fcntl(sess->fd, F_SETFL, flags | O_NONBLOCK) < 0 ||
+            epoll_ctl(g_sess.epfd, EPOLL_CTL_ADD, sess->fd, &ev) < 0)
+        {
+            log_error("[Session %d] Failed to park session: %s", sess->fd, strerror(errno));
+            park_close(sess);
+            continue;
+        }
+        if (sess->rbuf_len > 0)
+            park_feed(sess, false);
+    }
+}
+
+// 释放等待重连超时的脱离会话，返回距下一个会话超时的毫秒数，没有脱离会话时返回-1
+static int detach_expire(uint64_t now, uint64_t grace)
+{
+    for (;;)
+    {
+        pthread_mutex_lock(&g_sess.lock);
+        if (g_sess.dq_head == LUCPD_SESSION_NONE)
+        {
+            pthread_mutex_unlock(&g_sess.lock);
+            return -1;
+        }
+        LucpSession_t* sess = slot(g_sess.dq_head);
+        if (now < sess->last_active_ms + grace)
+        {
+            pthread_mutex_unlock(&g_sess.lock);
+            return (int) (sess->last_active_ms + grace - now);
+        }
+        // 移出队列后会话不能再被取回，释放需要重新加锁，在锁外进行
+        dq_remove(sess);
+        pthread_mutex_unlock(&g_sess.lock);
+        log_debug("[Session %u] Resume grace expired.", sess->index);
+        atomic_fetch_sub(&g_sess.detached, 1);
+        session_release(sess);
+    }
+}
+
+// 关闭超时的挂起会话，返回距下一个会话超时的毫秒数，没有挂起会话时返回-1
+static int park_expire(void)
+{
+    uint64_t now             = get_now_ms();
+    const LucpdConfig_t* cfg = lucpd_cfg_enter();
+    uint64_t window          = (uint64_t) cfg->protocol.session_timeout_ms;
+    uint64_t grace           = (uint64_t) cfg->protocol.resume_grace_ms;
+    lucpd_cfg_exit();
+
+    int timeout = detach_expire(now, grace);
+    while (g_sess.tq_head != LUCPD_SESSION_NONE)
+    {
+        LucpSession_t* sess = slot(g_sess.tq_head);
+        if (now < sess->last_active_ms + window)
+        {
+            int left = (int) (sess->last_active_ms + window - now);
+            return (timeout < 0 || left < timeout) ? left : timeout;
+        }
+        log_debug("[Session %d] Session timeout.", sess->fd);
+        park_close(sess);
+    }
+    return timeout;
+}
+
+static void* park_thread(void* arg)
+{
+    (void) arg;
+    struct epoll_event events[SESSION_MAX_EVENTS];
+    while (atomic_load(&g_sess.running))
+    {
+        int timeout = park_expire();
+        int n       = epoll_wait(g_sess.epfd, events, SESSION_MAX_EVENTS, timeout);
+        if (n < 0 && errno != EINTR)
+        {
+            log_error("[Session] epoll_wait: %s", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.u64 == SESSION_WAKE_TAG)
+            {
+                park_adopt();
+                continue;
+            }
+            LucpSession_t* sess = slot((uint32_t) events[i].data.u64);
+            if (sess->gen != (uint32_t) (events[i].data.u64 >> 32) || sess->fd < 0)
+                continue;
+            park_feed(sess, true);
+        }
+    }
+    return NULL;
+}
+
+void lucpd_session_park(LucpSession_t* sess, const uint8_t* pending, size_t len)
+{
+    // 会话线程即将退出，改为按残留数据实际长度计入内存
+    if (!atomic_load(&g_sess.running) || len > SESSION_FRAME_MAX ||
+        !park_keep(sess, pending, len))
+    {
+        log_debug("[Session %d] Session error!.", sess->fd);
+        lucpd_session_free(sess);
+        return;
+    }
+    sess->last_active_ms = get_now_ms();
+    sess->next           = LUCPD_SESSION_NONE;
+    atomic_fetch_sub(&g_sess.active, 1);
+    atomic_fetch_add(&g_sess.parked, 1);
+
+    pthread_mutex_lock(&g_sess.lock);
+    if (g_sess.handoff_tail != LUCPD_SESSION_NONE)
+        slot(g_sess.handoff_tail)->next = sess->index;
+    else
+        g_sess.handoff_head = sess->index;
+    g_sess.handoff_tail = sess->index;
+    pthread_mutex_unlock(&g_sess.lock);
+
+    uint64_t one = 1;
+    if (write(g_sess.wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        log_error("[Session] Failed to wake park thread: %s", strerror(errno));
+}
+
+int lucpd_session_make_token(LucpSession_t* sess, char* token, size_t len)
+{
+    uint64_t secret = 0;
+    while (secret == 0)
+    {
+        if (getrandom(&secret, sizeof(secret), 0) != sizeof(secret))
+            return -1;
+    }
+    sess->resume_secret = secret;
+    snprintf(token,
+             len,
+             "%08x%08x%016llx",
+             sess->index,
+             sess->gen,
+             (unsigned long long) secret);
+    return 0;
+}
+
+LucpSession_t* lucpd_session_claim(const char* token)
+{
+    char field[17];
+    memcpy(field, token, 8);
+    field[8]     = '\0';
+    uint32_t idx = (uint32_t) strtoul(field, NULL, 16);
+    memcpy(field, token + 8, 8);
+    uint32_t gen = (uint32_t) strtoul(field, NULL, 16);
+    memcpy(field, token + 16, 16);
+    field[16]       = '\0';
+    uint64_t secret = strtoull(field, NULL, 16);
+
+    LucpSession_t* sess = NULL;
+    pthread_mutex_lock(&g_sess.lock);
+    if (idx < g_sess.chunk_count * LUCPD_SESSION_CHUNK)
+    {
+        LucpSession_t* s = slot(idx);
+        if (s->detached && s->gen == gen && secret != 0 && s->resume_secret == secret)
+        {
+            dq_remove(s);
+            sess = s;
+        }
+    }
+    pthread_mutex_unlock(&g_sess.lock);
+    if (sess)
+    {
+        atomic_fetch_sub(&g_sess.detached, 1);
+        atomic_fetch_add(&g_sess.active, 1);
+    }
+    return sess;
+}
+
+void lucpd_session_stats(LucpdSessionStats_t* stats)
+{
+    stats->active     = atomic_load(&g_sess.active);
+    stats->parked     = atomic_load(&g_sess.parked);
+    stats->detached   = atomic_load(&g_sess.detached);
+    stats->mem_used   = atomic_load(&g_sess.mem_used);
+    stats->mem_budget = g_sess.mem_budget;
+}
+
+int lucpd_session_init(const LucpdConfig_t* cfg)
+{
+    g_sess.mem_budget   = (uint64_t) cfg->network.session_mem_budget_mb * 1024 * 1024;
+    uint64_t max        = g_sess.mem_budget / sizeof(LucpSession_t);
+    g_sess.chunk_cap    = (uint32_t) ((max + LUCPD_SESSION_CHUNK - 1) / LUCPD_SESSION_CHUNK);
+    g_sess.chunks       = calloc(g_sess.chunk_cap, sizeof(LucpSession_t*));
+    g_sess.free_head    = LUCPD_SESSION_NONE;
+    g_sess.handoff_head = g_sess.handoff_tail = LUCPD_SESSION_NONE;
+    g_sess.tq_head = g_sess.tq_tail = LUCPD_SESSION_NONE;
+    g_sess.dq_head = g_sess.dq_tail = LUCPD_SESSION_NONE;
+    if (!g_sess.chunks)
+    {
+        log_error("[Session] Out of memory");
+        return -1;
+    }
+
+    // 每个挂起会话保留一个连接，文件描述符上限放开到硬限制
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) != 0)
+            log_warn("[Session] Failed to raise RLIMIT_NOFILE: %s", strerror(errno));
+    }
+
+    g_sess.epfd    = epoll_create1(EPOLL_CLOEXEC);
+    g_sess.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event ev;
+    ev.events   = EPOLLIN;
+    ev.data.u64 = SESSION_WAKE_TAG;
+    if (g_sess.epfd < 0 || g_sess.wake_fd < 0 ||
+        epoll_ctl(g_sess.epfd, EPOLL_CTL_ADD, g_sess.wake_fd, &ev) < 0)
+    {
+        log_error("[Session] Failed to create park poller: %s", strerror(errno));
+        lucpd_session_shutdown();
+        return -1;
+    }
+
+    atomic_store(&g_sess.running, true);
+    if (pthread_create(&g_sess.thread, NULL, park_thread, NULL) != 0)
+    {
+        log_error("[Session] Failed to start park thread");
+        atomic_store(&g_sess.running, false);
+        lucpd_session_shutdown();
+        return -1;
+    }
+    log_info("[Session] Memory budget %llu KB (%zu bytes per parked session, %zu KB per active)",
+             (unsigned long long) (g_sess.mem_budget / 1024),
+             sizeof(LucpSession_t),
+             (sizeof(LucpSession_t) + LUCPD_SESSION_STACK_SIZE) / 1024);
+    return 0;
+}
+
+void lucpd_session_shutdown(void)
+{
+    if (atomic_exchange(&g_sess.running, false))
+    {
+        uint64_t one = 1;
+        if (write(g_sess.wake_fd, &one, sizeof(one)) < 0)
+            log_error("[Session] Failed to wake park thread: %s", strerror(errno));
+        pthread_join(g_sess.thread, NULL);
+
+        // 交接队列中尚未接收的会话也一并关闭
+        park_adopt();
+        while (g_sess.tq_head != LUCPD_SESSION_NONE)
+            park_close(slot(g_sess.tq_head));
+        // 脱离会话立即过期
+        detach_expire(UINT64_MAX, 0);
+    }
+    if (g_sess.epfd >= 0)
+        close(g_sess.epfd);
+    if (g_sess.wake_fd >= 0)
+        close(g_sess.wake_fd);
+    g_sess.epfd = g_sess.wake_fd = -1;
+    // 仍有会话线程在运行时保留slab，进程退出时由系统回收
+    if (atomic_load(&g_sess.active) > 0)
+        return;
+    for (uint32_t i = 0; i < g_sess.chunk_count; i++)
+        free(g_sess.chunks[i]);
+    free(g_sess.chunks);
+    g_sess.chunks      = NULL;
+    g_sess.chunk_count = 0;
+}
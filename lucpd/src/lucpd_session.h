@@ -0,0 +1,97 @@
+#ifndef LUCPD_SESSION_H
+#define LUCPD_SESSION_H
+
+#include "lucpd_archive.h"
+#include "lucpd_cache.h"
+#include "lucpd_cfg.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// slab每块容纳的会话数，块一经分配不再释放，会话地址和下标在生命周期内保持不变
+#define LUCPD_SESSION_CHUNK 1024
+// 活跃会话（接收请求、准备日志包）线程的栈大小
+#define LUCPD_SESSION_STACK_SIZE (256 * 1024)
+// 空下标
+#define LUCPD_SESSION_NONE UINT32_MAX
+
+// 会话状态
+typedef enum
+{
+    LUCP_SESSION_INIT,
+    LUCP_SESSION_WAITING_UPLOAD_REQUEST,
+    LUCP_SESSION_WAITING_FTP_LOGIN_RESULT,
+    LUCP_SESSION_WAITING_FTP_DOWNLOAD_RESULT,
+    LUCP_SESSION_WAITING_CLOUD_UPLOAD_RESULT,
+    LUCP_SESSION_COMPLETED,
+    LUCP_SESSION_ERROR
+} LucpSessionState;
+
+// 会话结构
+//
+// 发出 NOTIFY_DONE 之后会话进入挂起状态：会话线程退出，连接交给挂起线程统一监听，
+// 此时会话只占用本结构体，接收缓冲区仅在收到半帧时按实际长度分配。
+//
+// 申请了续传令牌的挂起会话在连接断开后转为脱离状态，在 resume_grace_ms 内保留
+// 状态和钉住的日志包，设备重连时在 UPLOAD_REQUEST 中出示令牌即可接续之前的状态，
+// 不必重新打包。令牌由槽位下标、代数和随机数组成，槽位被复用后旧令牌自动失效。
+typedef struct
+{
+    int fd;
+    uint32_t index;            // 在slab中的下标
+    uint32_t gen;              // 槽位复用代数，每次释放后递增
+    uint32_t seq_num;
+    uint8_t state;             // LucpSessionState
+    uint8_t detached;          // 连接已断开，等待设备携带令牌重连
+    uint16_t rbuf_len;         // rbuf中未成帧的字节数
+    uint32_t mem;              // 本会话当前计入内存预算的字节数
+    uint32_t conn_id;          // lucp网络层分配的连接标识，用于抓包记录
+    uint32_t prev, next;       // 挂起会话的超时链表 / 空闲槽位链表
+    uint64_t last_active_ms;
+    uint64_t resume_secret;    // 续传令牌中的随机数，0表示会话不可续传
+    LucpdCacheTicket_t ticket; // 设备正在下载的日志包及其待确认的高水位
+    uint8_t* rbuf;             // 挂起期间收到的半帧数据，没有时为NULL
+    LucpdArchiveRequest_t request;
+} LucpSession_t;
+
+// 会话统计
+typedef struct
+{
+    uint32_t active;     // 由会话线程处理中的会话数
+    uint32_t parked;     // 挂起等待FTP结果的会话数
+    uint32_t detached;   // 连接断开、等待重连的会话数
+    uint64_t mem_used;   // 计入预算的内存(字节)
+    uint64_t mem_budget; // 内存预算(字节)
+} LucpdSessionStats_t;
+
+/// @brief 初始化会话slab并启动挂起线程
+/// @param cfg 启动配置，内存预算只在启动时读取；会话超时每次从当前配置快照读取
+/// @return 成功返回0，失败返回-1
+int lucpd_session_init(const LucpdConfig_t* cfg);
+
+/// @brief 停止挂起线程并关闭所有挂起的会话
+void lucpd_session_shutdown(void);
+
+/// @brief 为新连接分配会话，会话计入一个线程栈的内存
+/// @return 超出内存预算时返回NULL
+LucpSession_t* lucpd_session_alloc(int fd);
+
+/// @brief 关闭连接并释放会话槽位
+void lucpd_session_free(LucpSession_t* sess);
+
+/// @brief 把会话交给挂起线程等待FTP结果，调用后会话线程不得再访问sess
+/// @param pending 会话线程接收缓冲区中尚未处理的数据（客户端提前发送的结果帧）
+void lucpd_session_park(LucpSession_t* sess, const uint8_t* pending, size_t len);
+
+/// @brief 为会话生成续传令牌，之后连接断开时会话保留 resume_grace_ms 等待重连
+/// @param token 输出缓冲区，至少 LUCPD_RESUME_TOKEN_LEN + 1 字节
+/// @return 成功返回0，随机数不可用时返回-1
+int lucpd_session_make_token(LucpSession_t* sess, char* token, size_t len);
+
+/// @brief 按令牌取回脱离的会话，取回后会话计为活跃，由调用方重新挂起或释放
+/// @return 令牌无效、会话已超时或仍有连接时返回NULL
+LucpSession_t* lucpd_session_claim(const char* token);
+
+/// @brief 获取会话统计
+void lucpd_session_stats(LucpdSessionStats_t* stats);
+
+#endif // LUCPD_SESSION_H
@@ -1,4 +1,5 @@
 #include "lucpd_utils.h"
+#include "lucpd_log.h"
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <stdarg.h>
@@ -19,22 +20,20 @@ static char ip_hash[1024][INET_ADDRSTRLEN] = {0};
 // 获取当前时间戳
 time_t get_current_timestamp() { return time(NULL); }
 
-// 日志输出
+// 日志输出，级别过滤在格式化之前完成，实际写出由lucpd_log后台线程批量完成
 void log_debug(const char* format, ...)
 {
     va_list args;
     va_start(args, format);
+    lucpd_log_vwrite(LUCP_LOG_DEBUG, NULL, format, args);
+    va_end(args);
+}
 
-    time_t now         = time(NULL);
-    struct tm* tm_info = localtime(&now);
-    char time_str[20];
-    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", tm_info);
-
-    fprintf(stdout, "[%s] DEBUG: ", time_str);
-    vfprintf(stdout, format, args);
-    fprintf(stdout, "\n");
-    fflush(stdout);
-
+void log_info(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    lucpd_log_vwrite(LUCP_LOG_INFO, NULL, format, args);
     va_end(args);
 }
 
@@ -42,17 +41,7 @@ void log_warn(const char* format, ...)
 {
     va_list args;
     va_start(args, format);
-
-    time_t now         = time(NULL);
-    struct tm* tm_info = localtime(&now);
-    char time_str[20];
-    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", tm_info);
-
-    fprintf(stdout, "[%s] WARN: ", time_str);
-    vfprintf(stdout, format, args);
-    fprintf(stdout, "\n");
-    fflush(stdout);
-
+    lucpd_log_vwrite(LUCP_LOG_WARN, NULL, format, args);
     va_end(args);
 }
 
@@ -60,17 +49,7 @@ void log_error(const char* format, ...)
 {
     va_list args;
     va_start(args, format);
-
-    time_t now         = time(NULL);
-    struct tm* tm_info = localtime(&now);
-    char time_str[20];
-    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", tm_info);
-
-    fprintf(stderr, "[%s] ERROR: ", time_str);
-    vfprintf(stderr, format, args);
-    fprintf(stderr, "\n");
-    fflush(stderr);
-
+    lucpd_log_vwrite(LUCP_LOG_ERROR, NULL, format, args);
     va_end(args);
 }
 
@@ -142,19 +121,19 @@ uint64_t get_now_ms(void)
     return ((uint64_t) tv.tv_sec) * 1000 + tv.tv_usec / 1000;
 }
 
+static void log_with_prefix(LucpLogLevel level, const char* prefix, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    lucpd_log_vwrite(level, prefix, format, args);
+    va_end(args);
+}
+
 void handle_lucp_log(LucpLogLevel level, const char *file, int line, const char *logmsg)
 {
-    const char *level_str = "";
-    switch (level) {
-        case LUCP_LOG_DEBUG: level_str = "DEBUG"; break;
-        case LUCP_LOG_INFO:  level_str = "INFO";  break;
-        case LUCP_LOG_WARN:  level_str = "WARN";  break;
-        case LUCP_LOG_ERROR: level_str = "ERROR"; break;
-        default: level_str = "UNKNOWN"; break;
-    }
-    if  (level == LUCP_LOG_ERROR || level == LUCP_LOG_WARN) {
-        fprintf(stderr, "[%s] (%s:%d) %s\n", level_str, file, line, logmsg);
+    if (!lucpd_log_enabled(level))
         return;
-    }
-    printf("[%s] (%s:%d) %s\n", level_str, file, line, logmsg);
-}
\ No newline at end of file
+    char where[128];
+    snprintf(where, sizeof(where), "(%s:%d)", file, line);
+    log_with_prefix(level, where, "%s", logmsg);
+}
@@ -11,6 +11,7 @@ time_t get_current_timestamp();
 
 // 日志输出
 void log_debug(const char* format, ...);
+void log_info(const char* format, ...);
 void log_warn(const char* format, ...);
 void log_error(const char* format, ...);
 
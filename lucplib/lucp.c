@@ -6,11 +6,15 @@
 
 // ================================ LOGGING ===========================
 static LucpLogCallback g_log_callback = NULL;
+static LucpLogLevel g_log_level       = LUCP_LOG_DEBUG;
 void lucp_set_log_callback(LucpLogCallback callback) {
     g_log_callback = callback;
 }
+void lucp_set_log_level(LucpLogLevel level) {
+    g_log_level = level;
+}
 static void lucp_log_internal(LucpLogLevel level, const char *file, int line, const char *format, ...) {
-    if (!g_log_callback) {
+    if (!g_log_callback || level < g_log_level) {
         return;
     }
     va_list args;
@@ -210,8 +214,117 @@ void lucp_frame_make(lucp_frame_t* frame,
 }
 
 #ifndef _WIN32 
+#include <pthread.h>
 #include <sys/select.h>
+#include <time.h>
 #include <unistd.h>
+
+// ================================ 抓包 ===========================
+#define LUCP_CAPTURE_IOBUF (256 * 1024)
+
+static pthread_mutex_t g_capture_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE* g_capture_file           = NULL;
+static int g_capture_on               = 0; // 无锁快速判断，修改时持有g_capture_lock
+static uint64_t g_capture_start_ns    = 0;
+static uint32_t g_conn_id_seq         = 0;
+
+static uint64_t clock_ns(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+uint32_t lucp_capture_next_conn_id(void)
+{
+    return __atomic_add_fetch(&g_conn_id_seq, 1, __ATOMIC_RELAXED);
+}
+
+int lucp_capture_enabled(void)
+{
+    return __atomic_load_n(&g_capture_on, __ATOMIC_ACQUIRE);
+}
+
+int lucp_capture_open(const char* path, uint8_t role)
+{
+    if (!path)
+    {
+        LUCP_LOG(LUCP_LOG_ERROR, "lucp_capture_open: NULL path");
+        return -1;
+    }
+    lucp_capture_close();
+
+    FILE* fp = fopen(path, "wb");
+    if (!fp)
+    {
+        LUCP_LOG(LUCP_LOG_ERROR, "lucp_capture_open: %s: %s", path, strerror(errno));
+        return -1;
+    }
+    // 记录在用户态缓冲，批量落盘
+    setvbuf(fp, NULL, _IOFBF, LUCP_CAPTURE_IOBUF);
+
+    lucp_capture_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic         = LUCP_CAPTURE_MAGIC;
+    hdr.version       = LUCP_CAPTURE_VERSION;
+    hdr.role          = role;
+    hdr.start_mono_ns = clock_ns(CLOCK_MONOTONIC);
+    hdr.start_real_ns = clock_ns(CLOCK_REALTIME);
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+    {
+        LUCP_LOG(LUCP_LOG_ERROR, "lucp_capture_open: header write failed");
+        fclose(fp);
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_capture_lock);
+    g_capture_file     = fp;
+    g_capture_start_ns = hdr.start_mono_ns;
+    __atomic_store_n(&g_capture_on, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_capture_lock);
+    LUCP_LOG(LUCP_LOG_INFO, "Capture started: %s", path);
+    return 0;
+}
+
+void lucp_capture_close(void)
+{
+    pthread_mutex_lock(&g_capture_lock);
+    FILE* fp = g_capture_file;
+    g_capture_file = NULL;
+    __atomic_store_n(&g_capture_on, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_capture_lock);
+    if (fp)
+        fclose(fp);
+}
+
+void lucp_capture_frame(uint32_t conn_id, uint8_t dir, const uint8_t* buf, size_t len)
+{
+    if (!lucp_capture_enabled() || !buf || len > UINT16_MAX)
+        return;
+
+    lucp_capture_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.conn_id = conn_id;
+    rec.dir     = dir;
+    rec.len     = (uint16_t) len;
+
+    pthread_mutex_lock(&g_capture_lock);
+    if (g_capture_file)
+    {
+        // 在锁内取时间，保证文件中的记录按时间递增
+        rec.ts_ns = clock_ns(CLOCK_MONOTONIC) - g_capture_start_ns;
+        if (fwrite(&rec, sizeof(rec), 1, g_capture_file) != 1 ||
+            fwrite(buf, 1, len, g_capture_file) != len)
+        {
+            LUCP_LOG(LUCP_LOG_ERROR, "lucp_capture_frame: write failed, capture stopped");
+            fclose(g_capture_file);
+            g_capture_file = NULL;
+            __atomic_store_n(&g_capture_on, 0, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&g_capture_lock);
+}
+
 /**
  * 初始化LUCP网络上下文。
  */
@@ -223,6 +336,7 @@ void lucp_net_ctx_init(lucp_net_ctx_t* ctx, int fd)
         return;
     }
     ctx->fd       = fd;
+    ctx->conn_id  = lucp_capture_next_conn_id();
     ctx->rbuf_len = 0;
     memset(ctx->rbuf, 0, sizeof(ctx->rbuf));
     LUCP_LOG(LUCP_LOG_INFO, "Network context initialized with fd=%d", fd);
@@ -277,6 +391,7 @@ int lucp_net_send(lucp_net_ctx_t* ctx, const lucp_frame_t* frame)
         LUCP_LOG(LUCP_LOG_ERROR, "lucp_net_send: Socket write failed");
         return -1;
     }
+    lucp_capture_frame(ctx->conn_id, LUCP_CAPTURE_TX, buf, (size_t) len);
     LUCP_LOG(LUCP_LOG_INFO, "Frame sent (msgType=0x%02X, seq=%u)", frame->msgType, frame->seq_num);
     return 0;
 }
@@ -296,6 +411,7 @@ int lucp_net_recv(lucp_net_ctx_t* ctx, lucp_frame_t* frame)
     int parsed = lucp_frame_unpack(frame, ctx->rbuf, ctx->rbuf_len);
     if (parsed > 0)
     {
+        lucp_capture_frame(ctx->conn_id, LUCP_CAPTURE_RX, ctx->rbuf, (size_t) parsed);
         // 移动剩余字节到缓冲区开头，供下次读取
         size_t remain = ctx->rbuf_len - parsed;
         if (remain > 0)
@@ -338,6 +454,7 @@ int lucp_net_recv(lucp_net_ctx_t* ctx, lucp_frame_t* frame)
         parsed = lucp_frame_unpack(frame, ctx->rbuf, ctx->rbuf_len);
         if (parsed > 0)
         {
+            lucp_capture_frame(ctx->conn_id, LUCP_CAPTURE_RX, ctx->rbuf, (size_t) parsed);
             // 移动剩余字节到缓冲区开头，供下次读取
             size_t remain = ctx->rbuf_len - parsed;
             if (remain > 0)
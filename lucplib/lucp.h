@@ -25,6 +25,9 @@ extern "C" {
 #define LUCP_MTYP_FTP_LOGIN_RESULT    0x04
 #define LUCP_MTYP_FTP_DOWNLOAD_RESULT 0x05
 #define LUCP_MTYP_CLOUD_UPLOAD_RESULT 0x06
+// 合并的FTP结果：登录成功并下载完成时只发这一帧，代替 0x04 + 0x05；
+// status 为 SUCCESS、FTP_LOGIN_FAILED 或 FTP_DOWNLOAD_FAILED
+#define LUCP_MTYP_FTP_TRANSFER_RESULT 0x07
 
 /**
  * LUCP 状态码定义
@@ -88,6 +91,7 @@ typedef struct
     int fd;             // Socket fd
     uint8_t rbuf[2048]; // 部分读取的接收缓冲区
     size_t rbuf_len;    // 当前在缓冲区中的字节数
+    uint32_t conn_id;   // 进程内唯一的连接标识，初始化时分配，用于抓包记录
 } lucp_net_ctx_t;
 
 /**
@@ -122,6 +126,57 @@ int lucp_net_send_with_retries(lucp_net_ctx_t* ctx,
                                int n_retries,
                                int timeout_ms);
 
+// ================================ 抓包 ===========================
+/**
+ * 开启抓包后，lucp_net_send/lucp_net_recv 收发的每一帧都会连同单调时钟时间戳、
+ * 方向和连接标识写入二进制文件，可用 lucp_replay 按原始节奏回放。
+ *
+ * 文件格式（主机字节序）：lucp_capture_header_t，之后是若干条
+ * lucp_capture_record_t，每条记录后紧跟 len 字节的原始帧。
+ */
+#define LUCP_CAPTURE_MAGIC       0x4C434150 // ASCII 'LCAP'
+#define LUCP_CAPTURE_VERSION     1
+#define LUCP_CAPTURE_RX          0 // 本端接收的帧
+#define LUCP_CAPTURE_TX          1 // 本端发送的帧
+#define LUCP_CAPTURE_ROLE_CLIENT 0
+#define LUCP_CAPTURE_ROLE_SERVER 1
+
+typedef struct
+{
+    uint32_t magic;         // LUCP_CAPTURE_MAGIC，读取方可据此判断字节序
+    uint16_t version;       // LUCP_CAPTURE_VERSION
+    uint8_t role;           // 抓包端角色 LUCP_CAPTURE_ROLE_*
+    uint8_t reserved;
+    uint64_t start_mono_ns; // 开始抓包时的单调时钟
+    uint64_t start_real_ns; // 开始抓包时的系统时间，仅用于显示
+} lucp_capture_header_t;
+
+typedef struct
+{
+    uint64_t ts_ns;   // 相对开始抓包的单调时钟(纳秒)
+    uint32_t conn_id; // 连接标识
+    uint8_t dir;      // LUCP_CAPTURE_RX / LUCP_CAPTURE_TX
+    uint8_t reserved;
+    uint16_t len;     // 原始帧长度
+} lucp_capture_record_t;
+
+/// @brief 开启抓包（进程内全局，重复调用时先关闭之前的文件）
+/// @param path 抓包文件路径，已存在时覆盖
+/// @param role 本端角色 LUCP_CAPTURE_ROLE_*
+/// @return 成功返回0，失败返回-1
+int lucp_capture_open(const char* path, uint8_t role);
+
+/// @brief 写出缓冲的记录并关闭抓包文件
+void lucp_capture_close(void);
+
+/// @brief 是否正在抓包
+int lucp_capture_enabled(void);
+
+/// @brief 记录一帧原始数据，供不经过 lucp_net_* 收发的调用方使用；未开启抓包时直接返回
+void lucp_capture_frame(uint32_t conn_id, uint8_t dir, const uint8_t* buf, size_t len);
+
+/// @brief 分配一个新的连接标识（lucp_net_ctx_init 内部使用）
+uint32_t lucp_capture_next_conn_id(void);
 
 #endif // !_WIN32
 
@@ -145,7 +200,11 @@ typedef void (*LucpLogCallback)(LucpLogLevel level, const char *file, int line,
 // 注册日志回调函数
 // 调用方通过此函数设置自定义日志处理逻辑
 // 参数：callback - 调用方实现的日志回调函数（NULL表示禁用日志）
-void lucp_set_log_callback(LucpLogCallback callback);                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                          
+void lucp_set_log_callback(LucpLogCallback callback);
+
+// 设置日志输出的最低级别（默认LUCP_LOG_DEBUG）
+// 低于该级别的日志在格式化之前即被丢弃，不会调用回调函数
+void lucp_set_log_level(LucpLogLevel level);
 
 #ifdef __cplusplus
 }
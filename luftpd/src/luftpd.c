@@ -1,297 +1,829 @@
+#define _GNU_SOURCE // accept4
 #include "luftpd_cfg.h"
+#include "luftpd_conn.h"
+#include "luftpd_hash.h"
+#include "luftpd_list.h"
+#include "luftpd_pasv.h"
+#include "luftpd_path.h"
+#include "luftpd_stats.h"
+#include "luftpd_transfer.h"
 #include "luftpd_utils.h"
+#include "luftpd_zmode.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <pthread.h>
 #include <logMgr.h>
 #include <string.h>
-#include <dirent.h>
+#include <netinet/tcp.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <arpa/inet.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
 
 
 
 // 全局变量
 LuftpdConfig_t g_luftpd_config;
-LuftpdClient_t *g_clients = NULL;
-int g_client_count = 0;
-pthread_mutex_t g_clients_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 #ifndef LUCPD_APPID
 #define LUCPD_APPID "luftpd"
 #endif
 
+// 命令名按字节打包成 uint64，分发时直接 switch，不足8个字符的低位补0
+#define LUFTPD_CMD8(a, b, c, d, e, f, g, h)                                                   \
+    (((uint64_t)(a) << 56) | ((uint64_t)(b) << 48) | ((uint64_t)(c) << 40) |                \
+     ((uint64_t)(d) << 32) | ((uint64_t)(e) << 24) | ((uint64_t)(f) << 16) |                \
+     ((uint64_t)(g) << 8) | (uint64_t)(h))
+#define LUFTPD_CMD(a, b, c, d) LUFTPD_CMD8(a, b, c, d, 0, 0, 0, 0)
+
 // 函数声明
 int luftpd_start_server();
-void *luftpd_handle_client(void *arg);
 int luftpd_send_response(int sock, const char *fmt, ...);
-int luftpd_parse_command(const char *cmd, char *out_cmd, char *out_arg);
+static int luftpd_reply(LuftpdClient_t *client, const char *fmt, ...);
+static int luftpd_reply_flush(LuftpdClient_t *client);
 int luftpd_handle_cwd(LuftpdClient_t *client, const char *arg);
-int luftpd_handle_list(LuftpdClient_t *client, const char *arg);
+int luftpd_handle_list(LuftpdClient_t *client, const char *arg, LuftpdListFormat_t format);
+int luftpd_handle_mlst(LuftpdClient_t *client, const char *arg);
 int luftpd_handle_retr(LuftpdClient_t *client, const char *arg);
+int luftpd_handle_stor(LuftpdClient_t *client, const char *arg, int append);
+int luftpd_handle_allo(LuftpdClient_t *client, const char *arg);
 int luftpd_handle_syst(LuftpdClient_t *client, const char *arg);
 int luftpd_handle_type(LuftpdClient_t *client, const char *arg);
+int luftpd_handle_mode(LuftpdClient_t *client, const char *arg);
 int luftpd_handle_feat(LuftpdClient_t *client, const char *arg);
 int luftpd_handle_size(LuftpdClient_t *client, const char *arg);
+int luftpd_handle_rest(LuftpdClient_t *client, const char *arg);
+int luftpd_handle_opts(LuftpdClient_t *client, const char *arg);
+int luftpd_handle_rang(LuftpdClient_t *client, const char *arg);
+int luftpd_handle_hash(LuftpdClient_t *client, const char *arg, uint64_t cmd);
 int luftpd_enter_pasv_mode(LuftpdClient_t *client);
+int luftpd_handle_epsv(LuftpdClient_t *client, const char *arg);
 int lufptd_create_data_connection(LuftpdClient_t *client);
 int lufptd_close_client(LuftpdClient_t *client);
 
+// 应答先写入连接的发送缓冲区，控制线程处理完一批命令后一次发送。缓冲区满时先发出已有内容，
+// 对端不读取应答、缓冲区腾不出空间时关闭连接
+static int luftpd_reply(LuftpdClient_t *client, const char *fmt, ...) {
+    for (;;) {
+        size_t room = sizeof(client->wbuf) - client->wbuf_len;
+        va_list args;
+        va_start(args, fmt);
+        int len = vsnprintf(client->wbuf + client->wbuf_len, room, fmt, args);
+        va_end(args);
+        if (len < 0) {
+            return -1;
+        }
+        if ((size_t)len + 2 <= room) {
+            memcpy(client->wbuf + client->wbuf_len + len, "\r\n", 2);
+            client->wbuf_len += (size_t)len + 2;
+            return 0;
+        }
+        if (client->wbuf_len == 0) {
+            // 单行超过整个缓冲区，截断
+            client->wbuf_len = sizeof(client->wbuf) - 2;
+            memcpy(client->wbuf + client->wbuf_len, "\r\n", 2);
+            client->wbuf_len += 2;
+            return 0;
+        }
+        int rc = luftpd_reply_flush(client);
+        if (rc < 0) {
+            return -1;
+        }
+        if (rc > 0 && sizeof(client->wbuf) - client->wbuf_len < (size_t)len + 2) {
+            client->is_active = 0;
+            return -1;
+        }
+    }
+}
+
+// 发送缓冲的应答，未发出的部分留在缓冲区。返回0表示已全部发出，1表示对端接收慢、仍有积压，
+// -1表示连接出错。控制连接是非阻塞的：控制线程不等待，由调用方关注可写事件；传输线程执行
+// 命令期间连接不在epoll中，在 data_timeout 内等待可写
+static int luftpd_reply_flush(LuftpdClient_t *client) {
+    size_t sent = 0;
+    int rc = 0;
+    while (sent < client->wbuf_len) {
+        ssize_t n = send(client->control_sock, client->wbuf + sent, client->wbuf_len - sent,
+                         MSG_NOSIGNAL);
+        if (n >= 0) {
+            sent += (size_t)n;
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            if (!client->busy) {
+                rc = 1;
+                break;
+            }
+            struct pollfd pfd = {.fd = client->control_sock, .events = POLLOUT};
+            int ready = poll(&pfd, 1, client->config->data_timeout * 1000);
+            if (ready > 0 || (ready < 0 && errno == EINTR)) {
+                continue;
+            }
+        }
+        rc = -1;
+        break;
+    }
+    if (rc < 0) {
+        client->wbuf_len = 0;
+        client->is_active = 0;
+        return -1;
+    }
+    client->wbuf_len -= sent;
+    memmove(client->wbuf, client->wbuf + sent, client->wbuf_len);
+    return rc;
+}
+
 // 处理CWD命令
 int luftpd_handle_cwd(LuftpdClient_t *client, const char *arg) {
-    char resolved_path[PATH_MAX];
-    
-    if (luftpd_resolve_path(client->config->root_dir, 
-                           client->current_dir, 
-                           arg, 
-                           resolved_path, 
-                           sizeof(resolved_path)) != 0) {
-        return luftpd_send_response(client->control_sock, "550 Failed to resolve path");
-    }
-    
-    // 检查目录是否存在
-    struct stat st;
-    if (stat(resolved_path, &st) != 0 || !S_ISDIR(st.st_mode)) {
-        return luftpd_send_response(client->control_sock, "550 Directory not found");
+    char vpath[PATH_MAX];
+    int fd = luftpd_path_open(client->cwd_fd, client->current_dir, arg,
+                              O_PATH | O_DIRECTORY, vpath, sizeof(vpath));
+    if (fd < 0) {
+        if (errno == ENOENT || errno == ENOTDIR) {
+            return luftpd_reply(client, "550 Directory not found");
+        }
+        return luftpd_reply(client, "550 Failed to resolve path");
     }
     
-    // 更新当前目录
-    // 计算相对于root_dir的路径
-    const char *relative_path = resolved_path + strlen(client->config->root_dir);
-    if (*relative_path == '\0') {
-        strcpy(client->current_dir, "/");
-    } else {
-        strncpy(client->current_dir, relative_path, PATH_MAX - 1);
-        client->current_dir[PATH_MAX - 1] = '\0';
+    // 更新当前目录，之后的相对路径从该描述符开始解析
+    if (client->cwd_fd >= 0) {
+        close(client->cwd_fd);
     }
+    client->cwd_fd = fd;
+    strcpy(client->current_dir, vpath);
     
-    return luftpd_send_response(client->control_sock, "250 Directory successfully changed");
+    return luftpd_reply(client, "250 Directory successfully changed");
 }
 
-
-
-// 处理LIST命令
-int luftpd_handle_list(LuftpdClient_t *client, const char *arg) {
-    char resolved_path[PATH_MAX];
-    
-    if (luftpd_resolve_path(client->config->root_dir, 
-                           client->current_dir, 
-                           arg, 
-                           resolved_path, 
-                           sizeof(resolved_path)) != 0) {
-        return luftpd_send_response(client->control_sock, "550 Failed to resolve path");
+// 处理LIST/NLST/MLSD命令
+// 列表整体生成后一次发送，同一目录的重复列表直接使用缓存
+int luftpd_handle_list(LuftpdClient_t *client, const char *arg, LuftpdListFormat_t format) {
+    char vpath[PATH_MAX];
+    int dir_fd = luftpd_path_open(client->cwd_fd, client->current_dir, arg,
+                                  O_RDONLY | O_DIRECTORY, vpath, sizeof(vpath));
+    if (dir_fd < 0) {
+        if (errno == ENOENT || errno == ENOTDIR) {
+            return luftpd_reply(client, "550 Directory not found");
+        }
+        return luftpd_reply(client, "550 Failed to resolve path");
     }
     
-    // 检查目录是否存在
-    struct stat st;
-    if (stat(resolved_path, &st) != 0 || !S_ISDIR(st.st_mode)) {
-        return luftpd_send_response(client->control_sock, "550 Directory not found");
+    // 缓存按主机上的目录路径索引
+    char host_path[PATH_MAX * 2];
+    snprintf(host_path, sizeof(host_path), "%s%s", client->config->root_dir, vpath);
+    char *listing = NULL;
+    size_t listing_len = 0;
+    int render_rc = luftpd_list_render(dir_fd, host_path, format, &listing, &listing_len);
+    close(dir_fd);
+    if (render_rc != 0) {
+        return luftpd_reply(client, "550 Failed to open directory");
     }
     
     // 建立数据连接
     if (lufptd_create_data_connection(client) != 0) {
-        return luftpd_send_response(client->control_sock, "425 Can't open data connection");
+        free(listing);
+        return luftpd_reply(client, "425 Can't open data connection");
     }
     
-    luftpd_send_response(client->control_sock, "150 Opening ASCII mode data connection for file list");
+    luftpd_reply(client, "150 Opening ASCII mode data connection for file list");
+    luftpd_reply_flush(client);
     
-    DIR *dir = opendir(resolved_path);
-    if (!dir) {
-        lufptd_close_client(client);
-        return luftpd_send_response(client->control_sock, "550 Failed to open directory");
-    }
-    
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
-        }
-        
-        char full_path[PATH_MAX];
-        snprintf(full_path, sizeof(full_path), "%s/%s", resolved_path, entry->d_name);
-        
-        if (stat(full_path, &st) != 0) {
-            continue;
-        }
-        
-        char listing[512];
-        char time_str[64];
-        struct tm *tm_info = localtime(&st.st_mtime);
-        strftime(time_str, sizeof(time_str), "%b %d %H:%M", tm_info);
-        
-        if (S_ISDIR(st.st_mode)) {
-            snprintf(listing, sizeof(listing), "drwxr-xr-x 1 ftp ftp %8ld %s %s\r\n", 
-                    st.st_size, time_str, entry->d_name);
-        } else {
-            snprintf(listing, sizeof(listing), "-rw-r--r-- 1 ftp ftp %8ld %s %s\r\n", 
-                    st.st_size, time_str, entry->d_name);
-        }
-        
-        send(client->data_sock, listing, strlen(listing), 0);
+    int rc;
+    if (client->mode_z) {
+        off_t sent = 0;
+        rc = luftpd_z_send_buf(client->data_sock, listing, listing_len, &sent);
+    } else {
+        rc = luftpd_send_raw(client->data_sock, listing, listing_len);
     }
-    
-    closedir(dir);
+    free(listing);
     close(client->data_sock);
     client->data_sock = -1;
     
-    return luftpd_send_response(client->control_sock, "226 Transfer complete");
+    if (rc != 0) {
+        return luftpd_reply(client, "426 Connection closed; transfer aborted");
+    }
+    return luftpd_reply(client, "226 Transfer complete");
 }
 
-// 处理RETR命令
-int luftpd_handle_retr(LuftpdClient_t *client, const char *arg) {
-    char resolved_path[PATH_MAX];
+// 处理MLST命令，单个条目的信息直接在控制连接上返回
+int luftpd_handle_mlst(LuftpdClient_t *client, const char *arg) {
+    int fd = luftpd_path_open(client->cwd_fd, client->current_dir, arg, O_PATH, NULL, 0);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        return luftpd_reply(client, "550 File not found");
+    }
+    close(fd);
     
-    if (luftpd_resolve_path(client->config->root_dir, 
-                           client->current_dir, 
-                           arg, 
-                           resolved_path, 
-                           sizeof(resolved_path)) != 0) {
-        return luftpd_send_response(client->control_sock, "550 Failed to resolve path");
+    char facts[128];
+    luftpd_list_facts(&st, facts, sizeof(facts));
+    const char *name = arg[0] ? arg : client->current_dir;
+    luftpd_reply(client, "250-Listing %s", name);
+    luftpd_reply(client, " %s %s", facts, name);
+    return luftpd_reply(client, "250 End");
+}
+
+// 记录一次文件传输：更新统计，写传输日志
+static void luftpd_account_xfer(LuftpdClient_t *client, char direction, const char *vpath,
+                                off_t bytes, const struct timespec *start, int code) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    LuftpdXferRec_t rec = {
+        .end = time(NULL),
+        .duration_ns = (uint64_t)(now.tv_sec - start->tv_sec) * 1000000000ULL +
+                       (uint64_t)now.tv_nsec - (uint64_t)start->tv_nsec,
+        .bytes = bytes,
+        .addr = client->client_addr.sin_addr,
+        .code = code,
+        .direction = direction,
+        .type = client->transfer_type == LUFTPD_TRANSFER_TYPE_ASCII ? 'a' : 'b',
+    };
+    // 记录定长，过深的路径截断，末尾标上"..."以便日志使用者分辨
+    if (snprintf(rec.path, sizeof(rec.path), "%s", vpath) >= (int)sizeof(rec.path)) {
+        memcpy(rec.path + sizeof(rec.path) - 4, "...", 4);
     }
+    luftpd_stats_xfer(&rec);
+}
+
+// 处理RETR命令
+int luftpd_handle_retr(LuftpdClient_t *client, const char *arg) {
+    // REST 断点只对紧随其后的一次传输有效
+    off_t offset = client->restart_offset;
+    client->restart_offset = 0;
     
-    // 检查文件是否存在
+    // 先打开文件再建立数据连接，检查的和发送的是同一个文件
+    char vpath[PATH_MAX];
+    int fd = luftpd_path_open(client->cwd_fd, client->current_dir, arg, O_RDONLY,
+                              vpath, sizeof(vpath));
     struct stat st;
-    if (stat(resolved_path, &st) != 0 || !S_ISREG(st.st_mode)) {
-        return luftpd_send_response(client->control_sock, "550 File not found");
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) close(fd);
+        return luftpd_reply(client, "550 File not found");
+    }
+    if (offset > st.st_size) {
+        close(fd);
+        return luftpd_reply(client, "554 Invalid REST parameter");
     }
     
     // 建立数据连接
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
     if (lufptd_create_data_connection(client) != 0) {
-        return luftpd_send_response(client->control_sock, "425 Can't open data connection");
+        close(fd);
+        luftpd_account_xfer(client, 'o', vpath, 0, &start, 425);
+        return luftpd_reply(client, "425 Can't open data connection");
     }
     
-    luftpd_send_response(client->control_sock, "150 Opening data connection for file transfer");
-    
-    FILE *file = fopen(resolved_path, "rb");
-    if (!file) {
-        lufptd_close_client(client);
-        return luftpd_send_response(client->control_sock, "550 Failed to open file");
+    const char *kind = "";
+    if (client->mode_z) {
+        kind = "compressed ";
+    } else if (client->transfer_type == LUFTPD_TRANSFER_TYPE_ASCII) {
+        kind = "ASCII mode ";
     }
+    luftpd_reply(client, "150 Opening %sdata connection for file transfer (%lld bytes)", kind,
+                 (long long)(st.st_size - offset));
+    // 150 须在数据开始前送达，不能等到传输结束后由控制线程统一发送
+    luftpd_reply_flush(client);
     
-    char buffer[4096];
-    size_t bytes_read;
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
-        if (send(client->data_sock, buffer, bytes_read, 0) < 0) {
-            break;
-        }
+    off_t sent = 0;
+    uint64_t throttled_before = client->shape.throttled_ns;
+    LuftpdShape_t *shape = luftpd_shape_enabled() ? &client->shape : NULL;
+    int rc;
+    if (client->mode_z) {
+        rc = luftpd_z_send_file(client->data_sock, fd, &st, offset, shape, &sent);
+    } else if (client->transfer_type == LUFTPD_TRANSFER_TYPE_ASCII) {
+        rc = luftpd_send_file_ascii(client->data_sock, fd, offset, st.st_size - offset, shape,
+                                    &sent);
+    } else {
+        rc = luftpd_send_file(client->data_sock, fd, offset, st.st_size - offset, shape, &sent);
+    }
+    uint64_t throttled = client->shape.throttled_ns - throttled_before;
+    if (throttled > 0) {
+        luftpd_stats_throttled(throttled);
+        char peer[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client->client_addr.sin_addr, peer, sizeof(peer));
+        dlt_log_info(LUCPD_APPID, "RETR %s to %s: %lld bytes, throttled %llu ms (client total %llu ms)",
+                     arg, peer, (long long)sent,
+                     (unsigned long long)(throttled / 1000000),
+                     (unsigned long long)(luftpd_shape_ip_throttled_ns(&client->shape) / 1000000));
     }
     
-    fclose(file);
+    close(fd);
     close(client->data_sock);
     client->data_sock = -1;
     
-    return luftpd_send_response(client->control_sock, "226 Transfer complete");
+    if (rc == LUFTPD_XFER_ERR_READ) {
+        luftpd_account_xfer(client, 'o', vpath, sent, &start, 451);
+        return luftpd_reply(client, "451 Local error in processing");
+    }
+    if (rc == LUFTPD_XFER_ERR_SEND) {
+        luftpd_account_xfer(client, 'o', vpath, sent, &start, 426);
+        return luftpd_reply(client, "426 Connection closed; transfer aborted");
+    }
+    luftpd_account_xfer(client, 'o', vpath, sent, &start, 226);
+    return luftpd_reply(client, "226 Transfer complete");
+}
+
+// 在目标目录中创建上传用的临时文件，传输完成后再改名为 name，半截文件不会以正式文件名出现
+static int luftpd_open_upload_tmp(LuftpdClient_t *client, const char *arg, int *dir_fd,
+                                  char *name, size_t name_sz, char *tmp, size_t tmp_sz) {
+    const char *slash = strrchr(arg, '/');
+    const char *base = slash ? slash + 1 : arg;
+    char dir[PATH_MAX];
+    if (!slash) {
+        strcpy(dir, ".");
+    } else if (slash == arg) {
+        strcpy(dir, "/");
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - arg), arg);
+    }
+    if (base[0] == '\0' || strcmp(base, ".") == 0 || strcmp(base, "..") == 0 ||
+        snprintf(name, name_sz, "%s", base) >= (int)name_sz ||
+        snprintf(tmp, tmp_sz, ".%s.luftpd-%u", base, client->index) >= (int)tmp_sz) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *dir_fd = luftpd_path_open(client->cwd_fd, client->current_dir, dir, O_PATH | O_DIRECTORY,
+                               NULL, 0);
+    if (*dir_fd < 0) {
+        return -1;
+    }
+    // 同一会话上次异常中断可能留下同名临时文件，先删掉
+    unlinkat(*dir_fd, tmp, 0);
+    int fd = openat(*dir_fd, tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+                    LUFTPD_PATH_FILE_MODE);
+    if (fd < 0) {
+        int saved = errno;
+        close(*dir_fd);
+        *dir_fd = -1;
+        errno = saved;
+    }
+    return fd;
+}
+
+// 释放 ALLO 预分配在文件末尾之后、未被写入的块，文件内容不变
+static void luftpd_drop_prealloc(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && ftruncate(fd, st.st_size) != 0) {
+        dlt_log_error(LUCPD_APPID, "Failed to release preallocated space: %s", strerror(errno));
+    }
+}
+
+// 处理STOR/APPE命令
+// STOR 写入临时文件，完成后改名覆盖目标；APPE 和 REST 之后的 STOR 是续传，直接写目标文件
+int luftpd_handle_stor(LuftpdClient_t *client, const char *arg, int append) {
+    off_t offset = client->restart_offset;
+    off_t alloc = client->alloc_size;
+    client->restart_offset = 0;
+    client->alloc_size = 0;
+    if (arg[0] == '\0') {
+        return luftpd_reply(client, "501 Missing file name");
+    }
+    if (client->mode_z) {
+        return luftpd_reply(client, "504 Uploads are not supported in MODE Z");
+    }
+
+    char vpath[PATH_MAX];
+    if (luftpd_path_normalize(client->current_dir, arg, vpath, sizeof(vpath)) != 0) {
+        return luftpd_reply(client, "553 Could not create file");
+    }
+
+    int dir_fd = -1;
+    int fd;
+    char name[NAME_MAX + 1];
+    char tmp[NAME_MAX + 1];
+    if (append || offset > 0) {
+        fd = luftpd_path_open(client->cwd_fd, client->current_dir, arg, O_WRONLY | O_CREAT,
+                              NULL, 0);
+    } else {
+        fd = luftpd_open_upload_tmp(client, arg, &dir_fd, name, sizeof(name), tmp, sizeof(tmp));
+    }
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) close(fd);
+        return luftpd_reply(client, "553 Could not create file");
+    }
+    if (append) {
+        offset = st.st_size;
+    } else if (offset > st.st_size) {
+        close(fd);
+        return luftpd_reply(client, "554 Invalid REST parameter");
+    }
+
+    // 大小已知时一次分配好空间：文件在磁盘上连续，空间不足也能在传输开始前发现。
+    // 不改变文件大小，传输失败时文件末尾不会留下填充的零
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int rc = LUFTPD_XFER_OK;
+    if (alloc > 0 && fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, alloc) != 0 &&
+        (errno == ENOSPC || errno == EDQUOT)) {
+        rc = LUFTPD_XFER_ERR_WRITE;
+    } else if (lufptd_create_data_connection(client) != 0) {
+        rc = LUFTPD_XFER_ERR_RECV;
+    }
+    if (rc != LUFTPD_XFER_OK) {
+        if (alloc > 0 && dir_fd < 0) {
+            luftpd_drop_prealloc(fd);
+        }
+        close(fd);
+        if (dir_fd >= 0) {
+            unlinkat(dir_fd, tmp, 0);
+            close(dir_fd);
+        }
+        if (rc == LUFTPD_XFER_ERR_WRITE) {
+            luftpd_account_xfer(client, 'i', vpath, 0, &start, 452);
+            return luftpd_reply(client, "452 Insufficient storage space");
+        }
+        luftpd_account_xfer(client, 'i', vpath, 0, &start, 425);
+        return luftpd_reply(client, "425 Can't open data connection");
+    }
+
+    luftpd_reply(client, "150 Ok to send data");
+    luftpd_reply_flush(client);
+
+    LuftpdStorSync_t sync = client->config->stor_sync;
+    off_t window = 0;
+    if (sync == LUFTPD_STOR_SYNC_PERIODIC) {
+        window = (off_t)client->config->stor_sync_mb << 20;
+    }
+    off_t received = 0;
+    rc = luftpd_recv_file(client->data_sock, fd, offset, window, &received);
+    int err = errno;
+    close(client->data_sock);
+    client->data_sock = -1;
+
+    if (rc == LUFTPD_XFER_OK) {
+        // 预分配超出实际大小的部分截掉；REST 续传时目标文件原有的尾部也一并去掉
+        if ((alloc > 0 || !append) && ftruncate(fd, offset + received) != 0) {
+            rc = LUFTPD_XFER_ERR_WRITE;
+            err = errno;
+        } else if (sync != LUFTPD_STOR_SYNC_NONE && fdatasync(fd) != 0) {
+            rc = LUFTPD_XFER_ERR_WRITE;
+            err = errno;
+        }
+    } else if (alloc > 0 && dir_fd < 0) {
+        luftpd_drop_prealloc(fd);
+    }
+    close(fd);
+    if (dir_fd >= 0) {
+        if (rc == LUFTPD_XFER_OK && renameat(dir_fd, tmp, dir_fd, name) != 0) {
+            rc = LUFTPD_XFER_ERR_WRITE;
+            err = errno;
+        }
+        if (rc != LUFTPD_XFER_OK) {
+            unlinkat(dir_fd, tmp, 0);
+        } else if (sync != LUFTPD_STOR_SYNC_NONE) {
+            // 改名记录在目录里，目录也要落盘
+            int dfd = openat(dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (dfd >= 0) {
+                fsync(dfd);
+                close(dfd);
+            }
+        }
+        close(dir_fd);
+    }
+
+    if (rc != LUFTPD_XFER_OK) {
+        char peer[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client->client_addr.sin_addr, peer, sizeof(peer));
+        dlt_log_error(LUCPD_APPID, "%s %s from %s failed after %lld bytes: %s",
+                      append ? "APPE" : "STOR", arg, peer, (long long)received, strerror(err));
+    }
+    int code = 226;
+    const char *text = "Transfer complete";
+    if (rc == LUFTPD_XFER_ERR_WRITE && (err == ENOSPC || err == EDQUOT)) {
+        code = 452;
+        text = "Insufficient storage space";
+    } else if (rc == LUFTPD_XFER_ERR_WRITE && err == EISDIR) {
+        code = 553;
+        text = "Could not create file";
+    } else if (rc == LUFTPD_XFER_ERR_WRITE) {
+        code = 451;
+        text = "Local error in processing";
+    } else if (rc == LUFTPD_XFER_ERR_RECV) {
+        code = 426;
+        text = "Connection closed; transfer aborted";
+    }
+    luftpd_account_xfer(client, 'i', vpath, received, &start, code);
+    return luftpd_reply(client, "%d %s", code, text);
 }
 
 // 处理SYST命令
 int luftpd_handle_syst(LuftpdClient_t *client, const char *arg) {
-    return luftpd_send_response(client->control_sock, "215 UNIX Type: L8");
+    return luftpd_reply(client, "215 UNIX Type: L8");
 }
 
 // 处理TYPE命令
 int luftpd_handle_type(LuftpdClient_t *client, const char *arg) {
     if (strcasecmp(arg, "A") == 0 || strcasecmp(arg, "ASCII") == 0) {
         client->transfer_type = LUFTPD_TRANSFER_TYPE_ASCII;
-        return luftpd_send_response(client->control_sock, "200 Switching to ASCII mode");
+        return luftpd_reply(client, "200 Switching to ASCII mode");
     } else if (strcasecmp(arg, "I") == 0 || strcasecmp(arg, "BINARY") == 0) {
         client->transfer_type = LUFTPD_TRANSFER_TYPE_BINARY;
-        return luftpd_send_response(client->control_sock, "200 Switching to Binary mode");
+        return luftpd_reply(client, "200 Switching to Binary mode");
     } else {
-        return luftpd_send_response(client->control_sock, "500 Unrecognized TYPE command");
+        return luftpd_reply(client, "500 Unrecognized TYPE command");
+    }
+}
+
+// 处理MODE命令，支持流模式和 deflate 压缩模式
+int luftpd_handle_mode(LuftpdClient_t *client, const char *arg) {
+    if (strcasecmp(arg, "S") == 0) {
+        client->mode_z = 0;
+        return luftpd_reply(client, "200 Mode set to S");
+    } else if (strcasecmp(arg, "Z") == 0) {
+        client->mode_z = 1;
+        return luftpd_reply(client, "200 Mode set to Z");
+    } else {
+        return luftpd_reply(client, "504 Unsupported transfer mode");
     }
 }
 
 // 处理FEAT命令
 int luftpd_handle_feat(LuftpdClient_t *client, const char *arg) {
-    luftpd_send_response(client->control_sock, "211-Features:");
-    luftpd_send_response(client->control_sock, " PASV");
-    luftpd_send_response(client->control_sock, " SIZE");
-    luftpd_send_response(client->control_sock, "211 End");
+    luftpd_reply(client, "211-Features:");
+    luftpd_reply(client, " PASV");
+    luftpd_reply(client, " EPSV");
+    luftpd_reply(client, " SIZE");
+    luftpd_reply(client, " MODE Z");
+    luftpd_reply(client, " REST STREAM");
+    luftpd_reply(client, " MLST type*;size*;modify*;perm*;");
+    // 列出全部摘要算法，当前会话选中的加 *
+    char algs[128];
+    size_t len = 0;
+    for (int i = 0; i < LUFTPD_HASH_COUNT && len < sizeof(algs); i++) {
+        len += (size_t)snprintf(algs + len, sizeof(algs) - len, "%s%s%s", i ? ";" : "",
+                                luftpd_hash_name((LuftpdHashAlg_t)i),
+                                i == (int)client->hash_alg ? "*" : "");
+    }
+    luftpd_reply(client, " HASH %s", algs);
+    luftpd_reply(client, " RANG STREAM");
+    luftpd_reply(client, " XCRC");
+    luftpd_reply(client, " XSHA256");
+    luftpd_reply(client, "211 End");
     return 0;
 }
 
 // 处理SIZE命令
 int luftpd_handle_size(LuftpdClient_t *client, const char *arg) {
-    char resolved_path[PATH_MAX];
-    
-    if (luftpd_resolve_path(client->config->root_dir, 
-                           client->current_dir, 
-                           arg, 
-                           resolved_path, 
-                           sizeof(resolved_path)) != 0) {
-        return luftpd_send_response(client->control_sock, "550 Failed to resolve path");
+    int fd = luftpd_path_open(client->cwd_fd, client->current_dir, arg, O_PATH, NULL, 0);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) close(fd);
+        return luftpd_reply(client, "550 File not found");
     }
+    close(fd);
     
+    return luftpd_reply(client, "213 %ld", st.st_size);
+}
+
+// 处理OPTS命令，目前只支持 OPTS HASH [算法]：查询或选择 HASH 命令使用的算法
+int luftpd_handle_opts(LuftpdClient_t *client, const char *arg) {
+    if (strncasecmp(arg, "HASH", 4) != 0 || (arg[4] != '\0' && arg[4] != ' ')) {
+        return luftpd_reply(client, "501 Option not understood");
+    }
+    if (arg[4] == ' ') {
+        int alg = luftpd_hash_parse(arg + 5);
+        if (alg < 0) {
+            return luftpd_reply(client, "504 Unknown hash algorithm");
+        }
+        client->hash_alg = (LuftpdHashAlg_t)alg;
+    }
+    return luftpd_reply(client, "200 %s", luftpd_hash_name(client->hash_alg));
+}
+
+// 处理RANG命令：RANG <起点> <终点>，两端都包含在内，只对下一次 HASH 有效。
+// RANG 1 0 取消已设置的区间
+int luftpd_handle_rang(LuftpdClient_t *client, const char *arg) {
+    char *end = NULL;
+    long long first = -1;
+    long long last = -1;
+    errno = 0;
+    if (arg[0] >= '0' && arg[0] <= '9') {
+        first = strtoll(arg, &end, 10);
+        if (end[0] == ' ' && end[1] >= '0' && end[1] <= '9') {
+            last = strtoll(end + 1, &end, 10);
+        }
+    }
+    if (last < 0 || *end != '\0' || errno != 0) {
+        return luftpd_reply(client, "501 Invalid RANG argument");
+    }
+    if (first == 1 && last == 0) {
+        client->range_start = client->range_end = 0;
+        return luftpd_reply(client, "350 Range reset");
+    }
+    if (last < first) {
+        return luftpd_reply(client, "501 Invalid RANG argument");
+    }
+    client->range_start = (off_t)first;
+    client->range_end = (off_t)last + 1;
+    return luftpd_reply(client, "350 Range set to %lld-%lld", first, last);
+}
+
+// XCRC/XSHA256 的参数：文件名 [起点 [终点]]，区间为 [起点, 终点)，省略终点表示到文件末尾。
+// 文件名含空格时用双引号括起；不加引号时末尾的一到两个数字视为区间
+static int luftpd_parse_xhash_arg(const char *arg, char *path, size_t path_sz, off_t *start,
+                                  off_t *end) {
+    const char *rest;
+    if (arg[0] == '"') {
+        const char *quote = strchr(arg + 1, '"');
+        if (!quote) {
+            return -1;
+        }
+        snprintf(path, path_sz, "%.*s", (int)(quote - arg - 1), arg + 1);
+        rest = quote + 1;
+    } else {
+        rest = arg + strlen(arg);
+        for (int k = 0; k < 2; k++) {
+            const char *token = rest;
+            while (token > arg && token[-1] != ' ') {
+                token--;
+            }
+            if (token == arg || token == rest ||
+                strspn(token, "0123456789") != (size_t)(rest - token)) {
+                break;
+            }
+            rest = token - 1;
+        }
+        snprintf(path, path_sz, "%.*s", (int)(rest - arg), arg);
+    }
+
+    off_t *bounds[2] = {start, end};
+    *start = 0;
+    *end = -1;
+    for (int k = 0; k < 2 && rest[0] == ' '; k++) {
+        char *next;
+        errno = 0;
+        long long v = strtoll(rest + 1, &next, 10);
+        if (next == rest + 1 || errno != 0 || v < 0) {
+            return -1;
+        }
+        *bounds[k] = (off_t)v;
+        rest = next;
+    }
+    return rest[0] == '\0' ? 0 : -1;
+}
+
+// 处理HASH/XCRC/XSHA256命令。摘要可能要读完整个大文件，和数据命令一样在传输线程执行
+int luftpd_handle_hash(LuftpdClient_t *client, const char *arg, uint64_t cmd) {
+    char path[PATH_MAX];
+    off_t start;
+    off_t end;
+    LuftpdHashAlg_t alg;
+    if (cmd == LUFTPD_CMD('H', 'A', 'S', 'H')) {
+        alg = client->hash_alg;
+        start = client->range_start;
+        end = client->range_end ? client->range_end : -1;
+        client->range_start = client->range_end = 0;
+        snprintf(path, sizeof(path), "%s", arg);
+    } else {
+        alg = cmd == LUFTPD_CMD('X', 'C', 'R', 'C') ? LUFTPD_HASH_CRC32 : LUFTPD_HASH_SHA256;
+        if (luftpd_parse_xhash_arg(arg, path, sizeof(path), &start, &end) != 0) {
+            return luftpd_reply(client, "501 Invalid argument");
+        }
+    }
+    if (path[0] == '\0') {
+        return luftpd_reply(client, "501 Missing file name");
+    }
+
+    int fd = luftpd_path_open(client->cwd_fd, client->current_dir, path, O_RDONLY, NULL, 0);
     struct stat st;
-    if (stat(resolved_path, &st) != 0 || !S_ISREG(st.st_mode)) {
-        return luftpd_send_response(client->control_sock, "550 File not found");
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) close(fd);
+        return luftpd_reply(client, "550 File not found");
     }
-    
-    return luftpd_send_response(client->control_sock, "213 %ld", st.st_size);
+    if (end < 0) {
+        end = st.st_size;
+    }
+    if (start > end || end > st.st_size) {
+        close(fd);
+        return luftpd_reply(client, "501 Invalid range");
+    }
+    char hex[LUFTPD_HASH_HEX_SIZE];
+    int rc = luftpd_hash_file(fd, &st, alg, start, end, hex);
+    close(fd);
+    if (rc != 0) {
+        return luftpd_reply(client, "451 Local error in processing");
+    }
+
+    if (cmd == LUFTPD_CMD('H', 'A', 'S', 'H')) {
+        // 区间同 RANG 的写法，终点包含在内
+        return luftpd_reply(client, "213 %s %lld-%lld %s %s", luftpd_hash_name(alg),
+                            (long long)start, (long long)(end > start ? end - 1 : start), hex,
+                            path);
+    }
+    if (alg == LUFTPD_HASH_CRC32) {
+        // XCRC 习惯用大写
+        for (char *p = hex; *p; p++) {
+            *p = (char)toupper((unsigned char)*p);
+        }
+    }
+    return luftpd_reply(client, "250 %s", hex);
 }
 
-// 进入PASV模式
-int luftpd_enter_pasv_mode(LuftpdClient_t *client) {
+// 处理ALLO命令，记下大小供下一次上传预分配空间
+int luftpd_handle_allo(LuftpdClient_t *client, const char *arg) {
+    if (!client->config->allow_upload) {
+        return luftpd_reply(client, "550 Permission denied");
+    }
+    // ALLO <size> [R <record-size>]，只取文件大小
+    char *end;
+    errno = 0;
+    long long size = strtoll(arg, &end, 10);
+    if (arg[0] < '0' || arg[0] > '9' || (*end != '\0' && *end != ' ') || errno != 0) {
+        return luftpd_reply(client, "501 Invalid ALLO argument");
+    }
+    client->alloc_size = (off_t)size;
+    return luftpd_reply(client, "200 ALLO command successful");
+}
+
+// 处理REST命令
+// 客户端可用多个会话各自 REST 到不同偏移后 RETR，取够所需的区间即关闭数据连接，
+// 以此并行分段下载大文件
+int luftpd_handle_rest(LuftpdClient_t *client, const char *arg) {
+    char *end;
+    errno = 0;
+    long long offset = strtoll(arg, &end, 10);
+    if (arg[0] < '0' || arg[0] > '9' || *end != '\0' || errno != 0) {
+        return luftpd_reply(client, "501 Invalid REST argument");
+    }
+    client->restart_offset = (off_t)offset;
+    return luftpd_reply(client, "350 Restarting at %lld. Send RETR to initiate transfer", offset);
+}
+
+// 分配数据端口并开始监听，返回端口号
+static int luftpd_open_pasv(LuftpdClient_t *client) {
     // 关闭之前的PASV socket
     if (client->pasv_sock != -1) {
-        close(client->pasv_sock);
+        luftpd_pasv_close(client->pasv_sock, client->pasv_port);
         client->pasv_sock = -1;
     }
     
-    // 创建PASV socket
-    client->pasv_sock = socket(AF_INET, SOCK_STREAM, 0);
+    client->pasv_sock = luftpd_pasv_open(&client->pasv_port);
     if (client->pasv_sock < 0) {
+        luftpd_stats_pasv_failed();
         return -1;
     }
-    
-    // 设置SO_REUSEADDR
-    int reuse = 1;
-    setsockopt(client->pasv_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-    
-    // 绑定到随机端口
-    struct sockaddr_in pasv_addr;
-    memset(&pasv_addr, 0, sizeof(pasv_addr));
-    pasv_addr.sin_family = AF_INET;
-    pasv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    
-    // 在配置的端口范围内尝试绑定
-    int port;
-    for (port = client->config->data_port_min; port <= client->config->data_port_max; port++) {
-        pasv_addr.sin_port = htons(port);
-        if (bind(client->pasv_sock, (struct sockaddr*)&pasv_addr, sizeof(pasv_addr)) == 0) {
-            break;
-        }
-    }
-    
-    if (port > client->config->data_port_max) {
-        close(client->pasv_sock);
-        client->pasv_sock = -1;
-        return -1;
+    return client->pasv_port;
+}
+
+// 进入PASV模式
+int luftpd_enter_pasv_mode(LuftpdClient_t *client) {
+    if (client->epsv_all) {
+        return luftpd_reply(client, "501 PASV not allowed after EPSV ALL");
     }
-    
-    if (listen(client->pasv_sock, 1) < 0) {
-        close(client->pasv_sock);
-        client->pasv_sock = -1;
-        return -1;
+    int port = luftpd_open_pasv(client);
+    if (port < 0) {
+        return luftpd_reply(client, "425 Can't open passive connection");
     }
     
-    // 获取服务器IP（简化处理，使用配置的IP）
+    // 监听全部地址时用控制连接的本端地址，客户端连得到的一定是它
     uint32_t ip = inet_addr(client->config->ip);
-    if (ip == INADDR_NONE) {
-        ip = htonl(INADDR_ANY);
+    if (ip == INADDR_NONE || ip == htonl(INADDR_ANY)) {
+        struct sockaddr_in local;
+        socklen_t local_len = sizeof(local);
+        if (getsockname(client->control_sock, (struct sockaddr*)&local, &local_len) == 0) {
+            ip = local.sin_addr.s_addr;
+        }
     }
     
     unsigned char *ip_bytes = (unsigned char*)&ip;
     
     // 发送PASV响应
-    luftpd_send_response(client->control_sock, 
-                        "227 Entering Passive Mode (%d,%d,%d,%d,%d,%d)",
+    return luftpd_reply(client, "227 Entering Passive Mode (%d,%d,%d,%d,%d,%d)",
                         ip_bytes[0], ip_bytes[1], ip_bytes[2], ip_bytes[3],
                         port >> 8, port & 0xFF);
-    
-    return 0;
+}
+
+// 处理EPSV命令（RFC 2428），只回复端口，客户端沿用控制连接的地址
+int luftpd_handle_epsv(LuftpdClient_t *client, const char *arg) {
+    if (strcasecmp(arg, "ALL") == 0) {
+        client->epsv_all = 1;
+        return luftpd_reply(client, "200 EPSV ALL ok");
+    }
+    // 只监听IPv4
+    if (arg[0] != '\0' && strcmp(arg, "1") != 0) {
+        return luftpd_reply(client, "522 Network protocol not supported, use (1)");
+    }
+    int port = luftpd_open_pasv(client);
+    if (port < 0) {
+        return luftpd_reply(client, "425 Can't open passive connection");
+    }
+    return luftpd_reply(client, "229 Entering Extended Passive Mode (|||%d|)", port);
 }
 
 // 创建数据连接
@@ -300,29 +832,34 @@ int lufptd_create_data_connection(LuftpdClient_t *client) {
         return -1;
     }
     
-    // 设置非阻塞并接受连接
-    struct timeval tv;
-    tv.tv_sec = 10;
-    tv.tv_usec = 0;
-    
-    fd_set readfds;
-    FD_ZERO(&readfds);
-    FD_SET(client->pasv_sock, &readfds);
-    
-    int result = select(client->pasv_sock + 1, &readfds, NULL, NULL, &tv);
+    // 等待客户端连接，最多10秒。连接数多时描述符会超过FD_SETSIZE，不能用select
+    struct pollfd pfd = {.fd = client->pasv_sock, .events = POLLIN};
+    int result;
+    do {
+        result = poll(&pfd, 1, 10000);
+    } while (result < 0 && errno == EINTR);
     if (result <= 0) {
         return -1;
     }
     
     struct sockaddr_in client_addr;
     socklen_t client_len = sizeof(client_addr);
-    client->data_sock = accept(client->pasv_sock, (struct sockaddr*)&client_addr, &client_len);
+    client->data_sock = accept4(client->pasv_sock, (struct sockaddr*)&client_addr, &client_len,
+                                SOCK_CLOEXEC);
     
-    // 关闭PASV socket
-    close(client->pasv_sock);
+    // 归还数据端口
+    luftpd_pasv_close(client->pasv_sock, client->pasv_port);
     client->pasv_sock = -1;
-    
-    return client->data_sock >= 0 ? 0 : -1;
+    if (client->data_sock < 0) {
+        return -1;
+    }
+
+    // 对端停止收发时 send/recv/sendfile/splice 超时返回 EAGAIN，传输以失败结束，
+    // 否则一个停滞的客户端会一直占住传输线程
+    struct timeval tv = {.tv_sec = client->config->data_timeout};
+    setsockopt(client->data_sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    setsockopt(client->data_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return 0;
 }
 
 // 关闭客户端连接
@@ -336,101 +873,472 @@ int lufptd_close_client(LuftpdClient_t *client) {
         client->data_sock = -1;
     }
     if (client->pasv_sock != -1) {
-        close(client->pasv_sock);
+        luftpd_pasv_close(client->pasv_sock, client->pasv_port);
         client->pasv_sock = -1;
     }
+    if (client->cwd_fd != -1) {
+        close(client->cwd_fd);
+        client->cwd_fd = -1;
+    }
     
     client->is_active = 0;
     return 0;
 }
 
-// 处理客户端连接的线程函数
-void *luftpd_handle_client(void *arg) {
-    LuftpdClient_t *client = (LuftpdClient_t *)arg;
-    char buffer[1024];
-    
-    // 发送欢迎消息
-    luftpd_send_response(client->control_sock, "220 Welcome to Luftpd FTP Server");
-    
-    while (client->is_active) {
-        int bytes_received = recv(client->control_sock, buffer, sizeof(buffer) - 1, 0);
-        if (bytes_received <= 0) {
-            break;
+// ================================ 传输线程 ===========================
+
+// 传输队列和完成队列，按连接下标串成链表
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t todo_head, todo_tail;  /* 等待传输线程执行的连接 */
+    uint32_t done_head, done_tail;  /* 已执行完、等待控制线程恢复的连接 */
+    int wake_fd;                    /* 通知控制线程有连接执行完 */
+} g_xfer = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .todo_head = LUFTPD_CONN_NONE, .todo_tail = LUFTPD_CONN_NONE,
+    .done_head = LUFTPD_CONN_NONE, .done_tail = LUFTPD_CONN_NONE,
+    .wake_fd = -1
+};
+
+static void xfer_append(uint32_t *head, uint32_t *tail, LuftpdClient_t *client) {
+    client->next = LUFTPD_CONN_NONE;
+    if (*tail != LUFTPD_CONN_NONE) {
+        luftpd_conn_at(*tail)->next = client->index;
+    } else {
+        *head = client->index;
+    }
+    *tail = client->index;
+}
+
+// 传输线程：执行需要数据连接的命令，期间阻塞在等待数据连接和发送上
+static void *luftpd_xfer_thread(void *arg) {
+    (void)arg;
+    luftpd_stats_thread_init();
+    for (;;) {
+        pthread_mutex_lock(&g_xfer.lock);
+        while (g_xfer.todo_head == LUFTPD_CONN_NONE) {
+            pthread_cond_wait(&g_xfer.cond, &g_xfer.lock);
         }
-        
-        buffer[bytes_received] = '\0';
-        
-        char command[16];
-        char argument[256];
-        
-        if (luftpd_parse_command(buffer, command, argument) != 0) {
-            luftpd_send_response(client->control_sock, "500 Syntax error");
-            continue;
+        LuftpdClient_t *client = luftpd_conn_at(g_xfer.todo_head);
+        g_xfer.todo_head = client->next;
+        if (g_xfer.todo_head == LUFTPD_CONN_NONE) {
+            g_xfer.todo_tail = LUFTPD_CONN_NONE;
         }
-        
-        // 处理命令
-        if (strcmp(command, "USER") == 0) {
-            luftpd_send_response(client->control_sock, "331 User name okay, need password");
-        } else if (strcmp(command, "PASS") == 0) {
-            luftpd_send_response(client->control_sock, "230 User logged in, proceed");
-        } else if (strcmp(command, "SYST") == 0) {
-            luftpd_handle_syst(client, argument);
-        } else if (strcmp(command, "FEAT") == 0) {
-            luftpd_handle_feat(client, argument);
-        } else if (strcmp(command, "PWD") == 0 || strcmp(command, "XPWD") == 0) {
-            luftpd_send_response(client->control_sock, "257 \"%s\"", client->current_dir);
-        } else if (strcmp(command, "CWD") == 0) {
-            luftpd_handle_cwd(client, argument);
-        } else if (strcmp(command, "TYPE") == 0) {
-            luftpd_handle_type(client, argument);
-        } else if (strcmp(command, "PASV") == 0) {
-            luftpd_enter_pasv_mode(client);
-        } else if (strcmp(command, "LIST") == 0 || strcmp(command, "NLST") == 0) {
-            luftpd_handle_list(client, argument);
-        } else if (strcmp(command, "RETR") == 0) {
-            luftpd_handle_retr(client, argument);
-        } else if (strcmp(command, "SIZE") == 0) {
-            luftpd_handle_size(client, argument);
-        } else if (strcmp(command, "QUIT") == 0) {
-            luftpd_send_response(client->control_sock, "221 Goodbye");
+        pthread_mutex_unlock(&g_xfer.lock);
+
+        switch (client->xfer_cmd) {
+        case LUFTPD_CMD('R', 'E', 'T', 'R'):
+            luftpd_handle_retr(client, client->xfer_arg);
+            break;
+        case LUFTPD_CMD('S', 'T', 'O', 'R'):
+            luftpd_handle_stor(client, client->xfer_arg, 0);
+            break;
+        case LUFTPD_CMD('A', 'P', 'P', 'E'):
+            luftpd_handle_stor(client, client->xfer_arg, 1);
+            break;
+        case LUFTPD_CMD('N', 'L', 'S', 'T'):
+            luftpd_handle_list(client, client->xfer_arg, LUFTPD_LIST_NAMES);
+            break;
+        case LUFTPD_CMD('M', 'L', 'S', 'D'):
+            luftpd_handle_list(client, client->xfer_arg, LUFTPD_LIST_MLSD);
+            break;
+        case LUFTPD_CMD('H', 'A', 'S', 'H'):
+        case LUFTPD_CMD('X', 'C', 'R', 'C'):
+        case LUFTPD_CMD8('X', 'S', 'H', 'A', '2', '5', '6', 0):
+            luftpd_handle_hash(client, client->xfer_arg, client->xfer_cmd);
+            break;
+        default:
+            luftpd_handle_list(client, client->xfer_arg, LUFTPD_LIST_LS);
             break;
-        } else {
-            luftpd_send_response(client->control_sock, "502 Command not implemented");
+        }
+
+        pthread_mutex_lock(&g_xfer.lock);
+        xfer_append(&g_xfer.done_head, &g_xfer.done_tail, client);
+        pthread_mutex_unlock(&g_xfer.lock);
+        uint64_t one = 1;
+        if (write(g_xfer.wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            dlt_log_error(LUCPD_APPID, "Failed to wake control thread: %s", strerror(errno));
         }
     }
-    
-    // 清理客户端资源
+    return NULL;
+}
+
+// ================================ 控制线程 ===========================
+
+#define LUFTPD_MAX_EVENTS  256
+#define LUFTPD_LISTEN_TAG  (UINT64_MAX - 1)
+#define LUFTPD_WAKE_TAG    UINT64_MAX
+
+static int g_epfd = -1;
+
+static void luftpd_conn_close(LuftpdClient_t *client) {
+    if (client->shape.throttled_ns > 0) {
+        char peer[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client->client_addr.sin_addr, peer, sizeof(peer));
+        dlt_log_info(LUCPD_APPID, "Session from %s throttled %llu ms in total", peer,
+                     (unsigned long long)(client->shape.throttled_ns / 1000000));
+    }
+    luftpd_shape_detach(&client->shape);
+    luftpd_stats_session_close();
+    // 关闭套接字时内核自动将其移出epoll
     lufptd_close_client(client);
-    
-    // 从全局客户端列表中移除
-    pthread_mutex_lock(&g_clients_mutex);
-    for (int i = 0; i < g_client_count; i++) {
-        if (g_clients[i].thread_id == client->thread_id) {
-            // 移动数组元素
-            for (int j = i; j < g_client_count - 1; j++) {
-                g_clients[j] = g_clients[j + 1];
+    luftpd_conn_free(client);
+}
+
+// 应答有积压时只关注可写，不再读取新命令；积压发完后恢复读取
+static void luftpd_conn_backlog(LuftpdClient_t *client, int backlog) {
+    if (client->backlog == backlog) {
+        return;
+    }
+    client->backlog = backlog;
+    struct epoll_event ev = {.events = backlog ? EPOLLOUT : EPOLLIN,
+                             .data.u64 = luftpd_conn_tag(client)};
+    epoll_ctl(g_epfd, EPOLL_CTL_MOD, client->control_sock, &ev);
+}
+
+// 把命令名原地转成大写并打包。标准命令不超过4个字符，XSHA256 这类扩展命令最长7个，
+// 超过8个字符的返回0
+static uint64_t luftpd_cmd_code(char *name) {
+    uint64_t code = 0;
+    size_t i;
+    for (i = 0; name[i] != '\0'; i++) {
+        if (i == 8) {
+            return 0;
+        }
+        name[i] = (char)toupper((unsigned char)name[i]);
+        code = (code << 8) | (uint8_t)name[i];
+    }
+    return code << (8 * (8 - i));
+}
+
+// 执行一条命令，返回-1表示需要关闭连接，返回1表示已交给传输线程
+static int luftpd_dispatch(LuftpdClient_t *client, uint64_t cmd, const char *argument) {
+    switch (cmd) {
+    case LUFTPD_CMD('U', 'S', 'E', 'R'):
+        luftpd_reply(client, "331 User name okay, need password");
+        break;
+    case LUFTPD_CMD('P', 'A', 'S', 'S'):
+        luftpd_reply(client, "230 User logged in, proceed");
+        break;
+    case LUFTPD_CMD('S', 'Y', 'S', 'T'):
+        luftpd_handle_syst(client, argument);
+        break;
+    case LUFTPD_CMD('F', 'E', 'A', 'T'):
+        luftpd_handle_feat(client, argument);
+        break;
+    case LUFTPD_CMD('P', 'W', 'D', 0):
+    case LUFTPD_CMD('X', 'P', 'W', 'D'):
+        luftpd_reply(client, "257 \"%s\"", client->current_dir);
+        break;
+    case LUFTPD_CMD('C', 'W', 'D', 0):
+        luftpd_handle_cwd(client, argument);
+        break;
+    case LUFTPD_CMD('T', 'Y', 'P', 'E'):
+        luftpd_handle_type(client, argument);
+        break;
+    case LUFTPD_CMD('M', 'O', 'D', 'E'):
+        luftpd_handle_mode(client, argument);
+        break;
+    case LUFTPD_CMD('P', 'A', 'S', 'V'):
+        luftpd_enter_pasv_mode(client);
+        break;
+    case LUFTPD_CMD('E', 'P', 'S', 'V'):
+        luftpd_handle_epsv(client, argument);
+        break;
+    case LUFTPD_CMD('L', 'I', 'S', 'T'):
+    case LUFTPD_CMD('N', 'L', 'S', 'T'):
+    case LUFTPD_CMD('M', 'L', 'S', 'D'):
+    case LUFTPD_CMD('R', 'E', 'T', 'R'):
+    case LUFTPD_CMD('S', 'T', 'O', 'R'):
+    case LUFTPD_CMD('A', 'P', 'P', 'E'):
+    case LUFTPD_CMD('H', 'A', 'S', 'H'):
+    case LUFTPD_CMD('X', 'C', 'R', 'C'):
+    case LUFTPD_CMD8('X', 'S', 'H', 'A', '2', '5', '6', 0): {
+        if ((cmd == LUFTPD_CMD('S', 'T', 'O', 'R') || cmd == LUFTPD_CMD('A', 'P', 'P', 'E')) &&
+            !client->config->allow_upload) {
+            luftpd_reply(client, "550 Permission denied");
+            break;
+        }
+        // 数据命令可能持续很久，交给传输线程，完成前不再读取该连接的命令。
+        // 交出前先尽量发出已缓冲的应答，之后发送缓冲区归传输线程使用，未发完的部分由它
+        // 连同后续应答一起发送。
+        // 期间把连接移出epoll：事件掩码为0时EPOLLHUP/EPOLLERR仍会上报，对端在传输中
+        // 断开会让控制线程反复被唤醒
+        if (luftpd_reply_flush(client) < 0) {
+            return -1;
+        }
+        client->xfer_cmd = cmd;
+        snprintf(client->xfer_arg, sizeof(client->xfer_arg), "%s", argument);
+        client->busy = 1;
+        epoll_ctl(g_epfd, EPOLL_CTL_DEL, client->control_sock, NULL);
+        pthread_mutex_lock(&g_xfer.lock);
+        xfer_append(&g_xfer.todo_head, &g_xfer.todo_tail, client);
+        pthread_cond_signal(&g_xfer.cond);
+        pthread_mutex_unlock(&g_xfer.lock);
+        return 1;
+    }
+    case LUFTPD_CMD('M', 'L', 'S', 'T'):
+        luftpd_handle_mlst(client, argument);
+        break;
+    case LUFTPD_CMD('S', 'I', 'Z', 'E'):
+        luftpd_handle_size(client, argument);
+        break;
+    case LUFTPD_CMD('R', 'E', 'S', 'T'):
+        luftpd_handle_rest(client, argument);
+        break;
+    case LUFTPD_CMD('A', 'L', 'L', 'O'):
+        luftpd_handle_allo(client, argument);
+        break;
+    case LUFTPD_CMD('O', 'P', 'T', 'S'):
+        luftpd_handle_opts(client, argument);
+        break;
+    case LUFTPD_CMD('R', 'A', 'N', 'G'):
+        luftpd_handle_rang(client, argument);
+        break;
+    case LUFTPD_CMD('A', 'B', 'O', 'R'):
+        // 传输期间不处理命令，收到ABOR时已没有进行中的传输
+        client->restart_offset = 0;
+        luftpd_reply(client, "226 ABOR command successful");
+        break;
+    case LUFTPD_CMD('N', 'O', 'O', 'P'):
+        luftpd_reply(client, "200 NOOP ok");
+        break;
+    case LUFTPD_CMD('Q', 'U', 'I', 'T'):
+        luftpd_reply(client, "221 Goodbye");
+        return -1;
+    default:
+        luftpd_reply(client, "502 Command not implemented");
+        break;
+    }
+    return client->is_active ? 0 : -1;
+}
+
+// 逐行处理缓冲区中的全部完整命令，客户端可以连续发送多条命令。命令行原地切分，
+// 处理完一批后才搬移剩余的半行，应答也在这时一次发出。应答积压超过半个缓冲区且发不出去时
+// 暂停，剩余命令留在缓冲区，等连接可写后继续。返回-1表示连接已关闭
+static int luftpd_process_commands(LuftpdClient_t *client) {
+    size_t start = 0;
+    int rc = 0;
+    while (!client->busy) {
+        if (client->wbuf_len > sizeof(client->wbuf) / 2) {
+            int wrc = luftpd_reply_flush(client);
+            if (wrc != 0) {
+                rc = wrc < 0 ? -1 : 0;
+                break;
+            }
+        }
+        char *line = client->rbuf + start;
+        char *eol = memchr(line, '\n', client->rbuf_len - start);
+        if (!eol) {
+            if (start == 0 && client->rbuf_len == sizeof(client->rbuf)) {
+                luftpd_reply(client, "500 Command line too long");
+                client->rbuf_len = 0;
             }
-            g_client_count--;
+            break;
+        }
+        start = (size_t)(eol - client->rbuf) + 1;
+        *eol = '\0';
+        if (eol > line && eol[-1] == '\r') {
+            eol[-1] = '\0';
+        }
+        char *argument = strchr(line, ' ');
+        if (argument) {
+            *argument++ = '\0';
+        } else {
+            argument = eol;
+        }
+
+        if (line[0] == '\0') {
+            continue;
+        }
+        if (luftpd_dispatch(client, luftpd_cmd_code(line), argument) < 0) {
+            rc = -1;
             break;
         }
     }
-    pthread_mutex_unlock(&g_clients_mutex);
-    
-    return NULL;
+
+    if (start > 0 && rc == 0) {
+        client->rbuf_len -= start;
+        memmove(client->rbuf, client->rbuf + start, client->rbuf_len);
+    }
+    if (!client->busy) {
+        // 数据命令已交给传输线程时应答在交出前发过，此时缓冲区归传输线程。
+        // 即将关闭的连接（QUIT）也尽量发出最后的应答
+        int wrc = luftpd_reply_flush(client);
+        if (wrc < 0) {
+            rc = -1;
+        } else if (rc == 0) {
+            luftpd_conn_backlog(client, wrc);
+        }
+    }
+    if (rc < 0) {
+        luftpd_conn_close(client);
+    }
+    return rc;
+}
+
+static void luftpd_on_readable(LuftpdClient_t *client) {
+    for (;;) {
+        size_t room = sizeof(client->rbuf) - client->rbuf_len;
+        ssize_t n = recv(client->control_sock, client->rbuf + client->rbuf_len, room, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (n <= 0) {
+            luftpd_conn_close(client);
+            return;
+        }
+        client->rbuf_len += (size_t)n;
+        if (luftpd_process_commands(client) < 0 || client->busy || client->backlog) {
+            return;
+        }
+    }
+}
+
+// 积压的应答发完后恢复读取，先处理暂停时留在缓冲区中的命令
+static void luftpd_on_writable(LuftpdClient_t *client) {
+    int rc = luftpd_reply_flush(client);
+    if (rc < 0) {
+        luftpd_conn_close(client);
+        return;
+    }
+    if (rc > 0) {
+        return;
+    }
+    luftpd_conn_backlog(client, 0);
+    if (luftpd_process_commands(client) == 0 && !client->busy && !client->backlog) {
+        luftpd_on_readable(client);
+    }
+}
+
+// 传输线程执行完的连接恢复读取命令，并处理期间已到达的命令
+static void luftpd_on_xfer_done(void) {
+    uint64_t v;
+    while (read(g_xfer.wake_fd, &v, sizeof(v)) < 0 && errno == EINTR)
+        ;
+    pthread_mutex_lock(&g_xfer.lock);
+    uint32_t idx = g_xfer.done_head;
+    g_xfer.done_head = g_xfer.done_tail = LUFTPD_CONN_NONE;
+    pthread_mutex_unlock(&g_xfer.lock);
+
+    while (idx != LUFTPD_CONN_NONE) {
+        LuftpdClient_t *client = luftpd_conn_at(idx);
+        idx = client->next;
+        client->busy = 0;
+        if (!client->is_active) {
+            luftpd_conn_close(client);
+            continue;
+        }
+        client->backlog = 0;
+        struct epoll_event ev = {.events = EPOLLIN, .data.u64 = luftpd_conn_tag(client)};
+        if (epoll_ctl(g_epfd, EPOLL_CTL_ADD, client->control_sock, &ev) < 0) {
+            perror("epoll_ctl");
+            luftpd_conn_close(client);
+            continue;
+        }
+        if (luftpd_process_commands(client) == 0 && !client->busy && !client->backlog) {
+            luftpd_on_readable(client);
+        }
+    }
+}
+
+static void luftpd_on_accept(int server_sock) {
+    for (;;) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_sock = accept4(server_sock, (struct sockaddr*)&client_addr, &client_len,
+                                  SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_sock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept");
+            }
+            return;
+        }
+
+        // 控制连接上的应答都很短，关闭Nagle，避免150/226等相邻应答被延迟确认拖住约40ms
+        int nodelay = 1;
+        setsockopt(client_sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+        LuftpdClient_t *client = luftpd_conn_alloc();
+        if (!client) {
+            luftpd_send_response(client_sock, "421 Too many connections, try again later");
+            close(client_sock);
+            continue;
+        }
+
+        // 初始化客户端结构
+        client->control_sock = client_sock;
+        client->data_sock = -1;
+        client->pasv_sock = -1;
+        client->client_addr = client_addr;
+        client->is_active = 1;
+        client->transfer_type = LUFTPD_TRANSFER_TYPE_BINARY;
+        strcpy(client->current_dir, "/");
+        client->cwd_fd = -1;
+        client->config = &g_luftpd_config;
+        luftpd_shape_attach(&client->shape, client_addr.sin_addr);
+        luftpd_stats_session_open();
+
+        struct epoll_event ev = {.events = EPOLLIN, .data.u64 = luftpd_conn_tag(client)};
+        if (epoll_ctl(g_epfd, EPOLL_CTL_ADD, client_sock, &ev) < 0) {
+            perror("epoll_ctl");
+            luftpd_conn_close(client);
+            continue;
+        }
+        luftpd_reply(client, "220 Welcome to Luftpd FTP Server");
+        int rc = luftpd_reply_flush(client);
+        if (rc < 0) {
+            luftpd_conn_close(client);
+            continue;
+        }
+        luftpd_conn_backlog(client, rc);
+        printf("Client connected: %s:%d\n",
+               inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+    }
 }
 
 // 启动FTP服务器
+//
+// 单个控制线程用epoll处理所有控制连接，空闲连接只占用连接表中的一个槽位；
+// 需要数据连接的命令交给固定数量的传输线程执行。
 int luftpd_start_server() {
-    // 加载配置
-    if (luftpd_cfg_load_with_file(&g_luftpd_config, LUFTPD_DEFAULT_CONFIG_FILE) != 0) {
-        printf("Using default configuration\n");
-    }
-    
     // 创建根目录
     mkdir(g_luftpd_config.root_dir, 0755);
+    if (luftpd_path_init(g_luftpd_config.root_dir) != 0) {
+        perror("open root_dir");
+        return -1;
+    }
+    if (luftpd_pasv_init(&g_luftpd_config) != 0) {
+        perror("data port range");
+        return -1;
+    }
+    if (luftpd_z_init(g_luftpd_config.zcache_dir, g_luftpd_config.zcache_max_mb) != 0) {
+        dlt_log_error(LUCPD_APPID, "MODE Z cache dir %s unavailable, compressing on the fly only: %s",
+                      g_luftpd_config.zcache_dir, strerror(errno));
+    }
+    luftpd_shape_init(g_luftpd_config.rate_limit_global, g_luftpd_config.rate_limit_per_ip,
+                      g_luftpd_config.rate_limit_per_session);
+    // 控制线程也记录统计（会话数、PASV失败）
+    luftpd_stats_thread_init();
+    if (luftpd_stats_init(g_luftpd_config.xferlog, g_luftpd_config.stats_socket) != 0) {
+        dlt_log_error(LUCPD_APPID, "xferlog %s or stats socket %s unavailable: %s",
+                      g_luftpd_config.xferlog, g_luftpd_config.stats_socket, strerror(errno));
+    }
+    if (luftpd_hash_init(g_luftpd_config.hash_index) != 0) {
+        dlt_log_error(LUCPD_APPID, "Digest index %s unavailable, caching in memory only: %s",
+                      g_luftpd_config.hash_index, strerror(errno));
+    }
     
     // 创建服务器socket
-    int server_sock = socket(AF_INET, SOCK_STREAM, 0);
+    int server_sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (server_sock < 0) {
         perror("socket");
         return -1;
@@ -453,8 +1361,8 @@ int luftpd_start_server() {
         return -1;
     }
     
-    // 监听
-    if (listen(server_sock, g_luftpd_config.max_connections) < 0) {
+    // 监听，空闲连接不再占用线程，积压队列按系统上限设置
+    if (listen(server_sock, SOMAXCONN) < 0) {
         perror("listen");
         close(server_sock);
         return -1;
@@ -463,61 +1371,70 @@ int luftpd_start_server() {
     printf("FTP server started on %s:%d\n", g_luftpd_config.ip, g_luftpd_config.port);
     printf("Root directory: %s\n", g_luftpd_config.root_dir);
     
-    // 初始化客户端数组
-    g_clients = malloc(g_luftpd_config.max_connections * sizeof(LuftpdClient_t));
-    if (!g_clients) {
+    // 初始化连接表和事件循环
+    g_epfd = epoll_create1(EPOLL_CLOEXEC);
+    g_xfer.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event ev = {.events = EPOLLIN, .data.u64 = LUFTPD_LISTEN_TAG};
+    struct epoll_event wake = {.events = EPOLLIN, .data.u64 = LUFTPD_WAKE_TAG};
+    if (luftpd_conn_init(g_luftpd_config.max_connections) != 0 || g_epfd < 0 || g_xfer.wake_fd < 0 ||
+        epoll_ctl(g_epfd, EPOLL_CTL_ADD, server_sock, &ev) < 0 ||
+        epoll_ctl(g_epfd, EPOLL_CTL_ADD, g_xfer.wake_fd, &wake) < 0) {
+        perror("epoll");
         close(server_sock);
         return -1;
     }
+
+    // 列表缓存不可用时每次重新扫描目录
+    if (luftpd_list_init() != 0) {
+        dlt_log_error(LUCPD_APPID, "inotify unavailable, directory listings are not cached: %s",
+                      strerror(errno));
+    }
+
+    // 启动传输线程
+    for (int i = 0; i < g_luftpd_config.transfer_threads; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, luftpd_xfer_thread, NULL) != 0) {
+            perror("pthread_create");
+            close(server_sock);
+            return -1;
+        }
+        pthread_detach(tid);
+    }
     
     // 主循环
+    struct epoll_event events[LUFTPD_MAX_EVENTS];
     while (1) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
-        
-        int client_sock = accept(server_sock, (struct sockaddr*)&client_addr, &client_len);
-        if (client_sock < 0) {
-            perror("accept");
-            continue;
-        }
-        
-        pthread_mutex_lock(&g_clients_mutex);
-        
-        if (g_client_count >= g_luftpd_config.max_connections) {
-            luftpd_send_response(client_sock, "421 Too many connections, try again later");
-            close(client_sock);
-            pthread_mutex_unlock(&g_clients_mutex);
-            continue;
+        int n = epoll_wait(g_epfd, events, LUFTPD_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
         }
-        
-        // 初始化客户端结构
-        LuftpdClient_t *client = &g_clients[g_client_count];
-        memset(client, 0, sizeof(LuftpdClient_t));
-        client->control_sock = client_sock;
-        client->data_sock = -1;
-        client->pasv_sock = -1;
-        client->client_addr = client_addr;
-        client->is_active = 1;
-        client->transfer_type = LUFTPD_TRANSFER_TYPE_BINARY;
-        strcpy(client->current_dir, "/");
-        client->config = &g_luftpd_config;
-        
-        // 创建线程处理客户端
-        pthread_t thread_id;
-        if (pthread_create(&thread_id, NULL, luftpd_handle_client, client) == 0) {
-            client->thread_id = (int)thread_id;
-            g_client_count++;
-            printf("Client connected: %s:%d\n", 
-                   inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
-        } else {
-            close(client_sock);
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.u64 == LUFTPD_LISTEN_TAG) {
+                luftpd_on_accept(server_sock);
+            } else if (events[i].data.u64 == LUFTPD_WAKE_TAG) {
+                luftpd_on_xfer_done();
+            } else {
+                // 同一批事件中前面的处理可能已关闭该连接，按代数校验
+                LuftpdClient_t *client = luftpd_conn_get(events[i].data.u64);
+                if (!client || client->busy) {
+                    continue;
+                }
+                if (client->backlog) {
+                    luftpd_on_writable(client);
+                } else {
+                    luftpd_on_readable(client);
+                }
+            }
         }
-        
-        pthread_mutex_unlock(&g_clients_mutex);
     }
     
     close(server_sock);
-    free(g_clients);
+    close(g_epfd);
+    luftpd_conn_shutdown();
     return 0;
 }
 
@@ -529,6 +1446,9 @@ int main(int argc, char *argv[]) {
 
     dlt_init_client(LUCPD_APPID);
 
+    // 客户端中途断开数据连接时发送返回EPIPE，而不是终止进程
+    signal(SIGPIPE, SIG_IGN);
+
     const char *config_file = LUFTPD_DEFAULT_CONFIG_FILE;
     if (argc > 1) {
         config_file = argv[1];
@@ -0,0 +1,160 @@
+#include "luftpd_ascii.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+typedef size_t (*AsciiEncodeFn_t)(const char* in, size_t len, char* out, char prev);
+
+static struct
+{
+    pthread_once_t once;
+    AsciiEncodeFn_t encode;
+    const char* name;
+} g_ascii = {.once = PTHREAD_ONCE_INIT};
+
+// 在 in[i] 处的换行前补 CR，前一个字节已经是 CR 时不补
+#define NEED_CR(in, i, prev) (((i) ? (in)[(i) - 1] : (prev)) != '\r')
+
+// 用 memchr 找换行，两个换行之间整段拷贝
+static size_t encode_memchr(const char* in, size_t len, char* out, char prev)
+{
+    size_t i = 0;
+    size_t o = 0;
+    while (i < len)
+    {
+        const char* nl = memchr(in + i, '\n', len - i);
+        size_t seg     = nl ? (size_t) (nl - in) - i : len - i;
+        memcpy(out + o, in + i, seg);
+        o += seg;
+        i += seg;
+        if (!nl)
+            break;
+        if (NEED_CR(in, i, prev))
+            out[o++] = '\r';
+        out[o++] = '\n';
+        i++;
+    }
+    return o;
+}
+
+#if defined(__x86_64__)
+// 每次检查 16 字节。没有换行的块整块写出；有换行时按换行切段，每段不超过一个向量宽，
+// 整向量写出后只前移段长，多写的字节被后续写入覆盖。读取 in[start, start + 16) 要求
+// start + 16 <= len，所以主循环留出一个向量宽的余量，余下部分交给 memchr 版本
+static size_t encode_sse2(const char* in, size_t len, char* out, char prev)
+{
+    const __m128i lf = _mm_set1_epi8('\n');
+    size_t i         = 0;
+    size_t o         = 0;
+    while (i + 32 <= len)
+    {
+        __m128i v  = _mm_loadu_si128((const __m128i*) (in + i));
+        unsigned m = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, lf));
+        if (m == 0)
+        {
+            _mm_storeu_si128((__m128i*) (out + o), v);
+            i += 16;
+            o += 16;
+            continue;
+        }
+        size_t start = i;
+        while (m)
+        {
+            size_t pos = i + (size_t) __builtin_ctz(m);
+            m &= m - 1;
+            _mm_storeu_si128((__m128i*) (out + o), _mm_loadu_si128((const __m128i*) (in + start)));
+            o += pos - start;
+            if (NEED_CR(in, pos, prev))
+                out[o++] = '\r';
+            out[o++] = '\n';
+            start    = pos + 1;
+        }
+        _mm_storeu_si128((__m128i*) (out + o), _mm_loadu_si128((const __m128i*) (in + start)));
+        o += i + 16 - start;
+        i += 16;
+    }
+    return o + encode_memchr(in + i, len - i, out + o, i ? in[i - 1] : prev);
+}
+
+// 拷贝 64 字节，两个换行之间的一段不超过它
+__attribute__((target("avx2"))) static inline void copy64(char* dst, const char* src)
+{
+    _mm256_storeu_si256((__m256i*) dst, _mm256_loadu_si256((const __m256i*) src));
+    _mm256_storeu_si256((__m256i*) (dst + 32), _mm256_loadu_si256((const __m256i*) (src + 32)));
+}
+
+// 同 encode_sse2，每次检查 64 字节：两次 32 字节比较拼成一个64位掩码，一般的日志行在
+// 一个块内至多一个换行，块越大按块计的开销占比越小
+__attribute__((target("avx2"))) static size_t encode_avx2(const char* in, size_t len, char* out,
+                                                         char prev)
+{
+    const __m256i lf = _mm256_set1_epi8('\n');
+    size_t i         = 0;
+    size_t o         = 0;
+    while (i + 128 <= len)
+    {
+        __m256i lo  = _mm256_loadu_si256((const __m256i*) (in + i));
+        __m256i hi  = _mm256_loadu_si256((const __m256i*) (in + i + 32));
+        uint64_t m0 = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, lf));
+        uint64_t m1 = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, lf));
+        uint64_t m  = m0 | (m1 << 32);
+        size_t start = i;
+        while (m)
+        {
+            size_t pos = i + (size_t) __builtin_ctzll(m);
+            m &= m - 1;
+            copy64(out + o, in + start);
+            o += pos - start;
+            if (NEED_CR(in, pos, prev))
+                out[o++] = '\r';
+            out[o++] = '\n';
+            start    = pos + 1;
+        }
+        copy64(out + o, in + start);
+        o += i + 64 - start;
+        i += 64;
+    }
+    return o + encode_sse2(in + i, len - i, out + o, i ? in[i - 1] : prev);
+}
+#endif
+
+static void pick_kernel(void)
+{
+    g_ascii.encode = encode_memchr;
+    g_ascii.name   = "scalar";
+#if defined(__x86_64__)
+    // SSE2 是 x86-64 的基线指令集
+    g_ascii.encode = encode_sse2;
+    g_ascii.name   = "sse2";
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        g_ascii.encode = encode_avx2;
+        g_ascii.name   = "avx2";
+    }
+#endif
+}
+
+void luftpd_ascii_init(LuftpdAscii_t* st, char prev)
+{
+    pthread_once(&g_ascii.once, pick_kernel);
+    st->last = prev;
+}
+
+size_t luftpd_ascii_encode(LuftpdAscii_t* st, const char* in, size_t len, char* out)
+{
+    if (len == 0)
+        return 0;
+    size_t n = g_ascii.encode(in, len, out, st->last);
+    st->last = in[len - 1];
+    return n;
+}
+
+const char* luftpd_ascii_kernel(void)
+{
+    pthread_once(&g_ascii.once, pick_kernel);
+    return g_ascii.name;
+}
@@ -0,0 +1,31 @@
+#ifndef LUFTPD_ASCII_H
+#define LUFTPD_ASCII_H
+#include <stddef.h>
+
+// 转换 len 字节输入所需的输出缓冲区大小：最坏情况每个字节都是换行，另留向量写越界的余量
+#define LUFTPD_ASCII_OUT_SIZE(len) ((len) * 2 + 64)
+
+// ASCII 模式（TYPE A）的换行转换
+//
+// 下载时把文件中的 LF 转为网络标准的 CRLF，已经是 CRLF 的保持不变。按块流式转换，
+// 块之间只需记住上一块的最后一个字节。内核按向量宽度查找换行符，没有换行的整块
+// 直接搬运；x86 上运行时选择 AVX2 或 SSE2，其它平台用 memchr 逐段拷贝。
+
+typedef struct
+{
+    char last; // 已转换部分的最后一个输入字节
+} LuftpdAscii_t;
+
+/// @brief 开始一次转换
+/// @param prev 转换起点之前的一个字节（断点续传时），从文件开头转换时传0
+void luftpd_ascii_init(LuftpdAscii_t* st, char prev);
+
+/// @brief 转换一块数据
+/// @param out 至少 LUFTPD_ASCII_OUT_SIZE(len) 字节
+/// @return 写入 out 的字节数
+size_t luftpd_ascii_encode(LuftpdAscii_t* st, const char* in, size_t len, char* out);
+
+/// @brief 当前使用的转换内核名称："avx2"、"sse2" 或 "scalar"
+const char* luftpd_ascii_kernel(void);
+
+#endif // LUFTPD_ASCII_H
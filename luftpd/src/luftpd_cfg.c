@@ -16,14 +16,22 @@ int luftpd_cfg_load_with_file(LuftpdConfig_t* cfg, const char* config_file)
     }
 
     // 解析配置项
-    if (lucfg_get_string(handle, "server", "ip", (const char **)&cfg->ip) != LUCFG_OK) {
+    const char *ip = NULL;
+    if (lucfg_get_string(handle, "server", "ip", &ip) == LUCFG_OK && ip) {
+        strncpy(cfg->ip, ip, sizeof(cfg->ip) - 1);
+        cfg->ip[sizeof(cfg->ip) - 1] = '\0';
+    } else {
         strcpy(cfg->ip, LUFTPD_DEFAULT_IP);
     }
     if (lucfg_get_uint16(handle, "server", "port", &cfg->port) != LUCFG_OK) {
         cfg->port = LUFTPD_DEFAULT_PORT;
     }
 
-    if (lucfg_get_string(handle, "server", "root_dir", (const char **)&cfg->root_dir) != LUCFG_OK) {
+    const char *root_dir = NULL;
+    if (lucfg_get_string(handle, "server", "root_dir", &root_dir) == LUCFG_OK && root_dir) {
+        strncpy(cfg->root_dir, root_dir, sizeof(cfg->root_dir) - 1);
+        cfg->root_dir[sizeof(cfg->root_dir) - 1] = '\0';
+    } else {
         strcpy(cfg->root_dir, LUFTPD_DEFAULT_ROOT_DIR);
     }
 
@@ -39,6 +47,80 @@ int luftpd_cfg_load_with_file(LuftpdConfig_t* cfg, const char* config_file)
         cfg->data_port_max = LUFTPD_DEFAULT_DATA_PORT_MAX;
     }
 
+    if (lucfg_get_int32(handle, "server", "transfer_threads", &cfg->transfer_threads) != LUCFG_OK ||
+        cfg->transfer_threads < 1 || cfg->transfer_threads > 256) {
+        cfg->transfer_threads = LUFTPD_DEFAULT_TRANSFER_THREADS;
+    }
+
+    if (lucfg_get_int32(handle, "server", "data_timeout", &cfg->data_timeout) != LUCFG_OK ||
+        cfg->data_timeout < 1) {
+        cfg->data_timeout = LUFTPD_DEFAULT_DATA_TIMEOUT;
+    }
+
+    if (lucfg_get_int32(handle, "server", "pasv_prebind", &cfg->pasv_prebind) != LUCFG_OK) {
+        cfg->pasv_prebind = 0;
+    }
+
+    if (lucfg_get_int32(handle, "server", "allow_upload", &cfg->allow_upload) != LUCFG_OK) {
+        cfg->allow_upload = 0;
+    }
+
+    if (lucfg_get_int32(handle, "server", "rate_limit_global", &cfg->rate_limit_global) != LUCFG_OK ||
+        cfg->rate_limit_global < 0) {
+        cfg->rate_limit_global = 0;
+    }
+    if (lucfg_get_int32(handle, "server", "rate_limit_per_ip", &cfg->rate_limit_per_ip) != LUCFG_OK ||
+        cfg->rate_limit_per_ip < 0) {
+        cfg->rate_limit_per_ip = 0;
+    }
+    if (lucfg_get_int32(handle, "server", "rate_limit_per_session",
+                        &cfg->rate_limit_per_session) != LUCFG_OK ||
+        cfg->rate_limit_per_session < 0) {
+        cfg->rate_limit_per_session = 0;
+    }
+
+    const char *zcache_dir = NULL;
+    if (lucfg_get_string(handle, "server", "zcache_dir", &zcache_dir) == LUCFG_OK && zcache_dir) {
+        strncpy(cfg->zcache_dir, zcache_dir, sizeof(cfg->zcache_dir) - 1);
+        cfg->zcache_dir[sizeof(cfg->zcache_dir) - 1] = '\0';
+    }
+    if (lucfg_get_int32(handle, "server", "zcache_max_mb", &cfg->zcache_max_mb) != LUCFG_OK ||
+        cfg->zcache_max_mb < 1) {
+        cfg->zcache_max_mb = LUFTPD_DEFAULT_ZCACHE_MAX_MB;
+    }
+
+    const char *stor_sync = NULL;
+    if (lucfg_get_string(handle, "server", "stor_sync", &stor_sync) == LUCFG_OK && stor_sync) {
+        if (strcmp(stor_sync, "none") == 0) {
+            cfg->stor_sync = LUFTPD_STOR_SYNC_NONE;
+        } else if (strcmp(stor_sync, "periodic") == 0) {
+            cfg->stor_sync = LUFTPD_STOR_SYNC_PERIODIC;
+        } else {
+            cfg->stor_sync = LUFTPD_STOR_SYNC_CLOSE;
+        }
+    }
+    if (lucfg_get_int32(handle, "server", "stor_sync_mb", &cfg->stor_sync_mb) != LUCFG_OK ||
+        cfg->stor_sync_mb < 1) {
+        cfg->stor_sync_mb = LUFTPD_DEFAULT_STOR_SYNC_MB;
+    }
+
+    const char *xferlog = NULL;
+    if (lucfg_get_string(handle, "server", "xferlog", &xferlog) == LUCFG_OK && xferlog) {
+        strncpy(cfg->xferlog, xferlog, sizeof(cfg->xferlog) - 1);
+        cfg->xferlog[sizeof(cfg->xferlog) - 1] = '\0';
+    }
+    const char *stats_socket = NULL;
+    if (lucfg_get_string(handle, "server", "stats_socket", &stats_socket) == LUCFG_OK &&
+        stats_socket) {
+        strncpy(cfg->stats_socket, stats_socket, sizeof(cfg->stats_socket) - 1);
+        cfg->stats_socket[sizeof(cfg->stats_socket) - 1] = '\0';
+    }
+    const char *hash_index = NULL;
+    if (lucfg_get_string(handle, "server", "hash_index", &hash_index) == LUCFG_OK && hash_index) {
+        strncpy(cfg->hash_index, hash_index, sizeof(cfg->hash_index) - 1);
+        cfg->hash_index[sizeof(cfg->hash_index) - 1] = '\0';
+    }
+
     lucfg_close(handle);
     return 0;
 }
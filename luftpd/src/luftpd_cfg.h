@@ -3,6 +3,9 @@
 #include <stdint.h>
 #include <limits.h>
 #include <netinet/in.h>
+#include <sys/types.h>
+#include "luftpd_hash.h"
+#include "luftpd_shape.h"
 
 #define LUFTPD_DEFAULT_CONFIG_FILE "/etc/luftpd.conf"
 
@@ -12,7 +15,26 @@
 #define LUFTPD_DEFAULT_MAX_CONNECTIONS 10
 #define LUFTPD_DEFAULT_DATA_PORT_MIN 30000
 #define LUFTPD_DEFAULT_DATA_PORT_MAX 30100
+#define LUFTPD_DEFAULT_TRANSFER_THREADS 8
+#define LUFTPD_DEFAULT_DATA_TIMEOUT 60
+#define LUFTPD_DEFAULT_ZCACHE_DIR   "/var/cache/luftpd"
+#define LUFTPD_DEFAULT_ZCACHE_MAX_MB 1024
+#define LUFTPD_DEFAULT_STOR_SYNC    LUFTPD_STOR_SYNC_CLOSE
+#define LUFTPD_DEFAULT_STOR_SYNC_MB 8
+#define LUFTPD_DEFAULT_XFERLOG      "/var/log/luftpd.xferlog"
+#define LUFTPD_DEFAULT_STATS_SOCKET "/run/luftpd.stats"
+#define LUFTPD_DEFAULT_HASH_INDEX   "/var/cache/luftpd/digests.idx"
 
+// 控制连接的命令接收缓冲区大小
+#define LUFTPD_CMD_BUF_SIZE 1024
+#define LUFTPD_REPLY_BUF_SIZE 2048
+
+// 上传文件的持久化方式
+typedef enum {
+    LUFTPD_STOR_SYNC_NONE = 0,     /* 不主动刷盘，由内核择机回写 */
+    LUFTPD_STOR_SYNC_CLOSE = 1,    /* 接收完成后 fdatasync，再改名为正式文件名 */
+    LUFTPD_STOR_SYNC_PERIODIC = 2  /* 接收中按窗口 sync_file_range 回写，完成后同 CLOSE */
+} LuftpdStorSync_t;
 
 typedef struct {
     char ip[16];
@@ -21,6 +43,20 @@ typedef struct {
     int max_connections;
     int data_port_min;
     int data_port_max;
+    int transfer_threads;   /* 执行数据传输命令的线程数 */
+    int data_timeout;       /* 数据连接上收发停滞多少秒后放弃传输，释放传输线程 */
+    int pasv_prebind;       /* 启动时为数据端口范围内的每个端口预先绑定监听套接字 */
+    int allow_upload;       /* 允许 STOR/APPE/ALLO。登录不校验口令，默认只读 */
+    int rate_limit_global;  /* 下载限速 KB/s，0 不限：全部会话合计 */
+    int rate_limit_per_ip;  /* 同一客户端 IP 的全部会话合计 */
+    int rate_limit_per_session; /* 单个会话 */
+    char zcache_dir[256];   /* MODE Z 压缩缓存目录，空串表示不缓存 */
+    int zcache_max_mb;      /* 压缩缓存总大小上限 */
+    LuftpdStorSync_t stor_sync; /* 上传的持久化方式 */
+    int stor_sync_mb;       /* PERIODIC 方式的回写窗口 */
+    char xferlog[256];      /* 传输日志（xferlog 格式），空串表示不记录 */
+    char stats_socket[256]; /* 统计查询的 UNIX 套接字，空串表示不提供 */
+    char hash_index[256];   /* 文件摘要缓存的索引文件，空串表示只在内存中缓存 */
 } LuftpdConfig_t;
 
 typedef enum{
@@ -33,11 +69,32 @@ typedef struct
     int control_sock;
     int data_sock;
     int pasv_sock;
+    int pasv_port;                /* pasv_sock 占用的数据端口 */
+    int epsv_all;                 /* 收到 EPSV ALL 后只接受 EPSV */
     struct sockaddr_in client_addr;
-    int thread_id;
+    uint32_t index;               /* 在连接表中的下标，生命周期内不变 */
+    uint32_t gen;                 /* 槽位复用代数 */
+    uint32_t next;                /* 空闲槽位链表 / 传输队列 */
     int is_active;
+    int in_use;                   /* 槽位已被占用 */
+    int busy;                     /* 数据命令正由传输线程执行，期间控制线程不读取命令 */
     char current_dir[PATH_MAX];   /* 相对 root 的路径 */
+    int cwd_fd;                   /* 当前目录描述符，-1 表示位于根目录 */
     LuftpdTransferType_t transfer_type;
+    int mode_z;                   /* MODE Z：数据通道 deflate 压缩 */
+    off_t restart_offset;         /* REST 设置的断点，下一次传输后清零 */
+    off_t alloc_size;             /* ALLO 声明的上传大小，下一次上传后清零 */
+    LuftpdHashAlg_t hash_alg;     /* OPTS HASH 选择的 HASH 算法 */
+    off_t range_start;            /* RANG 设置的区间 [start, end)，end 为0表示未设置 */
+    off_t range_end;
+    LuftpdShape_t shape;          /* 限速状态 */
+    uint64_t xfer_cmd;            /* 交给传输线程执行的命令（LUFTPD_CMD 编码）及参数 */
+    char xfer_arg[256];
+    char rbuf[LUFTPD_CMD_BUF_SIZE]; /* 尚未处理完的命令行 */
+    size_t rbuf_len;
+    char wbuf[LUFTPD_REPLY_BUF_SIZE]; /* 待发送的应答，每批命令处理完后统一发送 */
+    size_t wbuf_len;
+    int backlog;                  /* 应答未发完，等待可写，期间不读取命令 */
     LuftpdConfig_t *config;
 } LuftpdClient_t;
 
@@ -47,7 +104,16 @@ typedef struct
     .root_dir = LUFTPD_DEFAULT_ROOT_DIR, \
     .max_connections = LUFTPD_DEFAULT_MAX_CONNECTIONS, \
     .data_port_min = LUFTPD_DEFAULT_DATA_PORT_MIN, \
-    .data_port_max = LUFTPD_DEFAULT_DATA_PORT_MAX \
+    .data_port_max = LUFTPD_DEFAULT_DATA_PORT_MAX, \
+    .transfer_threads = LUFTPD_DEFAULT_TRANSFER_THREADS, \
+    .data_timeout = LUFTPD_DEFAULT_DATA_TIMEOUT, \
+    .zcache_dir = LUFTPD_DEFAULT_ZCACHE_DIR, \
+    .zcache_max_mb = LUFTPD_DEFAULT_ZCACHE_MAX_MB, \
+    .stor_sync = LUFTPD_DEFAULT_STOR_SYNC, \
+    .stor_sync_mb = LUFTPD_DEFAULT_STOR_SYNC_MB, \
+    .xferlog = LUFTPD_DEFAULT_XFERLOG, \
+    .stats_socket = LUFTPD_DEFAULT_STATS_SOCKET, \
+    .hash_index = LUFTPD_DEFAULT_HASH_INDEX \
 }
 
 int luftpd_cfg_load_with_file(LuftpdConfig_t* cfg, const char* config_file);
@@ -0,0 +1,102 @@
+#include "luftpd_conn.h"
+#include <stdlib.h>
+#include <string.h>
+
+static struct
+{
+    LuftpdClient_t** chunks;
+    uint32_t chunk_cap;
+    uint32_t chunk_count;
+    uint32_t free_head;
+    int max;
+    int count;
+} g_conn = {.free_head = LUFTPD_CONN_NONE};
+
+LuftpdClient_t* luftpd_conn_at(uint32_t index)
+{
+    return &g_conn.chunks[index / LUFTPD_CONN_CHUNK][index % LUFTPD_CONN_CHUNK];
+}
+
+int luftpd_conn_init(int max)
+{
+    g_conn.max         = max;
+    g_conn.chunk_cap   = (uint32_t) ((max + LUFTPD_CONN_CHUNK - 1) / LUFTPD_CONN_CHUNK);
+    g_conn.chunks      = calloc(g_conn.chunk_cap, sizeof(LuftpdClient_t*));
+    g_conn.chunk_count = 0;
+    g_conn.free_head   = LUFTPD_CONN_NONE;
+    g_conn.count       = 0;
+    return g_conn.chunks ? 0 : -1;
+}
+
+void luftpd_conn_shutdown(void)
+{
+    for (uint32_t i = 0; i < g_conn.chunk_count; i++)
+        free(g_conn.chunks[i]);
+    free(g_conn.chunks);
+    g_conn.chunks      = NULL;
+    g_conn.chunk_count = 0;
+}
+
+LuftpdClient_t* luftpd_conn_alloc(void)
+{
+    if (g_conn.count >= g_conn.max)
+        return NULL;
+    if (g_conn.free_head == LUFTPD_CONN_NONE)
+    {
+        if (g_conn.chunk_count >= g_conn.chunk_cap)
+            return NULL;
+        LuftpdClient_t* chunk = calloc(LUFTPD_CONN_CHUNK, sizeof(LuftpdClient_t));
+        if (!chunk)
+            return NULL;
+        uint32_t base                       = g_conn.chunk_count * LUFTPD_CONN_CHUNK;
+        g_conn.chunks[g_conn.chunk_count++] = chunk;
+        for (int i = LUFTPD_CONN_CHUNK - 1; i >= 0; i--)
+        {
+            chunk[i].index   = base + (uint32_t) i;
+            chunk[i].next    = g_conn.free_head;
+            g_conn.free_head = base + (uint32_t) i;
+        }
+    }
+
+    LuftpdClient_t* client = luftpd_conn_at(g_conn.free_head);
+    g_conn.free_head       = client->next;
+    uint32_t index         = client->index;
+    uint32_t gen           = client->gen;
+    memset(client, 0, sizeof(*client));
+    client->index  = index;
+    client->gen    = gen;
+    client->next   = LUFTPD_CONN_NONE;
+    client->in_use = 1;
+    g_conn.count++;
+    return client;
+}
+
+void luftpd_conn_free(LuftpdClient_t* client)
+{
+    client->in_use = 0;
+    client->gen++;
+    client->next     = g_conn.free_head;
+    g_conn.free_head = client->index;
+    g_conn.count--;
+}
+
+uint64_t luftpd_conn_tag(const LuftpdClient_t* client)
+{
+    return ((uint64_t) client->gen << 32) | client->index;
+}
+
+LuftpdClient_t* luftpd_conn_get(uint64_t tag)
+{
+    uint32_t index = (uint32_t) tag;
+    if (index >= g_conn.chunk_count * LUFTPD_CONN_CHUNK)
+        return NULL;
+    LuftpdClient_t* client = luftpd_conn_at(index);
+    if (!client->in_use || client->gen != (uint32_t) (tag >> 32))
+        return NULL;
+    return client;
+}
+
+int luftpd_conn_count(void)
+{
+    return g_conn.count;
+}
@@ -0,0 +1,43 @@
+#ifndef LUFTPD_CONN_H
+#define LUFTPD_CONN_H
+#include "luftpd_cfg.h"
+#include <stdint.h>
+
+// 连接表每块容纳的连接数，块一经分配不再释放，连接地址在生命周期内保持不变
+#define LUFTPD_CONN_CHUNK 256
+// 空下标
+#define LUFTPD_CONN_NONE UINT32_MAX
+
+// 控制连接表
+//
+// 只由控制线程（reactor）分配和释放。传输线程在执行数据命令期间持有连接指针，
+// 此时连接处于 busy 状态，控制线程不会释放它。
+
+/// @brief 初始化连接表
+/// @param max 最大连接数，按块按需分配
+/// @return 成功返回0，失败返回-1
+int luftpd_conn_init(int max);
+
+/// @brief 释放连接表
+void luftpd_conn_shutdown(void);
+
+/// @brief 分配连接并清零，index/gen 保持不变
+/// @return 连接数已达上限时返回NULL
+LuftpdClient_t* luftpd_conn_alloc(void);
+
+/// @brief 释放连接槽位，槽位代数递增，旧的 epoll 标识随之失效
+void luftpd_conn_free(LuftpdClient_t* client);
+
+/// @brief 连接的 epoll 标识：高32位为代数，低32位为下标
+uint64_t luftpd_conn_tag(const LuftpdClient_t* client);
+
+/// @brief 按 epoll 标识查找连接，槽位已释放或被复用时返回NULL
+LuftpdClient_t* luftpd_conn_get(uint64_t tag);
+
+/// @brief 按下标取连接
+LuftpdClient_t* luftpd_conn_at(uint32_t index);
+
+/// @brief 当前连接数
+int luftpd_conn_count(void);
+
+#endif // LUFTPD_CONN_H
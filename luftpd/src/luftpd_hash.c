@@ -0,0 +1,375 @@
+#include "luftpd_hash.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <openssl/evp.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <zlib.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#define HASH_INDEX_MAGIC "LFH1"
+// CRC32C 多项式（按位反转）
+#define CRC32C_POLY 0x82F63B78u
+
+// 缓存条目，也是索引文件中的一条记录。digest 之前的部分是键
+typedef struct
+{
+    char magic[4];
+    uint32_t alg;
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t start;
+    int64_t end;
+    uint8_t digest[LUFTPD_HASH_MAX_DIGEST];
+} HashEntry_t;
+
+#define HASH_KEY_SIZE offsetof(HashEntry_t, digest)
+
+typedef uint32_t (*Crc32cFn_t)(uint32_t crc, const unsigned char* p, size_t len);
+
+static const struct
+{
+    const char* name;
+    const EVP_MD* (*md)(void); // CRC 类为 NULL
+    unsigned len;
+} g_algs[LUFTPD_HASH_COUNT] = {
+    [LUFTPD_HASH_SHA256] = {"SHA-256", EVP_sha256, 32},
+    [LUFTPD_HASH_SHA1]   = {"SHA-1", EVP_sha1, 20},
+    [LUFTPD_HASH_SHA512] = {"SHA-512", EVP_sha512, 64},
+    [LUFTPD_HASH_MD5]    = {"MD5", EVP_md5, 16},
+    [LUFTPD_HASH_CRC32]  = {"CRC32", NULL, 4},
+    [LUFTPD_HASH_CRC32C] = {"CRC32C", NULL, 4},
+};
+
+static struct
+{
+    pthread_once_t once;
+    pthread_mutex_t lock;
+    Crc32cFn_t crc32c;
+    uint32_t crc32c_table[256];
+    char path[PATH_MAX];
+    int index_fd;     // 只追加的索引文件，-1 表示不持久化
+    uint64_t records; // 索引文件中的记录数，含已被覆盖的旧记录
+    HashEntry_t slots[LUFTPD_HASH_CACHE_SLOTS];
+} g_hash = {.once = PTHREAD_ONCE_INIT, .lock = PTHREAD_MUTEX_INITIALIZER, .index_fd = -1};
+
+// ================================ CRC32C =============================
+
+static uint32_t crc32c_table(uint32_t crc, const unsigned char* p, size_t len)
+{
+    crc = ~crc;
+    while (len--)
+        crc = g_hash.crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+// 每条 crc32 指令处理8字节
+__attribute__((target("sse4.2"))) static uint32_t crc32c_sse42(uint32_t crc, const unsigned char* p,
+                                                               size_t len)
+{
+    crc = ~crc;
+    for (; len > 0 && ((uintptr_t) p & 7) != 0; len--)
+        crc = _mm_crc32_u8(crc, *p++);
+    uint64_t c = crc;
+    for (; len >= 8; len -= 8, p += 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        c = _mm_crc32_u64(c, v);
+    }
+    crc = (uint32_t) c;
+    while (len--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return ~crc;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32c_armv8(uint32_t crc, const unsigned char* p, size_t len)
+{
+    crc = ~crc;
+    for (; len >= 8; len -= 8, p += 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        crc = __crc32cd(crc, v);
+    }
+    while (len--)
+        crc = __crc32cb(crc, *p++);
+    return ~crc;
+}
+#endif
+
+static void pick_kernel(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c >> 1) ^ (CRC32C_POLY & (0u - (c & 1)));
+        g_hash.crc32c_table[i] = c;
+    }
+    g_hash.crc32c = crc32c_table;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        g_hash.crc32c = crc32c_sse42;
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    g_hash.crc32c = crc32c_armv8;
+#endif
+}
+
+// ================================ 计算 ===============================
+
+static int hash_compute(int fd, LuftpdHashAlg_t alg, off_t start, off_t end, uint8_t* digest)
+{
+    unsigned char* buf = malloc(LUFTPD_HASH_BUF_SIZE);
+    EVP_MD_CTX* ctx    = NULL;
+    int rc             = -1;
+    if (!buf)
+        return -1;
+    if (g_algs[alg].md)
+    {
+        ctx = EVP_MD_CTX_new();
+        if (!ctx || EVP_DigestInit_ex(ctx, g_algs[alg].md(), NULL) != 1)
+            goto out;
+    }
+    posix_fadvise(fd, start, end - start, POSIX_FADV_SEQUENTIAL);
+
+    uint32_t crc = 0;
+    off_t off    = start;
+    while (off < end)
+    {
+        size_t want = end - off < LUFTPD_HASH_BUF_SIZE ? (size_t) (end - off) : LUFTPD_HASH_BUF_SIZE;
+        ssize_t n   = pread(fd, buf, want, off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) // 出错，或文件在计算期间被截短
+            goto out;
+        if (ctx)
+            EVP_DigestUpdate(ctx, buf, (size_t) n);
+        else if (alg == LUFTPD_HASH_CRC32)
+            crc = (uint32_t) crc32(crc, buf, (uInt) n);
+        else
+            crc = g_hash.crc32c(crc, buf, (size_t) n);
+        off += n;
+    }
+
+    if (ctx)
+    {
+        if (EVP_DigestFinal_ex(ctx, digest, NULL) != 1)
+            goto out;
+    }
+    else
+    {
+        // 按大端存放，十六进制串与习惯的 %08x 写法一致
+        digest[0] = (uint8_t) (crc >> 24);
+        digest[1] = (uint8_t) (crc >> 16);
+        digest[2] = (uint8_t) (crc >> 8);
+        digest[3] = (uint8_t) crc;
+    }
+    rc = 0;
+out:
+    EVP_MD_CTX_free(ctx);
+    free(buf);
+    return rc;
+}
+
+// ================================ 缓存 ===============================
+
+static void entry_key(HashEntry_t* e, const struct stat* st, LuftpdHashAlg_t alg, off_t start,
+                      off_t end)
+{
+    memset(e, 0, sizeof(*e));
+    memcpy(e->magic, HASH_INDEX_MAGIC, sizeof(e->magic));
+    e->alg        = (uint32_t) alg;
+    e->dev        = (uint64_t) st->st_dev;
+    e->ino        = (uint64_t) st->st_ino;
+    e->size       = st->st_size;
+    e->mtime_sec  = st->st_mtim.tv_sec;
+    e->mtime_nsec = st->st_mtim.tv_nsec;
+    e->start      = start;
+    e->end        = end;
+}
+
+static HashEntry_t* entry_slot(const HashEntry_t* e)
+{
+    uint64_t h = e->dev * 0x9E3779B97F4A7C15ull ^ e->ino;
+    h ^= ((uint64_t) e->start << 7) ^ ((uint64_t) e->end << 3) ^ e->alg;
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 29;
+    return &g_hash.slots[h & (LUFTPD_HASH_CACHE_SLOTS - 1)];
+}
+
+// 索引文件只追加，被覆盖的旧记录越积越多。用内存中仍有效的条目重写一份，改名替换
+static void index_compact(void)
+{
+    char tmp[PATH_MAX + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", g_hash.path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return;
+    uint64_t records = 0;
+    int ok           = 1;
+    for (size_t i = 0; i < LUFTPD_HASH_CACHE_SLOTS && ok; i++)
+    {
+        const HashEntry_t* e = &g_hash.slots[i];
+        if (e->magic[0] == '\0')
+            continue;
+        ok = write(fd, e, sizeof(*e)) == (ssize_t) sizeof(*e);
+        records++;
+    }
+    ok = ok && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp, g_hash.path) != 0)
+    {
+        unlink(tmp);
+        return;
+    }
+    fd = open(g_hash.path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    close(g_hash.index_fd);
+    g_hash.index_fd = fd;
+    g_hash.records  = records;
+}
+
+// 调用方持有锁。O_APPEND 下一次 write 写出整条记录，进程崩溃最多留下半条，加载时丢弃
+static void index_append(const HashEntry_t* e)
+{
+    if (g_hash.index_fd < 0)
+        return;
+    if (write(g_hash.index_fd, e, sizeof(*e)) == (ssize_t) sizeof(*e))
+        g_hash.records++;
+    if (g_hash.records > 2 * LUFTPD_HASH_CACHE_SLOTS)
+        index_compact();
+}
+
+int luftpd_hash_init(const char* index_path)
+{
+    pthread_once(&g_hash.once, pick_kernel);
+    if (index_path[0] == '\0')
+        return 0;
+    snprintf(g_hash.path, sizeof(g_hash.path), "%s", index_path);
+
+    // 后写的记录覆盖先写的
+    int torn = 0;
+    int fd   = open(index_path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        HashEntry_t batch[256];
+        ssize_t n;
+        while ((n = read(fd, batch, sizeof(batch))) > 0)
+        {
+            size_t count = (size_t) n / sizeof(HashEntry_t);
+            for (size_t i = 0; i < count; i++)
+            {
+                if (memcmp(batch[i].magic, HASH_INDEX_MAGIC, sizeof(batch[i].magic)) != 0 ||
+                    batch[i].alg >= LUFTPD_HASH_COUNT)
+                {
+                    torn = 1;
+                    continue;
+                }
+                *entry_slot(&batch[i]) = batch[i];
+                g_hash.records++;
+            }
+            if ((size_t) n % sizeof(HashEntry_t) != 0)
+            {
+                // 末尾的半条记录：对齐后的追加位置已错开，重写整个文件
+                torn = 1;
+                break;
+            }
+        }
+        close(fd);
+    }
+    else if (errno != ENOENT)
+    {
+        return -1;
+    }
+
+    // 索引文件所在目录可能还不存在（例如没有启用 MODE Z 缓存）
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", index_path);
+    char* slash = strrchr(dir, '/');
+    if (slash && slash != dir)
+    {
+        *slash = '\0';
+        mkdir(dir, 0700);
+    }
+    g_hash.index_fd = open(index_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (g_hash.index_fd < 0)
+        return -1;
+    if (torn || g_hash.records > 2 * LUFTPD_HASH_CACHE_SLOTS)
+        index_compact();
+    return 0;
+}
+
+int luftpd_hash_parse(const char* name)
+{
+    for (int i = 0; i < LUFTPD_HASH_COUNT; i++)
+    {
+        if (strcasecmp(name, g_algs[i].name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+const char* luftpd_hash_name(LuftpdHashAlg_t alg)
+{
+    return g_algs[alg].name;
+}
+
+int luftpd_hash_file(int fd, const struct stat* st, LuftpdHashAlg_t alg, off_t start, off_t end,
+                     char* hex)
+{
+    pthread_once(&g_hash.once, pick_kernel);
+    HashEntry_t e;
+    entry_key(&e, st, alg, start, end);
+    HashEntry_t* slot = entry_slot(&e);
+
+    pthread_mutex_lock(&g_hash.lock);
+    int hit = memcmp(slot, &e, HASH_KEY_SIZE) == 0;
+    if (hit)
+        memcpy(e.digest, slot->digest, sizeof(e.digest));
+    pthread_mutex_unlock(&g_hash.lock);
+
+    if (!hit)
+    {
+        if (hash_compute(fd, alg, start, end, e.digest) != 0)
+            return -1;
+        // 计算期间文件被改写时，结果不对应任何一个版本，只返回不缓存
+        struct stat after;
+        if (fstat(fd, &after) == 0 && after.st_size == st->st_size &&
+            after.st_mtim.tv_sec == st->st_mtim.tv_sec &&
+            after.st_mtim.tv_nsec == st->st_mtim.tv_nsec)
+        {
+            pthread_mutex_lock(&g_hash.lock);
+            *slot = e;
+            index_append(&e);
+            pthread_mutex_unlock(&g_hash.lock);
+        }
+    }
+
+    static const char digits[] = "0123456789abcdef";
+    for (unsigned i = 0; i < g_algs[alg].len; i++)
+    {
+        hex[2 * i]     = digits[e.digest[i] >> 4];
+        hex[2 * i + 1] = digits[e.digest[i] & 0xf];
+    }
+    hex[2 * g_algs[alg].len] = '\0';
+    return 0;
+}
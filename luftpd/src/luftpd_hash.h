@@ -0,0 +1,51 @@
+#ifndef LUFTPD_HASH_H
+#define LUFTPD_HASH_H
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// 摘要的最大字节数（SHA-512）
+#define LUFTPD_HASH_MAX_DIGEST 64
+// 十六进制摘要串的缓冲区大小
+#define LUFTPD_HASH_HEX_SIZE (LUFTPD_HASH_MAX_DIGEST * 2 + 1)
+// 内存中摘要缓存的槽位数，须为2的幂；直接映射，冲突时新条目覆盖旧条目
+#define LUFTPD_HASH_CACHE_SLOTS 16384
+// 计算摘要时每次读取的大小
+#define LUFTPD_HASH_BUF_SIZE (1024 * 1024)
+
+// 文件摘要（HASH、XCRC、XSHA256 命令）
+//
+// SHA 系列经 OpenSSL 计算，CPU 支持时它自动使用 SHA 扩展指令；CRC32C 在 x86 上用
+// SSE4.2 的 crc32 指令，其它平台查表。算好的摘要按 (设备号, inode, 大小, 修改时间,
+// 算法, 区间) 缓存：内存中一张直接映射表，另有一个只追加的索引文件，启动时读回，
+// 重启后重复查询同样不必再读文件。文件被修改后大小或修改时间变化，旧条目自然不再命中。
+
+typedef enum
+{
+    LUFTPD_HASH_SHA256 = 0, // 默认算法
+    LUFTPD_HASH_SHA1,
+    LUFTPD_HASH_SHA512,
+    LUFTPD_HASH_MD5,
+    LUFTPD_HASH_CRC32,  // IEEE 802.3，即 zlib 的 crc32，XCRC 使用
+    LUFTPD_HASH_CRC32C, // Castagnoli
+    LUFTPD_HASH_COUNT
+} LuftpdHashAlg_t;
+
+/// @brief 加载摘要索引文件
+/// @param index_path 索引文件路径，空串时只在内存中缓存
+/// @return 成功返回0；索引文件无法打开返回-1，此时只在内存中缓存
+int luftpd_hash_init(const char* index_path);
+
+/// @brief 按名称（不区分大小写，如 "SHA-256"）查找算法，未知返回-1
+int luftpd_hash_parse(const char* name);
+
+/// @brief 算法在 HASH 命令和 FEAT 中使用的名称
+const char* luftpd_hash_name(LuftpdHashAlg_t alg);
+
+/// @brief 计算文件 [start, end) 的摘要，缓存命中时不读文件
+/// @param st 文件的 fstat 结果，作为缓存的键
+/// @param hex 输出小写十六进制摘要，至少 LUFTPD_HASH_HEX_SIZE 字节
+/// @return 成功返回0，读文件失败返回-1
+int luftpd_hash_file(int fd, const struct stat* st, LuftpdHashAlg_t alg, off_t start, off_t end,
+                     char* hex);
+
+#endif // LUFTPD_HASH_H
@@ -0,0 +1,345 @@
+#include "luftpd_list.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// 目录内容或其中文件属性变化都会使缓存的列表过期
+#define LUFTPD_LIST_WATCH_MASK                                                                   \
+    (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_ATTRIB |             \
+     IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+// getdents64 返回的目录项
+struct linux_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef struct
+{
+    char* data;
+    size_t len;
+    size_t cap;
+} ListBuf_t;
+
+typedef struct
+{
+    char path[PATH_MAX];
+    int wd;            // inotify 监视描述符，-1 表示槽位空闲
+    uint64_t epoch;    // 每次作废或淘汰递增，用于识别扫描期间发生的变化
+    uint64_t last_use; // 最近使用时刻，用于 LRU 淘汰
+    char* out[LUFTPD_LIST_FORMATS];
+    size_t out_len[LUFTPD_LIST_FORMATS];
+} ListCache_t;
+
+static struct
+{
+    pthread_mutex_t lock;
+    int inotify_fd;
+    uint64_t tick;
+    uint64_t epoch;
+    ListCache_t entries[LUFTPD_LIST_CACHE_MAX];
+} g_list = {.lock = PTHREAD_MUTEX_INITIALIZER, .inotify_fd = -1};
+
+// ================================ 输出缓冲 ===========================
+
+static int buf_reserve(ListBuf_t* buf, size_t extra)
+{
+    if (buf->len + extra <= buf->cap)
+        return 0;
+    size_t cap = buf->cap ? buf->cap : 4096;
+    while (cap < buf->len + extra)
+        cap *= 2;
+    char* data = realloc(buf->data, cap);
+    if (!data)
+        return -1;
+    buf->data = data;
+    buf->cap  = cap;
+    return 0;
+}
+
+static int buf_printf(ListBuf_t* buf, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static int buf_printf(ListBuf_t* buf, const char* fmt, ...)
+{
+    if (buf_reserve(buf, 256) != 0)
+        return -1;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf->data + buf->len, buf->cap - buf->len, fmt, ap);
+    va_end(ap);
+    if (n < 0)
+        return -1;
+    if (buf->len + (size_t) n >= buf->cap)
+    {
+        if (buf_reserve(buf, (size_t) n + 1) != 0)
+            return -1;
+        va_start(ap, fmt);
+        vsnprintf(buf->data + buf->len, buf->cap - buf->len, fmt, ap);
+        va_end(ap);
+    }
+    buf->len += (size_t) n;
+    return 0;
+}
+
+// ================================ 目录扫描 ===========================
+
+int luftpd_list_facts(const struct stat* st, char* buf, size_t buf_sz)
+{
+    struct tm tm_info;
+    char modify[16];
+    gmtime_r(&st->st_mtime, &tm_info);
+    strftime(modify, sizeof(modify), "%Y%m%d%H%M%S", &tm_info);
+    bool is_dir = S_ISDIR(st->st_mode);
+    return snprintf(buf, buf_sz, "type=%s;size=%lld;modify=%s;perm=%s;", is_dir ? "dir" : "file",
+                    (long long) st->st_size, modify, is_dir ? "el" : "r");
+}
+
+static int render_entry(ListBuf_t* buf, int dir_fd, const char* name, LuftpdListFormat_t format)
+{
+    // NLST 只需要文件名，不必 stat
+    if (format == LUFTPD_LIST_NAMES)
+        return buf_printf(buf, "%s\r\n", name);
+
+    struct stat st;
+    if (fstatat(dir_fd, name, &st, 0) != 0)
+        return 0; // 扫描期间被删除的条目直接跳过
+
+    if (format == LUFTPD_LIST_MLSD)
+    {
+        char facts[128];
+        luftpd_list_facts(&st, facts, sizeof(facts));
+        return buf_printf(buf, "%s %s\r\n", facts, name);
+    }
+
+    char time_str[64];
+    struct tm tm_info;
+    localtime_r(&st.st_mtime, &tm_info);
+    strftime(time_str, sizeof(time_str), "%b %d %H:%M", &tm_info);
+    return buf_printf(buf, "%s 1 ftp ftp %8lld %s %s\r\n",
+                      S_ISDIR(st.st_mode) ? "drwxr-xr-x" : "-rw-r--r--", (long long) st.st_size,
+                      time_str, name);
+}
+
+static int scan_dir(int dir_fd, LuftpdListFormat_t format, ListBuf_t* out)
+{
+    char* dents = malloc(LUFTPD_LIST_DENTS_BUF);
+    int rc      = dents ? 0 : -1;
+    while (rc == 0)
+    {
+        long n = syscall(SYS_getdents64, dir_fd, dents, LUFTPD_LIST_DENTS_BUF);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            rc = n < 0 ? -1 : 0;
+            break;
+        }
+        for (long off = 0; off < n && rc == 0;)
+        {
+            struct linux_dirent64* d = (struct linux_dirent64*) (dents + off);
+            off += d->d_reclen;
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+                continue;
+            rc = render_entry(out, dir_fd, d->d_name, format);
+        }
+    }
+    free(dents);
+    return rc;
+}
+
+// ================================ 缓存 ===============================
+
+static void cache_invalidate(ListCache_t* entry)
+{
+    for (int i = 0; i < LUFTPD_LIST_FORMATS; i++)
+    {
+        free(entry->out[i]);
+        entry->out[i]     = NULL;
+        entry->out_len[i] = 0;
+    }
+    entry->epoch = ++g_list.epoch;
+}
+
+static void cache_drop(ListCache_t* entry)
+{
+    cache_invalidate(entry);
+    entry->wd      = -1;
+    entry->path[0] = '\0';
+}
+
+static ListCache_t* cache_by_wd(int wd)
+{
+    for (int i = 0; i < LUFTPD_LIST_CACHE_MAX; i++)
+    {
+        if (g_list.entries[i].wd == wd)
+            return &g_list.entries[i];
+    }
+    return NULL;
+}
+
+// 处理已排队的 inotify 事件，持锁调用
+static void cache_drain_events(void)
+{
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;)
+    {
+        ssize_t n = read(g_list.inotify_fd, events, sizeof(events));
+        if (n <= 0)
+            break;
+        for (char* p = events; p < events + n;)
+        {
+            const struct inotify_event* ev = (const struct inotify_event*) p;
+            p += sizeof(*ev) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW)
+            {
+                // 事件丢失，无法确定哪些目录变化了，全部作废
+                for (int i = 0; i < LUFTPD_LIST_CACHE_MAX; i++)
+                    cache_invalidate(&g_list.entries[i]);
+                continue;
+            }
+            ListCache_t* entry = cache_by_wd(ev->wd);
+            if (!entry)
+                continue;
+            if (ev->mask & IN_IGNORED)
+                cache_drop(entry); // 目录已删除或监视已移除
+            else
+                cache_invalidate(entry);
+        }
+    }
+}
+
+static ListCache_t* cache_find(const char* path)
+{
+    for (int i = 0; i < LUFTPD_LIST_CACHE_MAX; i++)
+    {
+        ListCache_t* entry = &g_list.entries[i];
+        if (entry->wd >= 0 && strcmp(entry->path, path) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+// 为目录分配缓存槽位并注册监视，槽位满时淘汰最久未使用的目录
+static ListCache_t* cache_insert(const char* path)
+{
+    ListCache_t* victim = &g_list.entries[0];
+    for (int i = 0; i < LUFTPD_LIST_CACHE_MAX; i++)
+    {
+        ListCache_t* entry = &g_list.entries[i];
+        if (entry->wd < 0)
+        {
+            victim = entry;
+            break;
+        }
+        if (entry->last_use < victim->last_use)
+            victim = entry;
+    }
+    if (victim->wd >= 0)
+    {
+        inotify_rm_watch(g_list.inotify_fd, victim->wd);
+        cache_drop(victim);
+    }
+
+    int wd = inotify_add_watch(g_list.inotify_fd, path, LUFTPD_LIST_WATCH_MASK);
+    if (wd < 0)
+        return NULL;
+    // 同一目录被不同路径引用时内核返回同一个监视描述符，只保留一个槽位
+    ListCache_t* existing = cache_by_wd(wd);
+    if (existing)
+        cache_drop(existing);
+    snprintf(victim->path, sizeof(victim->path), "%s", path);
+    victim->wd = wd;
+    return victim;
+}
+
+int luftpd_list_init(void)
+{
+    for (int i = 0; i < LUFTPD_LIST_CACHE_MAX; i++)
+        g_list.entries[i].wd = -1;
+    g_list.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    return g_list.inotify_fd >= 0 ? 0 : -1;
+}
+
+static int copy_out(const char* data, size_t len, char** out, size_t* out_len)
+{
+    *out = malloc(len ? len : 1);
+    if (!*out)
+        return -1;
+    memcpy(*out, data, len);
+    *out_len = len;
+    return 0;
+}
+
+int luftpd_list_render(int dir_fd, const char* path, LuftpdListFormat_t format, char** out,
+                       size_t* out_len)
+{
+    ListBuf_t buf = {0};
+    if (g_list.inotify_fd < 0)
+    {
+        if (scan_dir(dir_fd, format, &buf) != 0)
+        {
+            free(buf.data);
+            return -1;
+        }
+        *out     = buf.data ? buf.data : malloc(1);
+        *out_len = buf.len;
+        return *out ? 0 : -1;
+    }
+
+    // 命中缓存时复制一份再发送，避免持锁期间阻塞在慢速数据连接上
+    pthread_mutex_lock(&g_list.lock);
+    cache_drain_events();
+    ListCache_t* entry = cache_find(path);
+    if (!entry)
+        entry = cache_insert(path);
+    uint64_t epoch = 0;
+    if (entry)
+    {
+        entry->last_use = ++g_list.tick;
+        if (entry->out[format])
+        {
+            int rc = copy_out(entry->out[format], entry->out_len[format], out, out_len);
+            pthread_mutex_unlock(&g_list.lock);
+            return rc;
+        }
+        epoch = entry->epoch;
+    }
+    pthread_mutex_unlock(&g_list.lock);
+
+    // 监视在扫描前注册，扫描期间的变化会在下次查询前作废本次结果
+    if (scan_dir(dir_fd, format, &buf) != 0)
+    {
+        free(buf.data);
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_list.lock);
+    cache_drain_events();
+    if (entry && entry->wd >= 0 && entry->epoch == epoch && !entry->out[format] &&
+        strcmp(entry->path, path) == 0)
+    {
+        if (copy_out(buf.data ? buf.data : "", buf.len, &entry->out[format],
+                     &entry->out_len[format]) != 0)
+            entry->out[format] = NULL;
+    }
+    pthread_mutex_unlock(&g_list.lock);
+
+    *out     = buf.data ? buf.data : malloc(1);
+    *out_len = buf.len;
+    return *out ? 0 : -1;
+}
@@ -0,0 +1,41 @@
+#ifndef LUFTPD_LIST_H
+#define LUFTPD_LIST_H
+#include <stddef.h>
+#include <sys/stat.h>
+
+// 最多缓存的目录数，超出时淘汰最久未使用的目录
+#define LUFTPD_LIST_CACHE_MAX 64
+// getdents64 每次读取的缓冲区大小
+#define LUFTPD_LIST_DENTS_BUF (64 * 1024)
+
+// 目录列表格式
+typedef enum
+{
+    LUFTPD_LIST_LS = 0, // LIST：ls -l 风格
+    LUFTPD_LIST_NAMES,  // NLST：每行一个文件名
+    LUFTPD_LIST_MLSD,   // MLSD：RFC 3659 机器可读格式
+    LUFTPD_LIST_FORMATS
+} LuftpdListFormat_t;
+
+// 目录列表缓存
+//
+// 目录用 getdents64 + fstatat 扫描，按格式生成完整的列表文本后缓存，
+// 之后相同目录的列表请求直接复用，一次发送。每个缓存的目录注册 inotify 监视，
+// 目录内容或其中文件的大小、时间变化时在下一次查询前作废。
+
+/// @brief 初始化列表缓存
+/// @return 成功返回0；inotify 不可用时返回-1，此时每次都重新扫描
+int luftpd_list_init(void);
+
+/// @brief 生成目录列表
+/// @param dir_fd 新打开的目录描述符，缓存未命中时从中读取目录项，不会被关闭
+/// @param path 目录的主机路径，作为缓存键和 inotify 监视路径
+/// @param out 输出列表文本，调用方 free
+/// @return 成功返回0，读取目录失败时返回-1
+int luftpd_list_render(int dir_fd, const char* path, LuftpdListFormat_t format, char** out,
+                       size_t* out_len);
+
+/// @brief 按 MLSD/MLST 格式输出单个条目的事实部分，如 "type=file;size=1;modify=...;perm=r;"
+int luftpd_list_facts(const struct stat* st, char* buf, size_t buf_sz);
+
+#endif // LUFTPD_LIST_H
@@ -0,0 +1,151 @@
+#define _GNU_SOURCE // accept4
+#include "luftpd_pasv.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static struct
+{
+    pthread_mutex_t lock;
+    int port_min;
+    int count;
+    int nwords;
+    int cursor;     // 下一次从这里开始查找空闲端口
+    uint64_t* used; // 位图，超出范围的尾部位始终置1
+    int* prebound;  // 预绑定的监听套接字，按端口下标；未开启预绑定时为NULL
+} g_pasv = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static void mark(int idx, bool used)
+{
+    uint64_t bit = 1ULL << (idx % 64);
+    if (used)
+        g_pasv.used[idx / 64] |= bit;
+    else
+        g_pasv.used[idx / 64] &= ~bit;
+}
+
+// 从游标开始查找空闲端口，最后一轮回到起始字补查游标之前的位。持锁调用
+static int find_free(void)
+{
+    int w         = g_pasv.cursor / 64;
+    uint64_t mask = ~0ULL << (g_pasv.cursor % 64);
+    for (int k = 0; k <= g_pasv.nwords; k++)
+    {
+        uint64_t free_bits = ~g_pasv.used[w] & mask;
+        if (free_bits)
+            return w * 64 + __builtin_ctzll(free_bits);
+        w    = (w + 1) % g_pasv.nwords;
+        mask = ~0ULL;
+    }
+    return -1;
+}
+
+static int bind_port(int port)
+{
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return -1;
+
+    // 只设 SO_REUSEADDR 以便复用处于 TIME_WAIT 的端口
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr = {
+        .sin_family      = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+        .sin_port        = htons((uint16_t) port),
+    };
+    if (bind(sock, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(sock, 1) != 0)
+    {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+int luftpd_pasv_init(const LuftpdConfig_t* cfg)
+{
+    if (cfg->data_port_min < 1 || cfg->data_port_max > 65535 ||
+        cfg->data_port_min > cfg->data_port_max)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    g_pasv.port_min = cfg->data_port_min;
+    g_pasv.count    = cfg->data_port_max - cfg->data_port_min + 1;
+    g_pasv.nwords   = (g_pasv.count + 63) / 64;
+    g_pasv.cursor   = 0;
+    g_pasv.used     = calloc((size_t) g_pasv.nwords, sizeof(uint64_t));
+    if (!g_pasv.used)
+        return -1;
+    for (int i = g_pasv.count; i < g_pasv.nwords * 64; i++)
+        mark(i, true);
+
+    if (!cfg->pasv_prebind)
+        return 0;
+    g_pasv.prebound = malloc((size_t) g_pasv.count * sizeof(int));
+    if (!g_pasv.prebound)
+        return -1;
+    for (int i = 0; i < g_pasv.count; i++)
+    {
+        g_pasv.prebound[i] = bind_port(g_pasv.port_min + i);
+        if (g_pasv.prebound[i] < 0)
+            return -1;
+    }
+    return 0;
+}
+
+int luftpd_pasv_open(int* port)
+{
+    // 端口可能被其它进程占用导致 bind 失败，此时跳过它继续轮转，最多尝试一整圈
+    for (int attempt = 0; attempt < g_pasv.count; attempt++)
+    {
+        pthread_mutex_lock(&g_pasv.lock);
+        int idx = find_free();
+        if (idx < 0)
+        {
+            pthread_mutex_unlock(&g_pasv.lock);
+            break;
+        }
+        mark(idx, true);
+        g_pasv.cursor = (idx + 1) % g_pasv.count;
+        pthread_mutex_unlock(&g_pasv.lock);
+
+        *port = g_pasv.port_min + idx;
+        if (g_pasv.prebound)
+            return g_pasv.prebound[idx];
+        int sock = bind_port(*port);
+        if (sock >= 0)
+            return sock;
+
+        pthread_mutex_lock(&g_pasv.lock);
+        mark(idx, false);
+        pthread_mutex_unlock(&g_pasv.lock);
+    }
+    errno = EADDRINUSE;
+    return -1;
+}
+
+void luftpd_pasv_close(int sock, int port)
+{
+    if (g_pasv.prebound)
+    {
+        // 丢弃上一个会话留下的未接受连接，避免被下一个会话接受
+        int conn;
+        while ((conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC)) >= 0)
+            close(conn);
+    }
+    else
+    {
+        close(sock);
+    }
+
+    pthread_mutex_lock(&g_pasv.lock);
+    mark(port - g_pasv.port_min, false);
+    pthread_mutex_unlock(&g_pasv.lock);
+}
@@ -0,0 +1,25 @@
+#ifndef LUFTPD_PASV_H
+#define LUFTPD_PASV_H
+#include "luftpd_cfg.h"
+
+// 被动模式数据端口分配
+//
+// 用位图记录 [data_port_min, data_port_max] 中被会话占用的端口，游标轮转分配，
+// 刚释放的端口要等其余端口轮过一遍才会再次分配，减少迟到连接串到新会话。
+// 开启 pasv_prebind 时启动即为每个端口绑定并监听，PASV 直接取用已监听的套接字，
+// 不再有任何 bind 调用。数据端口不设置 SO_REUSEPORT：否则多个套接字可以绑定同一端口，
+// 内核会把数据连接分摊到不同会话。
+
+/// @brief 初始化端口池
+/// @return 成功返回0；端口范围非法或预绑定失败返回-1
+int luftpd_pasv_init(const LuftpdConfig_t* cfg);
+
+/// @brief 分配一个数据端口并返回其监听套接字
+/// @param port 输出分配到的端口
+/// @return 监听套接字；端口耗尽返回-1
+int luftpd_pasv_open(int* port);
+
+/// @brief 归还数据端口。预绑定的套接字丢弃未接受的连接后放回池中，否则直接关闭
+void luftpd_pasv_close(int sock, int port);
+
+#endif // LUFTPD_PASV_H
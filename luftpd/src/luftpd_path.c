@@ -0,0 +1,145 @@
+#define _GNU_SOURCE // O_PATH
+#include "luftpd_path.h"
+#include "luftpd_utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/openat2.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static struct
+{
+    int root_fd;
+    bool has_openat2; // 启动时探测，之后只读
+    char root_dir[PATH_MAX];
+} g_path = {.root_fd = -1};
+
+static int openat2_beneath(int base_fd, const char* rel, int flags)
+{
+    struct open_how how = {
+        .flags   = (unsigned long long) (flags | O_CLOEXEC),
+        .mode    = (flags & O_CREAT) ? LUFTPD_PATH_FILE_MODE : 0,
+        .resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS,
+    };
+    return (int) syscall(SYS_openat2, base_fd, rel, &how, sizeof(how));
+}
+
+int luftpd_path_init(const char* root_dir)
+{
+    snprintf(g_path.root_dir, sizeof(g_path.root_dir), "%s", root_dir);
+    g_path.root_fd = open(root_dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (g_path.root_fd < 0)
+        return -1;
+
+    int fd             = openat2_beneath(g_path.root_fd, ".", O_PATH | O_DIRECTORY);
+    g_path.has_openat2 = fd >= 0 || errno != ENOSYS;
+    if (fd >= 0)
+        close(fd);
+    return 0;
+}
+
+// 把 src 中的路径组件追加到 out[0, *len)，".." 到根为止
+static int append_components(const char* src, char* out, size_t* len, size_t out_sz)
+{
+    const char* p = src;
+    while (*p)
+    {
+        while (*p == '/')
+            p++;
+        const char* comp = p;
+        while (*p && *p != '/')
+            p++;
+        size_t comp_len = (size_t) (p - comp);
+        if (comp_len == 0 || (comp_len == 1 && comp[0] == '.'))
+            continue;
+        if (comp_len == 2 && comp[0] == '.' && comp[1] == '.')
+        {
+            while (*len > 0 && out[*len - 1] != '/')
+                (*len)--;
+            if (*len > 0)
+                (*len)--; // 去掉分隔符，根目录表示为空串
+            continue;
+        }
+        if (*len + comp_len + 2 > out_sz)
+            return -1;
+        out[(*len)++] = '/';
+        memcpy(out + *len, comp, comp_len);
+        *len += comp_len;
+    }
+    return 0;
+}
+
+int luftpd_path_normalize(const char* cwd, const char* arg, char* out, size_t out_sz)
+{
+    if (out_sz < 2)
+        return -1;
+    size_t len = 0;
+    if ((arg[0] != '/' && append_components(cwd, out, &len, out_sz) != 0) ||
+        append_components(arg, out, &len, out_sz) != 0)
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (len == 0)
+        out[len++] = '/';
+    out[len] = '\0';
+    return 0;
+}
+
+// 相对路径中没有 ".." 时可以直接从当前目录开始解析，不必从根目录重走一遍
+static bool stays_below(const char* arg)
+{
+    if (arg[0] == '/')
+        return false;
+    for (const char* p = arg; (p = strstr(p, "..")) != NULL; p += 2)
+    {
+        if ((p == arg || p[-1] == '/') && (p[2] == '\0' || p[2] == '/'))
+            return false;
+    }
+    return true;
+}
+
+static int open_fallback(const char* cwd, const char* arg, int flags)
+{
+    char host_path[PATH_MAX];
+    if (luftpd_resolve_path(g_path.root_dir, cwd, arg, host_path, sizeof(host_path)) != 0)
+        return -1;
+    return open(host_path, flags | O_CLOEXEC, LUFTPD_PATH_FILE_MODE);
+}
+
+int luftpd_path_open(int cwd_fd, const char* cwd, const char* arg, int flags, char* vpath,
+                     size_t vpath_sz)
+{
+    char norm[PATH_MAX];
+    if (luftpd_path_normalize(cwd, arg, norm, sizeof(norm)) != 0)
+        return -1;
+    if (vpath && snprintf(vpath, vpath_sz, "%s", norm) >= (int) vpath_sz)
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    if (g_path.has_openat2)
+    {
+        int base_fd     = g_path.root_fd;
+        const char* rel = norm[1] ? norm + 1 : ".";
+        if (cwd_fd >= 0 && stays_below(arg))
+        {
+            base_fd = cwd_fd;
+            rel     = arg[0] ? arg : ".";
+        }
+        // 越出基准目录（含指向其外的符号链接）时内核返回 EXDEV。从当前目录解析时
+        // 符号链接可能合法地指向当前目录之外、根目录之内，改从根目录重试
+        int fd = openat2_beneath(base_fd, rel, flags);
+        if (fd < 0 && errno == EXDEV && base_fd != g_path.root_fd)
+            fd = openat2_beneath(g_path.root_fd, norm[1] ? norm + 1 : ".", flags);
+        if (fd < 0 && errno == EXDEV)
+            errno = EACCES;
+        return fd;
+    }
+    return open_fallback(cwd, arg, flags);
+}
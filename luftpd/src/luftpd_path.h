@@ -0,0 +1,37 @@
+#ifndef LUFTPD_PATH_H
+#define LUFTPD_PATH_H
+#include <stddef.h>
+
+// 带 O_CREAT 打开时新建文件的权限
+#define LUFTPD_PATH_FILE_MODE 0644
+
+// 基于目录描述符的路径解析
+//
+// FTP 根目录在启动时打开一次，所有会话共用；会话切换目录后持有当前目录的描述符。
+// 客户端路径先按 FTP 语义做词法规范化（".." 到根为止），再用
+// openat2(RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS) 相对根目录或当前目录打开，
+// 由内核保证解析过程（包括符号链接）不会离开根目录，每条命令只需一次系统调用。
+// 内核不支持 openat2 时回退到 luftpd_resolve_path + open。
+
+/// @brief 打开 FTP 根目录
+/// @return 成功返回0，根目录无法打开返回-1
+int luftpd_path_init(const char* root_dir);
+
+/// @brief 词法规范化客户端路径
+/// @param cwd 客户端视角的当前目录，以 / 开头
+/// @param arg 客户端给出的路径，绝对路径相对 FTP 根目录
+/// @param out 输出客户端视角的绝对路径，如 "/" 或 "/a/b"
+/// @return 成功返回0，缓冲区不足返回-1
+int luftpd_path_normalize(const char* cwd, const char* arg, char* out, size_t out_sz);
+
+/// @brief 在 FTP 根目录内打开客户端路径
+/// @param cwd_fd 当前目录描述符，-1 表示当前目录就是根目录
+/// @param cwd 客户端视角的当前目录
+/// @param flags open 标志，如 O_RDONLY、O_PATH | O_DIRECTORY，自动加 O_CLOEXEC；
+///              含 O_CREAT 时以 LUFTPD_PATH_FILE_MODE 新建
+/// @param vpath 输出规范化后的客户端视角路径，可为 NULL
+/// @return 成功返回描述符；失败返回-1，路径越出根目录时 errno 为 EACCES
+int luftpd_path_open(int cwd_fd, const char* cwd, const char* arg, int flags, char* vpath,
+                     size_t vpath_sz);
+
+#endif // LUFTPD_PATH_H
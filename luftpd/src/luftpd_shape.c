@@ -0,0 +1,192 @@
+#include "luftpd_shape.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+// 按 IP 分桶的哈希表大小
+#define LUFTPD_SHAPE_IP_BUCKETS 256
+
+struct LuftpdShapeIp
+{
+    struct LuftpdShapeIp* next;
+    in_addr_t addr;
+    int refs;
+    LuftpdBucket_t bucket;
+    uint64_t throttled_ns;
+};
+
+static struct
+{
+    pthread_mutex_t lock;
+    int enabled;
+    double per_ip_rate;
+    double per_session_rate;
+    LuftpdBucket_t global;
+    LuftpdShapeIp_t* ips[LUFTPD_SHAPE_IP_BUCKETS];
+} g_shape = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static uint64_t mono_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void bucket_init(LuftpdBucket_t* b, double rate)
+{
+    b->rate  = rate;
+    b->burst = rate * LUFTPD_SHAPE_BURST_MS / 1000.0;
+    // 容量至少能容纳一次最大放行，否则低速率时永远凑不够
+    if (b->burst < LUFTPD_SHAPE_MAX_GRANT)
+        b->burst = LUFTPD_SHAPE_MAX_GRANT;
+    b->tokens  = b->burst;
+    b->last_ns = mono_ns();
+}
+
+static void bucket_refill(LuftpdBucket_t* b, uint64_t now)
+{
+    if (b->rate <= 0)
+        return;
+    b->tokens += (double) (now - b->last_ns) * b->rate / 1e9;
+    if (b->tokens > b->burst)
+        b->tokens = b->burst;
+    b->last_ns = now;
+}
+
+// 不限速的桶视为令牌无限
+static double bucket_avail(const LuftpdBucket_t* b)
+{
+    return b->rate > 0 ? b->tokens : 1e300;
+}
+
+// 凑够 need 个令牌还需等待的时间
+static uint64_t bucket_wait_ns(const LuftpdBucket_t* b, double need)
+{
+    if (b->rate <= 0 || b->tokens >= need)
+        return 0;
+    return (uint64_t) ((need - b->tokens) * 1e9 / b->rate) + 1;
+}
+
+void luftpd_shape_init(int global_kbs, int per_ip_kbs, int per_session_kbs)
+{
+    bucket_init(&g_shape.global, global_kbs * 1024.0);
+    g_shape.per_ip_rate      = per_ip_kbs * 1024.0;
+    g_shape.per_session_rate = per_session_kbs * 1024.0;
+    g_shape.enabled          = global_kbs > 0 || per_ip_kbs > 0 || per_session_kbs > 0;
+}
+
+int luftpd_shape_enabled(void)
+{
+    return g_shape.enabled;
+}
+
+void luftpd_shape_attach(LuftpdShape_t* shape, struct in_addr addr)
+{
+    bucket_init(&shape->session, g_shape.per_session_rate);
+    shape->throttled_ns = 0;
+    shape->ip           = NULL;
+    if (g_shape.per_ip_rate <= 0)
+        return;
+
+    pthread_mutex_lock(&g_shape.lock);
+    LuftpdShapeIp_t** slot = &g_shape.ips[addr.s_addr % LUFTPD_SHAPE_IP_BUCKETS];
+    LuftpdShapeIp_t* ip    = *slot;
+    while (ip && ip->addr != addr.s_addr)
+        ip = ip->next;
+    if (!ip && (ip = calloc(1, sizeof(*ip))) != NULL)
+    {
+        ip->addr = addr.s_addr;
+        bucket_init(&ip->bucket, g_shape.per_ip_rate);
+        ip->next = *slot;
+        *slot    = ip;
+    }
+    if (ip)
+        ip->refs++;
+    shape->ip = ip;
+    pthread_mutex_unlock(&g_shape.lock);
+}
+
+void luftpd_shape_detach(LuftpdShape_t* shape)
+{
+    LuftpdShapeIp_t* ip = shape->ip;
+    shape->ip           = NULL;
+    if (!ip)
+        return;
+
+    pthread_mutex_lock(&g_shape.lock);
+    if (--ip->refs == 0)
+    {
+        LuftpdShapeIp_t** slot = &g_shape.ips[ip->addr % LUFTPD_SHAPE_IP_BUCKETS];
+        while (*slot != ip)
+            slot = &(*slot)->next;
+        *slot = ip->next;
+        free(ip);
+    }
+    pthread_mutex_unlock(&g_shape.lock);
+}
+
+uint64_t luftpd_shape_ip_throttled_ns(const LuftpdShape_t* shape)
+{
+    if (!shape->ip)
+        return 0;
+    pthread_mutex_lock(&g_shape.lock);
+    uint64_t ns = shape->ip->throttled_ns;
+    pthread_mutex_unlock(&g_shape.lock);
+    return ns;
+}
+
+size_t luftpd_shape_acquire(LuftpdShape_t* shape, size_t want)
+{
+    if (want > LUFTPD_SHAPE_MAX_GRANT)
+        want = LUFTPD_SHAPE_MAX_GRANT;
+    double need = want < LUFTPD_SHAPE_MIN_GRANT ? (double) want : LUFTPD_SHAPE_MIN_GRANT;
+
+    pthread_mutex_lock(&g_shape.lock);
+    for (;;)
+    {
+        uint64_t now       = mono_ns();
+        LuftpdBucket_t* ip = shape->ip ? &shape->ip->bucket : NULL;
+        bucket_refill(&g_shape.global, now);
+        bucket_refill(&shape->session, now);
+        if (ip)
+            bucket_refill(ip, now);
+
+        double avail = bucket_avail(&g_shape.global);
+        if (bucket_avail(&shape->session) < avail)
+            avail = bucket_avail(&shape->session);
+        if (ip && bucket_avail(ip) < avail)
+            avail = bucket_avail(ip);
+
+        if (avail >= need)
+        {
+            size_t grant = avail < (double) want ? (size_t) avail : want;
+            if (g_shape.global.rate > 0)
+                g_shape.global.tokens -= (double) grant;
+            if (shape->session.rate > 0)
+                shape->session.tokens -= (double) grant;
+            if (ip)
+                ip->tokens -= (double) grant;
+            pthread_mutex_unlock(&g_shape.lock);
+            return grant;
+        }
+
+        // 按最紧的一级计算等待时间，睡眠期间不持锁
+        uint64_t wait = bucket_wait_ns(&g_shape.global, need);
+        uint64_t w    = bucket_wait_ns(&shape->session, need);
+        if (w > wait)
+            wait = w;
+        if (ip && (w = bucket_wait_ns(ip, need)) > wait)
+            wait = w;
+        shape->throttled_ns += wait;
+        if (shape->ip)
+            shape->ip->throttled_ns += wait;
+        pthread_mutex_unlock(&g_shape.lock);
+
+        struct timespec ts = {.tv_sec = (time_t) (wait / 1000000000ULL),
+                              .tv_nsec = (long) (wait % 1000000000ULL)};
+        while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR)
+            ;
+        pthread_mutex_lock(&g_shape.lock);
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef LUFTPD_SHAPE_H
+#define LUFTPD_SHAPE_H
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// 单次放行的字节数下限：令牌不足该值时等待，避免频繁小块发送
+#define LUFTPD_SHAPE_MIN_GRANT (16 * 1024)
+// 单次放行的字节数上限，多个会话共享上层令牌桶时轮流取用
+#define LUFTPD_SHAPE_MAX_GRANT (64 * 1024)
+// 令牌桶容量对应的突发时长
+#define LUFTPD_SHAPE_BURST_MS 100
+
+// 传输限速
+//
+// 三级令牌桶：全局、按客户端 IP、按会话。发送前从三级桶同时取令牌，任一级不足时
+// 按缺口计算等待时间睡眠，不忙等。速率为0的一级不限速，三级都为0时不启用限速。
+
+typedef struct
+{
+    double rate;   // 字节/秒，0 表示不限速
+    double burst;  // 桶容量
+    double tokens; // 当前令牌数
+    uint64_t last_ns;
+} LuftpdBucket_t;
+
+typedef struct LuftpdShapeIp LuftpdShapeIp_t;
+
+// 会话的限速状态，随控制连接建立和关闭
+typedef struct
+{
+    LuftpdBucket_t session;
+    LuftpdShapeIp_t* ip;
+    uint64_t throttled_ns; // 会话累计因限速等待的时间
+} LuftpdShape_t;
+
+/// @brief 初始化限速，速率单位 KB/s，0 表示该级不限速
+void luftpd_shape_init(int global_kbs, int per_ip_kbs, int per_session_kbs);
+
+/// @brief 是否配置了任一级限速
+int luftpd_shape_enabled(void);
+
+/// @brief 会话开始：初始化会话令牌桶，关联客户端 IP 的令牌桶
+void luftpd_shape_attach(LuftpdShape_t* shape, struct in_addr addr);
+
+/// @brief 会话结束：释放 IP 令牌桶引用，最后一个会话结束时删除该 IP 的令牌桶
+void luftpd_shape_detach(LuftpdShape_t* shape);
+
+/// @brief 客户端 IP 上所有会话累计因限速等待的时间，未按 IP 限速时返回0
+uint64_t luftpd_shape_ip_throttled_ns(const LuftpdShape_t* shape);
+
+/// @brief 申请发送额度，令牌不足时睡眠等待
+/// @param want 希望发送的字节数
+/// @return 本次可以发送的字节数，不超过 want 和 LUFTPD_SHAPE_MAX_GRANT
+size_t luftpd_shape_acquire(LuftpdShape_t* shape, size_t want);
+
+#endif // LUFTPD_SHAPE_H
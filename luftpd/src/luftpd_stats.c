@@ -0,0 +1,406 @@
+#define _GNU_SOURCE // accept4
+#include "luftpd_stats.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// 写传输日志的缓冲区，满了先写出
+#define STATS_OUT_SIZE (64 * 1024)
+
+// 一个线程的计数器，独占缓存行
+typedef struct
+{
+    _Atomic uint64_t sessions_opened;
+    _Atomic uint64_t sessions_closed;
+    _Atomic uint64_t pasv_failures;
+    _Atomic uint64_t throttled_ns;
+    _Atomic uint64_t xfer_ok[2]; // 下标0下载，1上传
+    _Atomic uint64_t xfer_failed[2];
+    _Atomic uint64_t bytes[2];
+    _Atomic uint64_t size_hist[LUFTPD_STATS_HIST_BUCKETS];
+    _Atomic uint64_t duration_hist[LUFTPD_STATS_HIST_BUCKETS];
+} __attribute__((aligned(64))) StatsShard_t;
+
+typedef struct
+{
+    _Atomic size_t seq;
+    LuftpdXferRec_t rec;
+} StatsSlot_t;
+
+static struct
+{
+    StatsShard_t shards[LUFTPD_STATS_SHARDS];
+    _Atomic int nshards;
+    // 多生产者单消费者的有界队列：slot.seq 等于 pos 时可写，等于 pos + 1 时可读
+    StatsSlot_t slots[LUFTPD_STATS_QUEUE_SIZE];
+    _Atomic size_t tail;
+    size_t head; // 只由写入线程访问
+    _Atomic uint64_t dropped;
+    int log_fd;
+    int listen_fd;
+    char log_path[256];
+} g_stats = {.log_fd = -1, .listen_fd = -1};
+
+static _Thread_local StatsShard_t* t_shard;
+
+static StatsShard_t* shard(void)
+{
+    return t_shard ? t_shard : &g_stats.shards[LUFTPD_STATS_SHARDS - 1];
+}
+
+static void add(_Atomic uint64_t* counter, uint64_t v)
+{
+    atomic_fetch_add_explicit(counter, v, memory_order_relaxed);
+}
+
+static uint64_t sum(size_t offset)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < LUFTPD_STATS_SHARDS; i++)
+        total += atomic_load_explicit((_Atomic uint64_t*) ((char*) &g_stats.shards[i] + offset),
+                                      memory_order_relaxed);
+    return total;
+}
+
+#define SUM(field) sum(offsetof(StatsShard_t, field))
+
+static uint64_t mono_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+// 第 b 个桶统计 (2^(b-1), 2^b] 内的值，0 和 1 落在第0个桶
+static int bucket_of(uint64_t v)
+{
+    int b = v <= 1 ? 0 : 64 - __builtin_clzll(v - 1);
+    return b < LUFTPD_STATS_HIST_BUCKETS ? b : LUFTPD_STATS_HIST_BUCKETS - 1;
+}
+
+void luftpd_stats_thread_init(void)
+{
+    int idx = atomic_fetch_add(&g_stats.nshards, 1);
+    t_shard = &g_stats.shards[idx < LUFTPD_STATS_SHARDS ? idx : LUFTPD_STATS_SHARDS - 1];
+}
+
+void luftpd_stats_session_open(void)
+{
+    add(&shard()->sessions_opened, 1);
+}
+
+void luftpd_stats_session_close(void)
+{
+    add(&shard()->sessions_closed, 1);
+}
+
+void luftpd_stats_pasv_failed(void)
+{
+    add(&shard()->pasv_failures, 1);
+}
+
+void luftpd_stats_bytes(char direction, uint64_t n)
+{
+    add(&shard()->bytes[direction == 'i'], n);
+}
+
+void luftpd_stats_throttled(uint64_t ns)
+{
+    add(&shard()->throttled_ns, ns);
+}
+
+static void enqueue(const LuftpdXferRec_t* rec)
+{
+    size_t pos = atomic_load_explicit(&g_stats.tail, memory_order_relaxed);
+    StatsSlot_t* slot;
+    for (;;)
+    {
+        slot         = &g_stats.slots[pos & (LUFTPD_STATS_QUEUE_SIZE - 1)];
+        size_t seq   = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t) seq - (intptr_t) pos;
+        if (dif == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&g_stats.tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (dif < 0)
+        {
+            add(&g_stats.dropped, 1); // 队列已满
+            return;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&g_stats.tail, memory_order_relaxed);
+        }
+    }
+    slot->rec = *rec;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+}
+
+static int dequeue(LuftpdXferRec_t* rec)
+{
+    StatsSlot_t* slot = &g_stats.slots[g_stats.head & (LUFTPD_STATS_QUEUE_SIZE - 1)];
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != g_stats.head + 1)
+        return 0;
+    *rec = slot->rec;
+    atomic_store_explicit(&slot->seq, g_stats.head + LUFTPD_STATS_QUEUE_SIZE, memory_order_release);
+    g_stats.head++;
+    return 1;
+}
+
+void luftpd_stats_xfer(const LuftpdXferRec_t* rec)
+{
+    StatsShard_t* s = shard();
+    int dir         = rec->direction == 'i';
+    if (rec->code == 226)
+        add(&s->xfer_ok[dir], 1);
+    else
+        add(&s->xfer_failed[dir], 1);
+    add(&s->size_hist[bucket_of((uint64_t) rec->bytes)], 1);
+    add(&s->duration_hist[bucket_of(rec->duration_ns / 1000000)], 1);
+    if (g_stats.log_fd >= 0)
+        enqueue(rec);
+}
+
+// 按 xferlog 格式输出一行，末尾追加应答码和吞吐率（字节/秒）
+static int format_rec(const LuftpdXferRec_t* rec, char* out, size_t sz)
+{
+    char when[32];
+    struct tm tm;
+    localtime_r(&rec->end, &tm);
+    strftime(when, sizeof(when), "%a %b %e %H:%M:%S %Y", &tm);
+
+    char host[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &rec->addr, host, sizeof(host));
+
+    // xferlog 以空白分隔字段，文件名中的空白替换掉
+    char path[LUFTPD_STATS_PATH_MAX];
+    size_t i;
+    for (i = 0; rec->path[i] && i < sizeof(path) - 1; i++)
+        path[i] = (unsigned char) rec->path[i] <= ' ' ? '_' : rec->path[i];
+    path[i] = '\0';
+
+    uint64_t secs = (rec->duration_ns + 500000000ULL) / 1000000000ULL;
+    double rate   = rec->duration_ns ? (double) rec->bytes * 1e9 / (double) rec->duration_ns : 0;
+    return snprintf(out, sz, "%s %llu %s %lld %s %c _ %c a anonymous ftp 0 * %c %d %.0f\n", when,
+                    (unsigned long long) secs, host, (long long) rec->bytes, path, rec->type,
+                    rec->direction, rec->code == 226 ? 'c' : 'i', rec->code, rate);
+}
+
+static void write_all(int fd, const char* buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        buf += n;
+        len -= (size_t) n;
+    }
+}
+
+static void drain_log(char* out)
+{
+    // 日志被轮转（移走或删除）后重新打开
+    struct stat st;
+    if (fstat(g_stats.log_fd, &st) == 0 && st.st_nlink == 0)
+    {
+        int fd = open(g_stats.log_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (fd >= 0)
+        {
+            close(g_stats.log_fd);
+            g_stats.log_fd = fd;
+        }
+    }
+
+    size_t len = 0;
+    LuftpdXferRec_t rec;
+    while (dequeue(&rec))
+    {
+        if (len + LUFTPD_STATS_PATH_MAX + 256 > STATS_OUT_SIZE)
+        {
+            write_all(g_stats.log_fd, out, len);
+            len = 0;
+        }
+        int n = format_rec(&rec, out + len, STATS_OUT_SIZE - len);
+        if (n > 0)
+            len += (size_t) n < STATS_OUT_SIZE - len ? (size_t) n : STATS_OUT_SIZE - len - 1;
+    }
+    if (len > 0)
+        write_all(g_stats.log_fd, out, len);
+}
+
+typedef struct
+{
+    uint64_t bytes[2];
+    uint64_t ns;
+    double rate[2]; // 最近一个周期的吞吐率
+} StatsRate_t;
+
+static void sample_rate(StatsRate_t* r)
+{
+    uint64_t now = mono_ns();
+    for (int dir = 0; dir < 2; dir++)
+    {
+        uint64_t bytes = SUM(bytes[dir]);
+        r->rate[dir]   = (double) (bytes - r->bytes[dir]) * 1e9 / (double) (now - r->ns);
+        r->bytes[dir]  = bytes;
+    }
+    r->ns = now;
+}
+
+static void print_hist(FILE* f, const char* name, size_t offset)
+{
+    uint64_t counts[LUFTPD_STATS_HIST_BUCKETS];
+    uint64_t total = 0;
+    int last       = -1;
+    for (int b = 0; b < LUFTPD_STATS_HIST_BUCKETS; b++)
+    {
+        counts[b] = sum(offset + (size_t) b * sizeof(_Atomic uint64_t));
+        total += counts[b];
+        if (counts[b])
+            last = b;
+    }
+    // 累计计数，只输出到最后一个非空桶，最后一个桶没有上界
+    uint64_t cum = 0;
+    for (int b = 0; b <= last && b < LUFTPD_STATS_HIST_BUCKETS - 1; b++)
+    {
+        cum += counts[b];
+        fprintf(f, "%s_bucket{le=\"%llu\"} %llu\n", name, 1ULL << b, (unsigned long long) cum);
+    }
+    fprintf(f, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long) total);
+}
+
+static void serve_query(const StatsRate_t* r)
+{
+    int conn = accept4(g_stats.listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (conn < 0)
+        return;
+
+    char* text = NULL;
+    size_t len = 0;
+    FILE* f    = open_memstream(&text, &len);
+    if (!f)
+    {
+        close(conn);
+        return;
+    }
+    uint64_t opened = SUM(sessions_opened);
+    uint64_t closed = SUM(sessions_closed);
+    fprintf(f, "sessions_active %llu\n", (unsigned long long) (opened - closed));
+    fprintf(f, "sessions_total %llu\n", (unsigned long long) opened);
+    fprintf(f, "pasv_failures %llu\n", (unsigned long long) SUM(pasv_failures));
+    fprintf(f, "downloads_ok %llu\n", (unsigned long long) SUM(xfer_ok[0]));
+    fprintf(f, "downloads_failed %llu\n", (unsigned long long) SUM(xfer_failed[0]));
+    fprintf(f, "uploads_ok %llu\n", (unsigned long long) SUM(xfer_ok[1]));
+    fprintf(f, "uploads_failed %llu\n", (unsigned long long) SUM(xfer_failed[1]));
+    fprintf(f, "bytes_out_total %llu\n", (unsigned long long) SUM(bytes[0]));
+    fprintf(f, "bytes_in_total %llu\n", (unsigned long long) SUM(bytes[1]));
+    fprintf(f, "bytes_out_per_sec %.0f\n", r->rate[0]);
+    fprintf(f, "bytes_in_per_sec %.0f\n", r->rate[1]);
+    fprintf(f, "throttled_ms_total %llu\n", (unsigned long long) (SUM(throttled_ns) / 1000000));
+    fprintf(f, "xferlog_dropped %llu\n",
+            (unsigned long long) atomic_load_explicit(&g_stats.dropped, memory_order_relaxed));
+    print_hist(f, "xfer_bytes", offsetof(StatsShard_t, size_hist));
+    print_hist(f, "xfer_duration_ms", offsetof(StatsShard_t, duration_hist));
+    fclose(f);
+
+    write_all(conn, text, len);
+    free(text);
+    close(conn);
+}
+
+static void* stats_thread(void* arg)
+{
+    (void) arg;
+    char* out = malloc(STATS_OUT_SIZE);
+    if (!out)
+        return NULL;
+
+    StatsRate_t rate = {.ns = mono_ns()};
+    uint64_t next    = rate.ns + LUFTPD_STATS_TICK_MS * 1000000ULL;
+    for (;;)
+    {
+        struct pollfd pfd = {.fd = g_stats.listen_fd, .events = POLLIN};
+        uint64_t now      = mono_ns();
+        int timeout       = now < next ? (int) ((next - now) / 1000000) + 1 : 0;
+        if (poll(&pfd, g_stats.listen_fd >= 0 ? 1 : 0, timeout) > 0)
+            serve_query(&rate);
+
+        if (mono_ns() >= next)
+        {
+            if (g_stats.log_fd >= 0)
+                drain_log(out);
+            sample_rate(&rate);
+            next += LUFTPD_STATS_TICK_MS * 1000000ULL;
+        }
+    }
+    return NULL;
+}
+
+static int open_socket(const char* path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    // 上次运行留下的套接字文件
+    unlink(path);
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(fd, 8) != 0)
+    {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+int luftpd_stats_init(const char* xferlog_path, const char* socket_path)
+{
+    for (size_t i = 0; i < LUFTPD_STATS_QUEUE_SIZE; i++)
+        atomic_init(&g_stats.slots[i].seq, i);
+
+    int rc = 0;
+    if (xferlog_path[0])
+    {
+        snprintf(g_stats.log_path, sizeof(g_stats.log_path), "%s", xferlog_path);
+        g_stats.log_fd = open(xferlog_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (g_stats.log_fd < 0)
+            rc = -1;
+    }
+    if (socket_path[0] && (g_stats.listen_fd = open_socket(socket_path)) < 0)
+        rc = -1;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, stats_thread, NULL) != 0)
+    {
+        // 没有写入线程时不再入队
+        if (g_stats.log_fd >= 0)
+            close(g_stats.log_fd);
+        g_stats.log_fd = -1;
+        return -1;
+    }
+    pthread_detach(tid);
+    return rc;
+}
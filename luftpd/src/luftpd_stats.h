@@ -0,0 +1,64 @@
+#ifndef LUFTPD_STATS_H
+#define LUFTPD_STATS_H
+#include <netinet/in.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+// 传输记录队列长度，须为2的幂；写入线程来不及处理时丢弃新记录并计数
+#define LUFTPD_STATS_QUEUE_SIZE 1024
+// 写入线程的周期：批量写传输日志、采样吞吐率
+#define LUFTPD_STATS_TICK_MS 500
+// 记录中路径的最大长度，超出截断并以"..."结尾
+#define LUFTPD_STATS_PATH_MAX 512
+// 直方图按2的幂分桶的桶数
+#define LUFTPD_STATS_HIST_BUCKETS 40
+// 计数分片数：每个传输线程和控制线程各占一片，超出的线程共用最后一片
+#define LUFTPD_STATS_SHARDS 260
+
+// 传输统计
+//
+// 计数器按线程分片，每个线程只写自己的分片，不加锁也没有缓存行争用；读取时把
+// 所有分片相加。每次文件传输结束生成一条记录，放入无锁队列，由后台线程按 xferlog
+// 格式批量追加到日志文件，同一线程还在本地 UNIX 套接字上应答统计查询：
+// 连接后服务器写出全部计数器（文本，一行一项）并关闭连接。
+
+typedef struct
+{
+    time_t end;           // 结束时间
+    uint64_t duration_ns; // 从建立数据连接到传输结束
+    off_t bytes;
+    struct in_addr addr;
+    int code;             // 最终应答码，226 表示成功
+    char direction;       // 'o' 下载，'i' 上传
+    char type;            // 'a' ASCII，'b' 二进制
+    char path[LUFTPD_STATS_PATH_MAX];
+} LuftpdXferRec_t;
+
+/// @brief 启动统计线程
+/// @param xferlog_path 传输日志路径，空串不写日志
+/// @param socket_path 统计查询套接字路径，空串不提供查询
+/// @return 成功返回0；日志或套接字无法打开返回-1，其余部分照常工作
+int luftpd_stats_init(const char* xferlog_path, const char* socket_path);
+
+/// @brief 当前线程领取一个计数分片，每个会记录统计的线程启动时调用一次
+void luftpd_stats_thread_init(void);
+
+/// @brief 会话建立和关闭
+void luftpd_stats_session_open(void);
+void luftpd_stats_session_close(void);
+
+/// @brief 被动模式端口分配失败
+void luftpd_stats_pasv_failed(void);
+
+/// @brief 数据连接上收发了 n 字节，传输过程中分块调用，吞吐率据此实时计算
+/// @param direction 'o' 下载，'i' 上传
+void luftpd_stats_bytes(char direction, uint64_t n);
+
+/// @brief 下载因限速等待的时间
+void luftpd_stats_throttled(uint64_t ns);
+
+/// @brief 一次文件传输结束：更新次数和直方图，并提交记录给写入线程
+void luftpd_stats_xfer(const LuftpdXferRec_t* rec);
+
+#endif // LUFTPD_STATS_H
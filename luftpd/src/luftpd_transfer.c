@@ -0,0 +1,293 @@
+#define _GNU_SOURCE // splice, sync_file_range
+#include "luftpd_transfer.h"
+#include "luftpd_ascii.h"
+#include "luftpd_stats.h"
+#include "luftpd_utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// 读写拷贝：sendfile 不支持的文件系统才会走到这里
+static int send_buffered(int sock, int fd, off_t offset, off_t len, LuftpdShape_t* shape,
+                         off_t* sent)
+{
+    void* buf = NULL;
+    if (posix_memalign(&buf, 4096, LUFTPD_XFER_BUF_SIZE) != 0)
+        return LUFTPD_XFER_ERR_READ;
+
+    int rc = LUFTPD_XFER_OK;
+    while (len > 0)
+    {
+        size_t want = len < LUFTPD_XFER_BUF_SIZE ? (size_t) len : LUFTPD_XFER_BUF_SIZE;
+        if (shape)
+            want = luftpd_shape_acquire(shape, want);
+        ssize_t n = pread(fd, buf, want, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            rc = LUFTPD_XFER_ERR_READ;
+            break;
+        }
+        if (luftpd_send_raw(sock, buf, (size_t) n) != 0)
+        {
+            rc = LUFTPD_XFER_ERR_SEND;
+            break;
+        }
+        offset += n;
+        len -= n;
+        *sent += n;
+        luftpd_stats_bytes('o', (uint64_t) n);
+    }
+    free(buf);
+    return rc;
+}
+
+int luftpd_send_file(int sock, int fd, off_t offset, off_t len, LuftpdShape_t* shape, off_t* sent)
+{
+    *sent = 0;
+    // 日志包按顺序整读，提示内核加大预读
+    posix_fadvise(fd, offset, len, POSIX_FADV_SEQUENTIAL);
+
+    while (len > 0)
+    {
+        size_t chunk = len < LUFTPD_XFER_SENDFILE_CHUNK ? (size_t) len : LUFTPD_XFER_SENDFILE_CHUNK;
+        if (shape)
+            chunk = luftpd_shape_acquire(shape, chunk);
+        ssize_t n = sendfile(sock, fd, &offset, chunk);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            // 文件系统不支持 sendfile，剩余部分改为读写拷贝
+            if (errno == EINVAL || errno == ENOSYS)
+            {
+                off_t rest = 0;
+                int rc     = send_buffered(sock, fd, offset, len, shape, &rest);
+                *sent += rest;
+                return rc;
+            }
+            return errno == EIO ? LUFTPD_XFER_ERR_READ : LUFTPD_XFER_ERR_SEND;
+        }
+        if (n == 0)
+            return LUFTPD_XFER_ERR_READ; // 文件在传输中被截断
+        len -= n;
+        *sent += n;
+        luftpd_stats_bytes('o', (uint64_t) n);
+    }
+    return LUFTPD_XFER_OK;
+}
+
+int luftpd_send_file_ascii(int sock, int fd, off_t offset, off_t len, LuftpdShape_t* shape,
+                           off_t* sent)
+{
+    *sent = 0;
+    posix_fadvise(fd, offset, len, POSIX_FADV_SEQUENTIAL);
+
+    // 续传时起点前一个字节决定起点处的 LF 是否已有 CR
+    char prev = 0;
+    if (offset > 0 && pread(fd, &prev, 1, offset - 1) != 1)
+        return LUFTPD_XFER_ERR_READ;
+    LuftpdAscii_t ascii;
+    luftpd_ascii_init(&ascii, prev);
+
+    char* in  = NULL;
+    char* out = NULL;
+    if (posix_memalign((void**) &in, 4096, LUFTPD_XFER_BUF_SIZE) != 0 ||
+        posix_memalign((void**) &out, 4096, LUFTPD_ASCII_OUT_SIZE(LUFTPD_XFER_BUF_SIZE)) != 0)
+    {
+        free(in);
+        return LUFTPD_XFER_ERR_READ;
+    }
+
+    int rc = LUFTPD_XFER_OK;
+    while (len > 0)
+    {
+        size_t want = len < LUFTPD_XFER_BUF_SIZE ? (size_t) len : LUFTPD_XFER_BUF_SIZE;
+        if (shape)
+            want = luftpd_shape_acquire(shape, want);
+        ssize_t n = pread(fd, in, want, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            rc = LUFTPD_XFER_ERR_READ;
+            break;
+        }
+        size_t out_len = luftpd_ascii_encode(&ascii, in, (size_t) n, out);
+        if (luftpd_send_raw(sock, out, out_len) != 0)
+        {
+            rc = LUFTPD_XFER_ERR_SEND;
+            break;
+        }
+        offset += n;
+        len -= n;
+        *sent += n;
+        luftpd_stats_bytes('o', (uint64_t) out_len);
+    }
+    free(in);
+    free(out);
+    return rc;
+}
+
+// 接收端的回写状态：[done, started) 已启动回写，[started, offset) 是尚未回写的脏页
+typedef struct
+{
+    off_t window;
+    off_t done;
+    off_t started;
+} WriteBehind_t;
+
+static void write_behind(int fd, WriteBehind_t* wb, off_t offset)
+{
+    if (wb->window <= 0 || offset - wb->started < wb->window)
+        return;
+    sync_file_range(fd, wb->started, offset - wb->started, SYNC_FILE_RANGE_WRITE);
+    // 上一个窗口此时多半已写完，等待只是兜底；落盘后的页不会再用到，直接丢弃
+    if (wb->started > wb->done)
+    {
+        sync_file_range(fd, wb->done, wb->started - wb->done,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                            SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(fd, wb->done, wb->started - wb->done, POSIX_FADV_DONTNEED);
+    }
+    wb->done    = wb->started;
+    wb->started = offset;
+}
+
+static int pwrite_all(int fd, const char* buf, size_t len, off_t offset)
+{
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, buf, len, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            if (n == 0)
+                errno = ENOSPC;
+            return -1;
+        }
+        buf += n;
+        len -= (size_t) n;
+        offset += n;
+    }
+    return 0;
+}
+
+// 读写拷贝。pipe_fd >= 0 时先把管道中 pending 字节取出写入，再继续从套接字接收
+static int recv_buffered(int sock, int fd, int pipe_fd, size_t pending, off_t offset,
+                         WriteBehind_t* wb, off_t* received)
+{
+    void* buf = NULL;
+    if (posix_memalign(&buf, 4096, LUFTPD_XFER_BUF_SIZE) != 0)
+        return LUFTPD_XFER_ERR_WRITE;
+
+    int rc = LUFTPD_XFER_OK;
+    for (;;)
+    {
+        size_t want = LUFTPD_XFER_BUF_SIZE;
+        ssize_t n;
+        if (pending > 0)
+        {
+            n = read(pipe_fd, buf, pending < want ? pending : want);
+            if (n > 0)
+                pending -= (size_t) n;
+        }
+        else
+        {
+            n = recv(sock, buf, want, 0);
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+        {
+            rc = LUFTPD_XFER_ERR_RECV;
+            break;
+        }
+        if (n == 0)
+            break;
+        if (pwrite_all(fd, buf, (size_t) n, offset) != 0)
+        {
+            rc = LUFTPD_XFER_ERR_WRITE;
+            break;
+        }
+        offset += n;
+        *received += n;
+        luftpd_stats_bytes('i', (uint64_t) n);
+        write_behind(fd, wb, offset);
+    }
+    int saved = errno;
+    free(buf);
+    errno = saved;
+    return rc;
+}
+
+int luftpd_recv_file(int sock, int fd, off_t offset, off_t sync_window, off_t* received)
+{
+    *received        = 0;
+    WriteBehind_t wb = {.window = sync_window, .done = offset, .started = offset};
+
+    int pfd[2];
+    if (pipe2(pfd, O_CLOEXEC) != 0)
+        return recv_buffered(sock, fd, -1, 0, offset, &wb, received);
+    // 管道默认只有 64KB，加大后每次 splice 能搬更多数据，失败时沿用默认容量
+    fcntl(pfd[1], F_SETPIPE_SZ, LUFTPD_XFER_PIPE_SIZE);
+
+    int rc = LUFTPD_XFER_OK;
+    for (;;)
+    {
+        ssize_t n = splice(sock, NULL, pfd[1], NULL, LUFTPD_XFER_PIPE_SIZE, SPLICE_F_MOVE);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EINVAL && *received == 0)
+        {
+            // 套接字不支持 splice，全程读写拷贝
+            rc = recv_buffered(sock, fd, -1, 0, offset, &wb, received);
+            break;
+        }
+        if (n < 0)
+        {
+            rc = LUFTPD_XFER_ERR_RECV;
+            break;
+        }
+        if (n == 0)
+            break;
+
+        size_t pending = (size_t) n;
+        while (pending > 0)
+        {
+            ssize_t m = splice(pfd[0], NULL, fd, &offset, pending, SPLICE_F_MOVE);
+            if (m < 0 && errno == EINTR)
+                continue;
+            if (m < 0 && errno == EINVAL)
+            {
+                // 文件系统不支持 splice 写入，管道中的剩余数据和之后的数据都走读写拷贝
+                off_t rest = 0;
+                rc         = recv_buffered(sock, fd, pfd[0], pending, offset, &wb, &rest);
+                *received += rest;
+                goto out;
+            }
+            if (m <= 0)
+            {
+                if (m == 0)
+                    errno = ENOSPC;
+                rc = LUFTPD_XFER_ERR_WRITE;
+                goto out;
+            }
+            pending -= (size_t) m;
+            *received += m;
+            luftpd_stats_bytes('i', (uint64_t) m);
+        }
+        write_behind(fd, &wb, offset);
+    }
+out:;
+    int saved = errno;
+    close(pfd[0]);
+    close(pfd[1]);
+    errno = saved;
+    return rc;
+}
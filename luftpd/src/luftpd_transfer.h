@@ -0,0 +1,44 @@
+#ifndef LUFTPD_TRANSFER_H
+#define LUFTPD_TRANSFER_H
+#include "luftpd_shape.h"
+#include <sys/types.h>
+
+// sendfile 不可用时回退到读写拷贝的缓冲区大小，按页对齐分配
+#define LUFTPD_XFER_BUF_SIZE (256 * 1024)
+// 单次 sendfile 的字节数（内核上限 0x7ffff000），分块发送以便统计及时看到传输进度
+#define LUFTPD_XFER_SENDFILE_CHUNK (8 * 1024 * 1024)
+// 接收时 splice 中转管道的容量
+#define LUFTPD_XFER_PIPE_SIZE (1024 * 1024)
+
+// 传输结果
+#define LUFTPD_XFER_OK        0
+#define LUFTPD_XFER_ERR_READ  -1 // 读取文件失败，或传输中文件被截断
+#define LUFTPD_XFER_ERR_SEND  -2 // 发送失败（对端断开、超时等）
+#define LUFTPD_XFER_ERR_WRITE -3 // 写入文件失败（磁盘已满等），errno 保留失败原因
+#define LUFTPD_XFER_ERR_RECV  -4 // 接收失败（连接被重置、超时等）
+
+/// @brief 把文件 [offset, offset + len) 发送到数据连接
+///
+/// 优先用 sendfile 在内核内直接从页缓存发送，文件系统不支持时回退到
+/// 对齐缓冲区的 pread + send。部分发送会继续发送剩余部分，直到全部完成或出错。
+/// @param shape 限速状态，NULL 表示不限速；限速时每块发送前先申请额度
+/// @param sent 输出实际发送的字节数
+/// @return LUFTPD_XFER_OK 或 LUFTPD_XFER_ERR_*
+int luftpd_send_file(int sock, int fd, off_t offset, off_t len, LuftpdShape_t* shape, off_t* sent);
+
+/// @brief 以 ASCII 模式发送文件 [offset, offset + len)：读入后把 LF 转为 CRLF 再发送
+/// @param sent 输出已发送的文件字节数（转换前）
+/// @return LUFTPD_XFER_OK 或 LUFTPD_XFER_ERR_*
+int luftpd_send_file_ascii(int sock, int fd, off_t offset, off_t len, LuftpdShape_t* shape,
+                           off_t* sent);
+
+/// @brief 从数据连接接收数据写入文件 offset 处，直到对端关闭连接
+///
+/// 优先用 splice 经管道把套接字数据直接搬进页缓存，不支持时回退到 recv + pwrite。
+/// @param sync_window 为0时不主动回写；非0时每写满一个窗口用 sync_file_range 启动该窗口的
+///                    回写，并等待上一个窗口落盘后丢弃其页缓存，脏页始终不超过两个窗口
+/// @param received 输出实际写入的字节数
+/// @return LUFTPD_XFER_OK 或 LUFTPD_XFER_ERR_*
+int luftpd_recv_file(int sock, int fd, off_t offset, off_t sync_window, off_t* received);
+
+#endif // LUFTPD_TRANSFER_H
@@ -16,7 +16,10 @@ int luftpd_send_raw(int sock, const char *buf, size_t len)
     size_t sent = 0;
     while (sent < len){
         ssize_t n = send(sock, buf + sent, len - sent, 0);
-        if (n < 0) return -1;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
         sent += n;
     }
     return 0;
@@ -133,8 +136,14 @@ int luftpd_resolve_path(const char* ftp_root,
         return -1; // FTP根目录不存在或无法访问
     }
 
-    // 获取current_path的真实路径
-    if (realpath(current_path, real_current_path) == NULL)
+    // 获取current_path的真实路径，current_path是相对FTP根目录的路径
+    char joined_current_path[PATH_MAX * 2];
+    snprintf(joined_current_path,
+             sizeof(joined_current_path),
+             "%s/%s",
+             normalized_ftp_root,
+             current_path);
+    if (realpath(joined_current_path, real_current_path) == NULL)
     {
         return -1; // 当前路径不存在或无法访问
     }
@@ -0,0 +1,408 @@
+#include "luftpd_zmode.h"
+#include "luftpd_stats.h"
+#include "luftpd_transfer.h"
+#include "luftpd_utils.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define ZCACHE_MAGIC "LFZ1"
+
+// 缓存文件头，之后是源文件完整内容的 zlib 流
+typedef struct
+{
+    char magic[4];
+    uint32_t reserved;
+    uint64_t src_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} ZCacheHeader_t;
+
+typedef struct
+{
+    int fd; // 源文件描述符的副本，构建完成后关闭
+    dev_t dev;
+    ino_t ino;
+} ZJob_t;
+
+typedef struct
+{
+    char name[NAME_MAX + 1];
+    off_t size;
+    time_t mtime;
+} ZCacheFile_t;
+
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int enabled;
+    char dir[PATH_MAX];
+    uint64_t max_bytes;
+    ZJob_t jobs[LUFTPD_Z_QUEUE_MAX];
+    int head;
+    int count;
+    dev_t building_dev; // 正在构建的文件，避免重复入队
+    ino_t building_ino;
+} g_z = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+
+// ================================ 压缩 ===============================
+
+// 压缩输出的去向：数据连接或缓存文件
+typedef int (*ZSink_t)(void* ctx, const unsigned char* data, size_t len);
+
+typedef struct
+{
+    int sock;
+    LuftpdShape_t* shape;
+    off_t* sent;
+} ZSockSink_t;
+
+static int sink_sock(void* ctx, const unsigned char* data, size_t len)
+{
+    ZSockSink_t* s = ctx;
+    while (len > 0)
+    {
+        size_t n = s->shape ? luftpd_shape_acquire(s->shape, len) : len;
+        if (luftpd_send_raw(s->sock, (const char*) data, n) != 0)
+            return -1;
+        data += n;
+        len -= n;
+        *s->sent += (off_t) n;
+        luftpd_stats_bytes('o', (uint64_t) n);
+    }
+    return 0;
+}
+
+static int sink_file(void* ctx, const unsigned char* data, size_t len)
+{
+    int fd = *(int*) ctx;
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        data += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+// 把文件 [offset, offset + len) 压缩成一个完整的 zlib 流写入 sink
+static int deflate_fd(int fd, off_t offset, off_t len, int level, ZSink_t sink, void* ctx)
+{
+    z_stream zs        = {0};
+    unsigned char* in  = malloc(LUFTPD_Z_BUF_SIZE);
+    unsigned char* out = malloc(LUFTPD_Z_BUF_SIZE);
+    if (!in || !out || deflateInit(&zs, level) != Z_OK)
+    {
+        free(in);
+        free(out);
+        return LUFTPD_XFER_ERR_READ;
+    }
+
+    int rc = LUFTPD_XFER_OK;
+    for (;;)
+    {
+        ssize_t n = 0;
+        if (len > 0)
+        {
+            size_t want = len < LUFTPD_Z_BUF_SIZE ? (size_t) len : LUFTPD_Z_BUF_SIZE;
+            do
+            {
+                n = pread(fd, in, want, offset);
+            } while (n < 0 && errno == EINTR);
+            if (n <= 0)
+            {
+                rc = LUFTPD_XFER_ERR_READ; // 读取失败或文件被截断
+                break;
+            }
+            offset += n;
+            len -= n;
+        }
+        zs.next_in  = in;
+        zs.avail_in = (uInt) n;
+        int flush   = len == 0 ? Z_FINISH : Z_NO_FLUSH;
+        do
+        {
+            zs.next_out  = out;
+            zs.avail_out = LUFTPD_Z_BUF_SIZE;
+            deflate(&zs, flush);
+            size_t have = LUFTPD_Z_BUF_SIZE - zs.avail_out;
+            if (have > 0 && sink(ctx, out, have) != 0)
+            {
+                rc = LUFTPD_XFER_ERR_SEND;
+                break;
+            }
+        } while (zs.avail_out == 0);
+        if (rc != LUFTPD_XFER_OK || flush == Z_FINISH)
+            break;
+    }
+    deflateEnd(&zs);
+    free(in);
+    free(out);
+    return rc;
+}
+
+int luftpd_z_send_buf(int sock, const char* data, size_t len, off_t* sent)
+{
+    *sent          = 0;
+    uLongf out_len = compressBound((uLong) len);
+    Bytef* out     = malloc(out_len ? out_len : 1);
+    if (!out)
+        return LUFTPD_XFER_ERR_READ;
+    if (compress2(out, &out_len, (const Bytef*) data, (uLong) len, Z_DEFAULT_COMPRESSION) != Z_OK)
+    {
+        free(out);
+        return LUFTPD_XFER_ERR_READ;
+    }
+    int rc = luftpd_send_raw(sock, (const char*) out, out_len);
+    free(out);
+    if (rc != 0)
+        return LUFTPD_XFER_ERR_SEND;
+    *sent = (off_t) out_len;
+    return LUFTPD_XFER_OK;
+}
+
+// ================================ 缓存 ===============================
+
+// 缓存文件名 "/<dev>-<ino>.z" 的长度，不含结尾的 '\0'
+#define ZCACHE_NAME_LEN (1 + 16 + 1 + 16 + 2)
+
+// 路径放不下时返回-1，调用方按未命中处理，避免截断后不同文件撞到同一个名字
+static int cache_path(dev_t dev, ino_t ino, char* out, size_t out_sz)
+{
+    int n = snprintf(out, out_sz, "%s/%016llx-%016llx.z", g_z.dir, (unsigned long long) dev,
+                     (unsigned long long) ino);
+    return (n < 0 || (size_t) n >= out_sz) ? -1 : 0;
+}
+
+static void header_fill(ZCacheHeader_t* h, const struct stat* st)
+{
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, ZCACHE_MAGIC, sizeof(h->magic));
+    h->src_size   = (uint64_t) st->st_size;
+    h->mtime_sec  = st->st_mtim.tv_sec;
+    h->mtime_nsec = st->st_mtim.tv_nsec;
+}
+
+// 打开与源文件当前状态一致的缓存，返回描述符和压缩数据长度
+static int cache_open(const struct stat* st, off_t* payload_len)
+{
+    char path[PATH_MAX];
+    if (cache_path(st->st_dev, st->st_ino, path, sizeof(path)) != 0)
+        return -1;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    ZCacheHeader_t h, expect;
+    struct stat cst;
+    header_fill(&expect, st);
+    if (pread(fd, &h, sizeof(h), 0) != (ssize_t) sizeof(h) || memcmp(&h, &expect, sizeof(h)) != 0 ||
+        fstat(fd, &cst) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    *payload_len = cst.st_size - (off_t) sizeof(h);
+    return fd;
+}
+
+static void cache_enqueue(int fd, const struct stat* st)
+{
+    pthread_mutex_lock(&g_z.lock);
+    int queued = g_z.building_dev == st->st_dev && g_z.building_ino == st->st_ino;
+    for (int i = 0; i < g_z.count && !queued; i++)
+    {
+        const ZJob_t* job = &g_z.jobs[(g_z.head + i) % LUFTPD_Z_QUEUE_MAX];
+        queued            = job->dev == st->st_dev && job->ino == st->st_ino;
+    }
+    if (!queued && g_z.count < LUFTPD_Z_QUEUE_MAX)
+    {
+        int dup_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (dup_fd >= 0)
+        {
+            g_z.jobs[(g_z.head + g_z.count) % LUFTPD_Z_QUEUE_MAX] =
+                (ZJob_t){.fd = dup_fd, .dev = st->st_dev, .ino = st->st_ino};
+            g_z.count++;
+            pthread_cond_signal(&g_z.cond);
+        }
+    }
+    pthread_mutex_unlock(&g_z.lock);
+}
+
+// 先写临时文件，压缩期间源文件没有变化才改名生效
+static void cache_build(int fd)
+{
+    struct stat before, after;
+    if (fstat(fd, &before) != 0)
+        return;
+    off_t payload_len;
+    int existing = cache_open(&before, &payload_len);
+    if (existing >= 0)
+    {
+        close(existing);
+        return;
+    }
+
+    char path[PATH_MAX], tmp[PATH_MAX + 8];
+    if (cache_path(before.st_dev, before.st_ino, path, sizeof(path)) != 0)
+        return;
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out < 0)
+        return;
+
+    ZCacheHeader_t h;
+    header_fill(&h, &before);
+    int ok = sink_file(&out, (const unsigned char*) &h, sizeof(h)) == 0 &&
+             deflate_fd(fd, 0, before.st_size, LUFTPD_Z_LEVEL_CACHE, sink_file, &out) ==
+                 LUFTPD_XFER_OK &&
+             fstat(fd, &after) == 0 && after.st_size == before.st_size &&
+             after.st_mtim.tv_sec == before.st_mtim.tv_sec &&
+             after.st_mtim.tv_nsec == before.st_mtim.tv_nsec;
+    close(out);
+    if (!ok || rename(tmp, path) != 0)
+        unlink(tmp);
+}
+
+static int cmp_mtime(const void* a, const void* b)
+{
+    time_t ma = ((const ZCacheFile_t*) a)->mtime;
+    time_t mb = ((const ZCacheFile_t*) b)->mtime;
+    return ma < mb ? -1 : ma > mb;
+}
+
+// 缓存目录超过上限时删除最早构建的文件，降到上限的90%
+static void cache_evict(void)
+{
+    DIR* dir = opendir(g_z.dir);
+    if (!dir)
+        return;
+    ZCacheFile_t* files = NULL;
+    size_t count = 0, cap = 0;
+    uint64_t total = 0;
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        size_t name_len = strlen(ent->d_name);
+        struct stat st;
+        if (name_len < 3 || strcmp(ent->d_name + name_len - 2, ".z") != 0 ||
+            fstatat(dirfd(dir), ent->d_name, &st, 0) != 0)
+            continue;
+        if (count == cap)
+        {
+            cap                 = cap ? cap * 2 : 64;
+            ZCacheFile_t* grown = realloc(files, cap * sizeof(*files));
+            if (!grown)
+                break;
+            files = grown;
+        }
+        snprintf(files[count].name, sizeof(files[count].name), "%s", ent->d_name);
+        files[count].size  = st.st_size;
+        files[count].mtime = st.st_mtime;
+        total += (uint64_t) st.st_size;
+        count++;
+    }
+
+    if (total > g_z.max_bytes)
+    {
+        qsort(files, count, sizeof(*files), cmp_mtime);
+        for (size_t i = 0; i < count && total > g_z.max_bytes / 10 * 9; i++)
+        {
+            if (unlinkat(dirfd(dir), files[i].name, 0) == 0)
+                total -= (uint64_t) files[i].size;
+        }
+    }
+    closedir(dir);
+    free(files);
+}
+
+static void* cache_builder(void* arg)
+{
+    (void) arg;
+    unsigned builds = 0;
+    for (;;)
+    {
+        pthread_mutex_lock(&g_z.lock);
+        while (g_z.count == 0)
+            pthread_cond_wait(&g_z.cond, &g_z.lock);
+        ZJob_t job = g_z.jobs[g_z.head];
+        g_z.head   = (g_z.head + 1) % LUFTPD_Z_QUEUE_MAX;
+        g_z.count--;
+        g_z.building_dev = job.dev;
+        g_z.building_ino = job.ino;
+        pthread_mutex_unlock(&g_z.lock);
+
+        cache_build(job.fd);
+        close(job.fd);
+
+        pthread_mutex_lock(&g_z.lock);
+        g_z.building_dev = 0;
+        g_z.building_ino = 0;
+        pthread_mutex_unlock(&g_z.lock);
+        if (++builds % LUFTPD_Z_EVICT_EVERY == 0)
+            cache_evict();
+    }
+    return NULL;
+}
+
+int luftpd_z_init(const char* cache_dir, int max_mb)
+{
+    if (cache_dir[0] == '\0')
+        return 0;
+    // 目录本身要给缓存文件名留出位置
+    if (strlen(cache_dir) + ZCACHE_NAME_LEN >= sizeof(g_z.dir))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    snprintf(g_z.dir, sizeof(g_z.dir), "%s", cache_dir);
+    g_z.max_bytes = (uint64_t) max_mb * 1024 * 1024;
+    if (mkdir(cache_dir, 0700) != 0 && errno != EEXIST)
+        return -1;
+    if (access(cache_dir, W_OK) != 0)
+        return -1;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, cache_builder, NULL) != 0)
+        return -1;
+    pthread_detach(tid);
+    g_z.enabled = 1;
+    cache_evict();
+    return 0;
+}
+
+int luftpd_z_send_file(int sock, int fd, const struct stat* st, off_t offset, LuftpdShape_t* shape,
+                       off_t* sent)
+{
+    *sent = 0;
+    // 缓存是整个文件的压缩流，只能用于从头下载
+    if (g_z.enabled && offset == 0 && st->st_size >= LUFTPD_Z_CACHE_MIN)
+    {
+        off_t payload_len;
+        int cfd = cache_open(st, &payload_len);
+        if (cfd >= 0)
+        {
+            int rc = luftpd_send_file(sock, cfd, (off_t) sizeof(ZCacheHeader_t), payload_len, shape,
+                                      sent);
+            close(cfd);
+            return rc;
+        }
+        cache_enqueue(fd, st);
+    }
+
+    ZSockSink_t sink = {.sock = sock, .shape = shape, .sent = sent};
+    return deflate_fd(fd, offset, st->st_size - offset, LUFTPD_Z_LEVEL_STREAM, sink_sock, &sink);
+}
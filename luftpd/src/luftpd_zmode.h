@@ -0,0 +1,43 @@
+#ifndef LUFTPD_ZMODE_H
+#define LUFTPD_ZMODE_H
+#include "luftpd_shape.h"
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// 实时压缩使用的级别，优先速度
+#define LUFTPD_Z_LEVEL_STREAM 1
+// 后台构建缓存使用的级别，一次压缩多次复用，取最高压缩比
+#define LUFTPD_Z_LEVEL_CACHE 9
+// 小于该大小的文件不进缓存，实时压缩足够快
+#define LUFTPD_Z_CACHE_MIN (64 * 1024)
+// 后台构建队列长度，队列满时放弃本次构建
+#define LUFTPD_Z_QUEUE_MAX 64
+// 每构建这么多个文件检查一次缓存目录总大小
+#define LUFTPD_Z_EVICT_EVERY 16
+// 压缩和读取的缓冲区大小
+#define LUFTPD_Z_BUF_SIZE (256 * 1024)
+
+// MODE Z（deflate 压缩数据通道）
+//
+// 每次传输发送一个完整的 zlib 流。下载整个文件时先查压缩缓存：缓存目录中按
+// 设备号和 inode 命名的文件，文件头记录源文件的大小和修改时间，二者都一致才视为有效，
+// 有效时用 sendfile 直接发送压缩好的字节。未命中时实时压缩发送，同时把源文件交给
+// 后台线程构建缓存，下一次下载即可命中。缓存放在独立目录，不出现在 FTP 目录列表中。
+
+/// @brief 初始化压缩缓存并启动后台构建线程
+/// @param cache_dir 缓存目录，为空串时不使用缓存
+/// @param max_mb 缓存目录总大小上限，超出后删除最早构建的文件
+/// @return 成功返回0；缓存目录不可用时返回-1，此时只做实时压缩
+int luftpd_z_init(const char* cache_dir, int max_mb);
+
+/// @brief 以 MODE Z 发送文件 [offset, st_size)
+/// @param st 源文件的 fstat 结果，用于校验缓存
+/// @param sent 输出实际发送的压缩字节数
+/// @return LUFTPD_XFER_OK 或 LUFTPD_XFER_ERR_*
+int luftpd_z_send_file(int sock, int fd, const struct stat* st, off_t offset, LuftpdShape_t* shape,
+                       off_t* sent);
+
+/// @brief 以 MODE Z 发送内存中的数据（目录列表）
+int luftpd_z_send_buf(int sock, const char* data, size_t len, off_t* sent);
+
+#endif // LUFTPD_ZMODE_H
@@ -0,0 +1,168 @@
+// ASCII 模式换行转换基准：对比逐字节循环、luftpd_ascii_encode 与 memcpy
+//
+// 用法：ascii_bench [数据MB数]
+// 生成类似日志的文本（行长 40~200，约 1/8 的行已是 CRLF），分别按 256KB 分块转换并计时；
+// 另用随机块长切分输入，核对流式转换结果与逐字节循环一致。
+#include "luftpd_ascii.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_CHUNK (256 * 1024)
+#define BENCH_ROUNDS 5
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// 原先的写法：逐字节判断
+static size_t encode_naive(const char* in, size_t len, char* out, char* last)
+{
+    size_t o = 0;
+    char prev = *last;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (in[i] == '\n' && prev != '\r')
+            out[o++] = '\r';
+        out[o++] = in[i];
+        prev     = in[i];
+    }
+    *last = prev;
+    return o;
+}
+
+static void make_log(char* buf, size_t len)
+{
+    size_t i = 0;
+    srand(1);
+    while (i < len)
+    {
+        size_t line = 40 + (size_t) (rand() % 160);
+        for (size_t k = 0; k < line && i < len; k++)
+            buf[i++] = (char) (' ' + rand() % 95);
+        if (i < len && rand() % 8 == 0)
+            buf[i++] = '\r';
+        if (i < len)
+            buf[i++] = '\n';
+    }
+}
+
+typedef size_t (*BenchFn_t)(const char* in, size_t len, char* out, void* st);
+
+static size_t run_naive(const char* in, size_t len, char* out, void* st)
+{
+    return encode_naive(in, len, out, (char*) st);
+}
+
+static size_t run_ascii(const char* in, size_t len, char* out, void* st)
+{
+    return luftpd_ascii_encode((LuftpdAscii_t*) st, in, len, out);
+}
+
+static size_t run_memcpy(const char* in, size_t len, char* out, void* st)
+{
+    (void) st;
+    memcpy(out, in, len);
+    return len;
+}
+
+static void bench(const char* name, BenchFn_t fn, const char* in, size_t len, char* out)
+{
+    double best = 0;
+    size_t total = 0;
+    for (int r = 0; r < BENCH_ROUNDS; r++)
+    {
+        char naive_state = 0;
+        LuftpdAscii_t ascii;
+        luftpd_ascii_init(&ascii, 0);
+        void* st = fn == run_naive ? (void*) &naive_state : (void*) &ascii;
+
+        double t0 = now_ns();
+        total     = 0;
+        for (size_t off = 0; off < len; off += BENCH_CHUNK)
+        {
+            size_t n = len - off < BENCH_CHUNK ? len - off : BENCH_CHUNK;
+            total += fn(in + off, n, out, st);
+        }
+        double dt = now_ns() - t0;
+        if (best == 0 || dt < best)
+            best = dt;
+    }
+    printf("%-8s %8.2f GB/s  (%zu -> %zu bytes)\n", name, len / best, len, total);
+}
+
+// 随机块长切分，包括把 CR 和 LF 分到两块的情况。结果不一致时打印第一个不同的位置并返回-1
+static int verify(const char* in, size_t len)
+{
+    char* expect = malloc(LUFTPD_ASCII_OUT_SIZE(len));
+    char* got    = malloc(LUFTPD_ASCII_OUT_SIZE(len));
+    if (!expect || !got)
+    {
+        printf("out of memory\n");
+        free(expect);
+        free(got);
+        return -1;
+    }
+    char last         = 0;
+    size_t expect_len = encode_naive(in, len, expect, &last);
+
+    LuftpdAscii_t ascii;
+    luftpd_ascii_init(&ascii, 0);
+    size_t got_len = 0;
+    srand(2);
+    for (size_t off = 0; off < len;)
+    {
+        size_t n = 1 + (size_t) (rand() % 300);
+        if (n > len - off)
+            n = len - off;
+        got_len += luftpd_ascii_encode(&ascii, in + off, n, got + got_len);
+        off += n;
+    }
+    size_t common = got_len < expect_len ? got_len : expect_len;
+    size_t diff   = 0;
+    while (diff < common && got[diff] == expect[diff])
+        diff++;
+    int rc = 0;
+    if (diff < common || got_len != expect_len)
+    {
+        printf("MISMATCH at output offset %zu: streaming %zu bytes, naive %zu bytes\n",
+               diff, got_len, expect_len);
+        rc = -1;
+    }
+    free(expect);
+    free(got);
+    return rc;
+}
+
+int main(int argc, char** argv)
+{
+    size_t mb  = argc > 1 ? (size_t) atoi(argv[1]) : 64;
+    size_t len = mb << 20;
+    char* in   = malloc(len);
+    char* out  = malloc(LUFTPD_ASCII_OUT_SIZE(BENCH_CHUNK));
+    if (!in || !out)
+    {
+        printf("out of memory\n");
+        return 1;
+    }
+    make_log(in, len);
+
+    if (verify(in, len < (4u << 20) ? len : (4u << 20)) != 0)
+    {
+        free(in);
+        free(out);
+        return 1;
+    }
+    printf("kernel: %s, %zu MB in %d KB chunks\n", luftpd_ascii_kernel(), mb, BENCH_CHUNK / 1024);
+    bench("naive", run_naive, in, len, out);
+    bench("ascii", run_ascii, in, len, out);
+    bench("memcpy", run_memcpy, in, len, out);
+
+    free(in);
+    free(out);
+    return 0;
+}
@@ -0,0 +1,719 @@
+// luftpd 本地吞吐与并发基准
+//
+// 用法：luftpd_bench -S <luftpd路径> [-w 工作目录] [-c 客户端数] [-l 其中下载大文件的客户端数]
+//                    [-d 秒数] [-n 小文件数] [-s 小文件KB] [-L 大文件数] [-G 大文件MB]
+//                    [-x 传输线程数] [-P 端口] [-T 最低MB/s] [-Q 小文件命令p99上限ms]
+// 在工作目录下生成测试目录树（许多小文件和几个大文件，参数不变时直接复用），写出配置并
+// 启动 luftpd，在回环地址上用多个客户端并发执行 PASV/LIST/RETR/SIZE。结束后输出下载吞吐、
+// 各命令的延迟分位数、服务器每 GB 消耗的 CPU 时间和峰值内存。出现错误，或指定了 -T/-Q
+// 而结果不达标时返回非0，可在构建中用作数据通道的回归门限。
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_FILES_PER_DIR 100
+#define BENCH_RECV_BUF (256 * 1024)
+#define BENCH_GEN_BUF (1024 * 1024)
+// 小文件客户端每执行这么多轮重新登录一次，覆盖建立会话的路径
+#define BENCH_RELOGIN_EVERY 200
+// 每隔几轮列一次目录
+#define BENCH_LIST_EVERY 4
+// 等待服务器开始监听的时间
+#define BENCH_START_TIMEOUT_S 5.0
+
+typedef enum
+{
+    OP_LOGIN = 0,
+    OP_SIZE,
+    OP_PASV,
+    OP_LIST,
+    OP_RETR,
+    OP_RETR_BIG,
+    OP_COUNT
+} BenchOp_t;
+
+static const char* g_op_names[OP_COUNT] = {"LOGIN", "SIZE", "PASV", "LIST", "RETR", "RETR big"};
+
+// 一种命令的延迟样本，单位微秒
+typedef struct
+{
+    uint32_t* us;
+    size_t count;
+    size_t cap;
+} Samples_t;
+
+typedef struct
+{
+    int id;
+    int big; // 下载大文件的客户端
+    unsigned seed;
+    Samples_t samples[OP_COUNT];
+    uint64_t bytes;  // RETR 收到的字节数
+    uint64_t files;  // 完成的 RETR 次数
+    uint64_t errors;
+    char* buf;
+} Worker_t;
+
+// 控制连接及其尚未解析的应答
+typedef struct
+{
+    int fd;
+    char buf[4096];
+    size_t len;
+} Ctrl_t;
+
+static struct
+{
+    const char* server;
+    char workdir[PATH_MAX];
+    int clients;
+    int big_clients;
+    int seconds;
+    int small_files;
+    int small_kb;
+    int large_files;
+    int large_mb;
+    int threads;
+    int port;
+    double min_mbps;
+    double max_p99_ms;
+    double deadline;
+} g_opt = {
+    .workdir     = "/tmp/luftpd_bench",
+    .clients     = 16,
+    .big_clients = 2,
+    .seconds     = 10,
+    .small_files = 2000,
+    .small_kb    = 4,
+    .large_files = 2,
+    .large_mb    = 2048,
+    .threads     = 8,
+    .port        = 22121,
+};
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void record(Worker_t* w, BenchOp_t op, double t0)
+{
+    Samples_t* s = &w->samples[op];
+    if (s->count == s->cap)
+    {
+        size_t cap     = s->cap ? s->cap * 2 : 1024;
+        uint32_t* grow = realloc(s->us, cap * sizeof(*grow));
+        if (!grow)
+            return;
+        s->us  = grow;
+        s->cap = cap;
+    }
+    s->us[s->count++] = (uint32_t) ((now_s() - t0) * 1e6);
+}
+
+// ================================ 协议 ===============================
+
+static int connect_port(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons((uint16_t) port)};
+    addr.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// 读一条应答，多行应答读到结束行为止。返回应答码，连接断开返回-1
+static int ctrl_reply(Ctrl_t* c, char* text, size_t text_sz)
+{
+    for (;;)
+    {
+        char* eol = memchr(c->buf, '\n', c->len);
+        if (!eol)
+        {
+            if (c->len == sizeof(c->buf))
+                return -1;
+            ssize_t n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len, 0);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return -1;
+            c->len += (size_t) n;
+            continue;
+        }
+        size_t line_len = (size_t) (eol - c->buf) + 1;
+        int final = line_len >= 4 && isdigit((unsigned char) c->buf[0]) &&
+                    isdigit((unsigned char) c->buf[1]) && isdigit((unsigned char) c->buf[2]) &&
+                    c->buf[3] == ' ';
+        int code = final ? atoi(c->buf) : 0;
+        if (final && text)
+            snprintf(text, text_sz, "%.*s", (int) line_len, c->buf);
+        c->len -= line_len;
+        memmove(c->buf, eol + 1, c->len);
+        if (final)
+            return code;
+    }
+}
+
+// 发送一条命令并读取应答，返回应答码
+static int ctrl_cmd(Ctrl_t* c, char* text, size_t text_sz, const char* fmt, ...)
+{
+    char line[PATH_MAX + 16];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line) - 2, fmt, args);
+    va_end(args);
+    if (len < 0 || len >= (int) sizeof(line) - 2)
+        return -1;
+    memcpy(line + len, "\r\n", 2);
+    if (send(c->fd, line, (size_t) len + 2, MSG_NOSIGNAL) != len + 2)
+        return -1;
+    return ctrl_reply(c, text, text_sz);
+}
+
+static void session_close(Ctrl_t* c)
+{
+    if (c->fd < 0)
+        return;
+    ctrl_cmd(c, NULL, 0, "QUIT");
+    close(c->fd);
+    c->fd = -1;
+}
+
+static int session_open(Ctrl_t* c, Worker_t* w)
+{
+    double t0 = now_s();
+    c->len    = 0;
+    c->fd     = connect_port(g_opt.port);
+    if (c->fd < 0)
+        return -1;
+    if (ctrl_reply(c, NULL, 0) != 220 || ctrl_cmd(c, NULL, 0, "USER bench") != 331 ||
+        ctrl_cmd(c, NULL, 0, "PASS bench") != 230 || ctrl_cmd(c, NULL, 0, "TYPE I") != 200)
+    {
+        close(c->fd);
+        c->fd = -1;
+        return -1;
+    }
+    record(w, OP_LOGIN, t0);
+    return 0;
+}
+
+// PASV 并连上数据端口，返回数据连接
+static int data_open(Ctrl_t* c, Worker_t* w)
+{
+    char text[256];
+    double t0 = now_s();
+    if (ctrl_cmd(c, text, sizeof(text), "PASV") != 227)
+        return -1;
+    int h[6];
+    const char* p = strchr(text, '(');
+    if (!p || sscanf(p, "(%d,%d,%d,%d,%d,%d)", &h[0], &h[1], &h[2], &h[3], &h[4], &h[5]) != 6)
+        return -1;
+    int fd = connect_port(h[4] * 256 + h[5]);
+    if (fd >= 0)
+        record(w, OP_PASV, t0);
+    return fd;
+}
+
+// 执行 LIST/RETR：数据读完后等待最终应答。下载大文件时到了截止时间就关闭数据连接，
+// 服务器以 426 结束，这次不计入延迟
+static int data_cmd(Ctrl_t* c, Worker_t* w, BenchOp_t op, const char* cmd, const char* path)
+{
+    int fd = data_open(c, w);
+    if (fd < 0)
+        return -1;
+    double t0 = now_s();
+    int code  = ctrl_cmd(c, NULL, 0, "%s %s", cmd, path);
+    if (code != 150 && code != 125)
+    {
+        close(fd);
+        return -1;
+    }
+    int aborted = 0;
+    for (;;)
+    {
+        // MSG_TRUNC：TCP 上直接丢弃收到的数据，不拷贝到用户态，客户端开销尽量小
+        ssize_t n = recv(fd, w->buf, BENCH_RECV_BUF, MSG_TRUNC);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        if (op != OP_LIST)
+            w->bytes += (uint64_t) n;
+        if (op == OP_RETR_BIG && now_s() > g_opt.deadline)
+        {
+            aborted = 1;
+            break;
+        }
+    }
+    close(fd);
+    code = ctrl_reply(c, NULL, 0);
+    if (aborted)
+        return code < 0 ? -1 : 0;
+    if (code != 226)
+        return -1;
+    record(w, op, t0);
+    if (op != OP_LIST)
+        w->files++;
+    return 0;
+}
+
+// ================================ 客户端 =============================
+
+static int small_round(Ctrl_t* c, Worker_t* w, unsigned round)
+{
+    int k = (int) (rand_r(&w->seed) % (unsigned) g_opt.small_files);
+    char dir[64];
+    char path[96];
+    snprintf(dir, sizeof(dir), "small/d%03d", k / BENCH_FILES_PER_DIR);
+    snprintf(path, sizeof(path), "%s/f%05d", dir, k);
+
+    double t0 = now_s();
+    if (ctrl_cmd(c, NULL, 0, "SIZE %s", path) != 213)
+        return -1;
+    record(w, OP_SIZE, t0);
+    if (round % BENCH_LIST_EVERY == 0 && data_cmd(c, w, OP_LIST, "LIST", dir) != 0)
+        return -1;
+    return data_cmd(c, w, OP_RETR, "RETR", path);
+}
+
+static void* worker_main(void* arg)
+{
+    Worker_t* w = arg;
+    Ctrl_t c    = {.fd = -1};
+    for (unsigned round = 0; now_s() < g_opt.deadline; round++)
+    {
+        if (c.fd >= 0 && !w->big && round % BENCH_RELOGIN_EVERY == 0)
+            session_close(&c);
+        if (c.fd < 0 && session_open(&c, w) != 0)
+        {
+            w->errors++;
+            usleep(10000);
+            continue;
+        }
+        int rc;
+        if (w->big)
+        {
+            char path[64];
+            snprintf(path, sizeof(path), "large/big%d.bin",
+                     (int) ((unsigned) w->id + round) % g_opt.large_files);
+            rc = data_cmd(&c, w, OP_RETR_BIG, "RETR", path);
+        }
+        else
+        {
+            rc = small_round(&c, w, round);
+        }
+        if (rc != 0)
+        {
+            // 出错后会话状态不确定，重新登录
+            w->errors++;
+            close(c.fd);
+            c.fd = -1;
+        }
+    }
+    session_close(&c);
+    return NULL;
+}
+
+// ================================ 测试数据 ===========================
+
+static uint64_t xorshift(uint64_t* s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static int write_random(const char* path, uint64_t size, uint64_t seed, char* buf)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+    uint64_t s = seed * 0x9E3779B97F4A7C15ull + 1;
+    while (size > 0)
+    {
+        size_t n = size < BENCH_GEN_BUF ? (size_t) size : BENCH_GEN_BUF;
+        for (size_t i = 0; i < n; i += 8)
+        {
+            uint64_t v = xorshift(&s);
+            memcpy(buf + i, &v, 8);
+        }
+        if (write(fd, buf, n) != (ssize_t) n)
+        {
+            close(fd);
+            return -1;
+        }
+        size -= n;
+    }
+    return close(fd);
+}
+
+// 生成测试目录树。目录下的标记文件记录生成参数，参数相同时直接复用，大文件只生成一次
+static int make_tree(void)
+{
+    char root[PATH_MAX + 8];
+    char path[PATH_MAX + 64];
+    char want[128];
+    char have[128] = "";
+    snprintf(root, sizeof(root), "%s/root", g_opt.workdir);
+    snprintf(want, sizeof(want), "small %d x %d KB, large %d x %d MB\n", g_opt.small_files,
+             g_opt.small_kb, g_opt.large_files, g_opt.large_mb);
+    snprintf(path, sizeof(path), "%s/.bench_tree", root);
+    FILE* f = fopen(path, "r");
+    if (f)
+    {
+        if (!fgets(have, sizeof(have), f))
+            have[0] = '\0';
+        fclose(f);
+    }
+    if (strcmp(have, want) == 0)
+        return 0;
+
+    printf("generating %s", want);
+    fflush(stdout);
+    char* buf = malloc(BENCH_GEN_BUF);
+    if (!buf)
+        return -1;
+    mkdir(g_opt.workdir, 0755);
+    mkdir(root, 0755);
+    snprintf(path, sizeof(path), "%s/small", root);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/large", root);
+    mkdir(path, 0755);
+    int rc = 0;
+    for (int k = 0; k < g_opt.small_files && rc == 0; k++)
+    {
+        if (k % BENCH_FILES_PER_DIR == 0)
+        {
+            snprintf(path, sizeof(path), "%s/small/d%03d", root, k / BENCH_FILES_PER_DIR);
+            mkdir(path, 0755);
+        }
+        snprintf(path, sizeof(path), "%s/small/d%03d/f%05d", root, k / BENCH_FILES_PER_DIR, k);
+        rc = write_random(path, (uint64_t) g_opt.small_kb * 1024, (uint64_t) k + 1, buf);
+    }
+    for (int k = 0; k < g_opt.large_files && rc == 0; k++)
+    {
+        snprintf(path, sizeof(path), "%s/large/big%d.bin", root, k);
+        rc = write_random(path, (uint64_t) g_opt.large_mb << 20, (uint64_t) k + 1000000, buf);
+    }
+    free(buf);
+    if (rc != 0)
+        return -1;
+    snprintf(path, sizeof(path), "%s/.bench_tree", root);
+    f = fopen(path, "w");
+    if (!f)
+        return -1;
+    fputs(want, f);
+    return fclose(f);
+}
+
+// ================================ 服务器 =============================
+
+static pid_t server_start(void)
+{
+    char conf[PATH_MAX + 16];
+    char log[PATH_MAX + 16];
+    snprintf(conf, sizeof(conf), "%s/luftpd.conf", g_opt.workdir);
+    snprintf(log, sizeof(log), "%s/luftpd.log", g_opt.workdir);
+    FILE* f = fopen(conf, "w");
+    if (!f)
+        return -1;
+    const char* w = g_opt.workdir;
+    fprintf(f,
+            "[server]\nip=127.0.0.1\nport=%d\nroot_dir=%s/root\nmax_connections=%d\n"
+            "data_port_min=%d\ndata_port_max=%d\ntransfer_threads=%d\nzcache_dir=%s/zcache\n"
+            "xferlog=%s/xferlog\nstats_socket=%s/stats.sock\nhash_index=%s/digests.idx\n",
+            g_opt.port, w, g_opt.clients + 16, g_opt.port + 1, g_opt.port + 2000, g_opt.threads,
+            w, w, w, w);
+    fclose(f);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0)
+        {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+        }
+        execl(g_opt.server, g_opt.server, conf, (char*) NULL);
+        _exit(127);
+    }
+    if (pid < 0)
+        return -1;
+
+    // 能收到欢迎语即视为启动完成
+    for (double t0 = now_s(); now_s() - t0 < BENCH_START_TIMEOUT_S; usleep(20000))
+    {
+        if (waitpid(pid, NULL, WNOHANG) == pid)
+            return -1;
+        Ctrl_t c = {.fd = connect_port(g_opt.port)};
+        if (c.fd < 0)
+            continue;
+        int code = ctrl_reply(&c, NULL, 0);
+        close(c.fd);
+        if (code == 220)
+            return pid;
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+// 进程已消耗的 CPU 时间（用户态加内核态），单位秒
+static double proc_cpu_s(pid_t pid)
+{
+    char path[64];
+    char stat[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return 0;
+    size_t n = fread(stat, 1, sizeof(stat) - 1, f);
+    fclose(f);
+    stat[n]             = '\0';
+    const char* p       = strrchr(stat, ')');
+    unsigned long utime = 0;
+    unsigned long stime = 0;
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime,
+                     &stime) != 2)
+        return 0;
+    return (double) (utime + stime) / (double) sysconf(_SC_CLK_TCK);
+}
+
+// 进程的峰值常驻内存，单位 KB
+static long proc_peak_rss_kb(pid_t pid)
+{
+    char path[64];
+    char line[256];
+    long kb = 0;
+    snprintf(path, sizeof(path), "/proc/%d/status", (int) pid);
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        if (sscanf(line, "VmHWM: %ld kB", &kb) == 1)
+            break;
+    }
+    fclose(f);
+    return kb;
+}
+
+// ================================ 报告 ===============================
+
+static int cmp_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_ms(const Samples_t* s, double q)
+{
+    return s->count ? s->us[(size_t) (q * (double) (s->count - 1))] / 1000.0 : 0;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "usage: %s -S <luftpd> [-w workdir] [-c clients] [-l big_clients] [-d seconds]\n"
+            "       [-n small_files] [-s small_kb] [-L large_files] [-G large_mb]\n"
+            "       [-x transfer_threads] [-P port] [-T min_mbps] [-Q max_p99_ms]\n",
+            prog);
+}
+
+int main(int argc, char* argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "S:w:c:l:d:n:s:L:G:x:P:T:Q:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'S':
+            g_opt.server = optarg;
+            break;
+        case 'w':
+            snprintf(g_opt.workdir, sizeof(g_opt.workdir), "%s", optarg);
+            break;
+        case 'c':
+            g_opt.clients = atoi(optarg);
+            break;
+        case 'l':
+            g_opt.big_clients = atoi(optarg);
+            break;
+        case 'd':
+            g_opt.seconds = atoi(optarg);
+            break;
+        case 'n':
+            g_opt.small_files = atoi(optarg);
+            break;
+        case 's':
+            g_opt.small_kb = atoi(optarg);
+            break;
+        case 'L':
+            g_opt.large_files = atoi(optarg);
+            break;
+        case 'G':
+            g_opt.large_mb = atoi(optarg);
+            break;
+        case 'x':
+            g_opt.threads = atoi(optarg);
+            break;
+        case 'P':
+            g_opt.port = atoi(optarg);
+            break;
+        case 'T':
+            g_opt.min_mbps = atof(optarg);
+            break;
+        case 'Q':
+            g_opt.max_p99_ms = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (!g_opt.server || g_opt.clients < 1 || g_opt.big_clients < 0 ||
+        g_opt.big_clients > g_opt.clients || g_opt.seconds < 1 || g_opt.small_files < 1 ||
+        g_opt.small_kb < 0 || (g_opt.big_clients > 0 && g_opt.large_files < 1) ||
+        g_opt.large_mb < 0 || g_opt.clients > 1900)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    if (make_tree() != 0)
+    {
+        perror("generate test tree");
+        return 1;
+    }
+    pid_t server = server_start();
+    if (server < 0)
+    {
+        fprintf(stderr, "failed to start %s, see %s/luftpd.log\n", g_opt.server, g_opt.workdir);
+        return 1;
+    }
+
+    Worker_t* workers = calloc((size_t) g_opt.clients, sizeof(*workers));
+    pthread_t* tids   = calloc((size_t) g_opt.clients, sizeof(*tids));
+    if (!workers || !tids)
+        return 1;
+    struct rusage ru0;
+    getrusage(RUSAGE_SELF, &ru0);
+    double cpu0    = proc_cpu_s(server);
+    double t0      = now_s();
+    g_opt.deadline = t0 + g_opt.seconds;
+    for (int i = 0; i < g_opt.clients; i++)
+    {
+        workers[i].id   = i;
+        workers[i].big  = i < g_opt.big_clients;
+        workers[i].seed = (unsigned) i * 2654435761u + 1;
+        workers[i].buf  = malloc(BENCH_RECV_BUF);
+        pthread_create(&tids[i], NULL, worker_main, &workers[i]);
+    }
+    for (int i = 0; i < g_opt.clients; i++)
+        pthread_join(tids[i], NULL);
+    double elapsed = now_s() - t0;
+    double cpu     = proc_cpu_s(server) - cpu0;
+    long rss_kb    = proc_peak_rss_kb(server);
+    struct rusage ru1;
+    getrusage(RUSAGE_SELF, &ru1);
+    double client_cpu = (double) (ru1.ru_utime.tv_sec - ru0.ru_utime.tv_sec) +
+                        (double) (ru1.ru_stime.tv_sec - ru0.ru_stime.tv_sec) +
+                        (double) (ru1.ru_utime.tv_usec - ru0.ru_utime.tv_usec) / 1e6 +
+                        (double) (ru1.ru_stime.tv_usec - ru0.ru_stime.tv_usec) / 1e6;
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+
+    // 合并各客户端的样本
+    Samples_t all[OP_COUNT] = {0};
+    uint64_t bytes = 0, files = 0, errors = 0;
+    for (int i = 0; i < g_opt.clients; i++)
+    {
+        Worker_t* w = &workers[i];
+        bytes += w->bytes;
+        files += w->files;
+        errors += w->errors;
+        for (int op = 0; op < OP_COUNT; op++)
+        {
+            Samples_t* s   = &w->samples[op];
+            uint32_t* grow = realloc(all[op].us, (all[op].count + s->count + 1) * sizeof(*grow));
+            if (!grow)
+                return 1;
+            all[op].us = grow;
+            memcpy(all[op].us + all[op].count, s->us, s->count * sizeof(*grow));
+            all[op].count += s->count;
+            free(s->us);
+        }
+        free(w->buf);
+    }
+
+    printf("%d clients (%d big), %d s, %d x %d KB + %d x %d MB files, transfer_threads %d\n",
+           g_opt.clients, g_opt.big_clients, g_opt.seconds, g_opt.small_files, g_opt.small_kb,
+           g_opt.large_files, g_opt.large_mb, g_opt.threads);
+    printf("%-9s %9s %9s %9s %9s %9s\n", "op", "count", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    double small_p99 = 0;
+    for (int op = 0; op < OP_COUNT; op++)
+    {
+        Samples_t* s = &all[op];
+        qsort(s->us, s->count, sizeof(*s->us), cmp_u32);
+        double p99 = percentile_ms(s, 0.99);
+        if ((op == OP_SIZE || op == OP_LIST || op == OP_RETR) && p99 > small_p99)
+            small_p99 = p99;
+        printf("%-9s %9zu %9.3f %9.3f %9.3f %9.3f\n", g_op_names[op], s->count,
+               percentile_ms(s, 0.5), percentile_ms(s, 0.9), p99, percentile_ms(s, 1.0));
+        free(s->us);
+    }
+    double mbps = bytes / elapsed / 1e6;
+    double gb   = bytes / 1e9;
+    printf("throughput: %.1f MB/s (%.2f GB in %.2f s), %.0f files/s\n", mbps, gb, elapsed,
+           files / elapsed);
+    printf("server: %.2f s CPU, %.3f CPU s/GB, peak RSS %ld KB; client: %.2f s CPU\n", cpu,
+           gb > 0 ? cpu / gb : 0, rss_kb, client_cpu);
+    printf("errors: %llu\n", (unsigned long long) errors);
+
+    int fail = errors > 0;
+    if (g_opt.min_mbps > 0 && mbps < g_opt.min_mbps)
+    {
+        printf("FAIL: throughput %.1f MB/s below %.1f\n", mbps, g_opt.min_mbps);
+        fail = 1;
+    }
+    if (g_opt.max_p99_ms > 0 && small_p99 > g_opt.max_p99_ms)
+    {
+        printf("FAIL: small-file p99 %.3f ms above %.3f\n", small_p99, g_opt.max_p99_ms);
+        fail = 1;
+    }
+    free(workers);
+    free(tids);
+    return fail;
+}
@@ -0,0 +1,128 @@
+// 路径解析基准：对比 luftpd_resolve_path + open 与基于目录描述符的 luftpd_path_open
+//
+// 用法：resolve_bench [迭代次数]
+// 在 /tmp 下建一棵临时目录树，对若干典型命令参数分别计时，并核对两种实现的越界判定一致。
+#define _GNU_SOURCE
+#include "luftpd_path.h"
+#include "luftpd_utils.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_ROOT "/tmp/resolve_bench_root"
+#define BENCH_CWD  "/logs/2025/10/18"
+
+typedef struct
+{
+    const char* cwd;
+    const char* arg;
+    int expect_ok;
+} BenchCase_t;
+
+static const BenchCase_t g_cases[] = {
+    {BENCH_CWD, "app.log", 1},
+    {BENCH_CWD, "../17/app.log", 1},
+    {BENCH_CWD, "/logs/2025/10/18/app.log", 1},
+    {"/", "logs/2025/10/18/app.log", 1},
+    {BENCH_CWD, "../../../../../../etc/passwd", 0},
+    {BENCH_CWD, "escape/passwd", 0},
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void make_tree(void)
+{
+    const char* dirs[] = {BENCH_ROOT,
+                          BENCH_ROOT "/logs",
+                          BENCH_ROOT "/logs/2025",
+                          BENCH_ROOT "/logs/2025/10",
+                          BENCH_ROOT "/logs/2025/10/17",
+                          BENCH_ROOT "/logs/2025/10/18"};
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++)
+        mkdir(dirs[i], 0755);
+    const char* files[] = {BENCH_ROOT "/logs/2025/10/17/app.log",
+                           BENCH_ROOT "/logs/2025/10/18/app.log"};
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+        close(open(files[i], O_CREAT | O_WRONLY, 0644));
+    unlink(BENCH_ROOT BENCH_CWD "/escape");
+    if (symlink("/etc", BENCH_ROOT BENCH_CWD "/escape") != 0)
+        perror("symlink");
+}
+
+// 原实现：解析出主机路径后再打开
+static int open_legacy(const char* cwd, const char* arg)
+{
+    char path[PATH_MAX];
+    if (luftpd_resolve_path(BENCH_ROOT, cwd, arg, path, sizeof(path)) != 0)
+        return -1;
+    return open(path, O_PATH | O_CLOEXEC);
+}
+
+static int open_fd(int cwd_fd, const char* cwd, const char* arg)
+{
+    return luftpd_path_open(strcmp(cwd, "/") == 0 ? -1 : cwd_fd, cwd, arg, O_PATH, NULL, 0);
+}
+
+int main(int argc, char* argv[])
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+    make_tree();
+    if (luftpd_path_init(BENCH_ROOT) != 0)
+    {
+        perror("luftpd_path_init");
+        return 1;
+    }
+    int cwd_fd = open(BENCH_ROOT BENCH_CWD, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    assert(cwd_fd >= 0);
+
+    printf("%-34s %12s %12s\n", "case (cwd=" BENCH_CWD ")", "legacy ns", "dirfd ns");
+    for (size_t i = 0; i < sizeof(g_cases) / sizeof(g_cases[0]); i++)
+    {
+        const BenchCase_t* c = &g_cases[i];
+
+        // 两种实现对越界路径的判定必须一致
+        int fd_legacy = open_legacy(c->cwd, c->arg);
+        int fd_new    = open_fd(cwd_fd, c->cwd, c->arg);
+        if ((fd_legacy >= 0) != c->expect_ok || (fd_new >= 0) != c->expect_ok)
+        {
+            printf("MISMATCH %s: legacy=%d dirfd=%d expect_ok=%d\n", c->arg, fd_legacy >= 0,
+                   fd_new >= 0, c->expect_ok);
+            return 1;
+        }
+        if (fd_legacy >= 0)
+            close(fd_legacy);
+        if (fd_new >= 0)
+            close(fd_new);
+
+        double t0 = now_ns();
+        for (int n = 0; n < iterations; n++)
+        {
+            int fd = open_legacy(c->cwd, c->arg);
+            if (fd >= 0)
+                close(fd);
+        }
+        double t1 = now_ns();
+        for (int n = 0; n < iterations; n++)
+        {
+            int fd = open_fd(cwd_fd, c->cwd, c->arg);
+            if (fd >= 0)
+                close(fd);
+        }
+        double t2 = now_ns();
+        printf("%-34s %12.0f %12.0f\n", c->arg, (t1 - t0) / iterations, (t2 - t1) / iterations);
+    }
+    close(cwd_fd);
+    return 0;
+}
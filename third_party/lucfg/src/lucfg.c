@@ -183,13 +183,10 @@ static void parse_value(entry_t* ent)
     size_t len = strlen(s);
     if (len >= 2 && s[0] == '"' && s[len - 1] == '"')
     {
-        s[len - 1] = 0;
-        ++s;
-        free(ent->value);
-        ent->value = strdup(s);
-        if (!ent->value)
-            return;
-        s = ent->value;
+        /* s 指向 ent->value 内部，原地去掉引号，不能先释放再复制 */
+        memmove(ent->value, s + 1, len - 2);
+        ent->value[len - 2] = 0;
+        s                   = ent->value;
     }
     /* 1. 尝试表达式 */
     double ev;
@@ -434,21 +431,19 @@ void lucfg_dump(lucfg_handle_t* h, FILE* fp)
 }
 
 /* ---------------- 范围检查宏 ---------------- */
+/* 展开在GEN_GET_*的 do { } while (0) 中，break 直接结束取值流程 */
 #define CHECK_RANGE_EXPR(min_v, max_v, target_type)                                                \
-    do                                                                                             \
+    if (e->has_expr)                                                                               \
     {                                                                                              \
-        if (e->has_expr)                                                                           \
+        if (e->expr_value < (double) (min_v) || e->expr_value > (double) (max_v))                  \
         {                                                                                          \
-            if (e->expr_value < (double) (min_v) || e->expr_value > (double) (max_v))              \
-            {                                                                                      \
-                rc = LUCFG_ERR_RANGE;                                                              \
-                break;                                                                             \
-            }                                                                                      \
-            *out = (target_type) e->expr_value;                                                    \
-            rc   = LUCFG_OK;                                                                       \
+            rc = LUCFG_ERR_RANGE;                                                                  \
             break;                                                                                 \
         }                                                                                          \
-    } while (0)
+        *out = (target_type) e->expr_value;                                                        \
+        rc   = LUCFG_OK;                                                                           \
+        break;                                                                                     \
+    }
 
 /* ---------------- 通用窄类型生成宏 ---------------- */
 #define GEN_GET_SIGNED(name, T, MIN, MAX)                                                          \
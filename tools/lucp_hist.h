@@ -0,0 +1,66 @@
+#ifndef LUCP_HIST_H
+#define LUCP_HIST_H
+
+/*
+ * 压测/回放工具共用的延迟直方图
+ */
+#include <math.h>
+#include <stdint.h>
+
+// 对数-线性分桶：每个2的幂区间再分32档，相对误差约3%，单位微秒
+#define HIST_LINEAR   64
+#define HIST_SUB_BITS 5
+#define HIST_BUCKETS  (HIST_LINEAR + 40 * (1 << HIST_SUB_BITS))
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t max;
+    uint64_t sum;
+    uint64_t buckets[HIST_BUCKETS];
+} Histogram_t;
+
+static inline int hist_index(uint64_t v)
+{
+    if (v < HIST_LINEAR)
+        return (int) v;
+    int e = 63 - __builtin_clzll(v); // e >= 6
+    int m = (int) ((v >> (e - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+    int i = HIST_LINEAR + (e - 6) * (1 << HIST_SUB_BITS) + m;
+    return i < HIST_BUCKETS ? i : HIST_BUCKETS - 1;
+}
+
+static inline uint64_t hist_value(int i)
+{
+    if (i < HIST_LINEAR)
+        return (uint64_t) i;
+    int e = (i - HIST_LINEAR) / (1 << HIST_SUB_BITS) + 6;
+    int m = (i - HIST_LINEAR) % (1 << HIST_SUB_BITS);
+    return ((uint64_t) ((1 << HIST_SUB_BITS) + m)) << (e - HIST_SUB_BITS);
+}
+
+static inline void hist_record(Histogram_t* h, uint64_t us)
+{
+    h->buckets[hist_index(us)]++;
+    h->count++;
+    h->sum += us;
+    if (us > h->max)
+        h->max = us;
+}
+
+static inline uint64_t hist_percentile(const Histogram_t* h, double p)
+{
+    if (h->count == 0)
+        return 0;
+    uint64_t rank = (uint64_t) ceil(p * (double) h->count);
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= rank)
+            return hist_value(i) < h->max ? hist_value(i) : h->max;
+    }
+    return h->max;
+}
+
+#endif // LUCP_HIST_H
@@ -0,0 +1,673 @@
+/*
+ * lucp_loadgen —— lucpd 设备集群压测工具
+ *
+ * 以开环方式（按到达率发起，不等待前一个会话结束）模拟大量设备并发执行完整流程：
+ *   UPLOAD_REQUEST -> ACK_START -> NOTIFY_DONE -> FTP_LOGIN_RESULT -> FTP_DOWNLOAD_RESULT
+ * 指定 -m 时两个FTP结果合并为一帧 FTP_TRANSFER_RESULT。
+ * 单线程 epoll 驱动所有连接，统计各阶段延迟分布(p50/p99/p999)与吞吐。
+ *
+ * 用法示例：
+ *   lucp_loadgen -r 500 -n 20000 -c 20000 -t 200 -f 5 -F 5 -x 2 -D 100 -a 16
+ */
+#define _GNU_SOURCE
+#include "lucp_hist.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <lucp.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOADGEN_FRAME_MAX   (14 + LUCP_MAX_TEXTINFO_LEN)
+#define LOADGEN_MAX_EVENTS  1024
+#define LOADGEN_SEQ_BASE    10001
+#define LOADGEN_REPORT_MS   1000
+
+// ================================ 会话状态 ===========================
+
+typedef enum
+{
+    DEV_FREE,
+    DEV_CONNECTING,
+    DEV_WAIT_ACK,
+    DEV_WAIT_DONE,
+    DEV_THINK_LOGIN,
+    DEV_THINK_DOWNLOAD
+} DeviceState;
+
+typedef enum
+{
+    PHASE_CONNECT,  // 发起连接 -> 连接建立
+    PHASE_ACK,      // 发送 UPLOAD_REQUEST -> 收到 ACK_START
+    PHASE_PREP,     // 收到 ACK_START -> 收到 NOTIFY_DONE
+    PHASE_SESSION,  // 发起连接 -> 发出 FTP_DOWNLOAD_RESULT
+    PHASE_COUNT
+} Phase;
+
+static const char* const g_phase_names[PHASE_COUNT] = {"connect", "ack", "prep", "session"};
+
+typedef enum
+{
+    OUT_COMPLETED,     // 完整流程成功
+    OUT_LOGIN_FAIL,    // 按比例注入的登录失败
+    OUT_DOWNLOAD_FAIL, // 按比例注入的下载失败
+    OUT_ABORTED,       // 按比例注入的中途断开
+    OUT_REJECTED,      // 服务端拒绝连接或在 ACK_START 前关闭（连接数超限、限流）
+    OUT_SERVER_FAIL,   // ACK_START/NOTIFY_DONE 返回失败状态
+    OUT_TIMEOUT,       // 等待服务端超时
+    OUT_ERROR,         // 连接失败或协议错误
+    OUT_COUNT
+} Outcome;
+
+static const char* const g_outcome_names[OUT_COUNT] = {"completed",
+                                                       "login_fail",
+                                                       "download_fail",
+                                                       "aborted",
+                                                       "rejected",
+                                                       "server_fail",
+                                                       "timeout",
+                                                       "error"};
+
+typedef struct
+{
+    int fd;
+    DeviceState state;
+    uint32_t gen;      // 槽位复用代数，用于识别过期定时器
+    uint32_t seq;
+    uint64_t t_start;  // 发起连接时刻(us)
+    uint64_t t_phase;  // 当前阶段开始时刻(us)
+    uint64_t deadline; // 当前定时器到期时刻(us)，0表示无
+    uint16_t rbuf_len;
+    uint8_t rbuf[LOADGEN_FRAME_MAX];
+} Device_t;
+
+typedef struct
+{
+    uint64_t when;
+    uint32_t idx;
+    uint32_t gen;
+} Timer_t;
+
+// ================================ 全局参数与统计 ===========================
+
+static struct
+{
+    char host[64];
+    uint16_t port;
+    double rate;         // 每秒发起的会话数
+    uint64_t total;      // 会话总数
+    int concurrency;     // 同时在途会话上限
+    int think_ms;        // 设备在各结果之间的平均思考时间(指数分布)
+    int timeout_ms;      // 等待服务端回复的超时时间
+    double login_fail;   // 登录失败比例(0~1)
+    double download_fail;
+    double abort_ratio;  // NOTIFY_DONE 后直接断开的比例
+    char device_prefix[32];
+    int device_count;    // 设备标识数量，会话按序轮流使用
+    int src_addrs;       // 分散到 127.0.0.1 ~ 127.0.0.N 的源地址数，避免临时端口耗尽
+    bool poisson;        // 到达间隔服从指数分布
+    bool merged_result;  // 用一帧 FTP_TRANSFER_RESULT 报告登录和下载结果
+    unsigned int seed;
+} g_opt = {
+    .host          = "127.0.0.1",
+    .port          = 32100,
+    .rate          = 100,
+    .total         = 1000,
+    .concurrency   = 10000,
+    .think_ms      = 100,
+    .timeout_ms    = 30000,
+    .device_prefix = "default",
+    .device_count  = 1,
+    .src_addrs     = 1,
+};
+
+static Device_t* g_devs;
+static uint32_t* g_free;
+static int g_free_top;
+static int g_active;
+static int g_epfd;
+
+static Timer_t* g_timers;
+static int g_timer_len, g_timer_cap;
+
+static Histogram_t g_hist[PHASE_COUNT];
+static uint64_t g_outcomes[OUT_COUNT];
+static uint64_t g_started, g_skipped;
+static volatile sig_atomic_t g_stop;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static double rand_unit(void) { return (rand() + 1.0) / ((double) RAND_MAX + 2.0); }
+
+static uint64_t rand_exp_us(double mean_ms)
+{
+    if (mean_ms <= 0)
+        return 0;
+    return (uint64_t) (-log(rand_unit()) * mean_ms * 1000.0);
+}
+
+// ================================ 定时器堆 ===========================
+
+static void timer_push(uint64_t when, uint32_t idx)
+{
+    if (g_timer_len == g_timer_cap)
+    {
+        g_timer_cap = g_timer_cap ? g_timer_cap * 2 : 1024;
+        g_timers    = realloc(g_timers, g_timer_cap * sizeof(Timer_t));
+        if (!g_timers)
+        {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    int i          = g_timer_len++;
+    g_timers[i]    = (Timer_t){.when = when, .idx = idx, .gen = g_devs[idx].gen};
+    g_devs[idx].deadline = when;
+    while (i > 0 && g_timers[(i - 1) / 2].when > g_timers[i].when)
+    {
+        Timer_t t               = g_timers[i];
+        g_timers[i]             = g_timers[(i - 1) / 2];
+        g_timers[(i - 1) / 2]   = t;
+        i                       = (i - 1) / 2;
+    }
+}
+
+static void timer_pop(void)
+{
+    g_timers[0] = g_timers[--g_timer_len];
+    int i       = 0;
+    while (1)
+    {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < g_timer_len && g_timers[l].when < g_timers[m].when)
+            m = l;
+        if (r < g_timer_len && g_timers[r].when < g_timers[m].when)
+            m = r;
+        if (m == i)
+            break;
+        Timer_t t   = g_timers[i];
+        g_timers[i] = g_timers[m];
+        g_timers[m] = t;
+        i           = m;
+    }
+}
+
+// ================================ 会话驱动 ===========================
+
+static void dev_finish(uint32_t idx, Outcome out)
+{
+    Device_t* d = &g_devs[idx];
+    if (d->fd >= 0)
+        close(d->fd);
+    d->fd       = -1;
+    d->state    = DEV_FREE;
+    d->deadline = 0;
+    d->gen++;
+    g_outcomes[out]++;
+    g_free[g_free_top++] = idx;
+    g_active--;
+}
+
+static int dev_send(Device_t* d, uint8_t msg_type, uint8_t status, const char* text)
+{
+    lucp_frame_t frame;
+    uint8_t buf[LOADGEN_FRAME_MAX];
+    lucp_frame_make(&frame, d->seq, msg_type, status, text, text ? (uint16_t) strlen(text) : 0);
+    int len = lucp_frame_pack(&frame, buf, sizeof(buf));
+    if (len < 0)
+        return -1;
+    // 帧很小且此前发送缓冲区为空，非阻塞send不会只写一部分
+    return send(d->fd, buf, (size_t) len, MSG_NOSIGNAL) == len ? 0 : -1;
+}
+
+static void dev_start(uint64_t now)
+{
+    uint32_t idx = g_free[--g_free_top];
+    Device_t* d  = &g_devs[idx];
+    g_active++;
+    g_started++;
+
+    d->seq      = LOADGEN_SEQ_BASE + (uint32_t) g_started;
+    d->rbuf_len = 0;
+    d->t_start  = now;
+    d->t_phase  = now;
+    d->state    = DEV_CONNECTING;
+    d->fd       = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (d->fd < 0)
+    {
+        dev_finish(idx, OUT_ERROR);
+        return;
+    }
+    int one = 1;
+    setsockopt(d->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (g_opt.src_addrs > 1)
+    {
+        struct sockaddr_in src = {.sin_family = AF_INET};
+        src.sin_addr.s_addr    = htonl(INADDR_LOOPBACK + (uint32_t) (g_started % g_opt.src_addrs));
+        setsockopt(d->fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+        bind(d->fd, (struct sockaddr*) &src, sizeof(src));
+    }
+
+    struct sockaddr_in dst = {.sin_family = AF_INET, .sin_port = htons(g_opt.port)};
+    inet_pton(AF_INET, g_opt.host, &dst.sin_addr);
+    if (connect(d->fd, (struct sockaddr*) &dst, sizeof(dst)) < 0 && errno != EINPROGRESS)
+    {
+        dev_finish(idx, OUT_ERROR);
+        return;
+    }
+
+    struct epoll_event ev = {.events = EPOLLOUT | EPOLLIN, .data.u32 = idx};
+    epoll_ctl(g_epfd, EPOLL_CTL_ADD, d->fd, &ev);
+    timer_push(now + (uint64_t) g_opt.timeout_ms * 1000, idx);
+}
+
+static void dev_on_connected(uint32_t idx, uint64_t now)
+{
+    Device_t* d = &g_devs[idx];
+    int err     = 0;
+    socklen_t l = sizeof(err);
+    if (getsockopt(d->fd, SOL_SOCKET, SO_ERROR, &err, &l) != 0 || err != 0)
+    {
+        dev_finish(idx, err == ECONNREFUSED ? OUT_REJECTED : OUT_ERROR);
+        return;
+    }
+    hist_record(&g_hist[PHASE_CONNECT], now - d->t_phase);
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = idx};
+    epoll_ctl(g_epfd, EPOLL_CTL_MOD, d->fd, &ev);
+
+    char text[96];
+    uint32_t dev_no = (uint32_t) (g_started % (uint64_t) g_opt.device_count);
+    if (g_opt.device_count > 1)
+        snprintf(text, sizeof(text), "device=%s%05u", g_opt.device_prefix, dev_no);
+    else
+        snprintf(text, sizeof(text), "device=%s", g_opt.device_prefix);
+
+    d->t_phase = now;
+    d->state   = DEV_WAIT_ACK;
+    timer_push(now + (uint64_t) g_opt.timeout_ms * 1000, idx);
+    if (dev_send(d, LUCP_MTYP_UPLOAD_REQUEST, 0, text) != 0)
+        dev_finish(idx, OUT_ERROR);
+}
+
+// 处理一帧服务端回复，返回false表示会话已结束
+static bool dev_on_frame(uint32_t idx, const lucp_frame_t* f, uint64_t now)
+{
+    Device_t* d = &g_devs[idx];
+    if (d->state == DEV_WAIT_ACK && f->msgType == LUCP_MTYP_ACK_START)
+    {
+        hist_record(&g_hist[PHASE_ACK], now - d->t_phase);
+        if (f->status == LUCP_STAT_TOO_MANY_CONNECTIONS || f->status == LUCP_STAT_RATE_LIMITED)
+        {
+            dev_finish(idx, OUT_REJECTED);
+            return false;
+        }
+        if (f->status != LUCP_STAT_SUCCESS)
+        {
+            dev_finish(idx, OUT_SERVER_FAIL);
+            return false;
+        }
+        d->t_phase = now;
+        d->state   = DEV_WAIT_DONE;
+        timer_push(now + (uint64_t) g_opt.timeout_ms * 1000, idx);
+        return true;
+    }
+    if (d->state == DEV_WAIT_DONE && f->msgType == LUCP_MTYP_NOTIFY_DONE)
+    {
+        hist_record(&g_hist[PHASE_PREP], now - d->t_phase);
+        if (f->status != LUCP_STAT_SUCCESS)
+        {
+            dev_finish(idx, OUT_SERVER_FAIL);
+            return false;
+        }
+        if (rand_unit() < g_opt.abort_ratio)
+        {
+            dev_finish(idx, OUT_ABORTED);
+            return false;
+        }
+        d->state = DEV_THINK_LOGIN;
+        timer_push(now + rand_exp_us(g_opt.think_ms), idx);
+        return true;
+    }
+    dev_finish(idx, OUT_ERROR);
+    return false;
+}
+
+static void dev_on_readable(uint32_t idx, uint64_t now)
+{
+    Device_t* d = &g_devs[idx];
+    while (1)
+    {
+        ssize_t n = recv(d->fd, d->rbuf + d->rbuf_len, sizeof(d->rbuf) - d->rbuf_len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (n <= 0)
+        {
+            // 在 ACK_START 之前被关闭视为服务端拒绝
+            dev_finish(idx, d->state == DEV_WAIT_ACK ? OUT_REJECTED : OUT_ERROR);
+            return;
+        }
+        d->rbuf_len += (uint16_t) n;
+
+        lucp_frame_t frame;
+        int used;
+        while ((used = lucp_frame_unpack(&frame, d->rbuf, d->rbuf_len)) > 0)
+        {
+            memmove(d->rbuf, d->rbuf + used, d->rbuf_len - used);
+            d->rbuf_len -= (uint16_t) used;
+            if (!dev_on_frame(idx, &frame, now))
+                return;
+        }
+        if (used < 0)
+        {
+            dev_finish(idx, OUT_ERROR);
+            return;
+        }
+    }
+}
+
+static void dev_on_timer(uint32_t idx, uint64_t now)
+{
+    Device_t* d = &g_devs[idx];
+    d->deadline = 0;
+    switch (d->state)
+    {
+    case DEV_THINK_LOGIN:
+        if (rand_unit() < g_opt.login_fail)
+        {
+            dev_send(d,
+                     g_opt.merged_result ? LUCP_MTYP_FTP_TRANSFER_RESULT
+                                         : LUCP_MTYP_FTP_LOGIN_RESULT,
+                     LUCP_STAT_FTP_LOGIN_FAILED,
+                     "FTP login failed");
+            dev_finish(idx, OUT_LOGIN_FAIL);
+            return;
+        }
+        // 合并结果时登录成功不单独报告
+        if (!g_opt.merged_result &&
+            dev_send(d, LUCP_MTYP_FTP_LOGIN_RESULT, LUCP_STAT_SUCCESS, NULL) != 0)
+        {
+            dev_finish(idx, OUT_ERROR);
+            return;
+        }
+        d->state = DEV_THINK_DOWNLOAD;
+        timer_push(now + rand_exp_us(g_opt.think_ms), idx);
+        return;
+    case DEV_THINK_DOWNLOAD: {
+        bool fail    = rand_unit() < g_opt.download_fail;
+        uint8_t type = g_opt.merged_result ? LUCP_MTYP_FTP_TRANSFER_RESULT
+                                           : LUCP_MTYP_FTP_DOWNLOAD_RESULT;
+        int rc       = dev_send(d,
+                             type,
+                             fail ? LUCP_STAT_FTP_DOWNLOAD_FAILED : LUCP_STAT_SUCCESS,
+                             fail ? "FTP download failed" : NULL);
+        if (rc == 0 && !fail)
+            hist_record(&g_hist[PHASE_SESSION], now - d->t_start);
+        dev_finish(idx, rc != 0 ? OUT_ERROR : (fail ? OUT_DOWNLOAD_FAIL : OUT_COMPLETED));
+        return;
+    }
+    default:
+        dev_finish(idx, OUT_TIMEOUT);
+        return;
+    }
+}
+
+// ================================ 报告 ===========================
+
+static void print_report(uint64_t elapsed_us)
+{
+    double secs = elapsed_us / 1e6;
+    printf("\n==== lucp_loadgen summary ====\n");
+    printf("duration      : %.2f s\n", secs);
+    printf("started       : %llu (%.1f/s offered, %llu arrivals skipped at concurrency cap)\n",
+           (unsigned long long) g_started,
+           secs > 0 ? g_started / secs : 0.0,
+           (unsigned long long) g_skipped);
+    printf("throughput    : %.1f completed sessions/s\n",
+           secs > 0 ? g_outcomes[OUT_COMPLETED] / secs : 0.0);
+    for (int i = 0; i < OUT_COUNT; i++)
+        printf("  %-13s %llu\n", g_outcome_names[i], (unsigned long long) g_outcomes[i]);
+
+    printf("\n%-8s %10s %10s %10s %10s %10s %10s\n",
+           "phase",
+           "count",
+           "mean(ms)",
+           "p50(ms)",
+           "p99(ms)",
+           "p999(ms)",
+           "max(ms)");
+    for (int i = 0; i < PHASE_COUNT; i++)
+    {
+        const Histogram_t* h = &g_hist[i];
+        printf("%-8s %10llu %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+               g_phase_names[i],
+               (unsigned long long) h->count,
+               h->count ? h->sum / 1000.0 / h->count : 0.0,
+               hist_percentile(h, 0.50) / 1000.0,
+               hist_percentile(h, 0.99) / 1000.0,
+               hist_percentile(h, 0.999) / 1000.0,
+               h->max / 1000.0);
+    }
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -H host      server address, loopback only (default 127.0.0.1)\n"
+            "  -p port      server port (default 32100)\n"
+            "  -r rate      session arrivals per second (default 100)\n"
+            "  -n total     total sessions to start (default 1000)\n"
+            "  -c conc      max in-flight sessions, arrivals beyond are skipped (default 10000)\n"
+            "  -P           Poisson arrivals instead of a constant interval\n"
+            "  -t ms        mean think time between FTP results (default 100)\n"
+            "  -m           report both FTP results in one FTP_TRANSFER_RESULT frame\n"
+            "  -T ms        timeout waiting for the server (default 30000)\n"
+            "  -f pct       injected FTP login failure percent\n"
+            "  -F pct       injected FTP download failure percent\n"
+            "  -x pct       percent of devices that disconnect after NOTIFY_DONE\n"
+            "  -d prefix    device id prefix (default \"default\")\n"
+            "  -D count     number of distinct device ids (default 1)\n"
+            "  -a count     spread connections over 127.0.0.1..127.0.0.<count>\n"
+            "  -s seed      random seed\n",
+            prog);
+}
+
+static void handle_sig(int sig)
+{
+    (void) sig;
+    g_stop = 1;
+}
+
+int main(int argc, char* argv[])
+{
+    g_opt.seed = (unsigned int) time(NULL);
+    int opt;
+    while ((opt = getopt(argc, argv, "H:p:r:n:c:Pt:mT:f:F:x:d:D:a:s:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'H': snprintf(g_opt.host, sizeof(g_opt.host), "%s", optarg); break;
+        case 'p': g_opt.port = (uint16_t) atoi(optarg); break;
+        case 'r': g_opt.rate = atof(optarg); break;
+        case 'n': g_opt.total = strtoull(optarg, NULL, 10); break;
+        case 'c': g_opt.concurrency = atoi(optarg); break;
+        case 'P': g_opt.poisson = true; break;
+        case 't': g_opt.think_ms = atoi(optarg); break;
+        case 'm': g_opt.merged_result = true; break;
+        case 'T': g_opt.timeout_ms = atoi(optarg); break;
+        case 'f': g_opt.login_fail = atof(optarg) / 100.0; break;
+        case 'F': g_opt.download_fail = atof(optarg) / 100.0; break;
+        case 'x': g_opt.abort_ratio = atof(optarg) / 100.0; break;
+        case 'd': snprintf(g_opt.device_prefix, sizeof(g_opt.device_prefix), "%s", optarg); break;
+        case 'D': g_opt.device_count = atoi(optarg); break;
+        case 'a': g_opt.src_addrs = atoi(optarg); break;
+        case 's': g_opt.seed = (unsigned int) strtoul(optarg, NULL, 10); break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+
+    struct in_addr host;
+    if (inet_pton(AF_INET, g_opt.host, &host) != 1 || (ntohl(host.s_addr) >> 24) != 127)
+    {
+        fprintf(stderr, "lucp_loadgen only targets loopback addresses (127.0.0.0/8)\n");
+        return 1;
+    }
+    if (g_opt.rate <= 0 || g_opt.concurrency <= 0 || g_opt.device_count <= 0 ||
+        g_opt.src_addrs <= 0 || g_opt.src_addrs > 254 || g_opt.timeout_ms <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // 每个设备一个连接，尽量放开文件描述符上限
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        if ((rlim_t) g_opt.concurrency + 16 > rl.rlim_cur)
+        {
+            g_opt.concurrency = (int) rl.rlim_cur - 16;
+            fprintf(stderr, "Concurrency capped to %d by RLIMIT_NOFILE\n", g_opt.concurrency);
+        }
+    }
+
+    srand(g_opt.seed);
+    signal(SIGINT, handle_sig);
+    signal(SIGPIPE, SIG_IGN);
+
+    g_devs = calloc((size_t) g_opt.concurrency, sizeof(Device_t));
+    g_free = malloc((size_t) g_opt.concurrency * sizeof(uint32_t));
+    g_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (!g_devs || !g_free || g_epfd < 0)
+    {
+        perror("init");
+        return 1;
+    }
+    for (int i = g_opt.concurrency - 1; i >= 0; i--)
+    {
+        g_devs[i].fd         = -1;
+        g_free[g_free_top++] = (uint32_t) i;
+    }
+
+    printf("lucp_loadgen: %s:%u rate=%.1f/s total=%llu conc=%d think=%dms%s "
+           "fail(login/download/abort)=%.1f%%/%.1f%%/%.1f%% seed=%u\n",
+           g_opt.host,
+           g_opt.port,
+           g_opt.rate,
+           (unsigned long long) g_opt.total,
+           g_opt.concurrency,
+           g_opt.think_ms,
+           g_opt.merged_result ? " merged" : "",
+           g_opt.login_fail * 100,
+           g_opt.download_fail * 100,
+           g_opt.abort_ratio * 100,
+           g_opt.seed);
+
+    struct epoll_event events[LOADGEN_MAX_EVENTS];
+    const double interval_us = 1e6 / g_opt.rate;
+    uint64_t begin           = now_us();
+    double next_arrival      = (double) begin;
+    uint64_t next_report     = begin + LOADGEN_REPORT_MS * 1000;
+    uint64_t last_done       = 0;
+
+    while (!g_stop && (g_started + g_skipped < g_opt.total || g_active > 0))
+    {
+        uint64_t now = now_us();
+
+        // 开环到达：落后于计划的到达全部补发，不受服务端响应快慢影响
+        while (g_started + g_skipped < g_opt.total && next_arrival <= (double) now)
+        {
+            if (g_free_top > 0)
+                dev_start(now);
+            else
+                g_skipped++;
+            next_arrival += g_opt.poisson ? -log(rand_unit()) * interval_us : interval_us;
+        }
+
+        while (g_timer_len > 0 && g_timers[0].when <= now)
+        {
+            Timer_t t = g_timers[0];
+            timer_pop();
+            Device_t* d = &g_devs[t.idx];
+            if (d->gen == t.gen && d->state != DEV_FREE && d->deadline == t.when)
+                dev_on_timer(t.idx, now);
+        }
+
+        if (now >= next_report)
+        {
+            uint64_t done = 0;
+            for (int i = 0; i < OUT_COUNT; i++)
+                done += g_outcomes[i];
+            printf("[%6.1fs] active=%d started=%llu finished=%llu (+%llu/s) completed=%llu\n",
+                   (now - begin) / 1e6,
+                   g_active,
+                   (unsigned long long) g_started,
+                   (unsigned long long) done,
+                   (unsigned long long) (done - last_done),
+                   (unsigned long long) g_outcomes[OUT_COMPLETED]);
+            fflush(stdout);
+            last_done = done;
+            next_report += LOADGEN_REPORT_MS * 1000;
+        }
+
+        uint64_t wake = next_report;
+        if (g_started + g_skipped < g_opt.total && next_arrival < (double) wake)
+            wake = (uint64_t) next_arrival;
+        if (g_timer_len > 0 && g_timers[0].when < wake)
+            wake = g_timers[0].when;
+        int timeout_ms = wake > now ? (int) ((wake - now + 999) / 1000) : 0;
+
+        int n = epoll_wait(g_epfd, events, LOADGEN_MAX_EVENTS, timeout_ms);
+        now   = now_us();
+        for (int i = 0; i < n; i++)
+        {
+            uint32_t idx = events[i].data.u32;
+            Device_t* d  = &g_devs[idx];
+            if (d->state == DEV_FREE)
+                continue;
+            if (d->state == DEV_CONNECTING)
+            {
+                if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+                    dev_on_connected(idx, now);
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                dev_on_readable(idx, now);
+        }
+    }
+
+    print_report(now_us() - begin);
+    for (int i = 0; i < g_opt.concurrency; i++)
+    {
+        if (g_devs[i].fd >= 0)
+            close(g_devs[i].fd);
+    }
+    close(g_epfd);
+    free(g_timers);
+    free(g_free);
+    free(g_devs);
+    return 0;
+}
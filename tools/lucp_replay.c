@@ -0,0 +1,666 @@
+/*
+ * lucp_replay —— 按抓包文件回放 LUCP 会话
+ *
+ * 读取 lucp_capture_open 生成的抓包文件，按连接重建会话，以原始节奏(1x)、
+ * N倍速或尽快(afap)的方式向 lucpd 重新发送客户端帧，并对比每类服务端回复
+ * 在抓包时与回放时的延迟。客户端帧之间的间隔按"上一事件之后的思考时间"缩放，
+ * 收到预期的服务端回复之前不会发送下一帧，因此回放保持原始的因果顺序。
+ *
+ * 用法示例：
+ *   lucp_replay -s 1 capture.bin       # 原速
+ *   lucp_replay -s 10 capture.bin      # 10倍速
+ *   lucp_replay -A capture.bin         # 尽快
+ */
+#define _GNU_SOURCE
+#include "lucp_hist.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <lucp.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REPLAY_FRAME_MAX  (14 + LUCP_MAX_TEXTINFO_LEN)
+#define REPLAY_MAX_EVENTS 1024
+#define REPLAY_MSG_TYPES  256
+
+typedef struct
+{
+    uint64_t ts_us;   // 相对抓包开始(微秒)
+    uint32_t conn_id;
+    uint32_t order;   // 在文件中的顺序
+    bool from_client;
+    uint8_t msg_type;
+    uint8_t status;
+    uint16_t len;
+    const uint8_t* data;
+} Record_t;
+
+typedef enum
+{
+    CONN_PENDING,    // 等待到达时刻
+    CONN_CONNECTING,
+    CONN_SEND_DUE,   // 等待下一客户端帧的发送时刻
+    CONN_WAIT_REPLY, // 等待服务端回复
+    CONN_DONE
+} ConnState;
+
+typedef enum
+{
+    RES_COMPLETED, // 所有帧回放完毕
+    RES_TIMEOUT,   // 等待服务端回复超时
+    RES_CLOSED,    // 服务端提前关闭连接
+    RES_ERROR,     // 连接或发送失败
+    RES_COUNT
+} ConnResult;
+
+static const char* const g_result_names[RES_COUNT] = {"completed", "timeout", "closed", "error"};
+
+typedef struct
+{
+    Record_t* recs;
+    int nrec;
+    int cursor;
+    int fd;
+    ConnState state;
+    uint64_t due_us;        // 下一次动作时刻(回放时钟)
+    uint64_t last_send_us;  // 最近一次发送客户端帧的时刻(回放时钟)
+    uint64_t last_event_us; // 最近一次收发的时刻(回放时钟)
+    uint16_t rbuf_len;
+    uint8_t rbuf[REPLAY_FRAME_MAX];
+} Conn_t;
+
+typedef struct
+{
+    uint64_t when;
+    uint32_t idx;
+} Timer_t;
+
+static struct
+{
+    char host[64];
+    uint16_t port;
+    double speed; // 0 表示尽快
+    int timeout_ms;
+} g_opt = {.host = "127.0.0.1", .port = 32100, .speed = 1.0, .timeout_ms = 30000};
+
+static Conn_t* g_conns;
+static int g_nconn;
+static int g_active;
+static int g_epfd;
+static Timer_t* g_timers;
+static int g_timer_len, g_timer_cap;
+
+static Histogram_t g_orig[REPLAY_MSG_TYPES];
+static Histogram_t g_replay[REPLAY_MSG_TYPES];
+static uint64_t g_results[RES_COUNT];
+static uint64_t g_sent, g_received, g_type_mismatch, g_status_diff, g_unexpected;
+static volatile sig_atomic_t g_stop;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// 按回放速度缩放原始间隔
+static uint64_t scale(uint64_t gap_us)
+{
+    return g_opt.speed > 0 ? (uint64_t) (gap_us / g_opt.speed) : 0;
+}
+
+// ================================ 定时器堆 ===========================
+
+static void timer_push(uint32_t idx, uint64_t when)
+{
+    if (g_timer_len == g_timer_cap)
+    {
+        g_timer_cap = g_timer_cap ? g_timer_cap * 2 : 1024;
+        g_timers    = realloc(g_timers, g_timer_cap * sizeof(Timer_t));
+        if (!g_timers)
+        {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    g_conns[idx].due_us = when;
+    int i               = g_timer_len++;
+    g_timers[i]         = (Timer_t){.when = when, .idx = idx};
+    while (i > 0 && g_timers[(i - 1) / 2].when > g_timers[i].when)
+    {
+        Timer_t t             = g_timers[i];
+        g_timers[i]           = g_timers[(i - 1) / 2];
+        g_timers[(i - 1) / 2] = t;
+        i                     = (i - 1) / 2;
+    }
+}
+
+static void timer_pop(void)
+{
+    g_timers[0] = g_timers[--g_timer_len];
+    int i       = 0;
+    while (1)
+    {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < g_timer_len && g_timers[l].when < g_timers[m].when)
+            m = l;
+        if (r < g_timer_len && g_timers[r].when < g_timers[m].when)
+            m = r;
+        if (m == i)
+            break;
+        Timer_t t   = g_timers[i];
+        g_timers[i] = g_timers[m];
+        g_timers[m] = t;
+        i           = m;
+    }
+}
+
+// ================================ 抓包文件 ===========================
+
+static int cmp_record(const void* a, const void* b)
+{
+    const Record_t* x = a;
+    const Record_t* y = b;
+    if (x->conn_id != y->conn_id)
+        return x->conn_id < y->conn_id ? -1 : 1;
+    return x->order < y->order ? -1 : (x->order > y->order);
+}
+
+// 读取抓包文件并按连接分组，返回记录数组（调用方释放），失败返回NULL
+static Record_t* load_capture(const char* path, uint8_t** blob_out, int* nrec_out, int* skipped)
+{
+    FILE* fp = fopen(path, "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t* blob = malloc(size > 0 ? (size_t) size : 1);
+    if (!blob || size < (long) sizeof(lucp_capture_header_t) ||
+        fread(blob, 1, (size_t) size, fp) != (size_t) size)
+    {
+        fprintf(stderr, "%s: unreadable or truncated capture\n", path);
+        fclose(fp);
+        free(blob);
+        return NULL;
+    }
+    fclose(fp);
+
+    lucp_capture_header_t hdr;
+    memcpy(&hdr, blob, sizeof(hdr));
+    if (hdr.magic != LUCP_CAPTURE_MAGIC || hdr.version != LUCP_CAPTURE_VERSION)
+    {
+        fprintf(stderr,
+                "%s: not a LUCP capture (or written on a host with different byte order)\n",
+                path);
+        free(blob);
+        return NULL;
+    }
+    uint8_t client_dir = hdr.role == LUCP_CAPTURE_ROLE_SERVER ? LUCP_CAPTURE_RX : LUCP_CAPTURE_TX;
+
+    int cap = 1024, n = 0;
+    Record_t* recs = malloc(cap * sizeof(Record_t));
+    size_t off     = sizeof(hdr);
+    while (recs && off + sizeof(lucp_capture_record_t) <= (size_t) size)
+    {
+        lucp_capture_record_t rec;
+        memcpy(&rec, blob + off, sizeof(rec));
+        off += sizeof(rec);
+        if (off + rec.len > (size_t) size || rec.len < 14)
+            break; // 进程异常退出时最后一条记录可能不完整
+        if (n == cap)
+        {
+            cap *= 2;
+            Record_t* p = realloc(recs, cap * sizeof(Record_t));
+            if (!p)
+            {
+                free(recs);
+                recs = NULL;
+                break;
+            }
+            recs = p;
+        }
+        recs[n] = (Record_t){.ts_us       = rec.ts_ns / 1000,
+                             .conn_id     = rec.conn_id,
+                             .order       = (uint32_t) n,
+                             .from_client = rec.dir == client_dir,
+                             .msg_type    = blob[off + 10],
+                             .status      = blob[off + 11],
+                             .len         = rec.len,
+                             .data        = blob + off};
+        n++;
+        off += rec.len;
+    }
+    if (!recs)
+    {
+        fprintf(stderr, "Out of memory\n");
+        free(blob);
+        return NULL;
+    }
+    qsort(recs, (size_t) n, sizeof(Record_t), cmp_record);
+
+    // 按连接分组；抓包开始时已在进行中的会话（首帧不是UPLOAD_REQUEST）无法重建，跳过
+    g_conns = calloc((size_t) n + 1, sizeof(Conn_t));
+    for (int i = 0; g_conns && i < n;)
+    {
+        int j = i;
+        while (j < n && recs[j].conn_id == recs[i].conn_id)
+            j++;
+        int first = i;
+        while (first < j && !recs[first].from_client)
+            first++;
+        if (first < j && recs[first].msg_type == LUCP_MTYP_UPLOAD_REQUEST)
+        {
+            Conn_t* c = &g_conns[g_nconn++];
+            c->recs   = &recs[first];
+            c->nrec   = j - first;
+            c->fd     = -1;
+        }
+        else
+        {
+            (*skipped)++;
+        }
+        i = j;
+    }
+    *blob_out = blob;
+    *nrec_out = n;
+    return recs;
+}
+
+// ================================ 回放 ===========================
+
+static void conn_finish(uint32_t idx, ConnResult res)
+{
+    Conn_t* c = &g_conns[idx];
+    if (c->fd >= 0)
+        close(c->fd);
+    c->fd    = -1;
+    c->state = CONN_DONE;
+    g_results[res]++;
+    g_active--;
+}
+
+// 推进到下一条记录：客户端帧按原始思考时间排期，服务端帧则开始等待
+static void conn_advance(uint32_t idx, uint64_t now)
+{
+    Conn_t* c = &g_conns[idx];
+    c->cursor++;
+    if (c->cursor >= c->nrec)
+    {
+        conn_finish(idx, RES_COMPLETED);
+        return;
+    }
+    const Record_t* prev = &c->recs[c->cursor - 1];
+    const Record_t* next = &c->recs[c->cursor];
+    if (next->from_client)
+    {
+        c->state = CONN_SEND_DUE;
+        timer_push(idx, c->last_event_us + scale(next->ts_us - prev->ts_us));
+    }
+    else
+    {
+        c->state = CONN_WAIT_REPLY;
+        timer_push(idx, now + (uint64_t) g_opt.timeout_ms * 1000);
+    }
+}
+
+static void conn_send(uint32_t idx, uint64_t now)
+{
+    Conn_t* c         = &g_conns[idx];
+    const Record_t* r = &c->recs[c->cursor];
+    if (send(c->fd, r->data, r->len, MSG_NOSIGNAL) != (ssize_t) r->len)
+    {
+        conn_finish(idx, RES_ERROR);
+        return;
+    }
+    g_sent++;
+    c->last_send_us  = now;
+    c->last_event_us = now;
+    conn_advance(idx, now);
+}
+
+static void conn_start(uint32_t idx, uint64_t now)
+{
+    Conn_t* c = &g_conns[idx];
+    c->fd     = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd < 0)
+    {
+        g_active++;
+        conn_finish(idx, RES_ERROR);
+        return;
+    }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct sockaddr_in dst = {.sin_family = AF_INET, .sin_port = htons(g_opt.port)};
+    inet_pton(AF_INET, g_opt.host, &dst.sin_addr);
+    g_active++;
+    if (connect(c->fd, (struct sockaddr*) &dst, sizeof(dst)) < 0 && errno != EINPROGRESS)
+    {
+        conn_finish(idx, RES_ERROR);
+        return;
+    }
+    struct epoll_event ev = {.events = EPOLLOUT | EPOLLIN, .data.u32 = idx};
+    epoll_ctl(g_epfd, EPOLL_CTL_ADD, c->fd, &ev);
+    c->state = CONN_CONNECTING;
+    timer_push(idx, now + (uint64_t) g_opt.timeout_ms * 1000);
+}
+
+static void conn_on_connected(uint32_t idx, uint64_t now)
+{
+    Conn_t* c   = &g_conns[idx];
+    int err     = 0;
+    socklen_t l = sizeof(err);
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &l) != 0 || err != 0)
+    {
+        conn_finish(idx, RES_ERROR);
+        return;
+    }
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = idx};
+    epoll_ctl(g_epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    conn_send(idx, now);
+}
+
+static void conn_on_frame(uint32_t idx, const uint8_t* raw, uint64_t now)
+{
+    Conn_t* c = &g_conns[idx];
+    g_received++;
+    if (c->state != CONN_WAIT_REPLY)
+    {
+        g_unexpected++;
+        return;
+    }
+    const Record_t* r = &c->recs[c->cursor];
+    uint8_t msg_type  = raw[10];
+    if (msg_type != r->msg_type)
+        g_type_mismatch++;
+    else if (raw[11] != r->status)
+        g_status_diff++;
+
+    // 原始延迟：该回复与之前最近一次客户端帧的间隔
+    uint64_t orig_send = r->ts_us;
+    for (int i = c->cursor - 1; i >= 0; i--)
+    {
+        if (c->recs[i].from_client)
+        {
+            orig_send = c->recs[i].ts_us;
+            break;
+        }
+    }
+    hist_record(&g_orig[r->msg_type], r->ts_us - orig_send);
+    hist_record(&g_replay[r->msg_type], now - c->last_send_us);
+    c->last_event_us = now;
+    conn_advance(idx, now);
+}
+
+static void conn_on_readable(uint32_t idx, uint64_t now)
+{
+    Conn_t* c = &g_conns[idx];
+    while (c->state != CONN_DONE)
+    {
+        ssize_t n = recv(c->fd, c->rbuf + c->rbuf_len, sizeof(c->rbuf) - c->rbuf_len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (n <= 0)
+        {
+            conn_finish(idx, RES_CLOSED);
+            return;
+        }
+        c->rbuf_len += (uint16_t) n;
+
+        lucp_frame_t frame;
+        int used;
+        while (c->state != CONN_DONE &&
+               (used = lucp_frame_unpack(&frame, c->rbuf, c->rbuf_len)) > 0)
+        {
+            conn_on_frame(idx, c->rbuf, now);
+            memmove(c->rbuf, c->rbuf + used, c->rbuf_len - used);
+            c->rbuf_len -= (uint16_t) used;
+        }
+        if (c->state != CONN_DONE && used < 0)
+        {
+            conn_finish(idx, RES_ERROR);
+            return;
+        }
+    }
+}
+
+static void conn_on_timer(uint32_t idx, uint64_t now)
+{
+    Conn_t* c = &g_conns[idx];
+    switch (c->state)
+    {
+    case CONN_PENDING: conn_start(idx, now); break;
+    case CONN_SEND_DUE: conn_send(idx, now); break;
+    case CONN_CONNECTING: conn_finish(idx, RES_ERROR); break;
+    case CONN_WAIT_REPLY: conn_finish(idx, RES_TIMEOUT); break;
+    default: break;
+    }
+}
+
+// ================================ 报告 ===========================
+
+static const char* msg_type_name(int t)
+{
+    switch (t)
+    {
+    case LUCP_MTYP_ACK_START: return "ACK_START";
+    case LUCP_MTYP_NOTIFY_DONE: return "NOTIFY_DONE";
+    case LUCP_MTYP_FTP_LOGIN_RESULT: return "FTP_LOGIN_RESULT";
+    case LUCP_MTYP_FTP_DOWNLOAD_RESULT: return "FTP_DOWNLOAD_RESULT";
+    case LUCP_MTYP_FTP_TRANSFER_RESULT: return "FTP_TRANSFER_RESULT";
+    default: return "other";
+    }
+}
+
+static void print_report(uint64_t elapsed_us, uint64_t span_us, int skipped)
+{
+    printf("\n==== lucp_replay summary ====\n");
+    printf("capture span  : %.2f s\n", span_us / 1e6);
+    char speed[32];
+    if (g_opt.speed > 0)
+        snprintf(speed, sizeof(speed), "%gx", g_opt.speed);
+    else
+        snprintf(speed, sizeof(speed), "afap");
+    printf("replay time   : %.2f s (speed %s)\n", elapsed_us / 1e6, speed);
+    printf("connections   : %d replayed, %d skipped (started before capture)\n", g_nconn, skipped);
+    for (int i = 0; i < RES_COUNT; i++)
+        printf("  %-11s %llu\n", g_result_names[i], (unsigned long long) g_results[i]);
+    printf("frames        : %llu sent, %llu received, %llu type mismatch, %llu status differs, "
+           "%llu unexpected\n",
+           (unsigned long long) g_sent,
+           (unsigned long long) g_received,
+           (unsigned long long) g_type_mismatch,
+           (unsigned long long) g_status_diff,
+           (unsigned long long) g_unexpected);
+
+    printf("\n%-20s %8s | %9s %9s %9s | %9s %9s %9s\n",
+           "reply (ms)",
+           "count",
+           "orig p50",
+           "replay",
+           "delta",
+           "orig p99",
+           "replay",
+           "delta");
+    for (int t = 0; t < REPLAY_MSG_TYPES; t++)
+    {
+        const Histogram_t* o = &g_orig[t];
+        const Histogram_t* r = &g_replay[t];
+        if (r->count == 0)
+            continue;
+        double o50 = hist_percentile(o, 0.50) / 1000.0, r50 = hist_percentile(r, 0.50) / 1000.0;
+        double o99 = hist_percentile(o, 0.99) / 1000.0, r99 = hist_percentile(r, 0.99) / 1000.0;
+        char name[32];
+        snprintf(name, sizeof(name), "0x%02X %s", t, msg_type_name(t));
+        printf("%-20s %8llu | %9.3f %9.3f %+9.3f | %9.3f %9.3f %+9.3f\n",
+               name,
+               (unsigned long long) r->count,
+               o50,
+               r50,
+               r50 - o50,
+               o99,
+               r99,
+               r99 - o99);
+    }
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] capture-file\n"
+            "  -H host      server address (default 127.0.0.1)\n"
+            "  -p port      server port (default 32100)\n"
+            "  -s speed     replay speed factor, 1 = original timing (default 1)\n"
+            "  -A           as fast as possible, ignore all recorded gaps\n"
+            "  -T ms        timeout waiting for each reply (default 30000)\n",
+            prog);
+}
+
+static void handle_sig(int sig)
+{
+    (void) sig;
+    g_stop = 1;
+}
+
+int main(int argc, char* argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "H:p:s:AT:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'H': snprintf(g_opt.host, sizeof(g_opt.host), "%s", optarg); break;
+        case 'p': g_opt.port = (uint16_t) atoi(optarg); break;
+        case 's': g_opt.speed = atof(optarg); break;
+        case 'A': g_opt.speed = 0; break;
+        case 'T': g_opt.timeout_ms = atoi(optarg); break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (optind != argc - 1 || g_opt.speed < 0 || g_opt.timeout_ms <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    uint8_t* blob = NULL;
+    int nrec = 0, skipped = 0;
+    Record_t* recs = load_capture(argv[optind], &blob, &nrec, &skipped);
+    if (!recs || !g_conns)
+        return 1;
+    if (g_nconn == 0)
+    {
+        fprintf(stderr, "No complete sessions in capture\n");
+        return 1;
+    }
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    signal(SIGINT, handle_sig);
+    signal(SIGPIPE, SIG_IGN);
+    g_epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    // 各连接按首个客户端帧的原始时刻（缩放后）发起
+    uint64_t first_ts = UINT64_MAX, last_ts = 0;
+    for (int i = 0; i < g_nconn; i++)
+    {
+        Conn_t* c = &g_conns[i];
+        if (c->recs[0].ts_us < first_ts)
+            first_ts = c->recs[0].ts_us;
+        if (c->recs[c->nrec - 1].ts_us > last_ts)
+            last_ts = c->recs[c->nrec - 1].ts_us;
+    }
+    printf("lucp_replay: %d records, %d sessions -> %s:%u\n",
+           nrec,
+           g_nconn,
+           g_opt.host,
+           g_opt.port);
+
+    uint64_t begin = now_us();
+    for (int i = 0; i < g_nconn; i++)
+    {
+        g_conns[i].state = CONN_PENDING;
+        timer_push((uint32_t) i, begin + scale(g_conns[i].recs[0].ts_us - first_ts));
+    }
+    int pending = g_nconn;
+
+    struct epoll_event events[REPLAY_MAX_EVENTS];
+    while (!g_stop && (pending > 0 || g_active > 0))
+    {
+        uint64_t now = now_us();
+        while (g_timer_len > 0 && g_timers[0].when <= now)
+        {
+            Timer_t t = g_timers[0];
+            timer_pop();
+            Conn_t* c = &g_conns[t.idx];
+            // 状态变化后旧的定时器作废
+            if (c->state == CONN_DONE || c->due_us != t.when)
+                continue;
+            if (c->state == CONN_PENDING)
+                pending--;
+            conn_on_timer(t.idx, now);
+        }
+
+        // 丢弃堆顶已作废的定时器，避免按过期的超时时刻空等
+        while (g_timer_len > 0 && (g_conns[g_timers[0].idx].state == CONN_DONE ||
+                                   g_conns[g_timers[0].idx].due_us != g_timers[0].when))
+            timer_pop();
+        if (pending == 0 && g_active == 0)
+            break;
+
+        int timeout_ms = -1;
+        if (g_timer_len > 0)
+            timeout_ms = g_timers[0].when > now ? (int) ((g_timers[0].when - now + 999) / 1000) : 0;
+        int n = epoll_wait(g_epfd, events, REPLAY_MAX_EVENTS, timeout_ms);
+        now   = now_us();
+        for (int i = 0; i < n; i++)
+        {
+            uint32_t idx = events[i].data.u32;
+            Conn_t* c    = &g_conns[idx];
+            if (c->state == CONN_DONE)
+                continue;
+            if (c->state == CONN_CONNECTING)
+            {
+                if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+                    conn_on_connected(idx, now);
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                conn_on_readable(idx, now);
+        }
+    }
+
+    print_report(now_us() - begin, last_ts - first_ts, skipped);
+    for (int i = 0; i < g_nconn; i++)
+    {
+        if (g_conns[i].fd >= 0)
+            close(g_conns[i].fd);
+    }
+    close(g_epfd);
+    free(g_timers);
+    free(g_conns);
+    free(recs);
+    free(blob);
+    return 0;
+}